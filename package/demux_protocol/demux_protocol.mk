@@ -0,0 +1,49 @@
+################################################################################
+#
+# demux_protocol
+#
+################################################################################
+
+DEMUX_PROTOCOL_VERSION = 0.1
+DEMUX_PROTOCOL_SITE = \
+  "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/demux_protocol/src"
+DEMUX_PROTOCOL_SITE_METHOD = local
+DEMUX_PROTOCOL_DEPENDENCIES = libpiksi
+DEMUX_PROTOCOL_INSTALL_STAGING = YES
+
+ifeq ($(BR2_BUILD_TESTS),y)
+DEMUX_PROTOCOL_DEPENDENCIES += gtest valgrind
+
+define DEMUX_PROTOCOL_BUILD_CMDS_TESTS
+    $(MAKE) CROSS=$(TARGET_CROSS) LD=$(TARGET_LD) -C $(@D) test
+endef
+
+define DEMUX_PROTOCOL_TESTS_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/test/run_demux_protocol_tests $(TARGET_DIR)/usr/bin
+endef
+endif
+
+ifeq ($(BR2_RUN_TESTS),y)
+DEMUX_PROTOCOL_TESTS_RUN = $(call pbr_proot_valgrind_test,run_demux_protocol_tests)
+endif
+
+define DEMUX_PROTOCOL_BUILD_CMDS
+    $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) LTO_PLUGIN="$(LTO_PLUGIN)" -C $(@D) all
+    $(DEMUX_PROTOCOL_BUILD_CMDS_TESTS)
+endef
+
+define DEMUX_PROTOCOL_INSTALL_STAGING_CMDS
+    $(INSTALL) -D -m 0755 $(@D)/libdemux_protocol.so* $(STAGING_DIR)/usr/lib
+    $(INSTALL) -D -m 0755 $(@D)/libdemux_protocol.a $(STAGING_DIR)/usr/lib
+    $(INSTALL) -D -m 0755 $(@D)/libdemux_protocol_static.a $(STAGING_DIR)/usr/lib
+endef
+
+define DEMUX_PROTOCOL_INSTALL_TARGET_CMDS
+    $(INSTALL) -d -m 0755 $(TARGET_DIR)/usr/lib/endpoint_protocols
+    $(INSTALL) -D -m 0755 $(@D)/libdemux_protocol.so*                            \
+                          $(TARGET_DIR)/usr/lib/endpoint_protocols
+    $(DEMUX_PROTOCOL_TESTS_INSTALL)
+    $(DEMUX_PROTOCOL_TESTS_RUN)
+endef
+
+$(eval $(generic-package))
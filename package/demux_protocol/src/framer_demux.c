@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ * Finds SBP, RTCM3 and NMEA frames interleaved in one byte stream. Frames are
+ * returned unmodified, so the first byte of each one tags its protocol
+ * (0x55 SBP, 0xD3 RTCM3, '$' or '!' NMEA), see --pub-route in
+ * endpoint_adapter.
+ *
+ * Every candidate is checked against its protocol's CRC or checksum before it
+ * is accepted. A candidate that fails is skipped one byte at a time rather
+ * than as a whole, its claimed length is not to be trusted when the stream
+ * may be carrying a different protocol.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libpiksi/crc.h>
+#include <libpiksi/logging.h>
+#include <libpiksi/protocol_plugin.h>
+
+// clang-format off
+#define SBP_PREAMBLE            0x55
+#define SBP_HEADER_LENGTH       6
+#define SBP_CRC_LENGTH          2
+#define SBP_LENGTH_OFFSET       5
+
+#define RTCM3_PREAMBLE          0xD3
+#define RTCM3_HEADER_LENGTH     3
+#define RTCM3_CRC_LENGTH        3
+#define RTCM3_FRAME_SIZE_MAX    1029
+/* The six bits following the preamble are reserved and must be zero */
+#define RTCM3_RESERVED_MASK     0xFC
+
+/* See framer_nmea.c */
+#define NMEA_SENTENCE_LEN_MAX   256
+
+/* Largest frame of any protocol */
+#define DEMUX_FRAME_SIZE_MAX    RTCM3_FRAME_SIZE_MAX
+
+/* Must be a power of two no smaller than DEMUX_FRAME_SIZE_MAX */
+#define CARRY_SIZE              2048
+#define CARRY_MASK              (CARRY_SIZE - 1)
+
+/* Log the first checksum error, then one in every DEMUX_ERROR_LOG_INTERVAL */
+#define DEMUX_ERROR_LOG_INTERVAL 100
+// clang-format on
+
+typedef enum {
+  DEMUX_NONE = 0,
+  DEMUX_SBP,
+  DEMUX_RTCM3,
+  DEMUX_NMEA,
+} demux_protocol_t;
+
+static const uint8_t demux_protocol_of[UINT8_MAX + 1] = {
+  [SBP_PREAMBLE] = DEMUX_SBP,
+  [RTCM3_PREAMBLE] = DEMUX_RTCM3,
+  ['$'] = DEMUX_NMEA,
+  ['!'] = DEMUX_NMEA,
+};
+
+/* Result of checking a candidate frame */
+enum {
+  CANDIDATE_INVALID = -1,
+  CANDIDATE_INCOMPLETE = 0,
+};
+
+/**
+ * Frames lying within the caller's buffer are returned in place. A candidate
+ * running off the end of a read is carried in the `carry` ring, which is then
+ * worked through, and topped up from later reads, before returning to the
+ * caller's buffer. Resync advances the ring head instead of shifting the
+ * carried data.
+ */
+typedef struct {
+  uint8_t carry[CARRY_SIZE];
+  uint32_t carry_head;
+  uint32_t carry_tail;
+  uint8_t frame[DEMUX_FRAME_SIZE_MAX]; /* Candidates that wrap around the carry */
+  uint32_t resync_count;
+  uint32_t checksum_error_count;
+} framer_demux_state_t;
+
+static void record_checksum_error(framer_demux_state_t *s, const char *protocol)
+{
+  if (s->checksum_error_count++ % DEMUX_ERROR_LOG_INTERVAL == 0) {
+    piksi_log(LOG_INFO,
+              "%s checksum error (checksum errors %u, resyncs %u)",
+              protocol,
+              s->checksum_error_count,
+              s->resync_count);
+  }
+}
+
+static int32_t sbp_check(framer_demux_state_t *s,
+                         const uint8_t *buf,
+                         uint32_t length,
+                         uint32_t *needed)
+{
+  if (length < SBP_HEADER_LENGTH) {
+    *needed = SBP_HEADER_LENGTH;
+    return CANDIDATE_INCOMPLETE;
+  }
+
+  uint32_t total = SBP_HEADER_LENGTH + buf[SBP_LENGTH_OFFSET] + SBP_CRC_LENGTH;
+  if (length < total) {
+    *needed = total;
+    return CANDIDATE_INCOMPLETE;
+  }
+
+  /* CRC covers the header (minus the preamble) and the payload */
+  uint32_t crc_offset = total - SBP_CRC_LENGTH;
+  uint16_t crc = pk_crc16_ccitt(&buf[1], crc_offset - 1, 0);
+  if (crc != (uint16_t)(buf[crc_offset] | (buf[crc_offset + 1] << 8))) {
+    record_checksum_error(s, "SBP");
+    return CANDIDATE_INVALID;
+  }
+
+  return (int32_t)total;
+}
+
+static int32_t rtcm3_check(framer_demux_state_t *s,
+                           const uint8_t *buf,
+                           uint32_t length,
+                           uint32_t *needed)
+{
+  if (length < RTCM3_HEADER_LENGTH) {
+    *needed = RTCM3_HEADER_LENGTH;
+    return CANDIDATE_INCOMPLETE;
+  }
+
+  if ((buf[1] & RTCM3_RESERVED_MASK) != 0) {
+    return CANDIDATE_INVALID;
+  }
+
+  uint32_t total = RTCM3_HEADER_LENGTH + (((buf[1] & 0x3) << 8) | buf[2]) + RTCM3_CRC_LENGTH;
+  if (length < total) {
+    *needed = total;
+    return CANDIDATE_INCOMPLETE;
+  }
+
+  uint32_t crc_offset = total - RTCM3_CRC_LENGTH;
+  uint32_t crc = pk_crc24q(buf, crc_offset, 0);
+  uint32_t frame_crc =
+    (uint32_t)((buf[crc_offset] << 16) | (buf[crc_offset + 1] << 8) | buf[crc_offset + 2]);
+  if (crc != frame_crc) {
+    record_checksum_error(s, "RTCM3");
+    return CANDIDATE_INVALID;
+  }
+
+  return (int32_t)total;
+}
+
+static int hex_value(uint8_t c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+/* <start><body>*<hex><hex>[\r]\n, the checksum is the XOR of the body */
+static int32_t nmea_check(framer_demux_state_t *s,
+                          const uint8_t *buf,
+                          uint32_t length,
+                          uint32_t *needed)
+{
+  *needed = NMEA_SENTENCE_LEN_MAX;
+
+  uint32_t limit = length < NMEA_SENTENCE_LEN_MAX ? length : NMEA_SENTENCE_LEN_MAX;
+  uint8_t checksum = 0;
+  uint32_t i = 1;
+  for (; i < limit && buf[i] != '*'; i++) {
+    if (buf[i] < 0x20 || buf[i] > 0x7E || demux_protocol_of[buf[i]] == DEMUX_NMEA) {
+      return CANDIDATE_INVALID;
+    }
+    checksum ^= buf[i];
+  }
+
+  /* Room for "*hh\r\n" */
+  uint32_t total = i + 5;
+  for (uint32_t j = i; j < total; j++) {
+    if (j == NMEA_SENTENCE_LEN_MAX) {
+      return CANDIDATE_INVALID;
+    }
+    if (j == length) {
+      return CANDIDATE_INCOMPLETE;
+    }
+    if (j == i + 1 || j == i + 2) {
+      if (hex_value(buf[j]) < 0) {
+        return CANDIDATE_INVALID;
+      }
+    } else if (j == i + 3) {
+      /* Tolerate senders that terminate with a bare LF */
+      if (buf[j] == '\n') {
+        total = j + 1;
+        break;
+      }
+      if (buf[j] != '\r') {
+        return CANDIDATE_INVALID;
+      }
+    } else if (j == i + 4 && buf[j] != '\n') {
+      return CANDIDATE_INVALID;
+    }
+  }
+
+  if (checksum != ((hex_value(buf[i + 1]) << 4) | hex_value(buf[i + 2]))) {
+    record_checksum_error(s, "NMEA");
+    return CANDIDATE_INVALID;
+  }
+
+  return (int32_t)total;
+}
+
+/**
+ * Check the candidate at the start of buf. Returns its length if it is a
+ * valid frame, CANDIDATE_INVALID, or CANDIDATE_INCOMPLETE with the length
+ * needed to decide in `needed`.
+ */
+static int32_t candidate_check(framer_demux_state_t *s,
+                               const uint8_t *buf,
+                               uint32_t length,
+                               uint32_t *needed)
+{
+  switch (demux_protocol_of[buf[0]]) {
+  case DEMUX_SBP: return sbp_check(s, buf, length, needed);
+  case DEMUX_RTCM3: return rtcm3_check(s, buf, length, needed);
+  case DEMUX_NMEA: return nmea_check(s, buf, length, needed);
+  default: return CANDIDATE_INVALID;
+  }
+}
+
+static uint32_t next_start(const uint8_t *buf, uint32_t offset, uint32_t length)
+{
+  while (offset < length && demux_protocol_of[buf[offset]] == DEMUX_NONE) {
+    offset++;
+  }
+  return offset;
+}
+
+static uint32_t carry_used(const framer_demux_state_t *s)
+{
+  return s->carry_tail - s->carry_head;
+}
+
+static void carry_push(framer_demux_state_t *s, const uint8_t *data, uint32_t length)
+{
+  uint32_t offset = s->carry_tail & CARRY_MASK;
+  uint32_t first = CARRY_SIZE - offset;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(&s->carry[offset], data, first);
+  memcpy(&s->carry[0], &data[first], length - first);
+  s->carry_tail += length;
+}
+
+/* Returns the carried candidate as one contiguous span */
+static const uint8_t *carry_candidate(framer_demux_state_t *s, uint32_t length)
+{
+  uint32_t offset = s->carry_head & CARRY_MASK;
+  uint32_t first = CARRY_SIZE - offset;
+  if (first >= length) {
+    return &s->carry[offset];
+  }
+  memcpy(s->frame, &s->carry[offset], first);
+  memcpy(&s->frame[first], &s->carry[0], length - first);
+  return s->frame;
+}
+
+/* Skip to the next carried start byte, false once the carry is empty */
+static bool carry_next_start(framer_demux_state_t *s)
+{
+  while (s->carry_head != s->carry_tail
+         && demux_protocol_of[s->carry[s->carry_head & CARRY_MASK]] == DEMUX_NONE) {
+    s->carry_head++;
+  }
+  return s->carry_head != s->carry_tail;
+}
+
+PK_PROTOCOL_API void *framer_create(void)
+{
+  framer_demux_state_t *s = calloc(1, sizeof(*s));
+
+  if (s == NULL) {
+    return NULL;
+  }
+
+  return (void *)s;
+}
+
+PK_PROTOCOL_API void framer_destroy(void **state)
+{
+  free(*state);
+  *state = NULL;
+}
+
+static uint32_t framer_demux_next(framer_demux_state_t *s,
+                                 const uint8_t *data,
+                                 uint32_t data_length,
+                                 const uint8_t **frame,
+                                 uint32_t *frame_length)
+{
+  uint32_t offset = 0;
+
+  /* Work through the carry first, topping it up as candidates need */
+  while (carry_next_start(s)) {
+    uint32_t used = carry_used(s);
+    uint32_t needed = 0;
+    const uint8_t *candidate = carry_candidate(s, used);
+    int32_t result = candidate_check(s, candidate, used, &needed);
+
+    if (result > 0) {
+      *frame = candidate;
+      *frame_length = (uint32_t)result;
+      s->carry_head += (uint32_t)result;
+      return offset;
+    }
+
+    if (result == CANDIDATE_INVALID) {
+      s->resync_count++;
+      s->carry_head++;
+      continue;
+    }
+
+    uint32_t count = needed - used;
+    if (count > data_length - offset) {
+      count = data_length - offset;
+    }
+    if (count == 0) {
+      *frame = NULL;
+      *frame_length = 0;
+      return offset;
+    }
+    carry_push(s, &data[offset], count);
+    offset += count;
+  }
+  /* Empty, start over from the beginning so fewer candidates wrap */
+  s->carry_head = 0;
+  s->carry_tail = 0;
+
+  while ((offset = next_start(data, offset, data_length)) < data_length) {
+    uint32_t needed = 0;
+    int32_t result = candidate_check(s, &data[offset], data_length - offset, &needed);
+
+    if (result > 0) {
+      *frame = &data[offset];
+      *frame_length = (uint32_t)result;
+      return offset + (uint32_t)result;
+    }
+
+    if (result == CANDIDATE_INVALID) {
+      s->resync_count++;
+      offset++;
+      continue;
+    }
+
+    /* Candidate continues in the next read, it is shorter than the largest
+     * frame so always fits */
+    carry_push(s, &data[offset], data_length - offset);
+    offset = data_length;
+  }
+
+  *frame = NULL;
+  *frame_length = 0;
+  return offset;
+}
+
+PK_PROTOCOL_API uint32_t framer_process(void *state,
+                                        const uint8_t *data,
+                                        uint32_t data_length,
+                                        const uint8_t **frame,
+                                        uint32_t *frame_length)
+{
+  return framer_demux_next((framer_demux_state_t *)state, data, data_length, frame, frame_length);
+}
+
+PK_PROTOCOL_FRAMER("DEMUX", framer_create, framer_destroy, framer_process, NULL)
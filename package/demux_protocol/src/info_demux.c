@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+const char *protocol_name = "DEMUX";
+const char *setting_name = "AUTO IN";
+
+/* SBP goes to the main pub socket, the other protocols are routed to their
+ * own routers */
+int port_adapter_opts_get(char *buf, size_t buf_size, const char *port_name)
+{
+  return snprintf(buf,
+                  buf_size,
+                  "--framer-in demux --framer-out none "
+                  "-p 'ipc:///var/run/sockets/external.sub' "
+                  "--pub-route rtcm3='ipc:///var/run/sockets/rtcm3_external.sub' "
+                  "--pub-route nmea='ipc:///var/run/sockets/nmea_external.sub'");
+}
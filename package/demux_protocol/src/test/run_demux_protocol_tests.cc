@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi/crc.h>
+#include <libpiksi/framer.h>
+#include <libpiksi/logging.h>
+
+#define PROGRAM_NAME "demux_protocol_tests"
+
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+#define PROTOCOL_LIBRARY_NAME "libdemux_protocol.so"
+#define FRAMER_NAME "demux"
+
+#define SBP_PREAMBLE 0x55
+#define RTCM3_PREAMBLE 0xD3
+#define CORPUS_FRAMES 600
+#define BATCH_MAX 32
+
+typedef std::vector<uint8_t> bytes_t;
+
+class DemuxFramerTests : public ::testing::Test {
+ protected:
+  /* Loaded once, the framer registry keeps the entry points for good */
+  static void SetUpTestCase()
+  {
+    const char *path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+    std::string library = std::string(path != nullptr ? path : PROTOCOL_LIBRARY_PATH_DEFAULT) + "/"
+                          + PROTOCOL_LIBRARY_NAME;
+
+    handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) return;
+
+    *(void **)&create = dlsym(handle, "framer_create");
+    *(void **)&destroy = dlsym(handle, "framer_destroy");
+    *(void **)&process = dlsym(handle, "framer_process");
+
+    /* No batch entry point of its own, batches come from the plugin layer */
+    if (create != nullptr && destroy != nullptr && process != nullptr) {
+      framer_interface_register(FRAMER_NAME, create, destroy, process, nullptr);
+    }
+  }
+
+  void SetUp() override
+  {
+    ASSERT_NE(handle, nullptr) << dlerror();
+    ASSERT_NE(create, nullptr);
+    ASSERT_NE(destroy, nullptr);
+    ASSERT_NE(process, nullptr);
+
+    state = create();
+    ASSERT_NE(state, nullptr);
+    framer = framer_create(FRAMER_NAME);
+    ASSERT_NE(framer, nullptr);
+  }
+
+  void TearDown() override
+  {
+    if (state != nullptr) destroy(&state);
+    if (framer != nullptr) framer_destroy(&framer);
+  }
+
+  void reset()
+  {
+    destroy(&state);
+    state = create();
+    ASSERT_NE(state, nullptr);
+    framer_destroy(&framer);
+    framer = framer_create(FRAMER_NAME);
+    ASSERT_NE(framer, nullptr);
+  }
+
+  /* Feeds the stream in chunks of up to max_chunk bytes, returns the frames */
+  std::vector<bytes_t> frame_stream(const bytes_t &stream, size_t max_chunk, bool batch = false)
+  {
+    std::vector<bytes_t> frames;
+    std::mt19937 rng(1);
+    size_t pos = 0;
+    while (pos < stream.size()) {
+      size_t chunk = 1 + rng() % max_chunk;
+      if (chunk > stream.size() - pos) chunk = stream.size() - pos;
+      bytes_t read(&stream[pos], &stream[pos] + chunk);
+      pos += chunk;
+      uint32_t offset = 0;
+      while (offset < read.size()) {
+        const uint8_t *frame_data[BATCH_MAX];
+        uint32_t frame_lengths[BATCH_MAX];
+        uint32_t frame_count = 0;
+        if (batch) {
+          offset += framer_process_batch(framer,
+                                         &read[offset],
+                                         (uint32_t)(read.size() - offset),
+                                         frame_data,
+                                         frame_lengths,
+                                         BATCH_MAX,
+                                         &frame_count);
+        } else {
+          offset += process(state,
+                            &read[offset],
+                            (uint32_t)(read.size() - offset),
+                            &frame_data[0],
+                            &frame_lengths[0]);
+          frame_count = (frame_data[0] != nullptr) ? 1 : 0;
+        }
+        for (uint32_t i = 0; i < frame_count; i++) {
+          frames.emplace_back(frame_data[i], frame_data[i] + frame_lengths[i]);
+        }
+      }
+    }
+    return frames;
+  }
+
+  static void *handle;
+  static framer_create_fn_t create;
+  static framer_destroy_fn_t destroy;
+  static framer_process_fn_t process;
+
+  void *state = nullptr;
+  framer_t *framer = nullptr;
+};
+
+void *DemuxFramerTests::handle = nullptr;
+framer_create_fn_t DemuxFramerTests::create = nullptr;
+framer_destroy_fn_t DemuxFramerTests::destroy = nullptr;
+framer_process_fn_t DemuxFramerTests::process = nullptr;
+
+static bytes_t make_sbp_frame(std::mt19937 &rng)
+{
+  uint8_t length = (uint8_t)(rng() % 256);
+  bytes_t frame = {SBP_PREAMBLE, (uint8_t)rng(), (uint8_t)rng(), 0x42, 0x00, length};
+  for (uint32_t i = 0; i < length; i++) {
+    frame.push_back((uint8_t)rng());
+  }
+  uint16_t crc = pk_crc16_ccitt(&frame[1], frame.size() - 1, 0);
+  frame.push_back((uint8_t)crc);
+  frame.push_back((uint8_t)(crc >> 8));
+  return frame;
+}
+
+static bytes_t make_rtcm3_frame(std::mt19937 &rng)
+{
+  uint32_t length = rng() % 1024;
+  bytes_t frame = {RTCM3_PREAMBLE, (uint8_t)(length >> 8), (uint8_t)length};
+  for (uint32_t i = 0; i < length; i++) {
+    frame.push_back((uint8_t)rng());
+  }
+  uint32_t crc = pk_crc24q(frame.data(), frame.size(), 0);
+  frame.push_back((uint8_t)(crc >> 16));
+  frame.push_back((uint8_t)(crc >> 8));
+  frame.push_back((uint8_t)crc);
+  return frame;
+}
+
+static bytes_t make_nmea_frame(std::mt19937 &rng)
+{
+  static const char *const sentences[] = {"GPGGA", "GNRMC", "GPGSV", "GNZDA"};
+  std::string body = sentences[rng() % 4];
+  uint32_t fields = rng() % 16;
+  for (uint32_t i = 0; i < fields; i++) {
+    body += "," + std::to_string(rng() % 100000);
+  }
+  uint8_t checksum = 0;
+  for (char c : body) {
+    checksum ^= (uint8_t)c;
+  }
+  char tail[8];
+  snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+  std::string sentence = "$" + body + tail;
+  return bytes_t(sentence.begin(), sentence.end());
+}
+
+static bytes_t make_frame(std::mt19937 &rng)
+{
+  switch (rng() % 3) {
+  case 0: return make_sbp_frame(rng);
+  case 1: return make_rtcm3_frame(rng);
+  default: return make_nmea_frame(rng);
+  }
+}
+
+/* Noise biased towards start bytes of every protocol */
+static void append_noise(std::mt19937 &rng, bytes_t &stream, size_t length)
+{
+  static const uint8_t starts[] = {SBP_PREAMBLE, RTCM3_PREAMBLE, '$', '!'};
+  for (size_t i = 0; i < length; i++) {
+    stream.push_back(rng() % 4 == 0 ? starts[rng() % 4] : (uint8_t)(rng() % 4));
+  }
+}
+
+TEST_F(DemuxFramerTests, mixedStream)
+{
+  std::mt19937 rng(42);
+  std::vector<bytes_t> expected;
+  bytes_t stream;
+  for (int i = 0; i < CORPUS_FRAMES; i++) {
+    expected.push_back(make_frame(rng));
+    stream.insert(stream.end(), expected.back().begin(), expected.back().end());
+  }
+
+  EXPECT_EQ(frame_stream(stream, 4096), expected);
+
+  /* Frames split across reads must come out the same */
+  reset();
+  EXPECT_EQ(frame_stream(stream, 7), expected);
+  reset();
+  EXPECT_EQ(frame_stream(stream, 1), expected);
+}
+
+TEST_F(DemuxFramerTests, batchMatchesSingle)
+{
+  std::mt19937 rng(5);
+  std::vector<bytes_t> expected;
+  bytes_t stream;
+  for (int i = 0; i < CORPUS_FRAMES; i++) {
+    expected.push_back(make_frame(rng));
+    stream.insert(stream.end(), expected.back().begin(), expected.back().end());
+  }
+
+  EXPECT_EQ(frame_stream(stream, 4096, true), expected);
+  reset();
+  EXPECT_EQ(frame_stream(stream, 300, true), expected);
+}
+
+TEST_F(DemuxFramerTests, corruptedStream)
+{
+  std::mt19937 rng(7);
+  std::vector<bytes_t> expected;
+  bytes_t stream;
+  int flipped = 0;
+
+  for (int i = 0; i < CORPUS_FRAMES; i++) {
+    bytes_t frame = make_frame(rng);
+    switch (rng() % 5) {
+    case 0:
+      /* Bit error past the start byte */
+      frame[1 + rng() % (frame.size() - 3)] ^= (uint8_t)(1 << (rng() % 8));
+      flipped++;
+      break;
+    case 1:
+      /* Garbage, including false starts, before the frame */
+      append_noise(rng, stream, rng() % 64);
+      expected.push_back(frame);
+      break;
+    case 2:
+      /* Truncated frame, the next frame starts inside its claimed length */
+      stream.insert(stream.end(), frame.begin(), frame.begin() + frame.size() / 2);
+      frame = make_frame(rng);
+      expected.push_back(frame);
+      break;
+    default: expected.push_back(frame); break;
+    }
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  /* Every damaged frame is dropped, none of its neighbours */
+  ASSERT_GT(flipped, 0);
+  EXPECT_EQ(frame_stream(stream, 4096), expected);
+
+  reset();
+  EXPECT_EQ(frame_stream(stream, 1), expected);
+  reset();
+  EXPECT_EQ(frame_stream(stream, 64, true), expected);
+}
+
+TEST_F(DemuxFramerTests, falseStartDoesNotHideFrame)
+{
+  std::mt19937 rng(3);
+  bytes_t frame = make_nmea_frame(rng);
+
+  /* An SBP header claiming a long payload directly in front of the sentence,
+   * the sentence must not be swallowed once the SBP CRC fails */
+  bytes_t stream = {SBP_PREAMBLE, 0x00, 0x00, 0x00, 0x00, 0x20};
+  stream.insert(stream.end(), frame.begin(), frame.end());
+  append_noise(rng, stream, 64);
+
+  std::vector<bytes_t> frames = frame_stream(stream, 4096);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0], frame);
+}
+
+TEST_F(DemuxFramerTests, carryWrapsAround)
+{
+  std::mt19937 rng(11);
+
+  /* Each false SBP header claims more than is left of the run, so the carry
+   * never empties while they are resynced past and it wraps several times */
+  bytes_t stream;
+  for (int i = 0; i < 2000; i++) {
+    bytes_t header = {SBP_PREAMBLE, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    stream.insert(stream.end(), header.begin(), header.end());
+  }
+  std::vector<bytes_t> expected;
+  for (int i = 0; i < 20; i++) {
+    expected.push_back(make_frame(rng));
+    stream.insert(stream.end(), expected.back().begin(), expected.back().end());
+  }
+
+  for (size_t chunk : {1, 7, 64, 4096}) {
+    reset();
+    EXPECT_EQ(frame_stream(stream, chunk), expected) << chunk;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  logging_init(PROGRAM_NAME);
+  logging_log_to_stdout_only(true);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  auto ret = RUN_ALL_TESTS();
+
+  logging_deinit();
+
+  return ret;
+}
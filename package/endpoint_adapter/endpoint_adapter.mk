@@ -6,22 +6,63 @@
 
 ENDPOINT_ADAPTER_VERSION = 0.1
 ENDPOINT_ADAPTER_SITE = \
-  "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/endpoint_adapter/src"
+  "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/endpoint_adapter"
 ENDPOINT_ADAPTER_SITE_METHOD = local
 ENDPOINT_ADAPTER_DEPENDENCIES = libuv libsbp libpiksi
 
+ifeq ($(BR2_PACKAGE_ENDPOINT_ADAPTER_STATIC_PROTOCOLS),y)
+ENDPOINT_ADAPTER_DEPENDENCIES += sbp_protocol rtcm3_in_protocol nmea_protocol \
+                                demux_protocol
+ENDPOINT_ADAPTER_MAKE_OPTS = STATIC_PROTOCOLS=y
+endif
+
+ifeq ($(BR2_BUILD_TESTS),y)
+ENDPOINT_ADAPTER_DEPENDENCIES += gtest
+endif
+
 ENDPOINT_ADAPTER_INSTALL_STAGING = YES
 
+define ENDPOINT_ADAPTER_BUILD_CMDS_DEFAULT
+    $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) $(ENDPOINT_ADAPTER_MAKE_OPTS) -C $(@D) all
+endef
+
+ifeq ($(BR2_BUILD_TESTS),y)
+define ENDPOINT_ADAPTER_BUILD_CMDS_TESTS
+    $(MAKE) CC=$(TARGET_CC) CXX=$(TARGET_CXX) LD=$(TARGET_LD) $(ENDPOINT_ADAPTER_MAKE_OPTS) -C $(@D) test
+endef
+endif
+
 define ENDPOINT_ADAPTER_BUILD_CMDS
-    $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) -C $(@D) all
+    $(ENDPOINT_ADAPTER_BUILD_CMDS_DEFAULT)
+    $(ENDPOINT_ADAPTER_BUILD_CMDS_TESTS)
+endef
+
+define ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_DEFAULT
+    $(INSTALL) -D -m 0755 $(@D)/src/endpoint_adapter $(TARGET_DIR)/usr/bin
+endef
+
+ifeq ($(BR2_BUILD_TESTS),y)
+define ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_TESTS_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/test/test_endpoint_adapter $(TARGET_DIR)/usr/bin
+endef
+endif
+
+# The CAN tests skip themselves without a vcan0 interface, which the chroot
+# doesn't have, run test_endpoint_adapter by hand on a host that does
+ifeq ($(BR2_RUN_TESTS),y)
+define ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_TESTS_RUN
+    sudo chroot $(TARGET_DIR) test_endpoint_adapter
 endef
+endif
 
 define ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS
-    $(INSTALL) -D -m 0755 $(@D)/endpoint_adapter $(TARGET_DIR)/usr/bin
+    $(ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_DEFAULT)
+    $(ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_TESTS_INSTALL)
+    $(ENDPOINT_ADAPTER_INSTALL_TARGET_CMDS_TESTS_RUN)
 endef
 
 define ENDPOINT_ADAPTER_INSTALL_STAGING_CMDS
-    $(INSTALL) -D -m 0755 $(@D)/endpoint_adapter $(STAGING_DIR)/usr/bin
+    $(INSTALL) -D -m 0755 $(@D)/src/endpoint_adapter $(STAGING_DIR)/usr/bin
 endef
 
 $(eval $(generic-package))
@@ -18,6 +18,8 @@
 #include <dlfcn.h>
 #include <syslog.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 #include <limits.h>
@@ -33,21 +35,41 @@
 #include <libpiksi/protocols.h>
 
 #include "endpoint_adapter.h"
+#include "endpoint_adapter_classify.h"
+#include "endpoint_adapter_shaper.h"
+#include "endpoint_adapter_sendq.h"
+#include "endpoint_adapter_fanout.h"
+#include "endpoint_adapter_dgram.h"
+#include "endpoint_adapter_replay.h"
 
 #define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
 #define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
 #define READ_BUFFER_SIZE (4 * 1024)
+/* Unframed reads are published whole, so they're capped at the largest
+ * message a subscriber takes in one piece */
+#define PASSTHROUGH_READ_SIZE PK_ENDPOINT_RECV_BUF_SIZE
+/* Most reads per wake up while the fd still has a backlog */
+#define PASSTHROUGH_READS_MAX 8
 #define REP_TIMEOUT_DEFAULT_ms 10000
 #define STARTUP_DELAY_DEFAULT_ms 0
 #define ENDPOINT_RESTART_RETRY_COUNT 3
 #define ENDPOINT_RESTART_RETRY_DELAY_ms 1
 #define FRAMER_NONE_NAME "none"
+#define FRAMER_BATCH_MAX 64
 #define FILTER_NONE_NAME "none"
 #define METRIC_NAME_LEN 128
-
-/* Sleep for a maximum 1s while waiting for a send to complete */
-#define MAX_SEND_SLEEP_MS (1000)
-#define SEND_SLEEP_NS (100)
+#define SHAPER_TICK_MS 10
+/* Default shaper queue holds this many seconds of budget */
+#define SHAPER_QUEUE_DEFAULT_s 2
+#define SHAPER_QUEUE_MIN 4096
+#define CLIENT_BUFFER_DEFAULT (64 * 1024)
+#define SENDQ_SIZE_DEFAULT (64 * 1024)
+/* The first frames go out once the loop is running and the pub socket has had
+ * a moment to connect, the timer is re-armed as frames fall due from then on */
+#define REPLAY_START_MS 1
+/* Most replayed bytes published per timer callback, bounds a max speed
+ * replay's hold on the loop */
+#define REPLAY_BURST_BYTES_MAX (64 * 1024)
 
 #define PROGRAM_NAME "endpoint_adapter"
 
@@ -66,6 +88,28 @@ PK_METRICS_TABLE(MT, MI,
   PK_METRICS_ENTRY("rx/frame/count",           "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, rx_frames),
   PK_METRICS_ENTRY("tx/frame/count",           "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, tx_frames),
 
+  PK_METRICS_ENTRY("shaper/dropped/high",      "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, shaper_dropped_high),
+  PK_METRICS_ENTRY("shaper/dropped/normal",    "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, shaper_dropped_normal),
+  PK_METRICS_ENTRY("shaper/dropped/low",       "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, shaper_dropped_low),
+
+  PK_METRICS_ENTRY("sendq/depth",              "current",        M_U32,         M_UPDATE_ASSIGN,  M_RESET_DEF, sendq_depth),
+  PK_METRICS_ENTRY("sendq/depth",              "max",            M_U32,         M_UPDATE_ASSIGN,  M_RESET_DEF, sendq_depth_max),
+  PK_METRICS_ENTRY("sendq/dropped/frames",     "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, sendq_dropped_frames),
+  PK_METRICS_ENTRY("sendq/dropped/bytes",      "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, sendq_dropped_bytes),
+  PK_METRICS_ENTRY("sendq/stalls",             "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, sendq_stalls),
+  PK_METRICS_ENTRY("sendq/stall_ms",           "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, sendq_stall_ms),
+
+  PK_METRICS_ENTRY("ring/rx/dropped",          "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, ring_rx_dropped),
+  PK_METRICS_ENTRY("ring/tx/dropped",          "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, ring_tx_dropped),
+
+  PK_METRICS_ENTRY("replay/frame/count",       "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, replay_frames),
+  PK_METRICS_ENTRY("replay/late/count",        "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, replay_late),
+  PK_METRICS_ENTRY("replay/lag_ms",            "max",            M_U32,         M_UPDATE_ASSIGN,  M_RESET_DEF, replay_lag_max),
+  PK_METRICS_ENTRY("replay/loops",             "total",          M_U32,         M_UPDATE_SUM,     M_RESET_DEF, replay_loops),
+
+  PK_METRICS_ENTRY("server/clients",           "current",        M_U32,         M_UPDATE_ASSIGN,  M_RESET_DEF, server_client_count),
+  PK_METRICS_ENTRY("server/evicted",           "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, server_evicted),
+
   PK_METRICS_ENTRY("rx/read/count",            "per_second",     M_U32,         M_UPDATE_COUNT,   M_RESET_DEF, rx_read_count),
   PK_METRICS_ENTRY("rx/read/size/per_second",  "total",          M_U32,         M_UPDATE_SUM,     M_RESET_DEF, rx_read_size_total),
   PK_METRICS_ENTRY("rx/read/size/per_second",  "average",        M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, rx_read_size_average,
@@ -86,6 +130,24 @@ PK_METRICS_TABLE(MT, MI,
   PK_METRICS_ENTRY("tx/write/size/per_second", "average",        M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, tx_write_size_average,
                    M_AVERAGE_OF(MI,         tx_write_size_total, tx_write_count)),
 
+  PK_METRICS_ENTRY("tx/syscall/count",         "per_second",     M_U32,         M_UPDATE_COUNT,   M_RESET_DEF, tx_syscall_count),
+  PK_METRICS_ENTRY("tx/syscall/size/per_second","total",         M_U32,         M_UPDATE_SUM,     M_RESET_DEF, tx_syscall_size_total),
+  PK_METRICS_ENTRY("tx/syscall/size/per_second","average",       M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, tx_syscall_size_average,
+                   M_AVERAGE_OF(MI,         tx_syscall_size_total, tx_syscall_count)),
+
+  PK_METRICS_ENTRY("udp/rx/syscall/count",     "per_second",     M_U32,         M_UPDATE_COUNT,   M_RESET_DEF, udp_rx_syscalls),
+  PK_METRICS_ENTRY("udp/rx/datagram/count",    "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, udp_rx_datagrams),
+  PK_METRICS_ENTRY("udp/rx/datagram/per_syscall","average",      M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, udp_rx_datagrams_average,
+                   M_AVERAGE_OF(MI,         udp_rx_datagrams,    udp_rx_syscalls)),
+
+  PK_METRICS_ENTRY("udp/tx/syscall/count",     "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, udp_tx_syscalls),
+  PK_METRICS_ENTRY("udp/tx/datagram/count",    "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, udp_tx_datagrams),
+  PK_METRICS_ENTRY("udp/tx/frame/count",       "per_second",     M_U32,         M_UPDATE_SUM,     M_RESET_DEF, udp_tx_frames),
+  PK_METRICS_ENTRY("udp/tx/datagram/per_syscall","average",      M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, udp_tx_datagrams_average,
+                   M_AVERAGE_OF(MI,         udp_tx_datagrams,    udp_tx_syscalls)),
+  PK_METRICS_ENTRY("udp/tx/frame/per_syscall", "average",        M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, udp_tx_frames_average,
+                   M_AVERAGE_OF(MI,         udp_tx_frames,       udp_tx_syscalls)),
+
   PK_METRICS_ENTRY("alt/read/count",           "per_second",     M_U32,         M_UPDATE_COUNT,   M_RESET_DEF, alt_read_count),
   PK_METRICS_ENTRY("alt/read/size/per_second", "total",          M_U32,         M_UPDATE_SUM,     M_RESET_DEF, alt_read_size_total),
   PK_METRICS_ENTRY("alt/read/size/per_second", "average",        M_U32,         M_UPDATE_AVERAGE, M_RESET_DEF, alt_read_size_average,
@@ -131,14 +193,41 @@ typedef struct {
   int write_fd;
   framer_t *framer;
   filter_t *filter;
+  classifier_t *classifier; /**< Output frame classes, shared by the shaper and sendq */
+  shaper_t *shaper;
+  sendq_t *sendq; /**< Output the fd doesn't take right away, see handle_fd_writev() */
+  fanout_t *fanout; /**< Output goes to every server client, overrides write_fd */
+  bool dgram_in; /**< read_fd is a datagram socket, read many datagrams at a time */
+  dgram_batch_t *dgram_out; /**< Output datagrams are queued, see handle_flush() */
+  pk_endpoint_t **routes; /**< Endpoint per leading frame byte, overrides pk_ept */
+  bool passthrough; /**< No framer or filter, data is written as it was read */
+  const io_ops_t *ops; /**< Reads or writes go through ops rather than the fds */
 } handle_t;
 
+/* Framed input is routed on the first byte of each frame, which tells the
+ * protocols apart (see the demux framer) */
+typedef struct {
+  const char *protocol;
+  const char *leads;
+  const char *addr;
+  pk_endpoint_t *pk_ept;
+} pub_route_t;
+
+/* A client of the single process TCP server, input from each client is
+ * framed on its own */
+typedef struct {
+  void *poll_handle;
+  handle_t read_handle;
+  handle_t pub_handle;
+} server_client_t;
+
 static void timer_handler(pk_loop_t *loop, void *handle, int status, void *context);
 static void setup_metrics();
 
 static void die_error(const char *error);
 
 static ssize_t handle_write_all_via_framer(handle_t *handle, const uint8_t *buffer, size_t bufsize);
+static ssize_t handle_write_passthrough(handle_t *handle, const uint8_t *buffer, size_t count);
 static void handle_alt_write(handle_t *handle, const uint8_t *buffer, size_t count);
 
 typedef ssize_t (*read_fn_t)(handle_t *handle, void *buffer, size_t count);
@@ -151,6 +240,13 @@ static struct {
   void *loop_sub_handle;
   void *loop_alt_sub_handle;
   void *read_fd_handle;
+  void *write_fd_handle;
+  bool write_fd_polled;
+  void *shaper_timer_handle;
+  void *replay_timer_handle;
+  replay_t *replay;
+  const io_ops_t *ops;
+  void *server_handle;
   pk_endpoint_t *pub_ept;
   pk_endpoint_t *sub_ept;
   pk_endpoint_t *alt_pub_ept;
@@ -196,9 +292,33 @@ static const char *udp_connect_addr = NULL;
 static int can_id = -1;
 static int can_filter = -1;
 static bool retry_pubsub = false;
-
-static uint8_t fd_read_buffer[READ_BUFFER_SIZE]; /** The read buffer */
-static bool eagain_warned = false; /** used to rate limit the EGAIN warning to once per second */
+static uint32_t shape_rate = 0;
+static uint32_t shape_queue = 0;
+static const char *shape_high = NULL;
+static const char *shape_low = NULL;
+static uint32_t tcp_clients = 0;
+static uint32_t client_buffer = CLIENT_BUFFER_DEFAULT;
+static uint32_t udp_pack = 0;
+static uint32_t sendq_size = SENDQ_SIZE_DEFAULT;
+static sendq_drop_t sendq_drop = SENDQ_DROP_OLDEST;
+static bool replay = false;
+static double replay_speed = 1;
+static bool replay_loop = false;
+
+static pub_route_t pub_routes[] = {
+  {.protocol = "sbp", .leads = "\x55"},
+  {.protocol = "rtcm3", .leads = "\xD3"},
+  {.protocol = "nmea", .leads = "$!"},
+};
+static pk_endpoint_t *pub_route_epts[UINT8_MAX + 1];
+
+static server_client_t *server_clients = NULL;
+
+static uint8_t fd_read_buffer[PASSTHROUGH_READ_SIZE]; /** The read buffer */
+static uint8_t replay_buffer[READ_BUFFER_SIZE]; /** Due replay frames, published together */
+static uint32_t replay_lag_max_ms = 0; /** Furthest behind schedule over the whole replay */
+static uint8_t dgram_read_buffer[DGRAM_BATCH_MAX][READ_BUFFER_SIZE]; /** Datagram read buffers */
+static bool eagain_warned = false; /** used to rate limit the EAGAIN warning to once per second */
 
 static void usage(char *command)
 {
@@ -225,6 +345,31 @@ static void usage(char *command)
   fprintf(stderr, "\t--filter-out-config <file>\n");
   fprintf(stderr, "\t\tfilter configuration file\n");
 
+  fprintf(stderr, "\nOutput Shaping - optional, requires --framer-out\n");
+  fprintf(stderr, "\t--shape-rate <bytes>\n");
+  fprintf(stderr, "\t\toutput budget in bytes per second\n");
+  fprintf(stderr, "\t--shape-queue <bytes>\n");
+  fprintf(stderr, "\t\tframes held back while over budget (default %d seconds worth),\n",
+          SHAPER_QUEUE_DEFAULT_s);
+  fprintf(stderr, "\t\teach class in use allocates this much, up to 3 times in all\n");
+  fprintf(stderr, "\t--shape-high <msg_type,...>\n");
+  fprintf(stderr, "\t\tsent first and dropped last\n");
+  fprintf(stderr, "\t--shape-low <msg_type,...>\n");
+  fprintf(stderr, "\t\tsent last and dropped first\n");
+
+  fprintf(stderr, "\nOutput Queue - optional\n");
+  fprintf(stderr, "\t--sendq-size <bytes>\n");
+  fprintf(stderr, "\t\toutput held while the fd is not writable (default %d, 0 to disable)\n",
+          SENDQ_SIZE_DEFAULT);
+  fprintf(stderr, "\t--sendq-drop <oldest|newest|priority>\n");
+  fprintf(stderr, "\t\twhat is dropped when the queue is full (default oldest), priority\n");
+  fprintf(stderr, "\t\trequires --framer-out and takes --shape-high/--shape-low, each\n");
+  fprintf(stderr, "\t\tclass in use allocates --sendq-size, up to 3 times in all\n");
+
+  fprintf(stderr, "\nPub Routing - optional, requires --framer-in\n");
+  fprintf(stderr, "\t--pub-route <sbp|rtcm3|nmea>=<addr>\n");
+  fprintf(stderr, "\t\tpublish frames of a protocol to their own socket\n");
+
   fprintf(stderr, "\nIO Modes - select one\n");
   fprintf(stderr, "\t--stdio\n");
   fprintf(stderr, "\t--file <file>\n");
@@ -235,6 +380,24 @@ static void usage(char *command)
   fprintf(stderr, "\t--can <can_id>\n");
   fprintf(stderr, "\t--can-f <can_filter>\n");
 
+  fprintf(stderr, "\nTCP Server - optional, requires --tcp-l\n");
+  fprintf(stderr, "\t--tcp-clients <n>\n");
+  fprintf(stderr, "\t\tserve up to n clients from this process instead of one process each\n");
+  fprintf(stderr, "\t--client-buffer <bytes>\n");
+  fprintf(stderr, "\t\tunsent output held per client before it is dropped (default %d)\n",
+          CLIENT_BUFFER_DEFAULT);
+
+  fprintf(stderr, "\nReplay - optional, requires --file and --pub\n");
+  fprintf(stderr, "\t--replay <speed|max>\n");
+  fprintf(stderr, "\t\tpublish an SBP log paced by its GPS time messages, 1 for real time,\n");
+  fprintf(stderr, "\t\tN for N times faster or max for as fast as it can be read\n");
+  fprintf(stderr, "\t--replay-loop\n");
+  fprintf(stderr, "\t\tstart over at the end of the log\n");
+
+  fprintf(stderr, "\nUDP Output - optional, requires --udp-c\n");
+  fprintf(stderr, "\t--udp-pack <bytes>\n");
+  fprintf(stderr, "\t\tpack frames into datagrams of up to this size, e.g. 1472 for a 1500 MTU\n");
+
   fprintf(stderr, "\nAlternate pub/sub sockets - select one or more\n");
   fprintf(stderr, "\t--pub2 <ipc_path>\n");
   fprintf(stderr, "\t--sub2 <ipc_path>\n");
@@ -250,6 +413,42 @@ static void usage(char *command)
   fprintf(stderr, "\t\tretry pub/sub endpoint connections\n");
 }
 
+static pub_route_t *pub_route_lookup(const char *protocol, size_t length)
+{
+  for (size_t i = 0; i < COUNT_OF(pub_routes); i++) {
+    if (strlen(pub_routes[i].protocol) == length
+        && strncasecmp(pub_routes[i].protocol, protocol, length) == 0) {
+      return &pub_routes[i];
+    }
+  }
+  return NULL;
+}
+
+/* <protocol>=<addr> */
+static int pub_route_parse(const char *arg)
+{
+  const char *addr = strchr(arg, '=');
+  if (addr == NULL || addr[1] == '\0') {
+    return -1;
+  }
+
+  pub_route_t *route = pub_route_lookup(arg, (size_t)(addr - arg));
+  if (route == NULL) {
+    return -1;
+  }
+
+  route->addr = addr + 1;
+  return 0;
+}
+
+static bool pub_routes_configured(void)
+{
+  for (size_t i = 0; i < COUNT_OF(pub_routes); i++) {
+    if (pub_routes[i].addr != NULL) return true;
+  }
+  return false;
+}
+
 static int parse_options(int argc, char *argv[])
 {
   enum {
@@ -276,6 +475,18 @@ static int parse_options(int argc, char *argv[])
     OPT_ID_FRAMER_OUT,
     OPT_ID_BYPASS_PUB,
     OPT_ID_BYPASS_SUB,
+    OPT_ID_SHAPE_RATE,
+    OPT_ID_SHAPE_QUEUE,
+    OPT_ID_SHAPE_HIGH,
+    OPT_ID_SHAPE_LOW,
+    OPT_ID_PUB_ROUTE,
+    OPT_ID_TCP_CLIENTS,
+    OPT_ID_CLIENT_BUFFER,
+    OPT_ID_UDP_PACK,
+    OPT_ID_SENDQ_SIZE,
+    OPT_ID_SENDQ_DROP,
+    OPT_ID_REPLAY,
+    OPT_ID_REPLAY_LOOP,
   };
 
   /* clang-format off */
@@ -304,6 +515,18 @@ static int parse_options(int argc, char *argv[])
     {"retry",             no_argument,       0, OPT_ID_RETRY_PUBSUB},
     {"pub2",              required_argument, 0, OPT_ID_BYPASS_PUB},
     {"sub2",              required_argument, 0, OPT_ID_BYPASS_SUB},
+    {"shape-rate",        required_argument, 0, OPT_ID_SHAPE_RATE},
+    {"shape-queue",       required_argument, 0, OPT_ID_SHAPE_QUEUE},
+    {"shape-high",        required_argument, 0, OPT_ID_SHAPE_HIGH},
+    {"shape-low",         required_argument, 0, OPT_ID_SHAPE_LOW},
+    {"pub-route",         required_argument, 0, OPT_ID_PUB_ROUTE},
+    {"tcp-clients",       required_argument, 0, OPT_ID_TCP_CLIENTS},
+    {"client-buffer",     required_argument, 0, OPT_ID_CLIENT_BUFFER},
+    {"udp-pack",          required_argument, 0, OPT_ID_UDP_PACK},
+    {"sendq-size",        required_argument, 0, OPT_ID_SENDQ_SIZE},
+    {"sendq-drop",        required_argument, 0, OPT_ID_SENDQ_DROP},
+    {"replay",            required_argument, 0, OPT_ID_REPLAY},
+    {"replay-loop",       no_argument,       0, OPT_ID_REPLAY_LOOP},
     {0, 0, 0, 0},
   };
   /* clang-format on */
@@ -440,6 +663,70 @@ static int parse_options(int argc, char *argv[])
       retry_pubsub = true;
     } break;
 
+    case OPT_ID_SHAPE_RATE: {
+      shape_rate = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_SHAPE_QUEUE: {
+      shape_queue = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_SHAPE_HIGH: {
+      shape_high = optarg;
+    } break;
+
+    case OPT_ID_SHAPE_LOW: {
+      shape_low = optarg;
+    } break;
+
+    case OPT_ID_PUB_ROUTE: {
+      if (pub_route_parse(optarg) != 0) {
+        fprintf(stderr, "invalid pub route\n");
+        return -1;
+      }
+    } break;
+
+    case OPT_ID_TCP_CLIENTS: {
+      tcp_clients = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_CLIENT_BUFFER: {
+      client_buffer = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_UDP_PACK: {
+      udp_pack = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_SENDQ_SIZE: {
+      sendq_size = strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_REPLAY: {
+      replay = true;
+      if (strcasecmp(optarg, "max") == 0) {
+        replay_speed = 0;
+      } else {
+        char *end;
+        replay_speed = strtod(optarg, &end);
+        if (end == optarg || *end != '\0' || replay_speed <= 0) {
+          fprintf(stderr, "invalid replay speed\n");
+          return -1;
+        }
+      }
+    } break;
+
+    case OPT_ID_REPLAY_LOOP: {
+      replay_loop = true;
+    } break;
+
+    case OPT_ID_SENDQ_DROP: {
+      if (sendq_drop_parse(optarg, &sendq_drop) != 0) {
+        fprintf(stderr, "invalid send queue drop policy\n");
+        return -1;
+      }
+    } break;
+
     default: {
       fprintf(stderr, "invalid option\n");
       return -1;
@@ -477,6 +764,49 @@ static int parse_options(int argc, char *argv[])
     return -1;
   }
 
+  /* Shaping drops whole frames, so it needs to know where they are */
+  if (shape_rate > 0 && strcasecmp(framer_out_name, FRAMER_NONE_NAME) == 0) {
+    fprintf(stderr, "output shaping requires an output framer\n");
+    return -1;
+  }
+
+  /* Message type classes also pick what the send queue drops first */
+  if (shape_rate == 0
+      && (shape_queue != 0
+          || ((shape_high != NULL || shape_low != NULL) && sendq_drop != SENDQ_DROP_PRIORITY))) {
+    fprintf(stderr, "invalid output shaping settings\n");
+    return -1;
+  }
+
+  if (sendq_drop == SENDQ_DROP_PRIORITY
+      && (sendq_size == 0 || strcasecmp(framer_out_name, FRAMER_NONE_NAME) == 0)) {
+    fprintf(stderr, "priority drops require a send queue and an output framer\n");
+    return -1;
+  }
+
+  /* Routing looks at whole frames published from the read side */
+  if (pub_routes_configured()
+      && (pub_addr == NULL || strcasecmp(framer_in_name, FRAMER_NONE_NAME) == 0)) {
+    fprintf(stderr, "pub routing requires --pub and an input framer\n");
+    return -1;
+  }
+
+  if (tcp_clients > 0 && (io_mode != IO_TCP_LISTEN || client_buffer == 0)) {
+    fprintf(stderr, "invalid TCP server settings\n");
+    return -1;
+  }
+
+  /* The shaper sends frames one at a time, so there's nothing to pack */
+  if (udp_pack > 0 && (io_mode != IO_UDP_CONNECT || udp_pack > DGRAM_SIZE_MAX || shape_rate > 0)) {
+    fprintf(stderr, "invalid UDP packing settings\n");
+    return -1;
+  }
+
+  if ((replay || replay_loop) && (!replay || io_mode != IO_FILE || pub_addr == NULL)) {
+    fprintf(stderr, "replay requires --file and --pub\n");
+    return -1;
+  }
+
   return 0;
 }
 
@@ -500,6 +830,31 @@ static void handle_deinit(handle_t *handle)
     assert(handle->filter == NULL);
   }
 
+  if (handle->shaper != NULL) {
+    shaper_destroy(&handle->shaper);
+    assert(handle->shaper == NULL);
+  }
+
+  if (handle->sendq != NULL) {
+    sendq_destroy(&handle->sendq);
+    assert(handle->sendq == NULL);
+  }
+
+  if (handle->classifier != NULL) {
+    classifier_destroy(&handle->classifier);
+    assert(handle->classifier == NULL);
+  }
+
+  if (handle->fanout != NULL) {
+    fanout_destroy(&handle->fanout);
+    assert(handle->fanout == NULL);
+  }
+
+  if (handle->dgram_out != NULL) {
+    dgram_batch_destroy(&handle->dgram_out);
+    assert(handle->dgram_out == NULL);
+  }
+
   if (handle->pk_ept != NULL) {
     pk_endpoint_destroy(&handle->pk_ept);
     assert(handle->pk_ept == NULL);
@@ -530,6 +885,8 @@ static int handle_init(handle_t *handle,
     .write_fd = write_fd,
     .framer = framer_create(framer_name),
     .filter = filter_create(filter_name, filter_config),
+    .passthrough = strcasecmp(framer_name, FRAMER_NONE_NAME) == 0
+                   && strcasecmp(filter_name, FILTER_NONE_NAME) == 0,
   };
 
   if ((handle->framer == NULL) || (handle->filter == NULL)) {
@@ -540,6 +897,102 @@ static int handle_init(handle_t *handle,
   return 0;
 }
 
+static int handle_classifier_init(handle_t *handle)
+{
+  if (handle->classifier != NULL) {
+    return 0;
+  }
+
+  handle->classifier = classifier_create(framer_out_name);
+  if (handle->classifier == NULL) {
+    return -1;
+  }
+
+  if ((shape_high != NULL
+       && classifier_set(handle->classifier, FRAME_CLASS_HIGH, shape_high) != 0)
+      || (shape_low != NULL
+          && classifier_set(handle->classifier, FRAME_CLASS_LOW, shape_low) != 0)) {
+    PK_LOG_ANNO(LOG_ERR, "invalid message type list");
+    classifier_destroy(&handle->classifier);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int handle_shaper_init(pk_loop_t *loop, handle_t *handle)
+{
+  uint32_t queue_size = shape_queue;
+  if (queue_size == 0) {
+    queue_size = shape_rate * SHAPER_QUEUE_DEFAULT_s;
+    if (queue_size < SHAPER_QUEUE_MIN) queue_size = SHAPER_QUEUE_MIN;
+  }
+
+  if (handle_classifier_init(handle) != 0) {
+    return -1;
+  }
+
+  handle->shaper = shaper_create(loop, shape_rate, queue_size, handle->classifier);
+  if (handle->shaper == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Only fds the loop can poll for writability get a queue, regular files are
+ * always writable and datagrams are sent whole or not at all */
+static bool handle_sendq_wanted(const handle_t *handle)
+{
+  struct stat st;
+  if (sendq_size == 0 || handle->dgram_out != NULL || fstat(handle->write_fd, &st) != 0) {
+    return false;
+  }
+  return !S_ISREG(st.st_mode);
+}
+
+static int handle_sendq_init(handle_t *handle)
+{
+  if (sendq_drop == SENDQ_DROP_PRIORITY && handle_classifier_init(handle) != 0) {
+    return -1;
+  }
+
+  handle->sendq = sendq_create(sendq_size, sendq_drop, handle->classifier);
+  if (handle->sendq == NULL) {
+    return -1;
+  }
+
+  /* Writes return EAGAIN instead of blocking, what's left is queued */
+  int flags = fcntl(handle->write_fd, F_GETFL);
+  if (flags < 0 || fcntl(handle->write_fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+    sendq_destroy(&handle->sendq);
+    return -1;
+  }
+
+  return 0;
+}
+
+static pk_endpoint_t *endpoint_create(pk_endpoint_type type,
+                                      const char *addr,
+                                      const char *metric_name)
+{
+  pk_endpoint_t *pk_ept = pk_endpoint_create(pk_endpoint_config()
+                                               .endpoint(addr)
+                                               .identity(metric_name)
+                                               .type(type)
+                                               .retry_connect(retry_pubsub)
+                                               .get());
+  if (pk_ept == NULL) {
+    debug_printf("pk_endpoint_create returned NULL\n");
+    return NULL;
+  }
+
+  usleep(1000 * startup_delay_ms);
+  debug_printf("opened socket: %s\n", addr);
+
+  return pk_ept;
+}
+
 static pk_endpoint_t *endpoint_start(pk_endpoint_type type, bool alt)
 {
   char metric_name[METRIC_NAME_LEN] = {0};
@@ -563,21 +1016,43 @@ static pk_endpoint_t *endpoint_start(pk_endpoint_type type, bool alt)
   } break;
   }
 
-  pk_endpoint_t *pk_ept = pk_endpoint_create(pk_endpoint_config()
-                                               .endpoint(addr)
-                                               .identity(metric_name)
-                                               .type(type)
-                                               .retry_connect(retry_pubsub)
-                                               .get());
-  if (pk_ept == NULL) {
-    debug_printf("pk_endpoint_create returned NULL\n");
-    return NULL;
+  return endpoint_create(type, addr, metric_name);
+}
+
+static int pub_routes_start(void)
+{
+  for (size_t i = 0; i < COUNT_OF(pub_routes); i++) {
+    pub_route_t *route = &pub_routes[i];
+    if (route->addr == NULL) continue;
+
+    char metric_name[METRIC_NAME_LEN] = {0};
+    snprintf_assert(metric_name,
+                    sizeof(metric_name),
+                    "adapter/%s/%s/pub",
+                    port_name,
+                    route->protocol);
+
+    route->pk_ept = endpoint_create(PK_ENDPOINT_PUB, route->addr, metric_name);
+    if (route->pk_ept == NULL) {
+      return -1;
+    }
+
+    for (const char *lead = route->leads; *lead != '\0'; lead++) {
+      pub_route_epts[(uint8_t)*lead] = route->pk_ept;
+    }
   }
 
-  usleep(1000 * startup_delay_ms);
-  debug_printf("opened socket: %s\n", addr);
+  return 0;
+}
 
-  return pk_ept;
+static void pub_routes_stop(void)
+{
+  memset(pub_route_epts, 0, sizeof(pub_route_epts));
+  for (size_t i = 0; i < COUNT_OF(pub_routes); i++) {
+    if (pub_routes[i].pk_ept != NULL) {
+      pk_endpoint_destroy(&pub_routes[i].pk_ept);
+    }
+  }
 }
 
 static ssize_t fd_read(int fd, void *buffer, size_t count)
@@ -627,46 +1102,67 @@ static bool ensure_outq_space(int fd, size_t count)
   return true;
 }
 
-static ssize_t fd_write_with_timeout(int handle,
-                                     const void *buffer,
-                                     size_t count,
-                                     const size_t max_send_sleep_ms,
-                                     const size_t per_retry_sleep_ns)
+static size_t iov_total(const struct iovec *iov, int iov_count)
 {
-  assert(per_retry_sleep_ns != 0);
-  const size_t max_send_sleep_count = MS_TO_NS(max_send_sleep_ms) / per_retry_sleep_ns;
-  size_t sleep_count = 0;
-  for (;;) {
-    ssize_t ret = write(handle, buffer, count);
+  size_t count = 0;
+  for (int i = 0; i < iov_count; i++) {
+    count += iov[i].iov_len;
+  }
+  return count;
+}
+
+/**
+ * Writes all of `iov` with as few writev() calls as the fd allows, partial
+ * writes are resumed where they stopped. If the fd is full whatever is left is
+ * dropped, fds that can stall for long are written through a sendq_t instead.
+ * `iov` is modified as it is written.
+ */
+static ssize_t fd_writev_all(int handle, struct iovec *iov, int iov_count)
+{
+  const size_t count = iov_total(iov, iov_count);
+  size_t written = 0;
+  int iov_index = 0;
+  while (iov_index < iov_count) {
+    ssize_t ret = writev(handle, &iov[iov_index], iov_count - iov_index);
     /* Retry if interrupted */
     if ((ret == -1) && (errno == EINTR)) {
       continue;
     } else if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
-      if (++sleep_count >= max_send_sleep_count) {
-        nanosleep_autoresume(0, per_retry_sleep_ns);
-        continue;
-      }
       if (!eagain_warned) {
         PK_LOG_ANNO(LOG_WARNING,
-                    "call to write() to send data returned EAGAIN for more than %d ms, "
-                    "%u queued bytes are pending (endpoint ident: %s), max_send_sleep_count: %zu",
-                    max_send_sleep_ms,
-                    count,
-                    port_name,
-                    max_send_sleep_count);
+                    "call to write() to send data returned EAGAIN, "
+                    "dropping %zu bytes (endpoint ident: %s)",
+                    count - written,
+                    port_name);
         eagain_warned = true;
       }
-      PK_METRICS_UPDATE(MR, MI.bytes_dropped, PK_METRICS_VALUE((u32)count));
-      sleep_count = 0;
-      continue;
-    } else {
-      return ret;
+      PK_METRICS_UPDATE(MR, MI.bytes_dropped, PK_METRICS_VALUE((u32)(count - written)));
+      return count;
+    } else if (ret <= 0) {
+      return (written > 0) ? (ssize_t)written : ret;
+    }
+
+    PK_METRICS_UPDATE(MR, MI.tx_syscall_count);
+    PK_METRICS_UPDATE(MR, MI.tx_syscall_size_total, PK_METRICS_VALUE((u32)ret));
+    written += (size_t)ret;
+
+    /* Skip what was written, resuming partway into an iovec if need be */
+    size_t advance = (size_t)ret;
+    while (iov_index < iov_count && advance >= iov[iov_index].iov_len) {
+      advance -= iov[iov_index].iov_len;
+      iov_index++;
+    }
+    if (iov_index < iov_count) {
+      iov[iov_index].iov_base = (uint8_t *)iov[iov_index].iov_base + advance;
+      iov[iov_index].iov_len -= advance;
     }
   }
+  return written;
 }
 
-static ssize_t fd_write(int handle, const void *buffer, size_t count)
+static ssize_t fd_writev(int handle, struct iovec *iov, int iov_count)
 {
+  size_t count = iov_total(iov, iov_count);
   if (needs_outq_check(handle)) {
     if (!ensure_outq_space(handle, count)) {
       /* If `ensure_outq_space` fails, we're attempting to drop and flush data,
@@ -676,7 +1172,13 @@ static ssize_t fd_write(int handle, const void *buffer, size_t count)
       return count;
     }
   }
-  return fd_write_with_timeout(handle, buffer, count, MAX_SEND_SLEEP_MS, SEND_SLEEP_NS);
+  return fd_writev_all(handle, iov, iov_count);
+}
+
+static ssize_t fd_write(int handle, const void *buffer, size_t count)
+{
+  struct iovec iov = {.iov_base = (void *)buffer, .iov_len = count};
+  return fd_writev(handle, &iov, 1);
 }
 
 static ssize_t process_read_buffer(handle_t *read_handle,
@@ -693,7 +1195,9 @@ static ssize_t process_read_buffer(handle_t *read_handle,
     UPDATE_IO_LOOP_METRIC(read_handle, MI.rx_read_count, MI.tx_read_count);
   }
 
-  ssize_t write_count = handle_write_all_via_framer(write_handle, buffer, length);
+  ssize_t write_count = write_handle->passthrough
+                          ? handle_write_passthrough(write_handle, buffer, length)
+                          : handle_write_all_via_framer(write_handle, buffer, length);
 
   if (write_count < 0) {
     debug_printf("write_count %d errno %s (%d)\n", write_count, strerror(errno), errno);
@@ -737,6 +1241,40 @@ static void handle_alt_write(handle_t *handle, const uint8_t *buffer, size_t cou
   }
 }
 
+/* The write fd is only polled while its queue holds data */
+static void write_fd_poll_update(handle_t *handle)
+{
+  bool poll = !sendq_empty(handle->sendq);
+  if (poll == loop_ctx.write_fd_polled) {
+    return;
+  }
+  if (pk_loop_poll_events_set(loop_ctx.loop, loop_ctx.write_fd_handle, poll ? LOOP_WRITE : 0)
+      == 0) {
+    loop_ctx.write_fd_polled = poll;
+  }
+}
+
+static ssize_t handle_fd_writev(handle_t *handle, struct iovec *iov, int iov_count)
+{
+  if (handle->ops != NULL) {
+    return handle->ops->writev(handle->ops->context, iov, iov_count);
+  }
+
+  if (handle->sendq == NULL) {
+    return fd_writev(handle->write_fd, iov, iov_count);
+  }
+
+  size_t count = iov_total(iov, iov_count);
+  if (needs_outq_check(handle->write_fd) && !ensure_outq_space(handle->write_fd, count)) {
+    /* Dropped and flushed, see fd_writev() */
+    return count;
+  }
+
+  ssize_t ret = sendq_write(handle->sendq, handle->write_fd, iov, iov_count);
+  write_fd_poll_update(handle);
+  return ret;
+}
+
 static ssize_t handle_write(handle_t *handle, const uint8_t *buffer, size_t count)
 {
   if (handle->pk_ept != NULL) {
@@ -754,56 +1292,201 @@ static ssize_t handle_write(handle_t *handle, const uint8_t *buffer, size_t coun
   PK_METRICS_UPDATE(MR, MI.tx_write_count);
   PK_METRICS_UPDATE(MR, MI.tx_write_size_total, PK_METRICS_VALUE((u32)count));
 
-  return fd_write(handle->write_fd, buffer, count);
+  if (handle->fanout != NULL) {
+    struct iovec iov = {.iov_base = (void *)buffer, .iov_len = count};
+    fanout_write(handle->fanout, &iov, 1);
+    return count;
+  }
+
+  struct iovec iov = {.iov_base = (void *)buffer, .iov_len = count};
+  return handle_fd_writev(handle, &iov, 1);
 }
 
-static ssize_t handle_write_all(handle_t *handle, const uint8_t *buffer, size_t count)
+/* Frames bound for an fd, or the server clients, are gathered and written
+ * together. Pubsub and routed output stays one message per frame, and the
+ * shaper paces frames one at a time */
+static bool handle_gathers_writes(handle_t *handle)
 {
-  uint32_t buffer_index = 0;
-  while (buffer_index < count) {
-    ssize_t write_count = handle_write(handle, &buffer[buffer_index], count - buffer_index);
-    if (write_count < 0) {
-      return write_count;
-    }
-    buffer_index += write_count;
-  }
-  return buffer_index;
+  return handle->pk_ept == NULL && handle->routes == NULL && handle->shaper == NULL;
 }
 
-static ssize_t handle_write_one_via_framer(handle_t *handle,
-                                           const uint8_t *buffer,
-                                           size_t count,
-                                           size_t *frames)
+/* Sends the datagrams queued by handle_queue_datagrams() */
+static int handle_flush(handle_t *handle)
 {
-  uint32_t buffer_index = 0;
-  for (;;) {
-    const uint8_t *frame;
-    uint32_t frame_length;
-    uint32_t remaining = count - buffer_index;
-    buffer_index +=
-      framer_process(handle->framer, &buffer[buffer_index], remaining, &frame, &frame_length);
-    if (frame == NULL) {
-      break;
-    }
-    /* Pass frame through filter */
-    if (filter_process(handle->filter, frame, frame_length) != 0) {
-      continue;
-    }
-    /* Write frame to handle */
-    ssize_t write_count = handle_write_all(handle, frame, frame_length);
-    if (write_count < 0) {
-      return write_count;
-    }
-    if (write_count != frame_length) {
-      syslog(LOG_ERR, "warning: write_count != frame_length");
-    }
-    *frames += 1;
-    break;
+  if (handle->dgram_out == NULL || dgram_batch_empty(handle->dgram_out)) {
+    return 0;
   }
-  return buffer_index;
-}
 
-static ssize_t handle_write_all_via_framer(handle_t *handle, const uint8_t *buffer, size_t bufsize)
+  dgram_stats_t stats = {0};
+  ssize_t ret = dgram_batch_flush(handle->dgram_out, handle->write_fd, &stats);
+
+  PK_METRICS_UPDATE(MR, MI.udp_tx_syscalls, PK_METRICS_VALUE(stats.syscalls));
+  PK_METRICS_UPDATE(MR, MI.udp_tx_datagrams, PK_METRICS_VALUE(stats.datagrams));
+  PK_METRICS_UPDATE(MR, MI.udp_tx_frames, PK_METRICS_VALUE(stats.frames));
+
+  return (ret < 0) ? -1 : 0;
+}
+
+/* Each iovec is a frame, frames are held until the current read has been
+ * processed so one sendmmsg() covers all of it */
+static ssize_t handle_queue_datagrams(handle_t *handle, const struct iovec *iov, int iov_count)
+{
+  size_t count = 0;
+  for (int i = 0; i < iov_count; i++) {
+    const uint8_t *frame = iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+    if (dgram_batch_add(handle->dgram_out, frame, length) != 0) {
+      if (handle_flush(handle) != 0) {
+        return -1;
+      }
+      /* Too large to queue at all, send it on its own */
+      if (dgram_batch_add(handle->dgram_out, frame, length) != 0
+          && fd_write(handle->write_fd, frame, length) < 0) {
+        return -1;
+      }
+    }
+    count += length;
+  }
+  return count;
+}
+
+static ssize_t handle_writev(handle_t *handle, struct iovec *iov, int iov_count)
+{
+  size_t count = iov_total(iov, iov_count);
+
+  PK_METRICS_UPDATE(MR, MI.tx_write_count);
+  PK_METRICS_UPDATE(MR, MI.tx_write_size_total, PK_METRICS_VALUE((u32)count));
+
+  if (handle->fanout != NULL) {
+    fanout_write(handle->fanout, iov, iov_count);
+    return count;
+  }
+
+  /* A single writev() would send every frame as one datagram */
+  if (handle->dgram_out != NULL) {
+    return handle_queue_datagrams(handle, iov, iov_count);
+  }
+
+  return handle_fd_writev(handle, iov, iov_count);
+}
+
+static ssize_t handle_write_all(handle_t *handle, const uint8_t *buffer, size_t count)
+{
+  uint32_t buffer_index = 0;
+  while (buffer_index < count) {
+    ssize_t write_count = handle_write(handle, &buffer[buffer_index], count - buffer_index);
+    if (write_count < 0) {
+      return write_count;
+    }
+    buffer_index += write_count;
+  }
+  return buffer_index;
+}
+
+/* Frames are held in the shaper rather than handed to a tty whose output
+ * queue is full, where ensure_outq_space() would flush them regardless of
+ * priority, or queued behind output the fd hasn't taken yet */
+static bool shaper_ready(size_t length, void *context)
+{
+  handle_t *handle = (handle_t *)context;
+  if (handle->sendq != NULL && !sendq_empty(handle->sendq)) {
+    return false;
+  }
+  if (!needs_outq_check(handle->write_fd)) {
+    return true;
+  }
+  int qlen;
+  ioctl(handle->write_fd, TIOCOUTQ, &qlen);
+  return qlen + length <= outq;
+}
+
+static ssize_t shaper_write(const uint8_t *frame, size_t length, void *context)
+{
+  return handle_write_all((handle_t *)context, frame, length);
+}
+
+static ssize_t handle_write_frame(handle_t *handle, const uint8_t *frame, size_t length)
+{
+  pk_endpoint_t *route = (handle->routes != NULL) ? handle->routes[frame[0]] : NULL;
+  if (route == NULL) {
+    return handle_write_all(handle, frame, length);
+  }
+
+  PK_METRICS_UPDATE(MR, MI.rx_write_count);
+  PK_METRICS_UPDATE(MR, MI.rx_write_size_total, PK_METRICS_VALUE((u32)length));
+
+  if (pk_endpoint_send(route, frame, length) != 0) {
+    return -1;
+  }
+
+  return length;
+}
+
+static ssize_t handle_write_batch_via_framer(handle_t *handle,
+                                             const uint8_t *buffer,
+                                             size_t count,
+                                             size_t *frames)
+{
+  const uint8_t *frame_data[FRAMER_BATCH_MAX];
+  uint32_t frame_lengths[FRAMER_BATCH_MAX];
+  uint32_t frame_count = 0;
+  struct iovec iov[FRAMER_BATCH_MAX];
+  int iov_count = 0;
+  size_t iov_bytes = 0;
+  bool gather = handle_gathers_writes(handle);
+  uint32_t buffer_index = framer_process_batch(handle->framer,
+                                               buffer,
+                                               count,
+                                               frame_data,
+                                               frame_lengths,
+                                               FRAMER_BATCH_MAX,
+                                               &frame_count);
+  for (uint32_t i = 0; i < frame_count; i++) {
+    /* Pass frame through filter */
+    if (filter_process(handle->filter, frame_data[i], frame_lengths[i]) != 0) {
+      continue;
+    }
+    if (handle->shaper != NULL) {
+      shaper_enqueue(handle->shaper, frame_data[i], frame_lengths[i]);
+      *frames += 1;
+      continue;
+    }
+    if (gather) {
+      iov[iov_count++] = (struct iovec){.iov_base = (void *)frame_data[i],
+                                        .iov_len = frame_lengths[i]};
+      iov_bytes += frame_lengths[i];
+      *frames += 1;
+      continue;
+    }
+    /* Write frame to handle */
+    ssize_t write_count = handle_write_frame(handle, frame_data[i], frame_lengths[i]);
+    if (write_count < 0) {
+      return write_count;
+    }
+    if (write_count != frame_lengths[i]) {
+      syslog(LOG_ERR, "warning: write_count != frame_length");
+    }
+    *frames += 1;
+  }
+  /* Frames are only valid until the next framer call, so flush them now */
+  if (iov_count > 0) {
+    ssize_t write_count = handle_writev(handle, iov, iov_count);
+    if (write_count < 0) {
+      return write_count;
+    }
+    if ((size_t)write_count != iov_bytes) {
+      syslog(LOG_ERR, "warning: write_count != frame_length");
+    }
+  }
+  if (handle->shaper != NULL && frame_count > 0) {
+    if (shaper_drain(handle->shaper, shaper_ready, shaper_write, handle) < 0) {
+      return -1;
+    }
+  }
+  return buffer_index;
+}
+
+static ssize_t handle_write_all_via_framer(handle_t *handle, const uint8_t *buffer, size_t bufsize)
 {
   ssize_t write_result = -1;
   uint32_t buffer_index = 0;
@@ -811,7 +1494,7 @@ static ssize_t handle_write_all_via_framer(handle_t *handle, const uint8_t *buff
   for (;;) {
     size_t remaining = bufsize - buffer_index;
     write_result =
-      handle_write_one_via_framer(handle, &buffer[buffer_index], remaining, &frame_count);
+      handle_write_batch_via_framer(handle, &buffer[buffer_index], remaining, &frame_count);
     if (write_result < 0) {
       break;
     }
@@ -825,6 +1508,85 @@ static ssize_t handle_write_all_via_framer(handle_t *handle, const uint8_t *buff
   return write_result;
 }
 
+/* Without a framer the whole buffer is one frame, skip the framer and filter
+ * calls and write it as is */
+static ssize_t handle_write_passthrough(handle_t *handle, const uint8_t *buffer, size_t count)
+{
+  if (handle->pk_ept != NULL) {
+    return handle_write(handle, buffer, count);
+  }
+  struct iovec iov = {.iov_base = (void *)buffer, .iov_len = count};
+  return handle_writev(handle, &iov, 1);
+}
+
+static ssize_t handle_read(handle_t *handle, void *buffer, size_t count)
+{
+  if (handle->ops != NULL) {
+    return handle->ops->read(handle->ops->context, buffer, count);
+  }
+  return fd_read(handle->read_fd, buffer, count);
+}
+
+/* Unframed input that filled the buffer may have more waiting, ops signal
+ * their own backlog so only a full read says anything about them */
+static bool handle_read_backlog(handle_t *handle)
+{
+  if (handle->ops != NULL) {
+    return true;
+  }
+  int available = 0;
+  return ioctl(handle->read_fd, FIONREAD, &available) == 0 && available > 0;
+}
+
+/* Reads what the fd has, unframed input with a backlog is drained with a few
+ * more reads rather than a trip through the loop for each */
+static ssize_t read_fd(handle_t *read_handle, handle_t *write_handle)
+{
+  ssize_t total = 0;
+  size_t read_size = write_handle->passthrough ? sizeof(fd_read_buffer) : READ_BUFFER_SIZE;
+  for (int i = 0; i < PASSTHROUGH_READS_MAX; i++) {
+    ssize_t rc = handle_read(read_handle, fd_read_buffer, read_size);
+    if (rc <= 0) {
+      return (total > 0) ? total : rc;
+    }
+    if (process_read_buffer(read_handle, write_handle, fd_read_buffer, rc) < 0) {
+      return -1;
+    }
+    total += rc;
+
+    if (!write_handle->passthrough || (size_t)rc < read_size || !handle_read_backlog(read_handle)) {
+      break;
+    }
+  }
+  return total;
+}
+
+static ssize_t read_datagrams(handle_t *read_handle, handle_t *write_handle)
+{
+  size_t lengths[DGRAM_BATCH_MAX];
+  int count = dgram_recv(read_handle->read_fd,
+                         &dgram_read_buffer[0][0],
+                         READ_BUFFER_SIZE,
+                         lengths,
+                         DGRAM_BATCH_MAX);
+  if (count <= 0) {
+    return count;
+  }
+
+  PK_METRICS_UPDATE(MR, MI.udp_rx_syscalls);
+  PK_METRICS_UPDATE(MR, MI.udp_rx_datagrams, PK_METRICS_VALUE((u32)count));
+
+  ssize_t total = 0;
+  for (int i = 0; i < count; i++) {
+    if (lengths[i] == 0) continue;
+    if (process_read_buffer(read_handle, write_handle, dgram_read_buffer[i], lengths[i]) < 0) {
+      return -1;
+    }
+    total += lengths[i];
+  }
+  return total;
+}
+
 static void io_loop_pubsub(pk_loop_t *loop, handle_t *read_handle, handle_t *write_handle)
 {
   ssize_t rc = 0;
@@ -845,13 +1607,22 @@ static void io_loop_pubsub(pk_loop_t *loop, handle_t *read_handle, handle_t *wri
     } else {
       rc = read_ctx.status;
     }
+  } else if (read_handle->dgram_in) {
+    rc = read_datagrams(read_handle, write_handle);
   } else {
-    rc = fd_read(read_handle->read_fd, fd_read_buffer, sizeof(fd_read_buffer));
-    if (rc > 0) {
-      rc = process_read_buffer(read_handle, write_handle, fd_read_buffer, rc);
+    rc = read_fd(read_handle, write_handle);
+    /* The read fd may share O_NONBLOCK with the write fd (see
+     * handle_sendq_init()), nothing to read is not an error */
+    if ((rc < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      return;
     }
   }
 
+  if (rc > 0 && handle_flush(write_handle) != 0) {
+    debug_printf("datagram send error: %s (%d)\n", strerror(errno), errno);
+    rc = -1;
+  }
+
   if (rc <= 0) {
     debug_printf("read returned code: %d\n", rc);
     pk_loop_stop(loop);
@@ -864,6 +1635,84 @@ static void io_loop_pubsub(pk_loop_t *loop, handle_t *read_handle, handle_t *wri
                         PK_METRICS_VALUE((u32)rc));
 }
 
+static void shaper_timer_handler(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  (void)status;
+  (void)context;
+
+  handle_t *write_handle = &loop_ctx.write_handle;
+  if (shaper_drain(write_handle->shaper, shaper_ready, shaper_write, write_handle) < 0) {
+    debug_printf("shaper write error: %s (%d)\n", strerror(errno), errno);
+    pk_loop_stop(loop);
+  }
+}
+
+/* Publishes replay_buffer, returns -1 on error */
+static int replay_publish(uint32_t *used)
+{
+  if (*used == 0) {
+    return 0;
+  }
+  ssize_t ret = process_read_buffer(&loop_ctx.read_handle, &loop_ctx.pub_handle, replay_buffer, *used);
+  if (ret > 0) {
+    PK_METRICS_UPDATE(MR, MI.rx_read_size_total, PK_METRICS_VALUE((u32)ret));
+  }
+  *used = 0;
+  return (ret < 0) ? -1 : 0;
+}
+
+/* A one shot timer, re-armed for when the next frame is due */
+static void replay_timer_handler(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)status;
+  (void)context;
+
+  uint32_t used = 0;
+  size_t published = 0;
+  uint32_t wait_ms = 0;
+  replay_status_t rs = REPLAY_FRAME;
+  while (published < REPLAY_BURST_BYTES_MAX) {
+    const uint8_t *frame;
+    uint32_t length;
+    rs = replay_next(loop_ctx.replay, &frame, &length, &wait_ms);
+    if (rs != REPLAY_FRAME) {
+      break;
+    }
+    if (length > sizeof(replay_buffer) - used && replay_publish(&used) != 0) {
+      rs = REPLAY_ERROR;
+      break;
+    }
+    memcpy(&replay_buffer[used], frame, length);
+    used += length;
+    published += length;
+  }
+
+  if (replay_publish(&used) != 0) {
+    rs = REPLAY_ERROR;
+  }
+
+  if (rs == REPLAY_END || rs == REPLAY_ERROR) {
+    replay_stats_t stats;
+    replay_take_stats(loop_ctx.replay, &stats);
+    if (stats.lag_max_ms > replay_lag_max_ms) replay_lag_max_ms = stats.lag_max_ms;
+    if (rs == REPLAY_ERROR) {
+      PK_LOG_ANNO(LOG_ERR, "replay read failed: %s (%d)", strerror(errno), errno);
+    }
+    piksi_log(LOG_INFO,
+              "%s replay finished, at most %u ms behind schedule",
+              port_name,
+              replay_lag_max_ms);
+    pk_loop_stop(loop);
+    return;
+  }
+
+  /* After a full burst more frames may be due right away */
+  if (pk_loop_timer_once(handle, (rs == REPLAY_WAIT) ? wait_ms : 0) != 0) {
+    pk_loop_stop(loop);
+  }
+}
+
 static void timer_handler(pk_loop_t *loop, void *handle, int status, void *context)
 {
   (void)loop;
@@ -876,10 +1725,72 @@ static void timer_handler(pk_loop_t *loop, void *handle, int status, void *conte
 
   PK_METRICS_UPDATE(MR, MI.tx_read_size_average);
   PK_METRICS_UPDATE(MR, MI.tx_write_size_average);
+  PK_METRICS_UPDATE(MR, MI.tx_syscall_size_average);
+
+  PK_METRICS_UPDATE(MR, MI.udp_rx_datagrams_average);
+  PK_METRICS_UPDATE(MR, MI.udp_tx_datagrams_average);
+  PK_METRICS_UPDATE(MR, MI.udp_tx_frames_average);
 
   PK_METRICS_UPDATE(MR, MI.alt_read_size_average);
   PK_METRICS_UPDATE(MR, MI.alt_write_size_average);
 
+  if (loop_ctx.write_handle.shaper != NULL) {
+    uint32_t drops[FRAME_CLASS_COUNT];
+    shaper_take_drops(loop_ctx.write_handle.shaper, drops);
+    PK_METRICS_UPDATE(MR, MI.shaper_dropped_high, PK_METRICS_VALUE(drops[FRAME_CLASS_HIGH]));
+    PK_METRICS_UPDATE(MR, MI.shaper_dropped_normal, PK_METRICS_VALUE(drops[FRAME_CLASS_NORMAL]));
+    PK_METRICS_UPDATE(MR, MI.shaper_dropped_low, PK_METRICS_VALUE(drops[FRAME_CLASS_LOW]));
+  }
+
+  if (loop_ctx.write_handle.sendq != NULL) {
+    sendq_stats_t stats;
+    sendq_take_stats(loop_ctx.write_handle.sendq, &stats);
+    PK_METRICS_UPDATE(MR, MI.sendq_depth, PK_METRICS_VALUE(stats.depth));
+    PK_METRICS_UPDATE(MR, MI.sendq_depth_max, PK_METRICS_VALUE(stats.depth_max));
+    PK_METRICS_UPDATE(MR, MI.sendq_dropped_frames, PK_METRICS_VALUE(stats.dropped_frames));
+    PK_METRICS_UPDATE(MR, MI.sendq_dropped_bytes, PK_METRICS_VALUE(stats.dropped_bytes));
+    PK_METRICS_UPDATE(MR, MI.sendq_stalls, PK_METRICS_VALUE(stats.stalls));
+    PK_METRICS_UPDATE(MR, MI.sendq_stall_ms, PK_METRICS_VALUE(stats.stall_ms));
+    if (stats.dropped_frames > 0) {
+      piksi_log(LOG_WARNING,
+                "%s output queue full, dropped %u frames (%u bytes)",
+                port_name,
+                stats.dropped_frames,
+                stats.dropped_bytes);
+    }
+  }
+
+  if (loop_ctx.ops != NULL && loop_ctx.ops->take_drops != NULL) {
+    uint32_t rx_dropped = 0;
+    uint32_t tx_dropped = 0;
+    loop_ctx.ops->take_drops(loop_ctx.ops->context, &rx_dropped, &tx_dropped);
+    PK_METRICS_UPDATE(MR, MI.ring_rx_dropped, PK_METRICS_VALUE(rx_dropped));
+    PK_METRICS_UPDATE(MR, MI.ring_tx_dropped, PK_METRICS_VALUE(tx_dropped));
+    if (rx_dropped > 0 || tx_dropped > 0) {
+      piksi_log(LOG_WARNING,
+                "%s rings full, dropped %u in and %u out",
+                port_name,
+                rx_dropped,
+                tx_dropped);
+    }
+  }
+
+  if (loop_ctx.replay != NULL) {
+    replay_stats_t stats;
+    replay_take_stats(loop_ctx.replay, &stats);
+    if (stats.lag_max_ms > replay_lag_max_ms) replay_lag_max_ms = stats.lag_max_ms;
+    PK_METRICS_UPDATE(MR, MI.replay_frames, PK_METRICS_VALUE(stats.frames));
+    PK_METRICS_UPDATE(MR, MI.replay_late, PK_METRICS_VALUE(stats.late));
+    PK_METRICS_UPDATE(MR, MI.replay_lag_max, PK_METRICS_VALUE(stats.lag_max_ms));
+    PK_METRICS_UPDATE(MR, MI.replay_loops, PK_METRICS_VALUE(stats.loops));
+  }
+
+  if (loop_ctx.write_handle.fanout != NULL) {
+    fanout_t *fanout = loop_ctx.write_handle.fanout;
+    PK_METRICS_UPDATE(MR, MI.server_client_count, PK_METRICS_VALUE(fanout_client_count(fanout)));
+    PK_METRICS_UPDATE(MR, MI.server_evicted, PK_METRICS_VALUE(fanout_take_evictions(fanout)));
+  }
+
   pk_metrics_flush(MR);
 
   pk_metrics_reset(MR, MI.bytes_dropped);
@@ -887,6 +1798,25 @@ static void timer_handler(pk_loop_t *loop, void *handle, int status, void *conte
   pk_metrics_reset(MR, MI.rx_frames);
   pk_metrics_reset(MR, MI.tx_frames);
 
+  pk_metrics_reset(MR, MI.shaper_dropped_high);
+  pk_metrics_reset(MR, MI.shaper_dropped_normal);
+  pk_metrics_reset(MR, MI.shaper_dropped_low);
+
+  pk_metrics_reset(MR, MI.sendq_depth_max);
+  pk_metrics_reset(MR, MI.sendq_dropped_frames);
+  pk_metrics_reset(MR, MI.sendq_dropped_bytes);
+  pk_metrics_reset(MR, MI.sendq_stalls);
+  pk_metrics_reset(MR, MI.sendq_stall_ms);
+
+  pk_metrics_reset(MR, MI.ring_rx_dropped);
+  pk_metrics_reset(MR, MI.ring_tx_dropped);
+
+  pk_metrics_reset(MR, MI.replay_frames);
+  pk_metrics_reset(MR, MI.replay_late);
+  pk_metrics_reset(MR, MI.replay_lag_max);
+
+  pk_metrics_reset(MR, MI.server_evicted);
+
   pk_metrics_reset(MR, MI.rx_read_count);
   pk_metrics_reset(MR, MI.rx_read_size_total);
   pk_metrics_reset(MR, MI.rx_read_size_average);
@@ -900,6 +1830,18 @@ static void timer_handler(pk_loop_t *loop, void *handle, int status, void *conte
   pk_metrics_reset(MR, MI.tx_write_count);
   pk_metrics_reset(MR, MI.tx_write_size_total);
   pk_metrics_reset(MR, MI.tx_write_size_average);
+  pk_metrics_reset(MR, MI.tx_syscall_count);
+  pk_metrics_reset(MR, MI.tx_syscall_size_total);
+  pk_metrics_reset(MR, MI.tx_syscall_size_average);
+
+  pk_metrics_reset(MR, MI.udp_rx_syscalls);
+  pk_metrics_reset(MR, MI.udp_rx_datagrams);
+  pk_metrics_reset(MR, MI.udp_rx_datagrams_average);
+  pk_metrics_reset(MR, MI.udp_tx_syscalls);
+  pk_metrics_reset(MR, MI.udp_tx_datagrams);
+  pk_metrics_reset(MR, MI.udp_tx_frames);
+  pk_metrics_reset(MR, MI.udp_tx_datagrams_average);
+  pk_metrics_reset(MR, MI.udp_tx_frames_average);
 
   pk_metrics_reset(MR, MI.alt_read_count);
   pk_metrics_reset(MR, MI.alt_read_size_total);
@@ -986,7 +1928,22 @@ static void read_fd_cb(pk_loop_t *loop, void *handle, int status, void *context)
   io_loop_pubsub(loop, &loop_ctx.read_handle, &loop_ctx.pub_handle);
 }
 
-int io_loop_run(int read_fd, int write_fd)
+static void write_fd_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  (void)context;
+
+  handle_t *write_handle = &loop_ctx.write_handle;
+  if ((status & LOOP_ERROR) || sendq_flush(write_handle->sendq, write_handle->write_fd) < 0) {
+    debug_printf("send queue write error: %s (%d)\n", strerror(errno), errno);
+    pk_loop_stop(loop);
+    return;
+  }
+
+  write_fd_poll_update(write_handle);
+}
+
+static void io_loop_create(void)
 {
   loop_ctx.loop = pk_loop_create();
 
@@ -997,43 +1954,36 @@ int io_loop_run(int read_fd, int write_fd)
 
   void *handle = pk_loop_timer_add(loop_ctx.loop, 1000, timer_handler, NULL);
   assert(handle != NULL);
+}
 
-  if (pub_addr != NULL && read_fd != -1) {
-
-    loop_ctx.pub_ept = endpoint_start(PK_ENDPOINT_PUB, false);
-    if (loop_ctx.pub_ept == NULL) {
-      die_error("endpoint_start(PK_ENDPOINT_PUB, false) returned NULL\n");
-    }
-
-    loop_ctx.read_fd_handle = pk_loop_poll_add(loop_ctx.loop, read_fd, read_fd_cb, NULL);
-
-    if (loop_ctx.read_fd_handle == NULL) {
-      die_error("pk_loop_poll_add(...) returned NULL");
-    }
+static void pub_start(void)
+{
+  loop_ctx.pub_ept = endpoint_start(PK_ENDPOINT_PUB, false);
+  if (loop_ctx.pub_ept == NULL) {
+    die_error("endpoint_start(PK_ENDPOINT_PUB, false) returned NULL\n");
+  }
 
-    if (handle_init(&loop_ctx.pub_handle,
-                    loop_ctx.pub_ept,
-                    -1,
-                    -1,
-                    framer_in_name,
-                    filter_in_name,
-                    filter_in_config)
-        != 0) {
-      die_error("handle_init for pub returned error");
-    }
+  if (handle_init(&loop_ctx.pub_handle,
+                  loop_ctx.pub_ept,
+                  -1,
+                  -1,
+                  framer_in_name,
+                  filter_in_name,
+                  filter_in_config)
+      != 0) {
+    die_error("handle_init for pub returned error");
+  }
 
-    if (handle_init(&loop_ctx.read_handle,
-                    NULL,
-                    read_fd,
-                    -1,
-                    FRAMER_NONE_NAME,
-                    FILTER_NONE_NAME,
-                    NULL)
-        != 0) {
-      die_error("handle_init for read_fd returned error\n");
+  if (pub_routes_configured()) {
+    if (pub_routes_start() != 0) {
+      die_error("error opening pub route sockets");
     }
+    loop_ctx.pub_handle.routes = pub_route_epts;
   }
+}
 
+static void alt_pub_start(void)
+{
   if (alt_pub_addr != NULL) {
     debug_printf("setting up alt pub socket");
     loop_ctx.alt_pub_ept = endpoint_start(PK_ENDPOINT_PUB, true);
@@ -1041,40 +1991,73 @@ int io_loop_run(int read_fd, int write_fd)
       die_error("endpoint_start(PK_ENDPOINT_PUB, true) returned NULL\n");
     }
   }
+}
 
-  if (sub_addr != NULL && write_fd != -1) {
+static void sub_start(int write_fd)
+{
+  loop_ctx.sub_ept = endpoint_start(PK_ENDPOINT_SUB, false);
+  if (loop_ctx.sub_ept == NULL) {
+    die_error("endpoint_start(PK_ENDPOINT_SUB, false) returned NULL");
+  }
 
-    loop_ctx.sub_ept = endpoint_start(PK_ENDPOINT_SUB, false);
-    if (loop_ctx.sub_ept == NULL) {
-      die_error("endpoint_start(PK_ENDPOINT_SUB, false) returned NULL");
-    }
+  loop_ctx.loop_sub_handle =
+    pk_loop_endpoint_reader_add(loop_ctx.loop, loop_ctx.sub_ept, sub_reader_cb, loop_ctx.sub_ept);
+
+  if (handle_init(&loop_ctx.sub_handle,
+                  loop_ctx.sub_ept,
+                  -1,
+                  -1,
+                  FRAMER_NONE_NAME,
+                  FILTER_NONE_NAME,
+                  NULL)
+      != 0) {
+    die_error("handle_init for sub returned error\n");
+  }
 
-    loop_ctx.loop_sub_handle =
-      pk_loop_endpoint_reader_add(loop_ctx.loop, loop_ctx.sub_ept, sub_reader_cb, loop_ctx.sub_ept);
+  if (handle_init(&loop_ctx.write_handle,
+                  NULL,
+                  -1,
+                  write_fd,
+                  framer_out_name,
+                  filter_out_name,
+                  filter_out_config)
+      != 0) {
+    die_error("handle_init for write_fd returned error\n");
+  }
 
-    if (handle_init(&loop_ctx.sub_handle,
-                    loop_ctx.sub_ept,
-                    -1,
-                    -1,
-                    FRAMER_NONE_NAME,
-                    FILTER_NONE_NAME,
-                    NULL)
-        != 0) {
-      die_error("handle_init for sub returned error\n");
+  if (dgram_fd_is_datagram(write_fd)) {
+    loop_ctx.write_handle.dgram_out = dgram_batch_create(udp_pack);
+    if (loop_ctx.write_handle.dgram_out == NULL) {
+      die_error("error creating datagram batch");
     }
+  }
 
-    if (handle_init(&loop_ctx.write_handle,
-                    NULL,
-                    -1,
-                    write_fd,
-                    framer_out_name,
-                    filter_out_name,
-                    filter_out_config)
-        != 0) {
-      die_error("handle_init for write_fd returned error\n");
+  if (handle_sendq_wanted(&loop_ctx.write_handle)) {
+    if (handle_sendq_init(&loop_ctx.write_handle) != 0) {
+      die_error("error configuring send queue");
+    }
+    loop_ctx.write_fd_handle = pk_loop_poll_add(loop_ctx.loop, write_fd, write_fd_cb, NULL);
+    if (loop_ctx.write_fd_handle == NULL
+        || pk_loop_poll_events_set(loop_ctx.loop, loop_ctx.write_fd_handle, 0) != 0) {
+      die_error("pk_loop_poll_add(...) for write_fd returned NULL");
     }
+    loop_ctx.write_fd_polled = false;
   }
 
+  if (shape_rate > 0) {
+    if (handle_shaper_init(loop_ctx.loop, &loop_ctx.write_handle) != 0) {
+      die_error("error configuring output shaper");
+    }
+    loop_ctx.shaper_timer_handle =
+      pk_loop_timer_add(loop_ctx.loop, SHAPER_TICK_MS, shaper_timer_handler, NULL);
+    if (loop_ctx.shaper_timer_handle == NULL) {
+      die_error("pk_loop_timer_add(...) for shaper returned NULL");
+    }
+  }
+}
+
+static void alt_sub_start(void)
+{
   if (alt_sub_addr != NULL) {
 
     debug_printf("setting up alt sub socket");
@@ -1100,17 +2083,219 @@ int io_loop_run(int read_fd, int write_fd)
       die_error("handle_init for sub returned error\n");
     }
   }
+}
 
+static void server_client_close(server_client_t *client)
+{
+  if (client->poll_handle == NULL) {
+    return;
+  }
+
+  int fd = client->read_handle.read_fd;
+  debug_printf("closing client fd %d\n", fd);
+
+  pk_loop_poll_remove(loop_ctx.loop, client->poll_handle);
+  client->poll_handle = NULL;
+
+  if (loop_ctx.write_handle.fanout != NULL) {
+    fanout_client_remove(loop_ctx.write_handle.fanout, fd);
+  }
+
+  /* The pub endpoint is shared, it belongs to loop_ctx.pub_handle */
+  client->pub_handle.pk_ept = NULL;
+  handle_deinit(&client->pub_handle);
+  handle_deinit(&client->read_handle);
+}
+
+static server_client_t *server_client_find(int fd)
+{
+  for (uint32_t i = 0; i < tcp_clients; i++) {
+    if (server_clients[i].poll_handle != NULL && server_clients[i].read_handle.read_fd == fd) {
+      return &server_clients[i];
+    }
+  }
+  return NULL;
+}
+
+static void server_client_evict(int fd, void *context)
+{
+  (void)context;
+
+  PK_LOG_ANNO(LOG_WARNING, "dropping TCP client that is not keeping up (fd %d)", fd);
+  server_client_t *client = server_client_find(fd);
+  if (client != NULL) {
+    server_client_close(client);
+  }
+}
+
+/* A client is polled for writability only while the fan out holds output
+ * for it */
+static void server_client_pending(int fd, bool pending, void *context)
+{
+  (void)context;
+
+  server_client_t *client = server_client_find(fd);
+  if (client == NULL) {
+    return;
+  }
+  if (pk_loop_poll_events_set(loop_ctx.loop,
+                              client->poll_handle,
+                              LOOP_READ | (pending ? LOOP_WRITE : 0))
+      != 0) {
+    server_client_close(client);
+  }
+}
+
+static void server_client_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  server_client_t *client = context;
+
+  if ((status & LOOP_DISCONNECTED) || (status & LOOP_ERROR)) {
+    server_client_close(client);
+    return;
+  }
+
+  if (status & LOOP_WRITE) {
+    /* May evict the client */
+    fanout_client_flush(loop_ctx.write_handle.fanout, client->read_handle.read_fd);
+    if (client->poll_handle == NULL) {
+      return;
+    }
+  }
+
+  if (!(status & LOOP_READ)) {
+    return;
+  }
+
+  ssize_t rc = fd_read(client->read_handle.read_fd, fd_read_buffer, sizeof(fd_read_buffer));
+  if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  if (rc <= 0) {
+    server_client_close(client);
+    return;
+  }
+
+  /* Without a pub socket client input has nowhere to go */
+  if (loop_ctx.pub_ept == NULL) {
+    return;
+  }
+
+  if (process_read_buffer(&client->read_handle, &client->pub_handle, fd_read_buffer, rc) < 0) {
+    server_client_close(client);
+    return;
+  }
+
+  UPDATE_IO_LOOP_METRIC((&client->read_handle),
+                        MI.rx_read_size_total,
+                        MI.tx_read_size_total,
+                        PK_METRICS_VALUE((u32)rc));
+}
+
+static void server_accept_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  int listen_fd = *(int *)context;
+
+  if (!handle_loop_status(loop, status)) return;
+
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      PK_LOG_ANNO(LOG_WARNING, "accept failed: %s", strerror(errno));
+    }
+    return;
+  }
+
+  /* A client that stops reading must not block the others */
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+    close(fd);
+    return;
+  }
+
+  server_client_t *client = NULL;
+  for (uint32_t i = 0; i < tcp_clients; i++) {
+    if (server_clients[i].poll_handle == NULL) {
+      client = &server_clients[i];
+      break;
+    }
+  }
+
+  if (client == NULL) {
+    PK_LOG_ANNO(LOG_WARNING, "refusing TCP client, %u clients connected", tcp_clients);
+    close(fd);
+    return;
+  }
+
+  if (handle_init(&client->read_handle, NULL, fd, -1, FRAMER_NONE_NAME, FILTER_NONE_NAME, NULL)
+      != 0) {
+    close(fd);
+    return;
+  }
+
+  if (loop_ctx.pub_ept != NULL) {
+    if (handle_init(&client->pub_handle,
+                    loop_ctx.pub_ept,
+                    -1,
+                    -1,
+                    framer_in_name,
+                    filter_in_name,
+                    filter_in_config)
+        != 0) {
+      handle_deinit(&client->read_handle);
+      return;
+    }
+    client->pub_handle.routes = loop_ctx.pub_handle.routes;
+  }
+
+  client->poll_handle = pk_loop_poll_add(loop, fd, server_client_cb, client);
+  if (client->poll_handle == NULL
+      || (loop_ctx.write_handle.fanout != NULL
+          && fanout_client_add(loop_ctx.write_handle.fanout, fd) != 0)) {
+    PK_LOG_ANNO(LOG_WARNING, "error adding TCP client");
+    if (client->poll_handle == NULL) {
+      client->pub_handle.pk_ept = NULL;
+      handle_deinit(&client->pub_handle);
+      handle_deinit(&client->read_handle);
+    } else {
+      server_client_close(client);
+    }
+    return;
+  }
+
+  debug_printf("accepted client fd %d\n", fd);
+}
+
+static void server_clients_stop(void)
+{
+  if (server_clients == NULL) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < tcp_clients; i++) {
+    server_client_close(&server_clients[i]);
+  }
+  free(server_clients);
+  server_clients = NULL;
+}
+
+static int io_loop_finish(void)
+{
   int rc = pk_loop_run_simple(loop_ctx.loop);
 
   if (rc != 0) {
     PK_LOG_ANNO(LOG_WARNING, "pk_loop_run_simple returned error: %d", rc);
   }
 
+  server_clients_stop();
   handle_deinit(&loop_ctx.pub_handle);
   handle_deinit(&loop_ctx.sub_handle);
+  replay_destroy(&loop_ctx.replay);
   handle_deinit(&loop_ctx.read_handle);
   handle_deinit(&loop_ctx.write_handle);
+  pub_routes_stop();
 
   pk_loop_destroy(&loop_ctx.loop);
   pk_metrics_destroy(&MR);
@@ -1122,16 +2307,131 @@ int io_loop_run(int read_fd, int write_fd)
   return IO_LOOP_SUCCESS;
 }
 
+/* With ops both fds are -1, the handles read and write through ops */
+static int io_loop_run_io(int read_fd, int write_fd, const io_ops_t *ops)
+{
+  bool readable = (ops != NULL) ? (ops->read != NULL) : (read_fd != -1);
+  bool writable = (ops != NULL) ? (ops->writev != NULL) : (write_fd != -1);
+
+  io_loop_create();
+  loop_ctx.ops = ops;
+
+  if (pub_addr != NULL && readable) {
+
+    pub_start();
+
+    /* A log is read on a timer, as its schedule allows, regular files can't
+     * be polled anyway */
+    if (replay) {
+      loop_ctx.replay = replay_create(loop_ctx.loop, read_fd, replay_speed, replay_loop);
+      if (loop_ctx.replay == NULL) {
+        die_error("error starting replay");
+      }
+      loop_ctx.replay_timer_handle =
+        pk_loop_timer_add(loop_ctx.loop, REPLAY_START_MS, replay_timer_handler, NULL);
+      if (loop_ctx.replay_timer_handle == NULL) {
+        die_error("pk_loop_timer_add(...) for replay returned NULL");
+      }
+    } else {
+      int poll_fd = (ops != NULL) ? ops->read_fd : read_fd;
+      loop_ctx.read_fd_handle = pk_loop_poll_add(loop_ctx.loop, poll_fd, read_fd_cb, NULL);
+
+      if (loop_ctx.read_fd_handle == NULL) {
+        die_error("pk_loop_poll_add(...) returned NULL");
+      }
+    }
+
+    if (handle_init(&loop_ctx.read_handle,
+                    NULL,
+                    read_fd,
+                    -1,
+                    FRAMER_NONE_NAME,
+                    FILTER_NONE_NAME,
+                    NULL)
+        != 0) {
+      die_error("handle_init for read_fd returned error\n");
+    }
+
+    loop_ctx.read_handle.dgram_in = dgram_fd_is_datagram(read_fd);
+    loop_ctx.read_handle.ops = ops;
+  }
+
+  alt_pub_start();
+
+  if (sub_addr != NULL && writable) {
+    sub_start(write_fd);
+    loop_ctx.write_handle.ops = ops;
+  }
+
+  alt_sub_start();
+
+  int rc = io_loop_finish();
+  loop_ctx.ops = NULL;
+  return rc;
+}
+
+int io_loop_run(int read_fd, int write_fd)
+{
+  return io_loop_run_io(read_fd, write_fd, NULL);
+}
+
+int io_loop_run_ops(const io_ops_t *ops)
+{
+  return io_loop_run_io(-1, -1, ops);
+}
+
+int io_loop_run_server(int listen_fd)
+{
+  io_loop_create();
+
+  server_clients = calloc(tcp_clients, sizeof(server_client_t));
+  if (server_clients == NULL) {
+    die_error("error allocating TCP clients");
+  }
+
+  loop_ctx.server_handle = pk_loop_poll_add(loop_ctx.loop, listen_fd, server_accept_cb, &listen_fd);
+  if (loop_ctx.server_handle == NULL) {
+    die_error("pk_loop_poll_add(...) returned NULL");
+  }
+
+  if (pub_addr != NULL) {
+    pub_start();
+  }
+
+  alt_pub_start();
+
+  /* Output is framed and filtered once, then copied to every client */
+  if (sub_addr != NULL) {
+    sub_start(-1);
+    loop_ctx.write_handle.fanout =
+      fanout_create(tcp_clients, client_buffer, server_client_evict, server_client_pending, NULL);
+    if (loop_ctx.write_handle.fanout == NULL) {
+      die_error("error creating TCP client fan out");
+    }
+  }
+
+  alt_sub_start();
+
+  return io_loop_finish();
+}
+
 int main(int argc, char *argv[])
 {
   logging_init(PROGRAM_NAME);
 
+#ifdef ENDPOINT_ADAPTER_STATIC_PROTOCOLS
+  /* Linked in protocols registered themselves before main() */
+  int import_result = protocols_register_builtin();
+#else
   const char *protocol_library_path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
   if (protocol_library_path == NULL) {
     protocol_library_path = PROTOCOL_LIBRARY_PATH_DEFAULT;
   }
 
-  if (protocols_import(protocol_library_path) != 0) {
+  int import_result = protocols_import(protocol_library_path);
+#endif
+
+  if (import_result != 0) {
     syslog(LOG_ERR, "error importing protocols");
     fprintf(stderr, "error importing protocols\n");
     exit(EXIT_FAILURE);
@@ -1174,8 +2474,8 @@ int main(int argc, char *argv[])
   } break;
 
   case IO_TCP_LISTEN: {
-    extern int tcp_listen_loop(int port);
-    ret = tcp_listen_loop(tcp_listen_port);
+    extern int tcp_listen_loop(int port, bool single_process);
+    ret = tcp_listen_loop(tcp_listen_port, tcp_clients > 0);
   } break;
 
   case IO_TCP_CONNECT: {
@@ -29,6 +29,7 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 enum {
   IO_LOOP_ERROR = -2,
@@ -38,6 +39,25 @@ enum {
 
 int io_loop_run(int read_fd, int write_fd);
 
+/* Serves every client accepted on listen_fd from this process */
+int io_loop_run_server(int listen_fd);
+
+/* Input and output that isn't an fd the loop can read and write itself, e.g.
+ * rings filled and drained by other threads. read_fd is polled and read() is
+ * called when it's readable, read() returns -1 with errno EAGAIN when there's
+ * nothing to read and 0 once input has ended. A NULL read() or writev() leaves
+ * that direction unused. */
+typedef struct {
+  int read_fd;
+  ssize_t (*read)(void *context, void *buffer, size_t count);
+  ssize_t (*writev)(void *context, const struct iovec *iov, int iov_count);
+  /* Counts input and output dropped since the last call, may be NULL */
+  void (*take_drops)(void *context, uint32_t *read_drops, uint32_t *write_drops);
+  void *context;
+} io_ops_t;
+
+int io_loop_run_ops(const io_ops_t *ops);
+
 extern bool debug;
 
 #define debug_printf(format, ...)                             \
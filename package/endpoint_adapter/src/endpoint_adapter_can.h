@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_CAN_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_CAN_H
+
+#include <stdint.h>
+
+#include "endpoint_adapter.h"
+
+/* Moves data between a CAN socket and the loop. A read thread and a write
+ * thread own the socket, frames are handed to and from the loop through
+ * preallocated single producer, single consumer rings, so no lock or syscall
+ * is taken per frame. A ring that fills up drops frames and counts them. */
+
+typedef struct can_bridge_s can_bridge_t;
+
+/**
+ * @param can_fd        bound, blocking CAN_RAW socket, not owned by the bridge
+ * @param can_id        standard id of the frames written
+ */
+can_bridge_t *can_bridge_start(int can_fd, uint32_t can_id);
+
+/* Stops and joins both threads */
+void can_bridge_stop(can_bridge_t **bridge);
+
+/* Reads return the data of the frames received, back to back, writes are cut
+ * into frames of up to 8 bytes. Valid until can_bridge_stop(). */
+const io_ops_t *can_bridge_ops(can_bridge_t *bridge);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_CAN_H */
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2018-2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <libpiksi/logging.h>
+
+#include "endpoint_adapter_can.h"
+#include "endpoint_adapter_dgram.h"
+#include "endpoint_adapter_spsc.h"
+
+#define CAN_SLEEP_NS 1000000 /* 1 millisecond */
+
+/* Frames held each way, 32 KiB of data */
+#define CAN_RING_FRAMES 4096
+
+struct can_bridge_s {
+  int can_fd;
+  uint32_t can_id;
+  spsc_t *rx; /**< Frames read, from the read thread to the loop */
+  spsc_t *tx; /**< Frames to write, from the loop to the write thread */
+  int stop_fd;
+  atomic_bool stopping;
+  atomic_bool ended;         /**< The read thread gave up, input ends once rx is empty */
+  atomic_uint write_dropped; /**< Frames the socket refused */
+  pthread_t read_thread;
+  pthread_t write_thread;
+  bool read_started;
+  bool write_started;
+  io_ops_t ops;
+};
+
+static void *can_read_thread_handler(void *arg)
+{
+  piksi_log(LOG_DEBUG, "CAN read thread starting...");
+  can_bridge_t *bridge = (can_bridge_t *)arg;
+
+  struct can_frame frames[DGRAM_BATCH_MAX];
+  size_t lengths[DGRAM_BATCH_MAX];
+  struct pollfd fds[] = {
+    {.fd = bridge->can_fd, .events = POLLIN},
+    {.fd = bridge->stop_fd, .events = POLLIN},
+  };
+
+  for (;;) {
+
+    if (poll(fds, 2, -1) < 0) {
+      /* Retry if interrupted */
+      if (errno == EINTR) continue;
+      PK_LOG_ANNO(LOG_WARNING, "poll failed: %s (%d)", strerror(errno), errno);
+      break;
+    }
+
+    if (fds[1].revents != 0) {
+      break;
+    }
+
+    /* Whatever the socket has queued, one syscall and one wake up of the
+     * loop for all of it */
+    int count = dgram_recv(bridge->can_fd,
+                           (uint8_t *)frames,
+                           sizeof(frames[0]),
+                           lengths,
+                           DGRAM_BATCH_MAX);
+    if (count < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) continue;
+      PK_LOG_ANNO(LOG_WARNING, "CAN read failed: %s (%d)", strerror(errno), errno);
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (lengths[i] != sizeof(frames[i]) || frames[i].can_dlc == 0) continue;
+      spsc_push(bridge->rx, &frames[i]);
+    }
+
+    if (count > 0) {
+      spsc_notify(bridge->rx);
+    }
+  }
+
+  if (!atomic_load(&bridge->stopping)) {
+    atomic_store(&bridge->ended, true);
+    spsc_notify(bridge->rx);
+  }
+
+  piksi_log(LOG_DEBUG, "CAN read thread stopping...");
+  return NULL;
+}
+
+static int can_write_frame(can_bridge_t *bridge, const struct can_frame *frame)
+{
+  for (;;) {
+
+    /* Never blocks, so a stop isn't held up by a bus that won't take frames */
+    ssize_t ret = send(bridge->can_fd, frame, sizeof(*frame), MSG_DONTWAIT);
+
+    if (ret == sizeof(*frame)) {
+      return 0;
+
+    } else if ((ret == -1) && (errno == EINTR)) {
+
+      /* Retry if interrupted */
+      continue;
+
+    } else if ((ret < 0) && ((errno == ENOBUFS) || (errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+
+      /* The device queue is full, wait for it to drain. Frames back up in
+       * the tx ring meanwhile and the ring drops them once it's full.
+       */
+
+      if (atomic_load(&bridge->stopping)) {
+        return -1;
+      }
+
+      nanosleep((const struct timespec[]){{0, CAN_SLEEP_NS}}, NULL);
+      continue;
+
+    } else {
+
+      PK_LOG_ANNO(LOG_WARNING, "CAN write failed: %s (%d)", strerror(errno), errno);
+      atomic_fetch_add(&bridge->write_dropped, 1);
+      return -1;
+    }
+  }
+}
+
+static void *can_write_thread_handler(void *arg)
+{
+  piksi_log(LOG_DEBUG, "CAN write thread starting...");
+  can_bridge_t *bridge = (can_bridge_t *)arg;
+
+  struct pollfd fds[] = {
+    {.fd = spsc_fd(bridge->tx), .events = POLLIN},
+    {.fd = bridge->stop_fd, .events = POLLIN},
+  };
+
+  for (;;) {
+
+    if (poll(fds, 2, -1) < 0) {
+      /* Retry if interrupted */
+      if (errno == EINTR) continue;
+      PK_LOG_ANNO(LOG_WARNING, "poll failed: %s (%d)", strerror(errno), errno);
+      break;
+    }
+
+    if (fds[1].revents != 0) {
+      break;
+    }
+
+    spsc_clear(bridge->tx);
+
+    struct can_frame frame;
+    while (spsc_pop(bridge->tx, &frame)) {
+      if (can_write_frame(bridge, &frame) != 0 && atomic_load(&bridge->stopping)) {
+        break;
+      }
+    }
+  }
+
+  piksi_log(LOG_DEBUG, "CAN write thread stopping...");
+  return NULL;
+}
+
+/* Runs on the loop, the data of as many received frames as fit in buffer */
+static ssize_t can_ring_read(void *context, void *buffer, size_t count)
+{
+  can_bridge_t *bridge = (can_bridge_t *)context;
+  uint8_t *data = (uint8_t *)buffer;
+
+  /* Read before draining, anything pushed before the read thread ended is
+   * then drained below */
+  bool ended = atomic_load(&bridge->ended);
+
+  spsc_clear(bridge->rx);
+
+  size_t length = 0;
+  struct can_frame frame;
+  while (count - length >= CAN_MAX_DLEN) {
+    if (!spsc_pop(bridge->rx, &frame)) {
+      break;
+    }
+    size_t dlc = (frame.can_dlc < CAN_MAX_DLEN) ? frame.can_dlc : CAN_MAX_DLEN;
+    memcpy(&data[length], frame.data, dlc);
+    length += dlc;
+  }
+
+  if (count - length < CAN_MAX_DLEN) {
+    /* Stopped short of the end of the ring, come back for the rest */
+    spsc_notify(bridge->rx);
+  }
+
+  if (length == 0) {
+    if (ended) {
+      return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return length;
+}
+
+/* Runs on the loop, cuts each iovec into frames */
+static ssize_t can_ring_writev(void *context, const struct iovec *iov, int iov_count)
+{
+  can_bridge_t *bridge = (can_bridge_t *)context;
+
+  size_t count = 0;
+  for (int i = 0; i < iov_count; i++) {
+    const uint8_t *data = (const uint8_t *)iov[i].iov_base;
+    size_t offset = 0;
+    while (offset < iov[i].iov_len) {
+      struct can_frame frame = {0};
+      frame.can_id = bridge->can_id & CAN_SFF_MASK;
+      frame.can_dlc = CAN_MAX_DLEN;
+      if (iov[i].iov_len - offset < frame.can_dlc) {
+        frame.can_dlc = iov[i].iov_len - offset;
+      }
+      memcpy(frame.data, &data[offset], frame.can_dlc);
+      /* Dropped and counted by the ring if the write thread is behind */
+      spsc_push(bridge->tx, &frame);
+      offset += frame.can_dlc;
+    }
+    count += iov[i].iov_len;
+  }
+
+  if (count > 0) {
+    spsc_notify(bridge->tx);
+  }
+
+  return count;
+}
+
+static void can_ring_take_drops(void *context, uint32_t *read_drops, uint32_t *write_drops)
+{
+  can_bridge_t *bridge = (can_bridge_t *)context;
+
+  *read_drops = spsc_take_drops(bridge->rx);
+  *write_drops = spsc_take_drops(bridge->tx) + atomic_exchange(&bridge->write_dropped, 0);
+}
+
+can_bridge_t *can_bridge_start(int can_fd, uint32_t can_id)
+{
+  can_bridge_t *bridge = calloc(1, sizeof(*bridge));
+  if (bridge == NULL) {
+    return NULL;
+  }
+
+  bridge->can_fd = can_fd;
+  bridge->can_id = can_id;
+  bridge->stop_fd = eventfd(0, EFD_CLOEXEC);
+  atomic_init(&bridge->stopping, false);
+  atomic_init(&bridge->ended, false);
+  atomic_init(&bridge->write_dropped, 0);
+
+  bridge->rx = spsc_create(CAN_RING_FRAMES, sizeof(struct can_frame));
+  bridge->tx = spsc_create(CAN_RING_FRAMES, sizeof(struct can_frame));
+
+  if (bridge->stop_fd < 0 || bridge->rx == NULL || bridge->tx == NULL) {
+    piksi_log(LOG_ERR, "failed to create CAN rings");
+    can_bridge_stop(&bridge);
+    return NULL;
+  }
+
+  bridge->ops = (io_ops_t){
+    .read_fd = spsc_fd(bridge->rx),
+    .read = can_ring_read,
+    .writev = can_ring_writev,
+    .take_drops = can_ring_take_drops,
+    .context = bridge,
+  };
+
+  bridge->read_started =
+    pthread_create(&bridge->read_thread, NULL, can_read_thread_handler, bridge) == 0;
+  bridge->write_started =
+    pthread_create(&bridge->write_thread, NULL, can_write_thread_handler, bridge) == 0;
+
+  if (!bridge->read_started || !bridge->write_started) {
+    piksi_log(LOG_ERR, "failed to start CAN threads");
+    can_bridge_stop(&bridge);
+    return NULL;
+  }
+
+  return bridge;
+}
+
+void can_bridge_stop(can_bridge_t **bridge_loc)
+{
+  if (bridge_loc == NULL || *bridge_loc == NULL) {
+    return;
+  }
+  can_bridge_t *bridge = *bridge_loc;
+
+  atomic_store(&bridge->stopping, true);
+  if (bridge->stop_fd >= 0) {
+    uint64_t one = 1;
+    while (write(bridge->stop_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+
+  if (bridge->read_started) pthread_join(bridge->read_thread, NULL);
+  if (bridge->write_started) pthread_join(bridge->write_thread, NULL);
+
+  spsc_destroy(&bridge->rx);
+  spsc_destroy(&bridge->tx);
+  if (bridge->stop_fd >= 0) close(bridge->stop_fd);
+
+  free(bridge);
+  *bridge_loc = NULL;
+}
+
+const io_ops_t *can_bridge_ops(can_bridge_t *bridge)
+{
+  return &bridge->ops;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+
+#include "endpoint_adapter_classify.h"
+
+#define MSG_TYPE_COUNT (65536)
+#define MSG_TYPE_WORDS (MSG_TYPE_COUNT / 32)
+
+typedef int (*msg_type_fn_t)(const uint8_t *frame, size_t length);
+
+struct classifier_s {
+  uint32_t *class_map[FRAME_CLASS_COUNT]; /**< Bitmaps of msg types, normal is implicit */
+  msg_type_fn_t msg_type_fn;
+};
+
+static int sbp_msg_type(const uint8_t *frame, size_t length)
+{
+  if (length < 3) return -1;
+  return frame[1] | (frame[2] << 8);
+}
+
+static int rtcm3_msg_type(const uint8_t *frame, size_t length)
+{
+  if (length < 5) return -1;
+  return (frame[3] << 4) | (frame[4] >> 4);
+}
+
+classifier_t *classifier_create(const char *protocol)
+{
+  classifier_t *classifier = calloc(1, sizeof(*classifier));
+  if (classifier == NULL) {
+    return NULL;
+  }
+
+  if (strcasecmp(protocol, "sbp") == 0) {
+    classifier->msg_type_fn = sbp_msg_type;
+  } else if (strcasecmp(protocol, "rtcm3") == 0) {
+    classifier->msg_type_fn = rtcm3_msg_type;
+  }
+
+  return classifier;
+}
+
+void classifier_destroy(classifier_t **classifier)
+{
+  for (int cls = 0; cls < FRAME_CLASS_COUNT; cls++) {
+    free((*classifier)->class_map[cls]);
+  }
+  free(*classifier);
+  *classifier = NULL;
+}
+
+int classifier_set(classifier_t *classifier, frame_class_t cls, const char *msg_types)
+{
+  if (classifier->class_map[cls] == NULL) {
+    classifier->class_map[cls] = calloc(MSG_TYPE_WORDS, sizeof(uint32_t));
+    if (classifier->class_map[cls] == NULL) {
+      return -1;
+    }
+  }
+
+  const char *c = msg_types;
+  while (*c != '\0') {
+    char *end;
+    unsigned long msg_type = strtoul(c, &end, 10);
+    if (end == c || msg_type >= MSG_TYPE_COUNT || (*end != ',' && *end != '\0')) {
+      return -1;
+    }
+    classifier->class_map[cls][msg_type / 32] |= 1u << (msg_type % 32);
+    c = (*end == ',') ? end + 1 : end;
+  }
+
+  return 0;
+}
+
+frame_class_t classifier_classify(const classifier_t *classifier,
+                                  const uint8_t *frame,
+                                  size_t length)
+{
+  if (classifier == NULL || classifier->msg_type_fn == NULL) return FRAME_CLASS_NORMAL;
+
+  int msg_type = classifier->msg_type_fn(frame, length);
+  if (msg_type < 0) return FRAME_CLASS_NORMAL;
+
+  for (int cls = 0; cls < FRAME_CLASS_COUNT; cls++) {
+    uint32_t *map = classifier->class_map[cls];
+    if (map != NULL && (map[msg_type / 32] & (1u << (msg_type % 32)))) {
+      return (frame_class_t)cls;
+    }
+  }
+  return FRAME_CLASS_NORMAL;
+}
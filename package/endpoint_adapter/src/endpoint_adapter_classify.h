@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_CLASSIFY_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_CLASSIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Priority classes of output frames, picked by message type. Used by the
+ * shaper and the send queue to decide what goes first and what is dropped. */
+
+typedef enum {
+  FRAME_CLASS_HIGH,
+  FRAME_CLASS_NORMAL,
+  FRAME_CLASS_LOW,
+  FRAME_CLASS_COUNT,
+} frame_class_t;
+
+typedef struct classifier_s classifier_t;
+
+/**
+ * @param protocol      framer name, selects how message types are read from
+ *                      frames ("sbp" or "rtcm3", others are all normal)
+ */
+classifier_t *classifier_create(const char *protocol);
+void classifier_destroy(classifier_t **classifier);
+
+/* Assign a comma separated list of decimal message types to a class */
+int classifier_set(classifier_t *classifier, frame_class_t cls, const char *msg_types);
+
+frame_class_t classifier_classify(const classifier_t *classifier,
+                                  const uint8_t *frame,
+                                  size_t length);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_CLASSIFY_H */
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "endpoint_adapter_classq.h"
+
+/* Records of one class, stored back to back as <length><data> in a ring */
+typedef struct {
+  uint8_t *buf;
+  uint32_t head;
+  uint32_t used;
+} ring_t;
+
+struct classq_s {
+  uint32_t size;
+  uint32_t record_max;
+  bool drop_queued;
+  uint32_t queued;
+  ring_t rings[FRAME_CLASS_COUNT];
+  classq_drops_t drops;
+};
+
+static void ring_put(const classq_t *classq, ring_t *ring, const uint8_t *data, uint32_t length)
+{
+  uint32_t tail = (ring->head + ring->used) % classq->size;
+  uint32_t first = classq->size - tail < length ? classq->size - tail : length;
+  memcpy(&ring->buf[tail], data, first);
+  memcpy(ring->buf, &data[first], length - first);
+  ring->used += length;
+}
+
+/* Copies length bytes starting offset bytes past pos */
+static void ring_copy(const classq_t *classq,
+                      const ring_t *ring,
+                      uint32_t pos,
+                      uint32_t offset,
+                      uint8_t *data,
+                      uint32_t length)
+{
+  uint32_t start = (pos + offset) % classq->size;
+  uint32_t first = classq->size - start < length ? classq->size - start : length;
+  memcpy(data, &ring->buf[start], first);
+  memcpy(&data[first], ring->buf, length - first);
+}
+
+static uint32_t ring_length_at(const classq_t *classq, const ring_t *ring, uint32_t pos)
+{
+  uint8_t header[CLASSQ_RECORD_HEADER];
+  ring_copy(classq, ring, pos, 0, header, CLASSQ_RECORD_HEADER);
+  return (uint32_t)header[0] | ((uint32_t)header[1] << 8) | ((uint32_t)header[2] << 16)
+         | ((uint32_t)header[3] << 24);
+}
+
+static void classq_drop(classq_t *classq, frame_class_t cls, uint32_t length)
+{
+  classq->drops.frames[cls]++;
+  classq->drops.bytes[cls] += length;
+}
+
+classq_t *classq_create(uint32_t size, uint32_t record_max, bool drop_queued)
+{
+  if (size <= CLASSQ_RECORD_HEADER) {
+    return NULL;
+  }
+
+  classq_t *classq = calloc(1, sizeof(*classq));
+  if (classq == NULL) {
+    return NULL;
+  }
+
+  classq->size = size;
+  classq->record_max =
+    (record_max < size - CLASSQ_RECORD_HEADER) ? record_max : size - CLASSQ_RECORD_HEADER;
+  classq->drop_queued = drop_queued;
+
+  return classq;
+}
+
+void classq_destroy(classq_t **classq_loc)
+{
+  if (classq_loc == NULL || *classq_loc == NULL) {
+    return;
+  }
+  classq_t *classq = *classq_loc;
+  for (int cls = 0; cls < FRAME_CLASS_COUNT; cls++) {
+    free(classq->rings[cls].buf);
+  }
+  free(classq);
+  *classq_loc = NULL;
+}
+
+void classq_put(classq_t *classq, frame_class_t cls, const uint8_t *data, uint32_t length)
+{
+  uint32_t need = length + CLASSQ_RECORD_HEADER;
+  ring_t *ring = &classq->rings[cls];
+
+  if (length > classq->record_max) {
+    classq_drop(classq, cls, length);
+    return;
+  }
+
+  /* A class's ring is allocated once it is first used */
+  if (ring->buf == NULL) {
+    ring->buf = malloc(classq->size);
+    if (ring->buf == NULL) {
+      classq_drop(classq, cls, length);
+      return;
+    }
+  }
+
+  /* Make room by dropping the oldest records of the lowest class, never of a
+   * class above the new record's */
+  while (classq->queued + need > classq->size) {
+    int victim = FRAME_CLASS_COUNT - 1;
+    while (victim > (int)cls && classq->rings[victim].used == 0) {
+      victim--;
+    }
+    if (!classq->drop_queued || classq->rings[victim].used == 0) {
+      classq_drop(classq, cls, length);
+      return;
+    }
+    classq_drop(classq, (frame_class_t)victim, classq_pop(classq, (frame_class_t)victim));
+  }
+
+  uint8_t header[CLASSQ_RECORD_HEADER] = {(uint8_t)(length & 0xFF),
+                                          (uint8_t)((length >> 8) & 0xFF),
+                                          (uint8_t)((length >> 16) & 0xFF),
+                                          (uint8_t)(length >> 24)};
+  ring_put(classq, ring, header, CLASSQ_RECORD_HEADER);
+  ring_put(classq, ring, data, length);
+  classq->queued += need;
+}
+
+bool classq_empty(const classq_t *classq)
+{
+  return classq->queued == 0;
+}
+
+uint32_t classq_queued(const classq_t *classq)
+{
+  return classq->queued;
+}
+
+frame_class_t classq_front_class(const classq_t *classq)
+{
+  int cls = FRAME_CLASS_HIGH;
+  while (cls < FRAME_CLASS_COUNT && classq->rings[cls].used == 0) {
+    cls++;
+  }
+  return (frame_class_t)cls;
+}
+
+uint32_t classq_front_length(const classq_t *classq, frame_class_t cls)
+{
+  const ring_t *ring = &classq->rings[cls];
+  return ring_length_at(classq, ring, ring->head);
+}
+
+void classq_front_copy(const classq_t *classq,
+                       frame_class_t cls,
+                       uint32_t offset,
+                       uint8_t *data,
+                       uint32_t length)
+{
+  const ring_t *ring = &classq->rings[cls];
+  ring_copy(classq, ring, ring->head, CLASSQ_RECORD_HEADER + offset, data, length);
+}
+
+uint32_t classq_pop(classq_t *classq, frame_class_t cls)
+{
+  ring_t *ring = &classq->rings[cls];
+  uint32_t length = ring_length_at(classq, ring, ring->head);
+  uint32_t stored = length + CLASSQ_RECORD_HEADER;
+  ring->head = (ring->head + stored) % classq->size;
+  ring->used -= stored;
+  classq->queued -= stored;
+  return length;
+}
+
+int classq_gather(const classq_t *classq, struct iovec *iov, int iov_max)
+{
+  int iov_count = 0;
+  for (int cls = FRAME_CLASS_HIGH; cls < FRAME_CLASS_COUNT; cls++) {
+    const ring_t *ring = &classq->rings[cls];
+    uint32_t pos = ring->head;
+    uint32_t remaining = ring->used;
+    while (remaining > 0 && iov_count <= iov_max - 2) {
+      uint32_t length = ring_length_at(classq, ring, pos);
+      uint32_t start = (pos + CLASSQ_RECORD_HEADER) % classq->size;
+      uint32_t first = classq->size - start < length ? classq->size - start : length;
+      iov[iov_count++] = (struct iovec){.iov_base = &ring->buf[start], .iov_len = first};
+      if (first < length) {
+        iov[iov_count++] = (struct iovec){.iov_base = ring->buf, .iov_len = length - first};
+      }
+      pos = (pos + CLASSQ_RECORD_HEADER + length) % classq->size;
+      remaining -= CLASSQ_RECORD_HEADER + length;
+    }
+  }
+  return iov_count;
+}
+
+void classq_take_drops(classq_t *classq, classq_drops_t *drops)
+{
+  *drops = classq->drops;
+  memset(&classq->drops, 0, sizeof(classq->drops));
+}
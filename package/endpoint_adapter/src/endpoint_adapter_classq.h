@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_CLASSQ_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_CLASSQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "endpoint_adapter_classify.h"
+
+/* Records queued by priority class against one byte budget, shared by the
+ * shaper and the send queue. Each class is a ring of <length><data> records,
+ * records are only ever added, dropped or removed whole. */
+
+/* Bytes stored ahead of each record, counted against the budget */
+#define CLASSQ_RECORD_HEADER (4)
+
+typedef struct classq_s classq_t;
+
+/* Dropped records per class since the last classq_take_drops() */
+typedef struct {
+  uint32_t frames[FRAME_CLASS_COUNT];
+  uint32_t bytes[FRAME_CLASS_COUNT];
+} classq_drops_t;
+
+/**
+ * @param size          bytes of records held, headers included, across all
+ *                      classes. Any one class may use all of it, so each
+ *                      class is given a ring of this size when it is first
+ *                      used: up to FRAME_CLASS_COUNT times size is allocated.
+ * @param record_max    longest record that is queued, longer ones are dropped
+ * @param drop_queued   make room for a new record by dropping the oldest
+ *                      records of the lowest class, never of a class above the
+ *                      new record's; otherwise the new record is dropped
+ */
+classq_t *classq_create(uint32_t size, uint32_t record_max, bool drop_queued);
+void classq_destroy(classq_t **classq);
+
+void classq_put(classq_t *classq, frame_class_t cls, const uint8_t *data, uint32_t length);
+
+bool classq_empty(const classq_t *classq);
+/* Bytes held, headers included */
+uint32_t classq_queued(const classq_t *classq);
+
+/* Highest class holding records, FRAME_CLASS_COUNT if there are none */
+frame_class_t classq_front_class(const classq_t *classq);
+/* Length of the oldest record of a class, which must hold records */
+uint32_t classq_front_length(const classq_t *classq, frame_class_t cls);
+/* Copies length bytes of the oldest record of a class, from offset on */
+void classq_front_copy(const classq_t *classq,
+                       frame_class_t cls,
+                       uint32_t offset,
+                       uint8_t *data,
+                       uint32_t length);
+/* Removes the oldest record of a class, returns its length */
+uint32_t classq_pop(classq_t *classq, frame_class_t cls);
+
+/* Points iov at queued records in place, highest class first and oldest
+ * first within a class, returns the number of iovecs used. A record that
+ * wraps around its ring takes two. */
+int classq_gather(const classq_t *classq, struct iovec *iov, int iov_max);
+
+void classq_take_drops(classq_t *classq, classq_drops_t *drops);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_CLASSQ_H */
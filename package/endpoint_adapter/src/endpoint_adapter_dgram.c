@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* recvmmsg() and sendmmsg() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "endpoint_adapter_dgram.h"
+
+/* Queued datagrams are stored back to back in one buffer */
+#define DGRAM_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+} dgram_t;
+
+struct dgram_batch_s {
+  uint32_t pack_size;
+  uint32_t used;
+  uint32_t count;
+  uint32_t frames;
+  /* The last datagram is still open for more frames */
+  bool open;
+  dgram_t dgrams[DGRAM_BATCH_MAX];
+  uint8_t buffer[DGRAM_BUFFER_SIZE];
+};
+
+/* Cleared the first time the kernel reports ENOSYS, each datagram then takes
+ * a syscall of its own */
+static bool recvmmsg_supported = true;
+static bool sendmmsg_supported = true;
+
+/* recvmmsg()/sendmmsg() stand ins, a single datagram per call */
+static int recvmmsg_single(int fd, struct mmsghdr *msgs)
+{
+  ssize_t ret = recvmsg(fd, &msgs[0].msg_hdr, 0);
+  if (ret < 0) {
+    return -1;
+  }
+  msgs[0].msg_len = (unsigned int)ret;
+  return 1;
+}
+
+static int sendmmsg_single(int fd, struct mmsghdr *msgs)
+{
+  ssize_t ret = sendmsg(fd, &msgs[0].msg_hdr, 0);
+  if (ret < 0) {
+    return -1;
+  }
+  msgs[0].msg_len = (unsigned int)ret;
+  return 1;
+}
+
+bool dgram_fd_is_datagram(int fd)
+{
+  int type;
+  socklen_t length = sizeof(type);
+  if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) != 0) {
+    return false;
+  }
+  return type == SOCK_DGRAM;
+}
+
+int dgram_recv(int fd, uint8_t *buffers, size_t size, size_t *lengths, uint32_t count)
+{
+  struct mmsghdr msgs[DGRAM_BATCH_MAX];
+  struct iovec iov[DGRAM_BATCH_MAX];
+
+  if (count > DGRAM_BATCH_MAX) count = DGRAM_BATCH_MAX;
+
+  memset(msgs, 0, sizeof(msgs[0]) * count);
+  for (uint32_t i = 0; i < count; i++) {
+    iov[i] = (struct iovec){.iov_base = &buffers[i * size], .iov_len = size};
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  for (;;) {
+    /* Only the first datagram is waited for, the rest are whatever is
+     * already queued on the socket */
+    int ret = recvmmsg_supported ? recvmmsg(fd, msgs, count, MSG_WAITFORONE, NULL)
+                                 : recvmmsg_single(fd, msgs);
+    /* Retry if interrupted */
+    if ((ret == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if ((ret == -1) && (errno == ENOSYS) && recvmmsg_supported) {
+      recvmmsg_supported = false;
+      continue;
+    }
+    for (int i = 0; i < ret; i++) {
+      lengths[i] = msgs[i].msg_len;
+    }
+    return ret;
+  }
+}
+
+dgram_batch_t *dgram_batch_create(uint32_t pack_size)
+{
+  if (pack_size > DGRAM_SIZE_MAX) {
+    return NULL;
+  }
+
+  dgram_batch_t *batch = calloc(1, sizeof(dgram_batch_t));
+  if (batch == NULL) {
+    return NULL;
+  }
+
+  batch->pack_size = pack_size;
+  return batch;
+}
+
+void dgram_batch_destroy(dgram_batch_t **batch_loc)
+{
+  if (batch_loc == NULL || *batch_loc == NULL) {
+    return;
+  }
+  free(*batch_loc);
+  *batch_loc = NULL;
+}
+
+bool dgram_batch_empty(const dgram_batch_t *batch)
+{
+  return batch->count == 0;
+}
+
+int dgram_batch_add(dgram_batch_t *batch, const uint8_t *frame, size_t length)
+{
+  if (length > DGRAM_BUFFER_SIZE - batch->used) {
+    return -1;
+  }
+
+  dgram_t *last = (batch->count > 0) ? &batch->dgrams[batch->count - 1] : NULL;
+
+  /* A frame is never split, one larger than pack_size goes on its own */
+  if (batch->open && last != NULL && last->length + length <= batch->pack_size) {
+    last->length += (uint32_t)length;
+  } else {
+    if (batch->count == DGRAM_BATCH_MAX) {
+      return -1;
+    }
+    batch->dgrams[batch->count++] =
+      (dgram_t){.offset = batch->used, .length = (uint32_t)length};
+  }
+
+  memcpy(&batch->buffer[batch->used], frame, length);
+  batch->used += (uint32_t)length;
+  batch->frames++;
+  batch->open = batch->pack_size > 0;
+
+  return 0;
+}
+
+static void dgram_batch_reset(dgram_batch_t *batch)
+{
+  batch->used = 0;
+  batch->count = 0;
+  batch->frames = 0;
+  batch->open = false;
+}
+
+ssize_t dgram_batch_flush(dgram_batch_t *batch, int fd, dgram_stats_t *stats)
+{
+  struct mmsghdr msgs[DGRAM_BATCH_MAX];
+  struct iovec iov[DGRAM_BATCH_MAX];
+
+  memset(msgs, 0, sizeof(msgs[0]) * batch->count);
+  for (uint32_t i = 0; i < batch->count; i++) {
+    iov[i] = (struct iovec){.iov_base = &batch->buffer[batch->dgrams[i].offset],
+                            .iov_len = batch->dgrams[i].length};
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t bytes = 0;
+  uint32_t sent = 0;
+  while (sent < batch->count) {
+    int ret = sendmmsg_supported ? sendmmsg(fd, &msgs[sent], batch->count - sent, 0)
+                                 : sendmmsg_single(fd, &msgs[sent]);
+    /* Retry if interrupted */
+    if ((ret == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if ((ret == -1) && (errno == ENOSYS) && sendmmsg_supported) {
+      sendmmsg_supported = false;
+      continue;
+    }
+    if ((ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      /* Datagrams are sent whole or not at all, drop what's left */
+      break;
+    }
+    if (ret < 0) {
+      dgram_batch_reset(batch);
+      return -1;
+    }
+    stats->syscalls++;
+    for (int i = 0; i < ret; i++) {
+      bytes += msgs[sent + (uint32_t)i].msg_len;
+    }
+    sent += (uint32_t)ret;
+  }
+
+  stats->datagrams += sent;
+  stats->frames += (sent == batch->count) ? batch->frames : 0;
+  stats->bytes += (uint32_t)bytes;
+
+  dgram_batch_reset(batch);
+  return (ssize_t)bytes;
+}
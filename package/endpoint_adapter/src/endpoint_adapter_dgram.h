@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_DGRAM_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_DGRAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Batched datagram IO: many datagrams per recvmmsg()/sendmmsg() call, and
+ * optionally several frames packed into each outgoing datagram. */
+
+/* Most datagrams moved by one syscall */
+#define DGRAM_BATCH_MAX 32
+
+/* Largest UDP payload over IPv4 */
+#define DGRAM_SIZE_MAX 65507
+
+typedef struct dgram_batch_s dgram_batch_t;
+
+/* Counts of what a flush sent, added to on every call */
+typedef struct {
+  uint32_t syscalls;
+  uint32_t datagrams;
+  uint32_t frames;
+  uint32_t bytes;
+} dgram_stats_t;
+
+bool dgram_fd_is_datagram(int fd);
+
+/* Receives up to count datagrams with one recvmmsg(), datagram i is stored at
+ * buffers + i * size, longer ones are truncated. Returns the number of
+ * datagrams received or -1 on error. */
+int dgram_recv(int fd, uint8_t *buffers, size_t size, size_t *lengths, uint32_t count);
+
+/* pack_size is the largest datagram frames are packed into, 0 sends every
+ * frame as a datagram of its own */
+dgram_batch_t *dgram_batch_create(uint32_t pack_size);
+void dgram_batch_destroy(dgram_batch_t **batch);
+
+/* Copies a frame into the batch, returns -1 if it doesn't fit until the
+ * batch is flushed, or at all if the batch is already empty */
+int dgram_batch_add(dgram_batch_t *batch, const uint8_t *frame, size_t length);
+
+bool dgram_batch_empty(const dgram_batch_t *batch);
+
+/* Sends every queued datagram, returns the bytes sent or -1 on error, in
+ * which case the batch is discarded */
+ssize_t dgram_batch_flush(dgram_batch_t *batch, int fd, dgram_stats_t *stats);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_DGRAM_H */
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "endpoint_adapter_fanout.h"
+#include "endpoint_adapter_io.h"
+
+/* Pending output of one client, a ring of buffer_size bytes */
+typedef struct {
+  int fd;
+  uint8_t *buf;
+  uint32_t head;
+  uint32_t used;
+  bool pending; /**< Last state passed to pending_fn */
+} client_t;
+
+struct fanout_s {
+  uint32_t clients_max;
+  uint32_t client_count;
+  uint32_t buffer_size;
+  uint32_t evictions;
+  fanout_evict_fn_t evict_fn;
+  fanout_pending_fn_t pending_fn;
+  void *context;
+  client_t *clients;
+};
+
+/* Returns -1 if the client is gone */
+static int client_flush(fanout_t *fanout, client_t *client)
+{
+  while (client->used > 0) {
+    uint32_t first = fanout->buffer_size - client->head;
+    if (first > client->used) first = client->used;
+    struct iovec iov[2] = {
+      {.iov_base = &client->buf[client->head], .iov_len = first},
+      {.iov_base = client->buf, .iov_len = client->used - first},
+    };
+
+    ssize_t ret = io_writev_nonblock(client->fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+    if (ret < 0) {
+      return -1;
+    }
+    if (ret == 0) {
+      break;
+    }
+    client->head = (uint32_t)((client->head + (size_t)ret) % fanout->buffer_size);
+    client->used -= (uint32_t)ret;
+  }
+  if (client->used == 0) {
+    client->head = 0;
+  }
+  return 0;
+}
+
+/* Copy iov into the client's ring, skipping the first `skip` bytes */
+static void client_buffer(fanout_t *fanout,
+                          client_t *client,
+                          const struct iovec *iov,
+                          int iov_count,
+                          size_t skip)
+{
+  for (int i = 0; i < iov_count; i++) {
+    const uint8_t *data = iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+    if (skip >= length) {
+      skip -= length;
+      continue;
+    }
+    data += skip;
+    length -= skip;
+    skip = 0;
+
+    while (length > 0) {
+      uint32_t tail = (client->head + client->used) % fanout->buffer_size;
+      size_t chunk = fanout->buffer_size - tail;
+      if (chunk > length) chunk = length;
+      memcpy(&client->buf[tail], data, chunk);
+      client->used += (uint32_t)chunk;
+      data += chunk;
+      length -= chunk;
+    }
+  }
+}
+
+static void client_pending_update(fanout_t *fanout, client_t *client)
+{
+  bool pending = (client->used > 0);
+  if (pending != client->pending) {
+    client->pending = pending;
+    fanout->pending_fn(client->fd, pending, fanout->context);
+  }
+}
+
+static void client_evict(fanout_t *fanout, uint32_t index)
+{
+  int fd = fanout->clients[index].fd;
+
+  free(fanout->clients[index].buf);
+  fanout->clients[index] = fanout->clients[--fanout->client_count];
+  fanout->evictions++;
+
+  fanout->evict_fn(fd, fanout->context);
+}
+
+fanout_t *fanout_create(uint32_t clients_max,
+                        uint32_t buffer_size,
+                        fanout_evict_fn_t evict_fn,
+                        fanout_pending_fn_t pending_fn,
+                        void *context)
+{
+  if (clients_max == 0 || buffer_size == 0 || evict_fn == NULL || pending_fn == NULL) {
+    return NULL;
+  }
+
+  fanout_t *fanout = calloc(1, sizeof(fanout_t));
+  if (fanout == NULL) {
+    return NULL;
+  }
+
+  fanout->clients = calloc(clients_max, sizeof(client_t));
+  if (fanout->clients == NULL) {
+    free(fanout);
+    return NULL;
+  }
+
+  fanout->clients_max = clients_max;
+  fanout->buffer_size = buffer_size;
+  fanout->evict_fn = evict_fn;
+  fanout->pending_fn = pending_fn;
+  fanout->context = context;
+
+  return fanout;
+}
+
+void fanout_destroy(fanout_t **fanout_loc)
+{
+  if (fanout_loc == NULL || *fanout_loc == NULL) {
+    return;
+  }
+  fanout_t *fanout = *fanout_loc;
+  for (uint32_t i = 0; i < fanout->client_count; i++) {
+    free(fanout->clients[i].buf);
+  }
+  free(fanout->clients);
+  free(fanout);
+  *fanout_loc = NULL;
+}
+
+int fanout_client_add(fanout_t *fanout, int fd)
+{
+  if (fanout->client_count == fanout->clients_max) {
+    return -1;
+  }
+
+  uint8_t *buf = malloc(fanout->buffer_size);
+  if (buf == NULL) {
+    return -1;
+  }
+
+  fanout->clients[fanout->client_count++] = (client_t){.fd = fd, .buf = buf};
+  return 0;
+}
+
+void fanout_client_remove(fanout_t *fanout, int fd)
+{
+  for (uint32_t i = 0; i < fanout->client_count; i++) {
+    if (fanout->clients[i].fd == fd) {
+      free(fanout->clients[i].buf);
+      fanout->clients[i] = fanout->clients[--fanout->client_count];
+      return;
+    }
+  }
+}
+
+uint32_t fanout_client_count(const fanout_t *fanout)
+{
+  return fanout->client_count;
+}
+
+void fanout_write(fanout_t *fanout, const struct iovec *iov, int iov_count)
+{
+  size_t count = 0;
+  for (int i = 0; i < iov_count; i++) {
+    count += iov[i].iov_len;
+  }
+
+  /* Backwards, eviction moves the last client into the evicted slot */
+  for (uint32_t i = fanout->client_count; i-- > 0;) {
+    client_t *client = &fanout->clients[i];
+
+    if (client_flush(fanout, client) != 0) {
+      client_evict(fanout, i);
+      continue;
+    }
+
+    /* Only write directly if nothing is queued ahead of this data */
+    size_t written = 0;
+    if (client->used == 0) {
+      ssize_t ret = io_writev_nonblock(client->fd, iov, iov_count);
+      if (ret < 0) {
+        client_evict(fanout, i);
+        continue;
+      }
+      written = (size_t)ret;
+    }
+
+    if (count - written > fanout->buffer_size - client->used) {
+      client_evict(fanout, i);
+      continue;
+    }
+
+    client_buffer(fanout, client, iov, iov_count, written);
+    client_pending_update(fanout, client);
+  }
+}
+
+void fanout_client_flush(fanout_t *fanout, int fd)
+{
+  for (uint32_t i = 0; i < fanout->client_count; i++) {
+    client_t *client = &fanout->clients[i];
+    if (client->fd != fd) {
+      continue;
+    }
+    if (client_flush(fanout, client) != 0) {
+      client_evict(fanout, i);
+      return;
+    }
+    client_pending_update(fanout, client);
+    return;
+  }
+}
+
+uint32_t fanout_take_evictions(fanout_t *fanout)
+{
+  uint32_t evictions = fanout->evictions;
+  fanout->evictions = 0;
+  return evictions;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_FANOUT_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_FANOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Output fan out: the same bytes are written to many non-blocking client fds.
+ * Whatever a client can't take right away is held in a buffer of its own and
+ * written once the fd is writable again, a client that falls a whole buffer
+ * behind is evicted rather than holding up the others. */
+
+typedef struct fanout_s fanout_t;
+
+/* Called after a client has been dropped from the fan out, owns closing fd */
+typedef void (*fanout_evict_fn_t)(int fd, void *context);
+/* Called when a client's buffer starts or stops holding data, fd should be
+ * polled for writability while it does */
+typedef void (*fanout_pending_fn_t)(int fd, bool pending, void *context);
+
+fanout_t *fanout_create(uint32_t clients_max,
+                        uint32_t buffer_size,
+                        fanout_evict_fn_t evict_fn,
+                        fanout_pending_fn_t pending_fn,
+                        void *context);
+void fanout_destroy(fanout_t **fanout);
+
+int fanout_client_add(fanout_t *fanout, int fd);
+/* Does nothing if fd is not a client, e.g. it was already evicted */
+void fanout_client_remove(fanout_t *fanout, int fd);
+uint32_t fanout_client_count(const fanout_t *fanout);
+
+/* Write to every client, buffering what doesn't go out straight away */
+void fanout_write(fanout_t *fanout, const struct iovec *iov, int iov_count);
+
+/* Write what a client has buffered, call once fd is writable */
+void fanout_client_flush(fanout_t *fanout, int fd);
+
+/* Clients evicted since the last call */
+uint32_t fanout_take_evictions(fanout_t *fanout);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_FANOUT_H */
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <errno.h>
+
+#include "endpoint_adapter_io.h"
+
+ssize_t io_writev_nonblock(int fd, const struct iovec *iov, int iov_count)
+{
+  for (;;) {
+    ssize_t ret = writev(fd, iov, iov_count);
+    /* Retry if interrupted */
+    if ((ret == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if ((ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      return 0;
+    }
+    return ret;
+  }
+}
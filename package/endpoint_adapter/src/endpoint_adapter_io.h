@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_IO_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* writev() to a non-blocking fd, retried if interrupted. Returns the number
+ * of bytes written, 0 if the fd can't take any right now, or -1 on error. */
+ssize_t io_writev_nonblock(int fd, const struct iovec *iov, int iov_count);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_IO_H */
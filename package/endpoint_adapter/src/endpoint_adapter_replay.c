@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libpiksi/framer.h>
+#include <libpiksi/loop.h>
+
+#include "endpoint_adapter_replay.h"
+
+#define REPLAY_BUFFER_SIZE (4 * 1024)
+/* Largest SBP frame: header, 255 byte payload and CRC */
+#define REPLAY_FRAME_MAX (6 + 255 + 2)
+/* A jump in log time larger than this, or backwards, restarts the schedule
+ * rather than stalling the replay or bursting through the gap */
+#define REPLAY_GAP_MAX_MS (10 * 1000)
+/* Released this much after its time a frame counts as late, the loop clock
+ * has whole ms so a timer commonly fires a ms after it was due */
+#define REPLAY_LATE_MS (2)
+
+#define SBP_PREAMBLE 0x55
+#define SBP_HEADER_LEN 6
+#define SBP_MSG_GPS_TIME 0x0102
+#define SBP_MSG_GPS_TIME_GNSS 0x0104
+#define SBP_GPS_TIME_LEN 11
+#define SBP_GPS_TIME_SOURCE_MASK 0x07
+
+#define WEEK_MS (7LL * 24 * 60 * 60 * 1000)
+
+struct replay_s {
+  pk_loop_t *pk_loop;
+  int fd;
+  double speed;
+  bool loop;
+  framer_t *framer;
+  uint8_t buf[REPLAY_BUFFER_SIZE];
+  uint32_t used;
+  uint32_t offset;
+  uint32_t pass_frames;
+  /* A timed frame read ahead of its schedule */
+  uint8_t held[REPLAY_FRAME_MAX];
+  uint32_t held_length;
+  int64_t held_due_ms;
+  bool anchored;
+  int64_t anchor_ms;
+  int64_t anchor_gps_ms;
+  int64_t last_gps_ms;
+  replay_stats_t stats;
+};
+
+/* GPS time of a frame in ms since the start of GPS time, -1 if it has none */
+static int64_t frame_gps_ms(const uint8_t *frame, uint32_t length)
+{
+  if (length < SBP_HEADER_LEN + SBP_GPS_TIME_LEN || frame[0] != SBP_PREAMBLE) {
+    return -1;
+  }
+
+  uint16_t msg_type = frame[1] | (frame[2] << 8);
+  if (msg_type != SBP_MSG_GPS_TIME && msg_type != SBP_MSG_GPS_TIME_GNSS) {
+    return -1;
+  }
+
+  const uint8_t *payload = &frame[SBP_HEADER_LEN];
+  if ((payload[10] & SBP_GPS_TIME_SOURCE_MASK) == 0) {
+    /* No valid time */
+    return -1;
+  }
+
+  uint16_t wn = payload[0] | (payload[1] << 8);
+  uint32_t tow = (uint32_t)payload[2] | ((uint32_t)payload[3] << 8) | ((uint32_t)payload[4] << 16)
+                 | ((uint32_t)payload[5] << 24);
+  return wn * WEEK_MS + tow;
+}
+
+static int64_t now_ms(const replay_t *replay)
+{
+  return (int64_t)pk_loop_now_ms(replay->pk_loop);
+}
+
+/* Loop time a frame of the given GPS time is due */
+static int64_t replay_due_ms(replay_t *replay, int64_t gps_ms)
+{
+  if (!replay->anchored || gps_ms < replay->last_gps_ms
+      || gps_ms - replay->last_gps_ms > REPLAY_GAP_MAX_MS) {
+    replay->anchored = true;
+    replay->anchor_ms = now_ms(replay);
+    replay->anchor_gps_ms = gps_ms;
+  }
+  replay->last_gps_ms = gps_ms;
+
+  return replay->anchor_ms + (int64_t)((double)(gps_ms - replay->anchor_gps_ms) / replay->speed);
+}
+
+static void replay_late_check(replay_t *replay, int64_t due_ms)
+{
+  int64_t lag = now_ms(replay) - due_ms;
+  if (lag < REPLAY_LATE_MS) {
+    return;
+  }
+  replay->stats.late++;
+  if ((uint32_t)lag > replay->stats.lag_max_ms) {
+    replay->stats.lag_max_ms = (uint32_t)lag;
+  }
+}
+
+static uint32_t wait_ms_until(const replay_t *replay, int64_t due_ms)
+{
+  int64_t wait = due_ms - now_ms(replay);
+  return (wait <= 0) ? 0 : (uint32_t)wait;
+}
+
+/* Returns 0 when the log was rewound, -1 at the end of it or on error */
+static int replay_rewind(replay_t *replay)
+{
+  /* A log without a single frame would spin forever */
+  if (!replay->loop || replay->pass_frames == 0) {
+    return -1;
+  }
+
+  if (lseek(replay->fd, 0, SEEK_SET) != 0) {
+    return -1;
+  }
+
+  /* Drop whatever partial frame the end of the log left behind */
+  framer_destroy(&replay->framer);
+  replay->framer = framer_create("sbp");
+  if (replay->framer == NULL) {
+    return -1;
+  }
+
+  replay->used = 0;
+  replay->offset = 0;
+  replay->pass_frames = 0;
+  replay->anchored = false;
+  replay->stats.loops++;
+  return 0;
+}
+
+replay_t *replay_create(pk_loop_t *pk_loop, int fd, double speed, bool loop)
+{
+  if (speed < 0) {
+    return NULL;
+  }
+
+  replay_t *replay = calloc(1, sizeof(*replay));
+  if (replay == NULL) {
+    return NULL;
+  }
+
+  replay->pk_loop = pk_loop;
+  replay->fd = fd;
+  replay->speed = speed;
+  replay->loop = loop;
+  replay->framer = framer_create("sbp");
+  if (replay->framer == NULL) {
+    free(replay);
+    return NULL;
+  }
+
+  return replay;
+}
+
+void replay_destroy(replay_t **replay_loc)
+{
+  if (replay_loc == NULL || *replay_loc == NULL) {
+    return;
+  }
+  framer_destroy(&(*replay_loc)->framer);
+  free(*replay_loc);
+  *replay_loc = NULL;
+}
+
+replay_status_t replay_next(replay_t *replay,
+                            const uint8_t **frame,
+                            uint32_t *length,
+                            uint32_t *wait_ms)
+{
+  if (replay->held_length > 0) {
+    *wait_ms = wait_ms_until(replay, replay->held_due_ms);
+    if (*wait_ms > 0) {
+      return REPLAY_WAIT;
+    }
+    replay_late_check(replay, replay->held_due_ms);
+    *frame = replay->held;
+    *length = replay->held_length;
+    replay->held_length = 0;
+    replay->stats.frames++;
+    return REPLAY_FRAME;
+  }
+
+  for (;;) {
+    if (replay->offset == replay->used) {
+      ssize_t ret = read(replay->fd, replay->buf, sizeof(replay->buf));
+      /* Retry if interrupted */
+      if ((ret == -1) && (errno == EINTR)) {
+        continue;
+      }
+      if (ret < 0) {
+        return REPLAY_ERROR;
+      }
+      if (ret == 0) {
+        if (replay_rewind(replay) != 0) {
+          return REPLAY_END;
+        }
+        continue;
+      }
+      replay->used = (uint32_t)ret;
+      replay->offset = 0;
+    }
+
+    const uint8_t *found = NULL;
+    uint32_t found_length = 0;
+    replay->offset += framer_process(replay->framer,
+                                     &replay->buf[replay->offset],
+                                     replay->used - replay->offset,
+                                     &found,
+                                     &found_length);
+    if (found == NULL) {
+      continue;
+    }
+    replay->pass_frames++;
+
+    int64_t gps_ms = (replay->speed > 0) ? frame_gps_ms(found, found_length) : -1;
+    if (gps_ms >= 0) {
+      int64_t due_ms = replay_due_ms(replay, gps_ms);
+      *wait_ms = wait_ms_until(replay, due_ms);
+      if (*wait_ms > 0 && found_length <= sizeof(replay->held)) {
+        memcpy(replay->held, found, found_length);
+        replay->held_length = found_length;
+        replay->held_due_ms = due_ms;
+        return REPLAY_WAIT;
+      }
+      replay_late_check(replay, due_ms);
+    }
+
+    *frame = found;
+    *length = found_length;
+    replay->stats.frames++;
+    return REPLAY_FRAME;
+  }
+}
+
+void replay_take_stats(replay_t *replay, replay_stats_t *stats)
+{
+  *stats = replay->stats;
+  memset(&replay->stats, 0, sizeof(replay->stats));
+}
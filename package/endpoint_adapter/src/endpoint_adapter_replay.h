@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_REPLAY_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libpiksi/loop.h>
+
+/* Timed replay of an SBP log: frames are released on the schedule given by
+ * the GPS time messages in the log, scaled by a speed factor. Frames without
+ * a time of their own follow the time message before them. The schedule is
+ * kept on the loop clock, so it follows virtual time. */
+
+typedef struct replay_s replay_t;
+
+typedef enum {
+  REPLAY_FRAME, /**< A frame is due */
+  REPLAY_WAIT,  /**< The next frame is due in wait_ms */
+  REPLAY_END,   /**< End of the log and not looping */
+  REPLAY_ERROR,
+} replay_status_t;
+
+/* Counts since the last replay_take_stats() */
+typedef struct {
+  uint32_t frames;
+  uint32_t late;       /**< Timed frames released after they were due */
+  uint32_t lag_max_ms; /**< Furthest behind schedule a frame was released */
+  uint32_t loops;
+} replay_stats_t;
+
+/**
+ * @param pk_loop       loop whose clock frames are scheduled against
+ * @param fd            log to read, not owned by the replay
+ * @param speed         1 for real time, N for N times faster, 0 for as fast
+ *                      as frames can be read
+ * @param loop          start over at the end of the log
+ */
+replay_t *replay_create(pk_loop_t *pk_loop, int fd, double speed, bool loop);
+void replay_destroy(replay_t **replay);
+
+/* Returns REPLAY_FRAME with the next frame if it's due, the frame is valid
+ * until the next call */
+replay_status_t replay_next(replay_t *replay,
+                            const uint8_t **frame,
+                            uint32_t *length,
+                            uint32_t *wait_ms);
+
+void replay_take_stats(replay_t *replay, replay_stats_t *stats);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_REPLAY_H */
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "endpoint_adapter_sendq.h"
+#include "endpoint_adapter_classq.h"
+#include "endpoint_adapter_io.h"
+
+/* Most iovecs gathered into one writev() */
+#define SENDQ_IOV_MAX (64)
+
+struct sendq_s {
+  sendq_drop_t drop;
+  classq_t *classq;
+  const classifier_t *classifier;
+  /* What's left of a record the fd took part of, it goes out before anything
+   * else and is never dropped so the output stays framed */
+  uint8_t *partial;
+  uint32_t partial_size;
+  uint32_t partial_offset;
+  uint32_t partial_length;
+  bool stalled;
+  struct timespec stall_start;
+  uint64_t stall_ns;
+  sendq_stats_t stats;
+};
+
+static uint32_t sendq_depth(const sendq_t *sendq)
+{
+  return classq_queued(sendq->classq) + (sendq->partial_length - sendq->partial_offset);
+}
+
+static void stall_account(sendq_t *sendq, const struct timespec *now)
+{
+  sendq->stall_ns += (uint64_t)(now->tv_sec - sendq->stall_start.tv_sec) * 1000000000ULL
+                     + (uint64_t)now->tv_nsec - (uint64_t)sendq->stall_start.tv_nsec;
+  sendq->stall_start = *now;
+}
+
+/* Tracks when the queue starts and stops holding data */
+static void sendq_update(sendq_t *sendq)
+{
+  uint32_t depth = sendq_depth(sendq);
+  if (depth > sendq->stats.depth_max) {
+    sendq->stats.depth_max = depth;
+  }
+
+  if (depth > 0 && !sendq->stalled) {
+    sendq->stalled = true;
+    sendq->stats.stalls++;
+    clock_gettime(CLOCK_MONOTONIC, &sendq->stall_start);
+  } else if (depth == 0 && sendq->stalled) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stall_account(sendq, &now);
+    sendq->stalled = false;
+  }
+}
+
+static int sendq_partial_set(sendq_t *sendq, const uint8_t *data, uint32_t length)
+{
+  if (length > sendq->partial_size) {
+    uint8_t *partial = realloc(sendq->partial, length);
+    if (partial == NULL) {
+      return -1;
+    }
+    sendq->partial = partial;
+    sendq->partial_size = length;
+  }
+  if (data != NULL) {
+    memcpy(sendq->partial, data, length);
+  }
+  sendq->partial_offset = 0;
+  sendq->partial_length = length;
+  return 0;
+}
+
+/* Without priorities everything is queued as normal */
+static void sendq_enqueue(sendq_t *sendq, const uint8_t *data, uint32_t length)
+{
+  frame_class_t cls = (sendq->drop == SENDQ_DROP_PRIORITY)
+                        ? classifier_classify(sendq->classifier, data, length)
+                        : FRAME_CLASS_NORMAL;
+  classq_put(sendq->classq, cls, data, length);
+}
+
+/* Points iov at the partial record and then whole records, highest class
+ * first, returns the number of iovecs used */
+static int sendq_gather(const sendq_t *sendq, struct iovec *iov)
+{
+  int iov_count = 0;
+  if (sendq->partial_offset < sendq->partial_length) {
+    iov[iov_count++] =
+      (struct iovec){.iov_base = &sendq->partial[sendq->partial_offset],
+                     .iov_len = sendq->partial_length - sendq->partial_offset};
+  }
+
+  iov_count += classq_gather(sendq->classq, &iov[iov_count], SENDQ_IOV_MAX - iov_count);
+
+  return iov_count;
+}
+
+/* Removes the first `written` bytes of the order sendq_gather() lays out */
+static int sendq_consume(sendq_t *sendq, size_t written)
+{
+  uint32_t partial = sendq->partial_length - sendq->partial_offset;
+  uint32_t taken = (written < partial) ? (uint32_t)written : partial;
+  sendq->partial_offset += taken;
+  written -= taken;
+  if (sendq->partial_offset == sendq->partial_length) {
+    sendq->partial_offset = 0;
+    sendq->partial_length = 0;
+  }
+
+  while (written > 0 && !classq_empty(sendq->classq)) {
+    frame_class_t cls = classq_front_class(sendq->classq);
+    uint32_t length = classq_front_length(sendq->classq, cls);
+    if (written < length) {
+      /* Move the rest of the record aside, the ring slot is freed */
+      uint32_t rest = length - (uint32_t)written;
+      if (sendq_partial_set(sendq, NULL, rest) != 0) {
+        return -1;
+      }
+      classq_front_copy(sendq->classq, cls, (uint32_t)written, sendq->partial, rest);
+      written = length;
+    }
+    classq_pop(sendq->classq, cls);
+    written -= length;
+  }
+
+  return 0;
+}
+
+int sendq_drop_parse(const char *name, sendq_drop_t *drop)
+{
+  if (strcmp(name, "oldest") == 0) {
+    *drop = SENDQ_DROP_OLDEST;
+  } else if (strcmp(name, "newest") == 0) {
+    *drop = SENDQ_DROP_NEWEST;
+  } else if (strcmp(name, "priority") == 0) {
+    *drop = SENDQ_DROP_PRIORITY;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+sendq_t *sendq_create(uint32_t size, sendq_drop_t drop, const classifier_t *classifier)
+{
+  sendq_t *sendq = calloc(1, sizeof(*sendq));
+  if (sendq == NULL) {
+    return NULL;
+  }
+
+  sendq->drop = drop;
+  sendq->classifier = classifier;
+
+  sendq->classq = classq_create(size, size, drop != SENDQ_DROP_NEWEST);
+  if (sendq->classq == NULL) {
+    free(sendq);
+    return NULL;
+  }
+
+  return sendq;
+}
+
+void sendq_destroy(sendq_t **sendq_loc)
+{
+  if (sendq_loc == NULL || *sendq_loc == NULL) {
+    return;
+  }
+  sendq_t *sendq = *sendq_loc;
+  classq_destroy(&sendq->classq);
+  free(sendq->partial);
+  free(sendq);
+  *sendq_loc = NULL;
+}
+
+bool sendq_empty(const sendq_t *sendq)
+{
+  return sendq_depth(sendq) == 0;
+}
+
+ssize_t sendq_flush(sendq_t *sendq, int fd)
+{
+  struct iovec iov[SENDQ_IOV_MAX];
+  size_t total = 0;
+
+  while (!sendq_empty(sendq)) {
+    int iov_count = sendq_gather(sendq, iov);
+    size_t count = 0;
+    for (int i = 0; i < iov_count; i++) {
+      count += iov[i].iov_len;
+    }
+
+    ssize_t ret = io_writev_nonblock(fd, iov, iov_count);
+    if (ret < 0) {
+      return -1;
+    }
+    if (sendq_consume(sendq, (size_t)ret) != 0) {
+      return -1;
+    }
+    total += (size_t)ret;
+    /* The fd is full, wait until it's writable again */
+    if ((size_t)ret < count) {
+      break;
+    }
+  }
+
+  sendq_update(sendq);
+  return (ssize_t)total;
+}
+
+ssize_t sendq_write(sendq_t *sendq, int fd, const struct iovec *iov, int iov_count)
+{
+  size_t count = 0;
+  for (int i = 0; i < iov_count; i++) {
+    count += iov[i].iov_len;
+  }
+
+  /* Data already queued goes first */
+  bool direct = sendq_empty(sendq);
+  size_t written = 0;
+  if (direct) {
+    ssize_t ret = io_writev_nonblock(fd, iov, iov_count);
+    if (ret < 0) {
+      return -1;
+    }
+    written = (size_t)ret;
+  }
+
+  for (int i = 0; i < iov_count; i++) {
+    const uint8_t *data = iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+    if (written >= length) {
+      written -= length;
+      continue;
+    }
+    if (written > 0) {
+      /* The fd took the start of this record, the rest must follow it */
+      if (sendq_partial_set(sendq, &data[written], (uint32_t)(length - written)) != 0) {
+        return -1;
+      }
+      written = 0;
+      continue;
+    }
+    sendq_enqueue(sendq, data, (uint32_t)length);
+  }
+
+  if (!direct && sendq_flush(sendq, fd) < 0) {
+    return -1;
+  }
+
+  sendq_update(sendq);
+  return (ssize_t)count;
+}
+
+void sendq_take_stats(sendq_t *sendq, sendq_stats_t *stats)
+{
+  if (sendq->stalled) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stall_account(sendq, &now);
+  }
+
+  classq_drops_t drops;
+  classq_take_drops(sendq->classq, &drops);
+
+  *stats = sendq->stats;
+  for (int cls = 0; cls < FRAME_CLASS_COUNT; cls++) {
+    stats->dropped_frames += drops.frames[cls];
+    stats->dropped_bytes += drops.bytes[cls];
+  }
+  stats->depth = sendq_depth(sendq);
+  stats->stall_ms = (uint32_t)(sendq->stall_ns / 1000000ULL);
+
+  sendq->stall_ns %= 1000000ULL;
+  memset(&sendq->stats, 0, sizeof(sendq->stats));
+  sendq->stats.depth_max = stats->depth;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_SENDQ_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_SENDQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "endpoint_adapter_classify.h"
+
+/* Bounded output queue for a non-blocking fd. Whatever the fd doesn't take
+ * right away is queued and written once it becomes writable again, so a slow
+ * reader never stalls the loop. Each queued iovec is a record (a frame when
+ * output is framed) and records are only ever dropped whole. */
+
+typedef struct sendq_s sendq_t;
+
+typedef enum {
+  SENDQ_DROP_OLDEST,   /**< Make room by dropping the oldest queued records */
+  SENDQ_DROP_NEWEST,   /**< Drop records that don't fit, keep what's queued */
+  SENDQ_DROP_PRIORITY, /**< Drop the oldest of the lowest class, send high first */
+} sendq_drop_t;
+
+/* Counts since the last sendq_take_stats(), depth is the current value */
+typedef struct {
+  uint32_t depth;
+  uint32_t depth_max;
+  uint32_t dropped_frames;
+  uint32_t dropped_bytes;
+  uint32_t stalls;   /**< Times the queue went from empty to holding data */
+  uint32_t stall_ms; /**< Time spent holding data */
+} sendq_stats_t;
+
+/* Returns 0 and sets drop if name is "oldest", "newest" or "priority" */
+int sendq_drop_parse(const char *name, sendq_drop_t *drop);
+
+/**
+ * @param size          bytes of records held, across all classes. With
+ *                      SENDQ_DROP_PRIORITY each class in use allocates this
+ *                      much, see classq_create()
+ * @param drop          what to drop when the queue is full
+ * @param classifier    picks the class of each record with SENDQ_DROP_PRIORITY,
+ *                      not owned by the queue
+ */
+sendq_t *sendq_create(uint32_t size, sendq_drop_t drop, const classifier_t *classifier);
+void sendq_destroy(sendq_t **sendq);
+
+/* Writes iov to fd, queueing what the fd doesn't take. Returns the number of
+ * bytes accepted, written or queued or dropped, or -1 on a write error. */
+ssize_t sendq_write(sendq_t *sendq, int fd, const struct iovec *iov, int iov_count);
+
+/* Writes queued records while the fd takes them, returns the number of bytes
+ * written or -1 on a write error */
+ssize_t sendq_flush(sendq_t *sendq, int fd);
+
+bool sendq_empty(const sendq_t *sendq);
+
+void sendq_take_stats(sendq_t *sendq, sendq_stats_t *stats);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_SENDQ_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+
+#include "endpoint_adapter_shaper.h"
+#include "endpoint_adapter_classq.h"
+
+/* Largest frame the shaper will hold */
+#define SHAPER_FRAME_MAX (4096)
+/* Budget accumulated while idle is capped at this fraction of a second */
+#define SHAPER_BURST_DIV (10)
+
+struct shaper_s {
+  pk_loop_t *pk_loop;
+  double rate;
+  double tokens;
+  uint64_t last_ms;
+  classq_t *classq;
+  const classifier_t *classifier;
+  uint8_t scratch[SHAPER_FRAME_MAX];
+};
+
+shaper_t *shaper_create(pk_loop_t *pk_loop,
+                        uint32_t rate,
+                        uint32_t queue_size,
+                        const classifier_t *classifier)
+{
+  shaper_t *shaper = calloc(1, sizeof(*shaper));
+  if (shaper == NULL) {
+    return NULL;
+  }
+
+  shaper->pk_loop = pk_loop;
+  shaper->rate = rate;
+  shaper->tokens = 0;
+  shaper->classifier = classifier;
+  shaper->last_ms = pk_loop_now_ms(pk_loop);
+
+  shaper->classq = classq_create(queue_size, SHAPER_FRAME_MAX, true);
+  if (shaper->classq == NULL) {
+    free(shaper);
+    return NULL;
+  }
+
+  return shaper;
+}
+
+void shaper_destroy(shaper_t **shaper)
+{
+  classq_destroy(&(*shaper)->classq);
+  free(*shaper);
+  *shaper = NULL;
+}
+
+void shaper_enqueue(shaper_t *shaper, const uint8_t *frame, size_t length)
+{
+  frame_class_t cls = classifier_classify(shaper->classifier, frame, length);
+  classq_put(shaper->classq, cls, frame, (uint32_t)length);
+}
+
+static void shaper_refill(shaper_t *shaper)
+{
+  uint64_t now_ms = pk_loop_now_ms(shaper->pk_loop);
+  double elapsed = (double)(now_ms - shaper->last_ms) / 1000;
+  shaper->last_ms = now_ms;
+
+  double burst = shaper->rate / SHAPER_BURST_DIV;
+  shaper->tokens += elapsed * shaper->rate;
+  if (shaper->tokens > burst) {
+    shaper->tokens = burst;
+  }
+}
+
+ssize_t shaper_drain(shaper_t *shaper,
+                     shaper_ready_fn_t ready_fn,
+                     shaper_write_fn_t write_fn,
+                     void *context)
+{
+  shaper_refill(shaper);
+
+  ssize_t total = 0;
+
+  /* A frame goes out whenever there is any budget left, the overdraft is
+   * paid back before the next one, so frames larger than the burst allowance
+   * still get through at the configured average rate */
+  while (shaper->tokens > 0 && !classq_empty(shaper->classq)) {
+    frame_class_t cls = classq_front_class(shaper->classq);
+    uint32_t length = classq_front_length(shaper->classq, cls);
+    if (ready_fn != NULL && !ready_fn(length, context)) {
+      break;
+    }
+
+    classq_front_copy(shaper->classq, cls, 0, shaper->scratch, length);
+    classq_pop(shaper->classq, cls);
+    shaper->tokens -= length;
+
+    ssize_t write_count = write_fn(shaper->scratch, length, context);
+    if (write_count < 0) {
+      return write_count;
+    }
+    total += write_count;
+  }
+
+  return total;
+}
+
+void shaper_take_drops(shaper_t *shaper, uint32_t drops[FRAME_CLASS_COUNT])
+{
+  classq_drops_t classq_drops;
+  classq_take_drops(shaper->classq, &classq_drops);
+  for (int cls = 0; cls < FRAME_CLASS_COUNT; cls++) {
+    drops[cls] = classq_drops.frames[cls];
+  }
+}
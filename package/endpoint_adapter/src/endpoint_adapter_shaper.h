@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_SHAPER_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_SHAPER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <libpiksi/loop.h>
+
+#include "endpoint_adapter_classify.h"
+
+/* Output shaping: frames are queued by priority class and released against a
+ * byte budget. When the queue is full the oldest frames of the lowest class
+ * are dropped first, so a slow link carries the high priority traffic. */
+
+typedef struct shaper_s shaper_t;
+
+/* Returns true if the link can take `length` more bytes right now */
+typedef bool (*shaper_ready_fn_t)(size_t length, void *context);
+typedef ssize_t (*shaper_write_fn_t)(const uint8_t *frame, size_t length, void *context);
+
+/**
+ * @param pk_loop       loop whose clock the budget is refilled against
+ * @param rate          byte budget per second
+ * @param queue_size    bytes of frames held back across all classes, each
+ *                      class in use allocates this much, see classq_create()
+ * @param classifier    picks the class of each frame, not owned by the shaper,
+ *                      NULL makes every frame normal
+ */
+shaper_t *shaper_create(pk_loop_t *pk_loop,
+                        uint32_t rate,
+                        uint32_t queue_size,
+                        const classifier_t *classifier);
+void shaper_destroy(shaper_t **shaper);
+
+void shaper_enqueue(shaper_t *shaper, const uint8_t *frame, size_t length);
+
+/* Send queued frames, highest class first, while budget allows and the link
+ * is ready. Returns the number of bytes written or -1 on a write error. */
+ssize_t shaper_drain(shaper_t *shaper,
+                     shaper_ready_fn_t ready_fn,
+                     shaper_write_fn_t write_fn,
+                     void *context);
+
+/* Frames dropped per class since the last call */
+void shaper_take_drops(shaper_t *shaper, uint32_t drops[FRAME_CLASS_COUNT]);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_SHAPER_H */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "endpoint_adapter_spsc.h"
+
+#define CACHE_LINE_SIZE 64
+
+/* head and tail only ever increase and wrap at 2^32, the index of an element
+ * is its position masked to the ring size. Each side keeps to its own cache
+ * line so a push doesn't evict what the consumer is reading and vice versa. */
+struct spsc_s {
+  /* Producer */
+  atomic_uint head;
+  uint32_t tail_cached; /**< Last tail seen, refreshed only when the ring looks full */
+  uint8_t pad0[CACHE_LINE_SIZE - sizeof(atomic_uint) - sizeof(uint32_t)];
+  /* Consumer */
+  atomic_uint tail;
+  uint32_t head_cached; /**< Last head seen, refreshed only when the ring looks empty */
+  uint8_t pad1[CACHE_LINE_SIZE - sizeof(atomic_uint) - sizeof(uint32_t)];
+  atomic_uint drops;
+  int event_fd;
+  uint32_t mask;
+  size_t element_size;
+  uint8_t *elements;
+};
+
+spsc_t *spsc_create(uint32_t count, size_t element_size)
+{
+  if (count == 0 || count > (1U << 31) || element_size == 0) {
+    return NULL;
+  }
+
+  uint32_t size = 1;
+  while (size < count) {
+    size <<= 1;
+  }
+
+  spsc_t *spsc = calloc(1, sizeof(*spsc));
+  if (spsc == NULL) {
+    return NULL;
+  }
+
+  spsc->elements = calloc(size, element_size);
+  spsc->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (spsc->elements == NULL || spsc->event_fd < 0) {
+    if (spsc->event_fd >= 0) close(spsc->event_fd);
+    free(spsc->elements);
+    free(spsc);
+    return NULL;
+  }
+
+  atomic_init(&spsc->head, 0);
+  atomic_init(&spsc->tail, 0);
+  atomic_init(&spsc->drops, 0);
+  spsc->mask = size - 1;
+  spsc->element_size = element_size;
+  return spsc;
+}
+
+void spsc_destroy(spsc_t **spsc_loc)
+{
+  if (spsc_loc == NULL || *spsc_loc == NULL) {
+    return;
+  }
+  close((*spsc_loc)->event_fd);
+  free((*spsc_loc)->elements);
+  free(*spsc_loc);
+  *spsc_loc = NULL;
+}
+
+bool spsc_push(spsc_t *spsc, const void *element)
+{
+  uint32_t head = atomic_load_explicit(&spsc->head, memory_order_relaxed);
+
+  if (head - spsc->tail_cached > spsc->mask) {
+    spsc->tail_cached = atomic_load_explicit(&spsc->tail, memory_order_acquire);
+    if (head - spsc->tail_cached > spsc->mask) {
+      atomic_fetch_add_explicit(&spsc->drops, 1, memory_order_relaxed);
+      return false;
+    }
+  }
+
+  memcpy(&spsc->elements[(head & spsc->mask) * spsc->element_size], element, spsc->element_size);
+  /* Publishes the element along with the new head */
+  atomic_store_explicit(&spsc->head, head + 1, memory_order_release);
+  return true;
+}
+
+void spsc_notify(spsc_t *spsc)
+{
+  uint64_t one = 1;
+  while (write(spsc->event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+bool spsc_pop(spsc_t *spsc, void *element)
+{
+  uint32_t tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+
+  if (tail == spsc->head_cached) {
+    spsc->head_cached = atomic_load_explicit(&spsc->head, memory_order_acquire);
+    if (tail == spsc->head_cached) {
+      return false;
+    }
+  }
+
+  memcpy(element, &spsc->elements[(tail & spsc->mask) * spsc->element_size], spsc->element_size);
+  /* Hands the slot back to the producer only once it's been copied out */
+  atomic_store_explicit(&spsc->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+int spsc_fd(const spsc_t *spsc)
+{
+  return spsc->event_fd;
+}
+
+void spsc_clear(spsc_t *spsc)
+{
+  uint64_t count;
+  while (read(spsc->event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+uint32_t spsc_take_drops(spsc_t *spsc)
+{
+  return atomic_exchange_explicit(&spsc->drops, 0, memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_ENDPOINT_ADAPTER_SPSC_H
+#define SWIFTNAV_ENDPOINT_ADAPTER_SPSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Lock-free ring of fixed size elements between exactly one producer thread
+ * and one consumer thread. All storage is allocated up front, a push to a
+ * full ring drops the element and counts it. The consumer sleeps on an
+ * eventfd the producer signals once per batch of pushes. */
+
+typedef struct spsc_s spsc_t;
+
+/**
+ * @param count         elements held, rounded up to a power of two
+ * @param element_size  bytes per element
+ */
+spsc_t *spsc_create(uint32_t count, size_t element_size);
+void spsc_destroy(spsc_t **spsc);
+
+/* Producer: copies element in, returns false and counts a drop if full */
+bool spsc_push(spsc_t *spsc, const void *element);
+
+/* Producer: wakes the consumer, call after a batch of pushes */
+void spsc_notify(spsc_t *spsc);
+
+/* Consumer: copies the oldest element out, returns false if empty */
+bool spsc_pop(spsc_t *spsc, void *element);
+
+/* Consumer: readable once pushes were notified, non-blocking */
+int spsc_fd(const spsc_t *spsc);
+
+/* Consumer: resets spsc_fd(), call before draining so pushes notified during
+ * the drain wake the consumer again */
+void spsc_clear(spsc_t *spsc);
+
+/* Drops since the last call, from any thread */
+uint32_t spsc_take_drops(spsc_t *spsc);
+
+#endif /* SWIFTNAV_ENDPOINT_ADAPTER_SPSC_H */
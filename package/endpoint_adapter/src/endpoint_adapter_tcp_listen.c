@@ -94,7 +94,7 @@ static void server_loop(int server_fd)
   }
 }
 
-int tcp_listen_loop(int port)
+int tcp_listen_loop(int port, bool single_process)
 {
   int server_fd = socket_create(port);
   if (server_fd < 0) {
@@ -102,7 +102,13 @@ int tcp_listen_loop(int port)
     return 1;
   }
 
-  server_loop(server_fd);
+  if (single_process) {
+    /* Only accept when the loop reports a waiting connection */
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+    io_loop_run_server(server_fd);
+  } else {
+    server_loop(server_fd);
+  }
 
   close(server_fd);
   server_fd = -1;
@@ -0,0 +1,1221 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi/crc.h>
+#include <libpiksi/framer.h>
+#include <libpiksi/loop.h>
+
+extern "C" {
+#include <libpiksi/protocols.h>
+
+#include "endpoint_adapter_can.h"
+#include "endpoint_adapter_classify.h"
+#include "endpoint_adapter_dgram.h"
+#include "endpoint_adapter_fanout.h"
+#include "endpoint_adapter_replay.h"
+#include "endpoint_adapter_sendq.h"
+#include "endpoint_adapter_shaper.h"
+#include "endpoint_adapter_spsc.h"
+}
+
+/* Where the replay tests load the SBP framer from */
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+
+#define WEEK_MS (7u * 24 * 60 * 60 * 1000)
+
+/* Interface the CAN throughput test runs on, set up with
+ *   ip link add dev vcan0 type vcan && ip link set up vcan0
+ * the test is skipped if it doesn't exist */
+#define CAN_TEST_INTERFACE_ENV_NAME "CAN_TEST_INTERFACE"
+#define CAN_TEST_INTERFACE_DEFAULT "vcan0"
+
+#define CAN_TEST_FRAMES 100000
+#define CAN_TEST_TIMEOUT_ms 10000
+
+/* Frames the bridge reads have this id, frames it writes have the other */
+#define CAN_TEST_ID_IN 0x123
+#define CAN_TEST_ID_OUT 0x321
+
+namespace {
+
+static uint64_t elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                               - start)
+    .count();
+}
+
+TEST(SpscTest, OrderAcrossWrap)
+{
+  spsc_t *spsc = spsc_create(5, sizeof(uint32_t));
+  ASSERT_NE(spsc, nullptr);
+
+  /* Rounded up to 8, pushed and popped in uneven steps so the ends wrap */
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < 7; i++) {
+      ASSERT_TRUE(spsc_push(spsc, &pushed));
+      pushed++;
+    }
+    uint32_t value;
+    while (spsc_pop(spsc, &value)) {
+      EXPECT_EQ(value, popped);
+      popped++;
+    }
+  }
+
+  EXPECT_EQ(popped, pushed);
+  EXPECT_EQ(spsc_take_drops(spsc), 0);
+
+  spsc_destroy(&spsc);
+  EXPECT_EQ(spsc, nullptr);
+}
+
+TEST(SpscTest, FullRingDrops)
+{
+  spsc_t *spsc = spsc_create(4, sizeof(uint32_t));
+  ASSERT_NE(spsc, nullptr);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    EXPECT_EQ(spsc_push(spsc, &i), i < 4);
+  }
+  EXPECT_EQ(spsc_take_drops(spsc), 6);
+  EXPECT_EQ(spsc_take_drops(spsc), 0);
+
+  /* What was queued is kept, new elements are the ones dropped */
+  uint32_t value;
+  for (uint32_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(spsc_pop(spsc, &value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(spsc_pop(spsc, &value));
+
+  spsc_destroy(&spsc);
+}
+
+TEST(SpscTest, NotifyWakesConsumer)
+{
+  spsc_t *spsc = spsc_create(16, sizeof(uint32_t));
+  ASSERT_NE(spsc, nullptr);
+
+  struct pollfd fd = {.fd = spsc_fd(spsc), .events = POLLIN};
+  EXPECT_EQ(poll(&fd, 1, 0), 0);
+
+  uint32_t value = 1;
+  spsc_push(spsc, &value);
+  spsc_push(spsc, &value);
+  spsc_notify(spsc);
+  EXPECT_EQ(poll(&fd, 1, 0), 1);
+
+  /* One clear however many notifies came before it */
+  spsc_notify(spsc);
+  spsc_clear(spsc);
+  EXPECT_EQ(poll(&fd, 1, 0), 0);
+
+  spsc_destroy(&spsc);
+}
+
+typedef struct {
+  spsc_t *spsc;
+  uint32_t count;
+} spsc_producer_t;
+
+static void *spsc_producer(void *arg)
+{
+  spsc_producer_t *producer = (spsc_producer_t *)arg;
+  for (uint32_t i = 0; i < producer->count; i++) {
+    /* Retried rather than dropped, every element has to come through */
+    while (!spsc_push(producer->spsc, &i)) {
+      spsc_notify(producer->spsc);
+      sched_yield();
+    }
+    if ((i & 63) == 63) spsc_notify(producer->spsc);
+  }
+  spsc_notify(producer->spsc);
+  return NULL;
+}
+
+TEST(SpscTest, TwoThreadsInOrder)
+{
+  spsc_t *spsc = spsc_create(256, sizeof(uint32_t));
+  ASSERT_NE(spsc, nullptr);
+
+  spsc_producer_t producer = {.spsc = spsc, .count = 2000000};
+  pthread_t thread;
+  ASSERT_EQ(pthread_create(&thread, NULL, spsc_producer, &producer), 0);
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t expected = 0;
+  struct pollfd fd = {.fd = spsc_fd(spsc), .events = POLLIN};
+  while (expected < producer.count && elapsed_ms(start) < CAN_TEST_TIMEOUT_ms) {
+    poll(&fd, 1, 100);
+    spsc_clear(spsc);
+    uint32_t value;
+    while (spsc_pop(spsc, &value)) {
+      ASSERT_EQ(value, expected);
+      expected++;
+    }
+  }
+  pthread_join(thread, NULL);
+
+  EXPECT_EQ(expected, producer.count);
+
+  spsc_destroy(&spsc);
+}
+
+/* SBP message types the priority tests assign to each class */
+#define TEST_MSG_TYPE_HIGH 1
+#define TEST_MSG_TYPE_NORMAL 2
+#define TEST_MSG_TYPE_LOW 3
+
+#define TEST_RECORD_LENGTH 100
+
+/* Non-blocking stream socketpair with a small send buffer, a write to fds[0]
+ * larger than the room left comes up short */
+static void stream_pair(int fds[2])
+{
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+  int sndbuf = 4096;
+  ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)), 0);
+}
+
+/* Writes filler until the fd takes no more, returns the number of bytes */
+static size_t fill_fd(int fd)
+{
+  uint8_t filler[512] = {};
+  size_t total = 0;
+  ssize_t ret;
+  while ((ret = write(fd, filler, sizeof(filler))) > 0) {
+    total += (size_t)ret;
+  }
+  return total;
+}
+
+/* Appends whatever can be read from fd right now */
+static void drain_fd(int fd, std::vector<uint8_t> *data)
+{
+  uint8_t buffer[4096];
+  ssize_t ret;
+  while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
+    data->insert(data->end(), buffer, buffer + ret);
+  }
+}
+
+/* An SBP style frame: preamble, message type, then seq in every other byte */
+static std::vector<uint8_t> make_record(uint16_t msg_type, uint8_t seq, size_t length)
+{
+  std::vector<uint8_t> record(length, seq);
+  record[0] = 0x55;
+  record[1] = (uint8_t)(msg_type & 0xFF);
+  record[2] = (uint8_t)(msg_type >> 8);
+  return record;
+}
+
+/* Splits output of fixed length records into (msg type, seq) pairs */
+static std::vector<std::pair<uint16_t, uint8_t>> record_ids(const std::vector<uint8_t> &data)
+{
+  std::vector<std::pair<uint16_t, uint8_t>> ids;
+  EXPECT_EQ(data.size() % TEST_RECORD_LENGTH, 0u);
+  for (size_t i = 0; i + TEST_RECORD_LENGTH <= data.size(); i += TEST_RECORD_LENGTH) {
+    std::vector<uint8_t> record(&data[i], &data[i + TEST_RECORD_LENGTH]);
+    uint16_t msg_type = (uint16_t)(record[1] | (record[2] << 8));
+    EXPECT_EQ(record, make_record(msg_type, record[3], TEST_RECORD_LENGTH));
+    ids.push_back(std::make_pair(msg_type, record[3]));
+  }
+  return ids;
+}
+
+static void sendq_put_record(sendq_t *sendq, int fd, uint16_t msg_type, uint8_t seq)
+{
+  std::vector<uint8_t> record = make_record(msg_type, seq, TEST_RECORD_LENGTH);
+  struct iovec iov = {.iov_base = record.data(), .iov_len = record.size()};
+  ASSERT_EQ(sendq_write(sendq, fd, &iov, 1), (ssize_t)record.size());
+}
+
+/* Reads the filler back, then flushes the queue until it's empty */
+static std::vector<uint8_t> sendq_drain(sendq_t *sendq, int fds[2], size_t filler)
+{
+  std::vector<uint8_t> data;
+  while (!sendq_empty(sendq) || data.size() < filler) {
+    drain_fd(fds[1], &data);
+    EXPECT_GE(sendq_flush(sendq, fds[0]), 0);
+  }
+  drain_fd(fds[1], &data);
+  data.erase(data.begin(), data.begin() + filler);
+  return data;
+}
+
+TEST(SendqTest, PartialWritesByteExact)
+{
+  int fds[2];
+  stream_pair(fds);
+  sendq_t *sendq = sendq_create(1024 * 1024, SENDQ_DROP_OLDEST, NULL);
+  ASSERT_NE(sendq, nullptr);
+
+  /* Uneven lengths and more per write than the fd holds, so the fd takes
+   * part of a record more often than not */
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> received;
+  uint8_t seq = 0;
+  for (int round = 0; round < 40; round++) {
+    std::vector<std::vector<uint8_t>> records;
+    struct iovec iov[16];
+    size_t count = 0;
+    for (int i = 0; i < 16; i++, seq++) {
+      records.push_back(make_record(TEST_MSG_TYPE_NORMAL, seq, 40 + (seq * 97) % 1200));
+      expected.insert(expected.end(), records.back().begin(), records.back().end());
+    }
+    for (int i = 0; i < 16; i++) {
+      iov[i] = (struct iovec){.iov_base = records[i].data(), .iov_len = records[i].size()};
+      count += records[i].size();
+    }
+    ASSERT_EQ(sendq_write(sendq, fds[0], iov, 16), (ssize_t)count);
+
+    /* Only read now and then, the writes in between back up */
+    if (round % 3 == 2) {
+      drain_fd(fds[1], &received);
+      ASSERT_GE(sendq_flush(sendq, fds[0]), 0);
+    }
+  }
+
+  std::vector<uint8_t> rest = sendq_drain(sendq, fds, 0);
+  received.insert(received.end(), rest.begin(), rest.end());
+  EXPECT_EQ(received, expected);
+
+  sendq_stats_t stats;
+  sendq_take_stats(sendq, &stats);
+  EXPECT_EQ(stats.dropped_frames, 0u);
+  EXPECT_GT(stats.stalls, 0u);
+  EXPECT_EQ(stats.depth, 0u);
+
+  sendq_destroy(&sendq);
+  EXPECT_EQ(sendq, nullptr);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(SendqTest, DropOldestAndNewest)
+{
+  struct {
+    sendq_drop_t drop;
+    std::vector<uint8_t> kept;
+  } cases[] = {
+    {SENDQ_DROP_OLDEST, {6, 7, 8, 9}},
+    {SENDQ_DROP_NEWEST, {0, 1, 2, 3}},
+  };
+
+  for (auto &c : cases) {
+    int fds[2];
+    stream_pair(fds);
+    /* Room for four records */
+    sendq_t *sendq = sendq_create(4 * (TEST_RECORD_LENGTH + 4), c.drop, NULL);
+    ASSERT_NE(sendq, nullptr);
+
+    size_t filler = fill_fd(fds[0]);
+    for (uint8_t seq = 0; seq < 10; seq++) {
+      sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_NORMAL, seq);
+    }
+
+    sendq_stats_t stats;
+    sendq_take_stats(sendq, &stats);
+    EXPECT_EQ(stats.dropped_frames, 6u);
+    EXPECT_EQ(stats.dropped_bytes, 6u * TEST_RECORD_LENGTH);
+
+    std::vector<uint8_t> seqs;
+    for (auto &id : record_ids(sendq_drain(sendq, fds, filler))) {
+      seqs.push_back(id.second);
+    }
+    EXPECT_EQ(seqs, c.kept);
+
+    sendq_destroy(&sendq);
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+class SendqPriorityTest : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    stream_pair(fds);
+    classifier = classifier_create("sbp");
+    ASSERT_NE(classifier, nullptr);
+    ASSERT_EQ(classifier_set(classifier, FRAME_CLASS_HIGH, "1"), 0);
+    ASSERT_EQ(classifier_set(classifier, FRAME_CLASS_LOW, "3"), 0);
+  }
+
+  void TearDown() override
+  {
+    sendq_destroy(&sendq);
+    classifier_destroy(&classifier);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  int fds[2] = {-1, -1};
+  classifier_t *classifier = NULL;
+  sendq_t *sendq = NULL;
+};
+
+TEST_F(SendqPriorityTest, HighClassFirst)
+{
+  sendq = sendq_create(64 * 1024, SENDQ_DROP_PRIORITY, classifier);
+  ASSERT_NE(sendq, nullptr);
+
+  /* Nothing goes out directly, the classes are interleaved in the queue */
+  size_t filler = fill_fd(fds[0]);
+  const uint16_t types[] = {TEST_MSG_TYPE_LOW, TEST_MSG_TYPE_NORMAL, TEST_MSG_TYPE_HIGH};
+  for (uint8_t seq = 0; seq < 30; seq++) {
+    sendq_put_record(sendq, fds[0], types[seq % 3], seq);
+  }
+
+  std::vector<std::pair<uint16_t, uint8_t>> expected;
+  for (int cls = 2; cls >= 0; cls--) {
+    for (uint8_t seq = (uint8_t)cls; seq < 30; seq += 3) {
+      expected.push_back(std::make_pair(types[cls], seq));
+    }
+  }
+  EXPECT_EQ(record_ids(sendq_drain(sendq, fds, filler)), expected);
+
+  sendq_stats_t stats;
+  sendq_take_stats(sendq, &stats);
+  EXPECT_EQ(stats.dropped_frames, 0u);
+}
+
+TEST_F(SendqPriorityTest, LowClassDropped)
+{
+  /* Room for four records */
+  sendq = sendq_create(4 * (TEST_RECORD_LENGTH + 4), SENDQ_DROP_PRIORITY, classifier);
+  ASSERT_NE(sendq, nullptr);
+
+  size_t filler = fill_fd(fds[0]);
+  /* Full after L0 L1 L2 H3, each high and normal record makes room by
+   * dropping the oldest low one. L7 can only drop its own class, which is
+   * empty by then, so it is dropped itself. */
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_LOW, 0);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_LOW, 1);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_LOW, 2);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_HIGH, 3);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_HIGH, 4);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_HIGH, 5);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_NORMAL, 6);
+  sendq_put_record(sendq, fds[0], TEST_MSG_TYPE_LOW, 7);
+
+  sendq_stats_t stats;
+  sendq_take_stats(sendq, &stats);
+  EXPECT_EQ(stats.dropped_frames, 4u);
+
+  std::vector<std::pair<uint16_t, uint8_t>> expected = {
+    {TEST_MSG_TYPE_HIGH, 3},
+    {TEST_MSG_TYPE_HIGH, 4},
+    {TEST_MSG_TYPE_HIGH, 5},
+    {TEST_MSG_TYPE_NORMAL, 6},
+  };
+  EXPECT_EQ(record_ids(sendq_drain(sendq, fds, filler)), expected);
+}
+
+/* 10 bytes of budget per ms, so 100 per shaper tick and a 1000 byte burst */
+#define TEST_SHAPER_RATE 10000
+#define TEST_SHAPER_TICK_MS 10
+
+class ShaperTest : public SendqPriorityTest {
+ protected:
+  void SetUp() override
+  {
+    SendqPriorityTest::SetUp();
+    loop = pk_loop_create();
+    ASSERT_NE(loop, nullptr);
+    ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+  }
+
+  void TearDown() override
+  {
+    if (shaper != NULL) shaper_destroy(&shaper);
+    pk_loop_destroy(&loop);
+    SendqPriorityTest::TearDown();
+  }
+
+  static ssize_t write_cb(const uint8_t *frame, size_t length, void *context)
+  {
+    std::vector<uint8_t> *out = (std::vector<uint8_t> *)context;
+    out->insert(out->end(), frame, frame + length);
+    return (ssize_t)length;
+  }
+
+  void enqueue(uint16_t msg_type, uint8_t seq)
+  {
+    std::vector<uint8_t> record = make_record(msg_type, seq, TEST_RECORD_LENGTH);
+    shaper_enqueue(shaper, record.data(), record.size());
+  }
+
+  /* Lets virtual time pass, then sends what the budget allows */
+  std::vector<uint8_t> tick(uint32_t ms = TEST_SHAPER_TICK_MS)
+  {
+    pk_loop_run_simple_with_timeout(loop, ms);
+    std::vector<uint8_t> out;
+    ssize_t ret = shaper_drain(shaper, NULL, write_cb, &out);
+    EXPECT_EQ(ret, (ssize_t)out.size());
+    return out;
+  }
+
+  pk_loop_t *loop = NULL;
+  shaper_t *shaper = NULL;
+};
+
+TEST_F(ShaperTest, BudgetPerTick)
+{
+  shaper = shaper_create(loop, TEST_SHAPER_RATE, 64 * 1024, classifier);
+  ASSERT_NE(shaper, nullptr);
+
+  /* Fed at five times the rate, one record's worth goes out per tick */
+  uint8_t seq = 0;
+  std::vector<uint8_t> out;
+  for (int i = 0; i < 20; i++) {
+    for (int j = 0; j < 5; j++) {
+      enqueue(TEST_MSG_TYPE_NORMAL, seq++);
+    }
+    std::vector<uint8_t> sent = tick();
+    EXPECT_EQ(sent.size(), (size_t)TEST_RECORD_LENGTH);
+    out.insert(out.end(), sent.begin(), sent.end());
+  }
+
+  std::vector<std::pair<uint16_t, uint8_t>> expected;
+  for (uint8_t i = 0; i < 20; i++) {
+    expected.push_back(std::make_pair(TEST_MSG_TYPE_NORMAL, i));
+  }
+  EXPECT_EQ(record_ids(out), expected);
+
+  /* Budget saved up while idle is capped at a tenth of a second */
+  EXPECT_EQ(tick(1000).size(), (size_t)(TEST_SHAPER_RATE / 10));
+  EXPECT_EQ(tick().size(), (size_t)TEST_RECORD_LENGTH);
+
+  uint32_t drops[FRAME_CLASS_COUNT];
+  shaper_take_drops(shaper, drops);
+  EXPECT_EQ(drops[FRAME_CLASS_NORMAL], 0u);
+}
+
+TEST_F(ShaperTest, LowClassDropped)
+{
+  /* Room for ten records */
+  shaper = shaper_create(loop, TEST_SHAPER_RATE, 10 * (TEST_RECORD_LENGTH + 4), classifier);
+  ASSERT_NE(shaper, nullptr);
+
+  /* Each tick brings one high, two normal and three low records while only
+   * one goes out, so the queue fills with normal records at the expense of
+   * every low one, and the link carries nothing but the high class */
+  uint8_t seq = 0;
+  std::vector<uint8_t> out;
+  std::vector<std::pair<uint16_t, uint8_t>> expected;
+  for (int i = 0; i < 20; i++) {
+    expected.push_back(std::make_pair(TEST_MSG_TYPE_HIGH, seq));
+    enqueue(TEST_MSG_TYPE_HIGH, seq++);
+    enqueue(TEST_MSG_TYPE_LOW, seq++);
+    enqueue(TEST_MSG_TYPE_NORMAL, seq++);
+    enqueue(TEST_MSG_TYPE_LOW, seq++);
+    enqueue(TEST_MSG_TYPE_NORMAL, seq++);
+    enqueue(TEST_MSG_TYPE_LOW, seq++);
+    std::vector<uint8_t> sent = tick();
+    EXPECT_EQ(sent.size(), (size_t)TEST_RECORD_LENGTH);
+    out.insert(out.end(), sent.begin(), sent.end());
+  }
+  EXPECT_EQ(record_ids(out), expected);
+
+  uint32_t drops[FRAME_CLASS_COUNT];
+  shaper_take_drops(shaper, drops);
+  EXPECT_EQ(drops[FRAME_CLASS_HIGH], 0u);
+  EXPECT_EQ(drops[FRAME_CLASS_LOW], 60u);
+  /* The last tick's high record left nine normal ones queued */
+  EXPECT_EQ(drops[FRAME_CLASS_NORMAL], 40u - 9u);
+}
+
+/* Bytes of a test stream, position dependent so a gap or repeat shows */
+static std::vector<uint8_t> stream_bytes(size_t offset, size_t length)
+{
+  std::vector<uint8_t> data(length);
+  for (size_t i = 0; i < length; i++) {
+    data[i] = (uint8_t)((offset + i) % 251);
+  }
+  return data;
+}
+
+class FanoutTest : public ::testing::Test {
+ protected:
+  void TearDown() override
+  {
+    fanout_destroy(&fanout);
+    for (int fd : fds) {
+      close(fd);
+    }
+  }
+
+  /* Adds a client, returns the index of its reading end in fds */
+  size_t client_add()
+  {
+    int pair[2];
+    stream_pair(pair);
+    fds.push_back(pair[0]);
+    fds.push_back(pair[1]);
+    EXPECT_EQ(fanout_client_add(fanout, pair[0]), 0);
+    return fds.size() - 1;
+  }
+
+  /* Writes length bytes of the stream in three uneven iovecs */
+  void write_stream(size_t length)
+  {
+    std::vector<uint8_t> data = stream_bytes(written, length);
+    size_t first = length / 5;
+    size_t second = length / 2;
+    struct iovec iov[3] = {
+      {.iov_base = &data[0], .iov_len = first},
+      {.iov_base = &data[first], .iov_len = second},
+      {.iov_base = &data[first + second], .iov_len = length - first - second},
+    };
+    fanout_write(fanout, iov, 3);
+    written += length;
+  }
+
+  static void evict_cb(int fd, void *context)
+  {
+    ((FanoutTest *)context)->evicted.push_back(fd);
+  }
+
+  static void pending_cb(int fd, bool pending, void *context)
+  {
+    ((FanoutTest *)context)->pending.push_back(std::make_pair(fd, pending));
+  }
+
+  fanout_t *fanout = NULL;
+  std::vector<int> fds;
+  size_t written = 0;
+  std::vector<int> evicted;
+  std::vector<std::pair<int, bool>> pending;
+};
+
+TEST_F(FanoutTest, PendingUntilFlushed)
+{
+  fanout = fanout_create(4, 64 * 1024, evict_cb, pending_cb, this);
+  ASSERT_NE(fanout, nullptr);
+  size_t reader = client_add();
+  int fd = fds[reader - 1];
+
+  /* More than the fd holds, it takes part of the second iovec and the rest
+   * is buffered */
+  write_stream(20000);
+  ASSERT_EQ(pending.size(), 1u);
+  EXPECT_EQ(pending[0], std::make_pair(fd, true));
+
+  std::vector<uint8_t> received;
+  for (int i = 0; i < 100 && pending.size() == 1; i++) {
+    drain_fd(fds[reader], &received);
+    fanout_client_flush(fanout, fd);
+  }
+  drain_fd(fds[reader], &received);
+
+  ASSERT_EQ(pending.size(), 2u);
+  EXPECT_EQ(pending[1], std::make_pair(fd, false));
+  EXPECT_EQ(received, stream_bytes(0, written));
+  EXPECT_TRUE(evicted.empty());
+
+  /* Nothing buffered, flushing is a no-op */
+  fanout_client_flush(fanout, fd);
+  EXPECT_EQ(pending.size(), 2u);
+}
+
+TEST_F(FanoutTest, SlowClientEvicted)
+{
+  fanout = fanout_create(4, 16 * 1024, evict_cb, pending_cb, this);
+  ASSERT_NE(fanout, nullptr);
+
+  /* Writes go last client first, evicting the slow one in the middle moves
+   * the last client into its slot */
+  std::vector<size_t> fast = {client_add(), client_add()};
+  size_t slow = client_add();
+  fast.push_back(client_add());
+  int slow_fd = fds[slow - 1];
+
+  std::vector<std::vector<uint8_t>> received(fast.size());
+  for (int i = 0; i < 100; i++) {
+    write_stream(1000 + i);
+    for (size_t c = 0; c < fast.size(); c++) {
+      drain_fd(fds[fast[c]], &received[c]);
+      fanout_client_flush(fanout, fds[fast[c] - 1]);
+    }
+  }
+  for (size_t c = 0; c < fast.size(); c++) {
+    drain_fd(fds[fast[c]], &received[c]);
+  }
+
+  ASSERT_EQ(evicted.size(), 1u);
+  EXPECT_EQ(evicted[0], slow_fd);
+  EXPECT_EQ(fanout_take_evictions(fanout), 1u);
+  EXPECT_EQ(fanout_take_evictions(fanout), 0u);
+  EXPECT_EQ(fanout_client_count(fanout), 3u);
+
+  /* The slow client was pending once its fd filled up */
+  EXPECT_NE(std::find(pending.begin(), pending.end(), std::make_pair(slow_fd, true)),
+            pending.end());
+
+  std::vector<uint8_t> expected = stream_bytes(0, written);
+  for (size_t c = 0; c < fast.size(); c++) {
+    EXPECT_EQ(received[c], expected) << "client " << c;
+  }
+
+  /* An evicted client is no longer flushed or removed */
+  fanout_client_flush(fanout, slow_fd);
+  fanout_client_remove(fanout, slow_fd);
+  EXPECT_EQ(fanout_client_count(fanout), 3u);
+}
+
+/* Two non-blocking UDP sockets on loopback, connected to each other */
+static void udp_pair(int fds[2])
+{
+  struct sockaddr_in addr[2];
+  for (int i = 0; i < 2; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    ASSERT_GE(fds[i], 0);
+    addr[i] = {};
+    addr[i].sin_family = AF_INET;
+    addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr[i]);
+    ASSERT_EQ(bind(fds[i], (struct sockaddr *)&addr[i], length), 0);
+    ASSERT_EQ(getsockname(fds[i], (struct sockaddr *)&addr[i], &length), 0);
+  }
+  ASSERT_EQ(connect(fds[0], (struct sockaddr *)&addr[1], sizeof(addr[1])), 0);
+  ASSERT_EQ(connect(fds[1], (struct sockaddr *)&addr[0], sizeof(addr[0])), 0);
+}
+
+class DgramBatchTest : public ::testing::Test {
+ protected:
+  void TearDown() override
+  {
+    dgram_batch_destroy(&batch);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  /* Frame n is filled with n, so a datagram shows which frames it holds */
+  void add(size_t length, int expected = 0)
+  {
+    std::vector<uint8_t> frame(length, frame_count++);
+    EXPECT_EQ(dgram_batch_add(batch, frame.data(), frame.size()), expected);
+  }
+
+  /* Lengths of the frames in each datagram that arrives */
+  std::vector<std::vector<size_t>> receive()
+  {
+    std::vector<std::vector<size_t>> dgrams;
+    std::vector<uint8_t> buffers(DGRAM_BATCH_MAX * 2048);
+    size_t lengths[DGRAM_BATCH_MAX];
+    int count;
+    while ((count = dgram_recv(fds[1], buffers.data(), 2048, lengths, DGRAM_BATCH_MAX)) > 0) {
+      for (int i = 0; i < count; i++) {
+        const uint8_t *data = &buffers[i * 2048];
+        std::vector<size_t> frames;
+        for (size_t offset = 0; offset < lengths[i];) {
+          size_t length = 0;
+          while (offset + length < lengths[i] && data[offset + length] == data[offset]) {
+            length++;
+          }
+          frames.push_back(length);
+          offset += length;
+        }
+        dgrams.push_back(frames);
+      }
+    }
+    return dgrams;
+  }
+
+  int fds[2] = {-1, -1};
+  dgram_batch_t *batch = NULL;
+  uint8_t frame_count = 0;
+  dgram_stats_t stats = {};
+};
+
+TEST_F(DgramBatchTest, PackedUpToPackSize)
+{
+  udp_pair(fds);
+  batch = dgram_batch_create(1000);
+  ASSERT_NE(batch, nullptr);
+
+  /* A frame that doesn't fit the open datagram starts the next one, one
+   * larger than the pack size goes on its own, none are split */
+  add(300);
+  add(300);
+  add(300);
+  add(200);
+  add(1200);
+  add(50);
+  add(50);
+  EXPECT_FALSE(dgram_batch_empty(batch));
+
+  EXPECT_EQ(dgram_batch_flush(batch, fds[0], &stats), 2400);
+  EXPECT_TRUE(dgram_batch_empty(batch));
+  EXPECT_EQ(stats.syscalls, 1u);
+  EXPECT_EQ(stats.datagrams, 4u);
+  EXPECT_EQ(stats.frames, 7u);
+  EXPECT_EQ(stats.bytes, 2400u);
+
+  std::vector<std::vector<size_t>> expected = {{300, 300, 300}, {200}, {1200}, {50, 50}};
+  EXPECT_EQ(receive(), expected);
+
+  /* After a flush the next frame starts a new datagram */
+  add(10);
+  EXPECT_EQ(dgram_batch_flush(batch, fds[0], &stats), 10);
+  EXPECT_EQ(receive(), std::vector<std::vector<size_t>>({{10}}));
+}
+
+TEST_F(DgramBatchTest, UnpackedAndFull)
+{
+  udp_pair(fds);
+  batch = dgram_batch_create(0);
+  ASSERT_NE(batch, nullptr);
+
+  /* Every frame is a datagram of its own, a batch holds DGRAM_BATCH_MAX */
+  for (int i = 0; i < DGRAM_BATCH_MAX; i++) {
+    add(20);
+  }
+  add(20, -1);
+
+  EXPECT_EQ(dgram_batch_flush(batch, fds[0], &stats), DGRAM_BATCH_MAX * 20);
+  EXPECT_EQ(stats.datagrams, (uint32_t)DGRAM_BATCH_MAX);
+  EXPECT_EQ(receive(), std::vector<std::vector<size_t>>(DGRAM_BATCH_MAX, {20}));
+
+  /* Out of buffer space, and too large for even an empty batch */
+  add(60000);
+  add(10000, -1);
+  EXPECT_EQ(dgram_batch_flush(batch, fds[0], &stats), 60000);
+  add(70000, -1);
+  EXPECT_TRUE(dgram_batch_empty(batch));
+}
+
+TEST_F(DgramBatchTest, FullSocketDropsWholeDatagrams)
+{
+  /* A unix datagram socket refuses datagrams once the sender's buffer is
+   * full, where UDP would drop them silently */
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds), 0);
+  int size = 16384;
+  ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)), 0);
+  batch = dgram_batch_create(1500);
+  ASSERT_NE(batch, nullptr);
+
+  for (int i = 0; i < DGRAM_BATCH_MAX * 2; i++) {
+    add(700);
+  }
+  ssize_t sent = dgram_batch_flush(batch, fds[0], &stats);
+  EXPECT_GT(sent, 0);
+  EXPECT_LT(stats.datagrams, (uint32_t)DGRAM_BATCH_MAX);
+  EXPECT_EQ(sent, (ssize_t)stats.datagrams * 1400);
+  /* Frames are only counted once the whole batch is out */
+  EXPECT_EQ(stats.frames, 0u);
+  EXPECT_TRUE(dgram_batch_empty(batch));
+
+  std::vector<std::vector<size_t>> dgrams = receive();
+  EXPECT_EQ(dgrams.size(), stats.datagrams);
+  for (auto &dgram : dgrams) {
+    EXPECT_EQ(dgram, std::vector<size_t>({700, 700}));
+  }
+}
+
+class ReplayTest : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    static bool imported = false;
+    if (!imported) {
+      const char *path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+      protocols_import((path != NULL) ? path : PROTOCOL_LIBRARY_PATH_DEFAULT);
+      imported = true;
+    }
+    if (framer_interface_valid("sbp") != 0) {
+      GTEST_SKIP() << "sbp protocol not found";
+    }
+
+    loop = pk_loop_create();
+    ASSERT_NE(loop, nullptr);
+    ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+  }
+
+  void TearDown() override
+  {
+    replay_destroy(&replay);
+    if (log != NULL) fclose(log);
+    if (loop != NULL) pk_loop_destroy(&loop);
+  }
+
+  /* Frames are numbered by their sender id, in the order they are added */
+  void add_frame(uint16_t msg_type, const std::vector<uint8_t> &payload)
+  {
+    std::vector<uint8_t> frame = {0x55,
+                                  (uint8_t)(msg_type & 0xFF),
+                                  (uint8_t)(msg_type >> 8),
+                                  frame_count++,
+                                  0,
+                                  (uint8_t)payload.size()};
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    uint16_t crc = pk_crc16_ccitt(&frame[1], frame.size() - 1, 0);
+    frame.push_back((uint8_t)(crc & 0xFF));
+    frame.push_back((uint8_t)(crc >> 8));
+    frames.insert(frames.end(), frame.begin(), frame.end());
+  }
+
+  /* MSG_GPS_TIME with a valid time source */
+  void add_time(uint16_t wn, uint32_t tow_ms)
+  {
+    add_frame(0x0102,
+              {(uint8_t)(wn & 0xFF),
+               (uint8_t)(wn >> 8),
+               (uint8_t)(tow_ms & 0xFF),
+               (uint8_t)((tow_ms >> 8) & 0xFF),
+               (uint8_t)((tow_ms >> 16) & 0xFF),
+               (uint8_t)(tow_ms >> 24),
+               0,
+               0,
+               0,
+               0,
+               1});
+  }
+
+  void add_other() { add_frame(0x0001, {0xAB}); }
+
+  void start(double speed, bool repeat)
+  {
+    log = tmpfile();
+    ASSERT_NE(log, nullptr);
+    ASSERT_EQ(fwrite(frames.data(), 1, frames.size(), log), frames.size());
+    fflush(log);
+    rewind(log);
+    replay = replay_create(loop, fileno(log), speed, repeat);
+    ASSERT_NE(replay, nullptr);
+  }
+
+  /* Runs the replay on the virtual clock until it ends or frames_max frames
+   * are out. Each wait is overslept by the next of late_ms, if any. */
+  replay_status_t run(size_t frames_max, const std::vector<uint32_t> &late_ms = {})
+  {
+    replay_status_t rs = REPLAY_ERROR;
+    while (released.size() < frames_max) {
+      const uint8_t *frame;
+      uint32_t length;
+      uint32_t wait_ms;
+      rs = replay_next(replay, &frame, &length, &wait_ms);
+      if (rs == REPLAY_FRAME) {
+        released.push_back(std::make_pair(frame[3], pk_loop_now_ms(loop)));
+      } else if (rs == REPLAY_WAIT) {
+        EXPECT_GT(wait_ms, 0u);
+        waits.push_back(wait_ms);
+        uint32_t late = (waits.size() <= late_ms.size()) ? late_ms[waits.size() - 1] : 0;
+        pk_loop_run_simple_with_timeout(loop, wait_ms + late);
+      } else {
+        break;
+      }
+    }
+    return rs;
+  }
+
+  pk_loop_t *loop = NULL;
+  FILE *log = NULL;
+  replay_t *replay = NULL;
+  std::vector<uint8_t> frames;
+  uint8_t frame_count = 0;
+  std::vector<std::pair<uint8_t, u64>> released;
+  std::vector<uint32_t> waits;
+};
+
+TEST_F(ReplayTest, Schedule)
+{
+  add_time(2000, 1000);
+  add_other();
+  add_time(2000, 1200);
+  add_other();
+  /* Backwards, the schedule starts over */
+  add_time(2000, 1100);
+  /* Too far ahead, the schedule starts over */
+  add_time(2000, 21100);
+  add_time(2000, 21400);
+  add_time(2000, WEEK_MS - 100);
+  /* Across the week rollover the schedule carries on */
+  add_time(2001, 100);
+  add_other();
+
+  /* At twice real time */
+  start(2, false);
+  u64 start_ms = pk_loop_now_ms(loop);
+  EXPECT_EQ(run(100), REPLAY_END);
+
+  std::vector<std::pair<uint8_t, u64>> expected = {
+    {0, 0},
+    {1, 0},
+    {2, 100},
+    {3, 100},
+    {4, 100},
+    {5, 100},
+    {6, 250},
+    {7, 250},
+    {8, 350},
+    {9, 350},
+  };
+  for (auto &frame : expected) {
+    frame.second += start_ms;
+  }
+  EXPECT_EQ(released, expected);
+  EXPECT_EQ(waits, std::vector<uint32_t>({100, 150, 100}));
+
+  replay_stats_t stats;
+  replay_take_stats(replay, &stats);
+  EXPECT_EQ(stats.frames, 10u);
+  EXPECT_EQ(stats.late, 0u);
+  EXPECT_EQ(stats.lag_max_ms, 0u);
+  EXPECT_EQ(stats.loops, 0u);
+}
+
+TEST_F(ReplayTest, LateFrames)
+{
+  add_time(2000, 0);
+  add_time(2000, 100);
+  add_time(2000, 200);
+  add_time(2000, 300);
+
+  start(1, false);
+  u64 start_ms = pk_loop_now_ms(loop);
+  /* 30 ms late, then a ms late which is within the loop clock's jitter, then
+   * on time. The schedule doesn't move for a late frame. */
+  EXPECT_EQ(run(100, {30, 1, 0}), REPLAY_END);
+
+  ASSERT_EQ(released.size(), 4u);
+  EXPECT_EQ(released[1].second, start_ms + 130);
+  EXPECT_EQ(released[2].second, start_ms + 201);
+  EXPECT_EQ(released[3].second, start_ms + 300);
+  EXPECT_EQ(waits, std::vector<uint32_t>({100, 70, 99}));
+
+  replay_stats_t stats;
+  replay_take_stats(replay, &stats);
+  EXPECT_EQ(stats.frames, 4u);
+  EXPECT_EQ(stats.late, 1u);
+  EXPECT_EQ(stats.lag_max_ms, 30u);
+}
+
+TEST_F(ReplayTest, LoopRestartsSchedule)
+{
+  add_time(2000, 0);
+  add_time(2000, 100);
+
+  start(1, true);
+  u64 start_ms = pk_loop_now_ms(loop);
+  EXPECT_EQ(run(5), REPLAY_FRAME);
+
+  /* Each pass starts right away, rather than waiting for time to go back */
+  std::vector<std::pair<uint8_t, u64>> expected = {
+    {0, 0},
+    {1, 100},
+    {0, 100},
+    {1, 200},
+    {0, 200},
+  };
+  for (auto &frame : expected) {
+    frame.second += start_ms;
+  }
+  EXPECT_EQ(released, expected);
+
+  replay_stats_t stats;
+  replay_take_stats(replay, &stats);
+  EXPECT_EQ(stats.loops, 2u);
+  EXPECT_EQ(stats.late, 0u);
+}
+
+class CanBridgeTest : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    const char *name = getenv(CAN_TEST_INTERFACE_ENV_NAME);
+    name = (name != NULL) ? name : CAN_TEST_INTERFACE_DEFAULT;
+    ifindex = if_nametoindex(name);
+    if (ifindex == 0) {
+      GTEST_SKIP() << "CAN interface " << name << " not found";
+    }
+
+    /* Frames sent on a vcan interface only reach other sockets, one socket
+     * stands in for the bus and the other is the adapter's */
+    bus_fd = can_open(CAN_TEST_ID_OUT);
+    bridge_fd = can_open(CAN_TEST_ID_IN);
+    ASSERT_GE(bus_fd, 0);
+    ASSERT_GE(bridge_fd, 0);
+
+    bridge = can_bridge_start(bridge_fd, CAN_TEST_ID_OUT);
+    ASSERT_NE(bridge, nullptr);
+    ops = can_bridge_ops(bridge);
+  }
+
+  void TearDown() override
+  {
+    can_bridge_stop(&bridge);
+    if (bridge_fd >= 0) close(bridge_fd);
+    if (bus_fd >= 0) close(bus_fd);
+  }
+
+  int can_open(canid_t id)
+  {
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) return -1;
+
+    struct can_filter filter = {.can_id = id, .can_mask = CAN_SFF_MASK};
+    struct sockaddr_can addr = {};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifindex;
+    if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) != 0
+        || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /* Waits out a full device queue, like the bridge's write thread does */
+  static void can_send(int fd, const struct can_frame *frame)
+  {
+    while (write(fd, frame, sizeof(*frame)) != sizeof(*frame)) {
+      nanosleep((const struct timespec[]){{0, 100000}}, NULL);
+    }
+  }
+
+  unsigned int ifindex = 0;
+  int bus_fd = -1;
+  int bridge_fd = -1;
+  can_bridge_t *bridge = NULL;
+  const io_ops_t *ops = NULL;
+};
+
+TEST_F(CanBridgeTest, ReadThroughput)
+{
+  auto start = std::chrono::steady_clock::now();
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t dropped = 0;
+  uint32_t out_of_order = 0;
+  uint32_t last = 0;
+  uint8_t buffer[8 * 1024];
+  struct pollfd fd = {.fd = ops->read_fd, .events = POLLIN};
+
+  while (received + dropped < CAN_TEST_FRAMES && elapsed_ms(start) < CAN_TEST_TIMEOUT_ms) {
+    /* Send in bursts, the loop side drains between them */
+    for (int i = 0; i < 64 && sent < CAN_TEST_FRAMES; i++, sent++) {
+      struct can_frame frame = {};
+      frame.can_id = CAN_TEST_ID_IN;
+      frame.can_dlc = sizeof(sent);
+      memcpy(frame.data, &sent, sizeof(sent));
+      can_send(bus_fd, &frame);
+    }
+
+    if (poll(&fd, 1, (sent < CAN_TEST_FRAMES) ? 0 : 100) <= 0) continue;
+    ssize_t length = ops->read(ops->context, buffer, sizeof(buffer));
+    ASSERT_NE(length, 0);
+    for (ssize_t i = 0; i + 4 <= length; i += 4) {
+      uint32_t seq;
+      memcpy(&seq, &buffer[i], sizeof(seq));
+      if (received > 0 && seq <= last) out_of_order++;
+      last = seq;
+      received++;
+    }
+
+    uint32_t read_drops = 0;
+    uint32_t write_drops = 0;
+    ops->take_drops(ops->context, &read_drops, &write_drops);
+    dropped += read_drops;
+  }
+
+  uint64_t ms = elapsed_ms(start);
+  printf("CAN read: %u frames in %llu ms (%.0f frames/s), %u dropped\n",
+         received,
+         (unsigned long long)ms,
+         received * 1000.0 / (ms ? ms : 1),
+         dropped);
+
+  EXPECT_EQ(received + dropped, CAN_TEST_FRAMES);
+  EXPECT_EQ(out_of_order, 0);
+}
+
+TEST_F(CanBridgeTest, WriteThroughput)
+{
+  /* Each iovec is cut into 8 byte frames, the last one shorter */
+  std::vector<uint8_t> data(CAN_TEST_FRAMES * 8 - 4);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (uint8_t)(i / 8);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t received = 0;
+  uint32_t dropped = 0;
+  uint32_t corrupt = 0;
+  size_t offset = 0;
+  struct pollfd fd = {.fd = bus_fd, .events = POLLIN};
+
+  while (received + dropped < CAN_TEST_FRAMES && elapsed_ms(start) < CAN_TEST_TIMEOUT_ms) {
+    if (offset < data.size()) {
+      struct iovec iov = {.iov_base = &data[offset], .iov_len = 64 * 8};
+      if (iov.iov_len > data.size() - offset) iov.iov_len = data.size() - offset;
+      ASSERT_EQ(ops->writev(ops->context, &iov, 1), (ssize_t)iov.iov_len);
+      offset += iov.iov_len;
+    }
+
+    while (poll(&fd, 1, (offset < data.size()) ? 0 : 100) > 0) {
+      struct can_frame frame;
+      if (read(bus_fd, &frame, sizeof(frame)) != sizeof(frame)) break;
+      if (frame.can_id != CAN_TEST_ID_OUT || frame.can_dlc == 0
+          || frame.data[0] != frame.data[frame.can_dlc - 1]) {
+        corrupt++;
+      }
+      received++;
+    }
+
+    uint32_t read_drops = 0;
+    uint32_t write_drops = 0;
+    ops->take_drops(ops->context, &read_drops, &write_drops);
+    dropped += write_drops;
+  }
+
+  uint64_t ms = elapsed_ms(start);
+  printf("CAN write: %u frames in %llu ms (%.0f frames/s), %u dropped\n",
+         received,
+         (unsigned long long)ms,
+         received * 1000.0 / (ms ? ms : 1),
+         dropped);
+
+  EXPECT_EQ(received + dropped, CAN_TEST_FRAMES);
+  EXPECT_EQ(corrupt, 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
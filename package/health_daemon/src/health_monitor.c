@@ -43,7 +43,7 @@ void health_monitor_set_timer_resolution(u32 resolution)
  */
 void health_monitor_reset_timer(health_monitor_t *monitor)
 {
-  pk_loop_timer_reset(monitor->timer_handle);
+  pk_loop_wheel_timer_reset(monitor->loop, monitor->timer_handle);
 }
 
 /*
@@ -157,7 +157,7 @@ void health_monitor_destroy(health_monitor_t **monitor_ptr)
   }
   health_monitor_t *monitor = *monitor_ptr;
   if (monitor->timer_handle != NULL) {
-    pk_loop_remove_handle(monitor->timer_handle);
+    pk_loop_wheel_timer_remove(monitor->loop, monitor->timer_handle);
   }
   free(monitor);
   *monitor_ptr = NULL;
@@ -193,9 +193,10 @@ int health_monitor_init(health_monitor_t *monitor,
       return -1;
     }
 
-    /* Use proxy callback for timer returns */
+    /* Use proxy callback for timer returns, wheel timers make the reset on
+     * every received message cheap */
     monitor->timer_handle =
-      pk_loop_timer_add(monitor->loop, timer_period, health_monitor_timer_callback, monitor);
+      pk_loop_wheel_timer_add(monitor->loop, timer_period, health_monitor_timer_callback, monitor);
     if (monitor->timer_handle == NULL) {
       return -1;
     }
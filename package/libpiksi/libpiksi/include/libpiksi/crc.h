@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/**
+ * @file    crc.h
+ * @brief   Checksums used by the framing protocols.
+ *
+ * @defgroup    crc CRC
+ * @addtogroup  crc
+ * @{
+ */
+
+#ifndef LIBPIKSI_CRC_H
+#define LIBPIKSI_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Compute the CRC16-CCITT used by SBP
+ * @details Polynomial 0x1021, not reflected. Processes eight bytes per step
+ *          (slicing-by-8), results are identical to libsbp's crc16_ccitt().
+ *
+ * @param[in] buf       Data to checksum.
+ * @param[in] len       Length of the data.
+ * @param[in] crc       Initial value, or the result of a previous call to
+ *                      continue a running checksum (SBP uses 0).
+ *
+ * @return              The updated CRC.
+ */
+uint16_t pk_crc16_ccitt(const uint8_t *buf, size_t len, uint16_t crc);
+
+/**
+ * @brief   Compute the CRC24Q used by RTCM3
+ * @details Polynomial 0x864CFB, not reflected. Processes eight bytes per step
+ *          (slicing-by-8).
+ *
+ * @param[in] buf       Data to checksum.
+ * @param[in] len       Length of the data.
+ * @param[in] crc       Initial value, or the result of a previous call to
+ *                      continue a running checksum (RTCM3 uses 0).
+ *
+ * @return              The updated CRC, in the low 24 bits.
+ */
+uint32_t pk_crc24q(const uint8_t *buf, size_t len, uint32_t crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPIKSI_CRC_H */
+
+/** @} */
@@ -183,7 +183,8 @@ ssize_t pk_endpoint_read(pk_endpoint_t *pk_ept, u8 *buffer, size_t count);
  * @details Receive messages from the endpoint context. The callback supplied
  *          will be called for each message received. A single call to this function
  *          may result in several calls to the callback as multiple messages may
- *          be queued.
+ *          be queued. Returning non-zero from the callback stops the receive,
+ *          messages not yet delivered are delivered by the next call.
  *
  * @param[in] pk_ept        Pointer to Piksi endpoint context to use.
  * @param[in] rx_cb         Callback used to process each message.
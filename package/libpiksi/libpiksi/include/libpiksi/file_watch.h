@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/**
+ * @file    file_watch.h
+ *
+ * @brief   Notice writes to a config file from a hot path
+ *
+ * @defgroup    file_watch
+ * @addtogroup  file_watch
+ * @{
+ */
+
+#ifndef LIBPIKSI_FILE_WATCH_H
+#define LIBPIKSI_FILE_WATCH_H
+
+#include <libpiksi/common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Writes are noticed at most this long after the file is closed
+ */
+#define PK_FILE_WATCH_INTERVAL_MS 100
+
+/**
+ * @brief Opaque context for a file watch
+ */
+typedef struct pk_file_watch_s pk_file_watch_t;
+
+/**
+ * @brief Watch a file for writes
+ *
+ * @details Uses a non-blocking inotify handle, no thread is started.
+ *
+ * @param[in] path       The file to watch, must exist
+ *
+ * @return               Pointer to the created context, or NULL on failure
+ */
+pk_file_watch_t *pk_file_watch_create(const char *path);
+
+/**
+ * @brief Destroy a file watch
+ *
+ * @param[inout] watch   The watch being free'd, NULL'd on completion
+ */
+void pk_file_watch_destroy(pk_file_watch_t **watch);
+
+/**
+ * @brief Count of writes to the file noticed so far
+ *
+ * @details Cheap enough to call for every message: the inotify handle is
+ *          only read once per PK_FILE_WATCH_INTERVAL_MS, and any number of
+ *          writes in between bump the generation once. Compare the result
+ *          with the generation last loaded to decide whether to reload.
+ *
+ * @param[in] watch      The watch
+ *
+ * @return               The generation, 0 until the first write
+ */
+unsigned int pk_file_watch_generation(pk_file_watch_t *watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPIKSI_FILE_WATCH_H */
+
+/** @} */
@@ -16,6 +16,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct framer_s framer_t;
 
 typedef void *(*framer_create_fn_t)(void);
@@ -25,11 +29,23 @@ typedef uint32_t (*framer_process_fn_t)(void *state,
                                         uint32_t data_length,
                                         const uint8_t **frame,
                                         uint32_t *frame_length);
+/* Optional: return every frame found in data from one call. Frames are written
+ * to frames/frame_lengths (at most frames_max), the number found to
+ * frame_count, and the number of bytes consumed is returned. Frames remain
+ * valid until the next call into the framer. */
+typedef uint32_t (*framer_process_batch_fn_t)(void *state,
+                                              const uint8_t *data,
+                                              uint32_t data_length,
+                                              const uint8_t **frames,
+                                              uint32_t *frame_lengths,
+                                              uint32_t frames_max,
+                                              uint32_t *frame_count);
 
 int framer_interface_register(const char *name,
                               framer_create_fn_t create,
                               framer_destroy_fn_t destroy,
-                              framer_process_fn_t process);
+                              framer_process_fn_t process,
+                              framer_process_batch_fn_t process_batch);
 int framer_interface_valid(const char *name);
 
 framer_t *framer_create(const char *name);
@@ -39,5 +55,19 @@ uint32_t framer_process(framer_t *framer,
                         uint32_t data_length,
                         const uint8_t **frame,
                         uint32_t *frame_length);
+/* Uses the framer's batch entry point if it has one, otherwise calls the
+ * single frame entry point until data runs out, frames_max is reached or a
+ * frame is returned from outside data, i.e. from the framer's own buffer */
+uint32_t framer_process_batch(framer_t *framer,
+                              const uint8_t *data,
+                              uint32_t data_length,
+                              const uint8_t **frames,
+                              uint32_t *frame_lengths,
+                              uint32_t frames_max,
+                              uint32_t *frame_count);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* SWIFTNAV_FRAMER_H */
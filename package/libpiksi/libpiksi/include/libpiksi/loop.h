@@ -37,6 +37,7 @@ enum {
   LOOP_READ = 0x1,
   LOOP_DISCONNECTED = 0x2,
   LOOP_ERROR = 0x4,
+  LOOP_WRITE = 0x8,
 };
 
 /**
@@ -51,6 +52,26 @@ typedef struct pk_loop_s pk_loop_t;
  */
 typedef void (*pk_loop_cb)(pk_loop_t *loop, void *handle, int status, void *context);
 
+/**
+ * @brief   Piksi Loop Work Signature
+ * @details Called on a worker thread, must not call any loop APIs.
+ */
+typedef void (*pk_loop_work_fn)(void *context);
+
+/**
+ * @brief   Piksi Loop Work Done Signature
+ * @details Called on the loop thread after the work function has returned,
+ *          status is LOOP_ERROR if the work was cancelled instead.
+ */
+typedef void (*pk_loop_work_done_fn)(pk_loop_t *loop, int status, void *context);
+
+/**
+ * @brief   Piksi Loop Post Signature
+ * @details Called on the loop thread, status is LOOP_ERROR if the loop
+ *          was destroyed before the closure could run.
+ */
+typedef void (*pk_loop_post_fn)(pk_loop_t *loop, int status, void *context);
+
 /**
  * @brief   Create a Piksi loop context
  * @details Create a Piksi loop context
@@ -123,6 +144,72 @@ void *pk_loop_timer_add(pk_loop_t *pk_loop, u64 period_ms, pk_loop_cb callback,
  */
 int pk_loop_timer_reset(void *handle);
 
+/**
+ * @brief   Arm a timer to fire once
+ * @details Restart a timer so that it fires once, `delay_ms` from now, and
+ *          then stays stopped until it is armed again. For timers whose next
+ *          deadline is only known after each callback, may be called from
+ *          the timer's own callback. A timer armed this way can no longer be
+ *          passed to pk_loop_timer_reset().
+ *
+ * @param[in] handle        Handle returned from pk_loop_timer_add().
+ * @param[in] delay_ms      Milliseconds until the timer fires, 0 fires it on
+ *                          the next loop iteration.
+ *
+ * @return                  The operation result.
+ * @retval 0                Timer armed successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_timer_once(void *handle, u64 delay_ms);
+
+/**
+ * @brief   Add a timer wheel timer
+ * @details Add a periodic timer to the timer wheel of the loop. Wheel timers
+ *          have a 10 ms resolution and fire between `period_ms` and
+ *          `period_ms + 20` ms after they were armed, in exchange adding,
+ *          resetting and removing them are constant time list operations.
+ *          Use them for watchdog style timeouts which are reset on every
+ *          message, where pk_loop_timer_reset() would re-sort a heap each time.
+ *
+ * @note    The handle is not a loop handle, it must only be passed to the
+ *          pk_loop_wheel_timer_* functions.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] period_ms     Timer period in milliseconds.
+ * @param[in] callback      Callback function.
+ * @param[in] context       User data passed to the callback.
+ *
+ * @return                  Timer handle if added successfully, otherwise NULL
+ */
+void *pk_loop_wheel_timer_add(pk_loop_t *pk_loop,
+                              u64 period_ms,
+                              pk_loop_cb callback,
+                              void *context);
+
+/**
+ * @brief   Reset a timer wheel timer
+ * @details Restart the period of a timer wheel timer, may be called from
+ *          the timer's own callback.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] handle        Handle returned from pk_loop_wheel_timer_add().
+ *
+ * @return                  The operation result.
+ * @retval 0                Timer reset successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_wheel_timer_reset(pk_loop_t *pk_loop, void *handle);
+
+/**
+ * @brief   Remove a timer wheel timer
+ * @details Stop and free a timer wheel timer, may be called from the
+ *          timer's own callback.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] handle        Handle returned from pk_loop_wheel_timer_add().
+ */
+void pk_loop_wheel_timer_remove(pk_loop_t *pk_loop, void *handle);
+
 /**
  * @brief   Add a reader for a given Piksi Endpoint
  * @details Add a reader for a given Piksi Endpoint
@@ -162,6 +249,51 @@ void *pk_loop_poll_add(pk_loop_t *pk_loop, int fd, pk_loop_cb callback, void *co
  */
 void pk_loop_poll_remove(pk_loop_t *pk_loop, void *handle);
 
+/**
+ * @brief   Select the events a poll handle wakes the loop for
+ * @details Poll handles start out waiting for LOOP_READ. A handle can be
+ *          switched to LOOP_WRITE to wait for buffered output to drain, or
+ *          to no events while there is nothing to wait for.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] handle        Poll handle returned by pk_loop_poll_add().
+ * @param[in] events        LOOP_READ and/or LOOP_WRITE, zero stops polling.
+ *
+ * @return                  0 on success, -1 on failure.
+ */
+int pk_loop_poll_events_set(pk_loop_t *pk_loop, void *handle, int events);
+
+/**
+ * @brief   Add a callback run before the loop waits for I/O
+ * @details The callback runs once per loop iteration, after every timer
+ *          and I/O callback of the previous iteration and right before
+ *          the loop blocks again. Output queued during callbacks can be
+ *          flushed here exactly once per batch, without the latency of
+ *          flushing from a timer.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] callback      Callback function.
+ * @param[in] context       User data passed to the callback.
+ *
+ * @return                  Handle if added successfully, otherwise NULL.
+ *                          Remove with pk_loop_remove_handle().
+ */
+void *pk_loop_before_poll_add(pk_loop_t *pk_loop, pk_loop_cb callback, void *context);
+
+/**
+ * @brief   Add a callback run after the loop has handled I/O
+ * @details The callback runs once per loop iteration, right after the I/O
+ *          callbacks of the iteration.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] callback      Callback function.
+ * @param[in] context       User data passed to the callback.
+ *
+ * @return                  Handle if added successfully, otherwise NULL.
+ *                          Remove with pk_loop_remove_handle().
+ */
+void *pk_loop_after_poll_add(pk_loop_t *pk_loop, pk_loop_cb callback, void *context);
+
 /**
  * @brief   Remove a callback handle
  * @details Remove a callback handle from the loop, ending any calls from that context.
@@ -174,6 +306,151 @@ void pk_loop_poll_remove(pk_loop_t *pk_loop, void *handle);
  */
 int pk_loop_remove_handle(void *handle);
 
+/**
+ * @brief   Set the name of a callback handle
+ * @details Set the name used to identify a handle in profiling metrics and
+ *          slow callback logs. Handles that are not named are identified by
+ *          their kind (timer, poll, reader, signal) and an index. Has no effect
+ *          if profiling is not enabled on the loop of the handle.
+ *
+ * @note    The name must be set before the first profile publish (one second
+ *          after the handle is added).
+ *
+ * @param[in] handle        Handle pointer.
+ * @param[in] name          Name of the handle, used as a metrics folder name.
+ *
+ * @return                  The operation result.
+ * @retval 0                Name set successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_handle_name_set(void *handle, const char *name);
+
+/**
+ * @brief   Enable callback profiling
+ * @details Record the call count, total and maximum run time of every callback
+ *          added to the loop after this call. The statistics are published once
+ *          per second under the metrics folder `<metrics_name>/loop/<handle name>`.
+ *          Callbacks running longer than `slow_threshold_us` are logged.
+ *
+ * @note    Profiling may also be enabled for every loop of a process by setting
+ *          the PK_LOOP_PROFILE_THRESHOLD_US environment variable, in which case
+ *          the program name is used as the metrics name.
+ *
+ * @note    Run times are always measured on the real monotonic clock and
+ *          published once per real second, also for a loop running in
+ *          virtual time, where callbacks take no time on the loop clock.
+ *
+ * @param[in] pk_loop            Pointer to the Piksi loop to use.
+ * @param[in] metrics_name       Base metrics folder, typically the program name.
+ * @param[in] slow_threshold_us  Slow callback threshold in microseconds, 0 disables
+ *                               slow callback detection.
+ *
+ * @return                  The operation result.
+ * @retval 0                Profiling enabled successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_profiling_enable(pk_loop_t *pk_loop, const char *metrics_name, u32 slow_threshold_us);
+
+/**
+ * @brief   Run blocking work off the loop thread
+ * @details Run `work_fn` on the libuv worker pool and then call `done_fn`
+ *          on the loop thread. Use this for file system walks, process
+ *          spawning or other blocking work which would otherwise delay
+ *          every other callback of the loop. At most 32 work items may be
+ *          pending per loop, submissions beyond that are rejected.
+ *
+ * @note    The worker pool is shared by all loops of a process and is
+ *          sized by the UV_THREADPOOL_SIZE environment variable (default 4).
+ *          Queue depth and latency metrics are published once per second
+ *          under `<program name>/loop/work` from the first submission on,
+ *          or under the metrics name given to pk_loop_profiling_enable().
+ *
+ * @note    `done_fn` is called exactly once per accepted submission. Work
+ *          which has not started when the loop is destroyed is cancelled
+ *          and `done_fn` is called with LOOP_ERROR.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] work_fn       Function to run on a worker thread.
+ * @param[in] done_fn       Optional function to call on the loop thread.
+ * @param[in] context       User data passed to both functions.
+ *
+ * @return                  The operation result.
+ * @retval 0                Work submitted successfully.
+ * @retval -1               The queue is full or an error occurred.
+ */
+int pk_loop_work_submit(pk_loop_t *pk_loop,
+                        pk_loop_work_fn work_fn,
+                        pk_loop_work_done_fn done_fn,
+                        void *context);
+
+/**
+ * @brief   Get number of pending work items
+ * @details Get the number of items submitted with pk_loop_work_submit()
+ *          whose `done_fn` has not been called yet.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ *
+ * @return                  Number of pending work items.
+ */
+u32 pk_loop_work_queue_depth(pk_loop_t *pk_loop);
+
+/**
+ * @brief   Run a closure on the loop thread
+ * @details Queue `fn` to be called on the thread running the loop. This is
+ *          the only loop function which may be called from any thread, use
+ *          it to hand data from worker threads to the loop instead of pipes
+ *          or mutexes. Closures posted from one thread run in the order they
+ *          were posted, closures posted while the loop is busy are run
+ *          together on the next loop iteration.
+ *
+ * @note    Closures still queued when the loop is destroyed are called
+ *          with LOOP_ERROR from pk_loop_destroy() so that the context can
+ *          be released.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ * @param[in] fn            Function to call on the loop thread.
+ * @param[in] context       User data passed to the function.
+ *
+ * @return                  The operation result.
+ * @retval 0                Closure posted successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_post(pk_loop_t *pk_loop, pk_loop_post_fn fn, void *context);
+
+/**
+ * @brief   Run the loop in virtual time
+ * @details Switch the loop to a simulated clock which starts at 0 ms. Ready
+ *          I/O is handled as usual, but whenever the loop would wait for
+ *          a timer the clock jumps straight to the next deadline, so timer
+ *          driven code runs as fast as it can and in a repeatable order.
+ *          Intended for unit tests and for replaying captures.
+ *
+ * @note    Must be called before any timers or handles are added to the
+ *          loop, fails otherwise. The virtual clock belongs to this loop
+ *          only, work latency metrics of the loop follow it while
+ *          pk_metrics_gettime() stays on the monotonic clock. Endpoint
+ *          connect and send retries wait on another process and keep
+ *          sleeping in real time.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ *
+ * @return                  The operation result.
+ * @retval 0                Virtual time enabled successfully.
+ * @retval -1               An error occurred.
+ */
+int pk_loop_virtual_time_enable(pk_loop_t *pk_loop);
+
+/**
+ * @brief   Get the current loop time
+ * @details Get the time timers of the loop are measured against, this is
+ *          the virtual time if pk_loop_virtual_time_enable() was called.
+ *
+ * @param[in] pk_loop       Pointer to the Piksi loop to use.
+ *
+ * @return                  Loop time in milliseconds.
+ */
+u64 pk_loop_now_ms(pk_loop_t *pk_loop);
+
 /**
  * @brief   Run a Piksi loop.
  * @details Run a Piksi loop until an error occurs or handler requests exit
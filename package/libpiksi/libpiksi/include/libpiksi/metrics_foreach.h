@@ -54,11 +54,45 @@
 #define _M_FOREACH_28(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_27(Context, TheMacro, __VA_ARGS__)
 #define _M_FOREACH_29(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_28(Context, TheMacro, __VA_ARGS__)
 #define _M_FOREACH_30(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_29(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_31(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_30(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_32(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_31(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_33(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_32(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_34(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_33(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_35(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_34(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_36(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_35(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_37(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_36(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_38(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_37(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_39(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_38(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_40(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_39(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_41(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_40(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_42(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_41(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_43(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_42(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_44(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_43(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_45(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_44(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_46(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_45(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_47(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_46(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_48(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_47(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_49(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_48(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_50(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_49(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_51(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_50(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_52(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_51(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_53(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_52(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_54(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_53(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_55(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_54(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_56(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_55(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_57(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_56(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_58(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_57(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_59(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_58(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_60(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_59(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_61(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_60(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_62(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_61(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_63(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_62(Context, TheMacro, __VA_ARGS__)
+#define _M_FOREACH_64(Context, TheMacro, x, ...)   TheMacro(Context, x) _M_FOREACH_63(Context, TheMacro, __VA_ARGS__)
 
 #define _M_FOREACH_NARG(...) _M_FOREACH_NARG_(__VA_ARGS__, _M_FOREACH_RSEQ_N())
 #define _M_FOREACH_NARG_(...) _M_FOREACH_ARG_N(__VA_ARGS__)
-#define _M_FOREACH_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, N, ...) N
-#define _M_FOREACH_RSEQ_N() 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define _M_FOREACH_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, _33, _34, _35, _36, _37, _38, _39, _40, _41, _42, _43, _44, _45, _46, _47, _48, _49, _50, _51, _52, _53, _54, _55, _56, _57, _58, _59, _60, _61, _62, _63, _64, N, ...) N
+#define _M_FOREACH_RSEQ_N() 64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
 
 #define _M_CONCAT(arg1, arg2)   _M_CONCAT1(arg1, arg2)
 #define _M_CONCAT1(arg1, arg2)  _M_CONCAT2(arg1, arg2)
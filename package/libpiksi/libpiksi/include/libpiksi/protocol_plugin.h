@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/**
+ * @file    protocol_plugin.h
+ * @brief   Build glue for protocol framer and filter plugins.
+ *
+ * @defgroup protocol_plugin Protocol Plugin
+ * @addtogroup protocol_plugin
+ * @{
+ *
+ * Protocol plugins are normally built as shared objects that
+ * protocols_import() loads with dlopen(), finding the entry points by name.
+ * Compiled with PK_PROTOCOL_STATIC defined the same sources can be linked
+ * straight into the host instead: the entry points become file local, so
+ * several plugins can share one binary, and a constructor registers them
+ * under the protocol name before main() runs.
+ *
+ * Plugins must not include framer.h or filter.h, their entry point names
+ * collide with the host side API, so the registration functions are
+ * declared here.
+ */
+
+#ifndef LIBPIKSI_PROTOCOL_PLUGIN_H
+#define LIBPIKSI_PROTOCOL_PLUGIN_H
+
+#include <stdint.h>
+#include <syslog.h>
+
+int framer_interface_register(const char *name,
+                              void *(*create)(void),
+                              void (*destroy)(void **state),
+                              uint32_t (*process)(void *state,
+                                                  const uint8_t *data,
+                                                  uint32_t data_length,
+                                                  const uint8_t **frame,
+                                                  uint32_t *frame_length),
+                              uint32_t (*process_batch)(void *state,
+                                                        const uint8_t *data,
+                                                        uint32_t data_length,
+                                                        const uint8_t **frames,
+                                                        uint32_t *frame_lengths,
+                                                        uint32_t frames_max,
+                                                        uint32_t *frame_count));
+
+int filter_interface_register(const char *name,
+                              void *(*create)(const char *filename),
+                              void (*destroy)(void **state),
+                              int (*process)(void *state,
+                                             const uint8_t *msg,
+                                             uint32_t msg_length));
+
+#ifdef PK_PROTOCOL_STATIC
+
+#define PK_PROTOCOL_API static __attribute__((unused))
+
+#define PK_PROTOCOL_FRAMER(name, create, destroy, process, process_batch)                         \
+  static void __attribute__((constructor)) pk_protocol_framer_register(void)                      \
+  {                                                                                                \
+    if (framer_interface_register(name, create, destroy, process, process_batch) != 0) {           \
+      syslog(LOG_ERR, "error registering %s framer", name);                                        \
+    }                                                                                              \
+  }
+
+#define PK_PROTOCOL_FILTER(name, create, destroy, process)                                         \
+  static void __attribute__((constructor)) pk_protocol_filter_register(void)                      \
+  {                                                                                                \
+    if (filter_interface_register(name, create, destroy, process) != 0) {                          \
+      syslog(LOG_ERR, "error registering %s filter", name);                                        \
+    }                                                                                              \
+  }
+
+#else /* PK_PROTOCOL_STATIC */
+
+/* Exported for dlsym(), see protocols_import() */
+#define PK_PROTOCOL_API
+#define PK_PROTOCOL_FRAMER(name, create, destroy, process, process_batch)
+#define PK_PROTOCOL_FILTER(name, create, destroy, process)
+
+#endif /* PK_PROTOCOL_STATIC */
+
+#endif /* LIBPIKSI_PROTOCOL_PLUGIN_H */
+
+/** @} */
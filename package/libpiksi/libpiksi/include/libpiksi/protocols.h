@@ -16,6 +16,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Registers the "none" framer and filter. Protocols linked in statically
+ * (see protocol_plugin.h) register themselves before main() runs. */
+int protocols_register_builtin(void);
+
+/* Registers the builtin protocols, then loads every plugin in path */
 int protocols_import(const char *path);
 
 #endif /* SWIFTNAV_PROTOCOLS_H */
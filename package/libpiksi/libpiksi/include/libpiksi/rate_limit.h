@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/**
+ * @file    rate_limit.h
+ *
+ * @brief   Hold a message stream to a maximum rate
+ *
+ * @defgroup    rate_limit
+ * @addtogroup  rate_limit
+ * @{
+ */
+
+#ifndef LIBPIKSI_RATE_LIMIT_H
+#define LIBPIKSI_RATE_LIMIT_H
+
+#include <libpiksi/common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Lowest rate accepted, once every 1000 seconds
+ */
+#define PK_RATE_LIMIT_MAX_HZ_MIN 1e-3
+
+/**
+ * @brief Fraction of the interval a message may arrive early by
+ *
+ * @details Absorbs jitter on a source already running at the configured rate,
+ *          which would otherwise lose every other message.
+ */
+#define PK_RATE_LIMIT_TOLERANCE_DIV 20
+
+/**
+ * @brief Token bucket holding at most one message
+ *
+ * @details Kept by value so callers can hold them in arrays, the fields are
+ *          private to rate_limit.c.
+ */
+typedef struct {
+  int64_t interval_ns;
+  int64_t credit_ns;
+  int64_t last_ns;
+} pk_rate_limit_t;
+
+/**
+ * @brief Check a rate before passing it to pk_rate_limit_init
+ *
+ * @param[in] max_hz     The rate
+ *
+ * @return               True if finite and at least PK_RATE_LIMIT_MAX_HZ_MIN
+ */
+bool pk_rate_limit_valid(double max_hz);
+
+/**
+ * @brief Set up a rate limit
+ *
+ * @details The bucket starts full, so the first message passes.
+ *
+ * @param[out] limit     The rate limit
+ * @param[in] max_hz     The rate, must pass pk_rate_limit_valid
+ */
+void pk_rate_limit_init(pk_rate_limit_t *limit, double max_hz);
+
+/**
+ * @brief Account for a message
+ *
+ * @details Passes at most one message per interval, so a faster stream is
+ *          decimated evenly rather than passed in bursts.
+ *
+ * @param[inout] limit   The rate limit
+ *
+ * @return               True if the message may pass
+ */
+bool pk_rate_limit_take(pk_rate_limit_t *limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPIKSI_RATE_LIMIT_H */
+
+/** @} */
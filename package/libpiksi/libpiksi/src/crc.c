@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <libpiksi/crc.h>
+
+#define CRC16_POLY (0x1021u)
+#define CRC24Q_POLY (0x864CFBu)
+#define CRC24_MASK (0xFFFFFFu)
+
+#define SLICES (8u)
+
+/* Table k holds the contribution of a byte followed by k zero bytes, so
+ * eight input bytes can be folded into the CRC with eight lookups. */
+static uint16_t crc16_table[SLICES][256];
+static uint32_t crc24q_table[SLICES][256];
+
+/**
+ * @brief crc_tables_init - build the slicing tables when libpiksi is loaded
+ */
+static __attribute__((constructor)) void crc_tables_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc16 = i << 8;
+    uint32_t crc24 = i << 16;
+    for (int bit = 0; bit < 8; bit++) {
+      crc16 = (crc16 & 0x8000u) ? (crc16 << 1) ^ CRC16_POLY : crc16 << 1;
+      crc24 = (crc24 & 0x800000u) ? (crc24 << 1) ^ CRC24Q_POLY : crc24 << 1;
+    }
+    crc16_table[0][i] = (uint16_t)crc16;
+    crc24q_table[0][i] = crc24 & CRC24_MASK;
+  }
+
+  for (uint32_t k = 1; k < SLICES; k++) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint16_t prev16 = crc16_table[k - 1][i];
+      crc16_table[k][i] = (uint16_t)((prev16 << 8) ^ crc16_table[0][prev16 >> 8]);
+      uint32_t prev24 = crc24q_table[k - 1][i];
+      crc24q_table[k][i] = ((prev24 << 8) & CRC24_MASK) ^ crc24q_table[0][prev24 >> 16];
+    }
+  }
+}
+
+uint16_t pk_crc16_ccitt(const uint8_t *buf, size_t len, uint16_t crc)
+{
+  while (len >= SLICES) {
+    crc = crc16_table[7][buf[0] ^ (crc >> 8)] ^ crc16_table[6][buf[1] ^ (crc & 0xFFu)]
+          ^ crc16_table[5][buf[2]] ^ crc16_table[4][buf[3]] ^ crc16_table[3][buf[4]]
+          ^ crc16_table[2][buf[5]] ^ crc16_table[1][buf[6]] ^ crc16_table[0][buf[7]];
+    buf += SLICES;
+    len -= SLICES;
+  }
+
+  while (len-- > 0) {
+    crc = (uint16_t)((crc << 8) ^ crc16_table[0][(crc >> 8) ^ *buf++]);
+  }
+
+  return crc;
+}
+
+uint32_t pk_crc24q(const uint8_t *buf, size_t len, uint32_t crc)
+{
+  crc &= CRC24_MASK;
+
+  while (len >= SLICES) {
+    crc = crc24q_table[7][buf[0] ^ (crc >> 16)] ^ crc24q_table[6][buf[1] ^ ((crc >> 8) & 0xFFu)]
+          ^ crc24q_table[5][buf[2] ^ (crc & 0xFFu)] ^ crc24q_table[4][buf[3]]
+          ^ crc24q_table[3][buf[4]] ^ crc24q_table[2][buf[5]] ^ crc24q_table[1][buf[6]]
+          ^ crc24q_table[0][buf[7]];
+    buf += SLICES;
+    len -= SLICES;
+  }
+
+  while (len-- > 0) {
+    crc = ((crc << 8) & CRC24_MASK) ^ crc24q_table[0][(crc >> 16) ^ *buf++];
+  }
+
+  return crc;
+}
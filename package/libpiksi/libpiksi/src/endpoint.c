@@ -10,6 +10,8 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -38,6 +40,9 @@
 /* Maximum number of reads to service for one socket */
 #define ENDPOINT_SERVICE_MAX (32u)
 
+/* Number of messages pulled from a socket by a single recvmmsg() call */
+#define ENDPOINT_RECV_BATCH (8u)
+
 /* Sleep for a maximum 10ms while waiting for a send to complete */
 #define MAX_SEND_SLEEP_MS (10)
 #define MAX_SEND_SLEEP_NS (MS_TO_NS(MAX_SEND_SLEEP_MS))
@@ -81,6 +86,8 @@ PK_METRICS_TABLE(endpoint_metrics_table, MI,
   PK_METRICS_ENTRY("send/close",         "count",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  send_close_count),
   PK_METRICS_ENTRY("read/close",         "count",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  read_close_count),
   PK_METRICS_ENTRY("read/discard",       "count",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  read_discard_count),
+  PK_METRICS_ENTRY("read/syscalls",      "per_second",  M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  read_syscalls_per_s),
+  PK_METRICS_ENTRY("read/batch",         "max",         M_U32,   M_UPDATE_MAX,     M_RESET_DEF,  read_batch_max),
   PK_METRICS_ENTRY("accept/count",       "total",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  accept_count),
   PK_METRICS_ENTRY("accept/error",       "total",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  accept_error),
   PK_METRICS_ENTRY("disconnect/count",   "total",       M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  disconnect_count)
@@ -137,6 +144,11 @@ struct pk_endpoint_s {
 
   bool warned_on_discard; /**< Warn only once for writes on read-only sockets */
 
+  u8 *recv_batch; /**< Lazily allocated buffer for batched (recvmmsg) reads */
+  size_t recv_lengths[ENDPOINT_RECV_BATCH]; /**< Length of each message held in recv_batch */
+  unsigned int recv_next;  /**< Index of the next undelivered message in recv_batch */
+  unsigned int recv_count; /**< Number of messages held in recv_batch */
+
   pk_endpoint_eagain_fn_t eagain_cb; /**< Invoked when a connection is terminated on EAGAIN */
 };
 
@@ -156,6 +168,10 @@ static int recv_impl(client_context_t *ctx, u8 *buffer, size_t *length_loc);
 
 static int service_reads(client_context_t *ctx, pk_endpoint_receive_cb rx_cb, void *context);
 
+static bool receive_held(pk_endpoint_t *pk_ept, pk_endpoint_receive_cb rx_cb, void *context);
+
+static void wake_endpoint(pk_endpoint_t *ept);
+
 static void send_close_socket_helper(client_context_t *ctx);
 
 static int send_impl(client_context_t *ctx, const u8 *data, size_t length);
@@ -312,6 +328,7 @@ void pk_endpoint_destroy(pk_endpoint_t **pk_ept_loc)
     pk_metrics_destroy(&pk_ept->metrics);
   }
 
+  free(pk_ept->recv_batch);
   free(pk_ept);
   *pk_ept_loc = NULL;
 }
@@ -356,6 +373,13 @@ ssize_t pk_endpoint_read(pk_endpoint_t *pk_ept, u8 *buffer, size_t count)
 {
   if (count == 0) return 0;
 
+  if (pk_ept->recv_next < pk_ept->recv_count) {
+    unsigned int i = pk_ept->recv_next++;
+    size_t length = SWFT_MIN(count, pk_ept->recv_lengths[i]);
+    memcpy(buffer, pk_ept->recv_batch + (i * PK_ENDPOINT_RECV_BUF_SIZE), length);
+    return sizet_to_ssizet(length);
+  }
+
   size_t length = count;
 
   read_handler_fn_t read_handler = NESTED_FN(ssize_t, (client_context_t * client_ctx, void *ctx), {
@@ -378,12 +402,23 @@ int pk_endpoint_receive(pk_endpoint_t *pk_ept, pk_endpoint_receive_cb rx_cb, voi
   ASSERT_TRACE(pk_ept->nonblock);
   ASSERT_TRACE(rx_cb != NULL);
 
+  /* Messages held back by an earlier stop go out before anything newer */
+  if (receive_held(pk_ept, rx_cb, context)) return 0;
+
   read_handler_fn_t read_handler = NESTED_FN(ssize_t, (client_context_t * client_ctx, void *ctx), {
     service_reads(client_ctx, rx_cb, ctx);
     return 0;
   });
 
-  return ssizet_to_int(read_and_receive_common(pk_ept, read_handler, context));
+  int rc = ssizet_to_int(read_and_receive_common(pk_ept, read_handler, context));
+
+  /* A server endpoint is only polled through its eventfd, keep it signalled
+   * while messages are held so the loop comes back for them */
+  if (pk_ept->recv_next < pk_ept->recv_count && pk_ept->wakefd >= 0) {
+    wake_endpoint(pk_ept);
+  }
+
+  return rc;
 }
 
 /**********************************************************************/
@@ -576,6 +611,8 @@ static int connect_un_socket(int fd, const char *path, bool retry_connect)
 
   for (size_t retry = 0; retry <= CONNECT_RETRIES_MAX; retry++) {
 
+    /* Real time even for a virtual loop: no loop is attached yet, and the
+     * wait is for another process to create the socket */
     if (retry > 0) nanosleep_autoresume(0, MS_TO_NS(CONNECT_RETRY_SLEEP_MS));
 
     rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
@@ -682,12 +719,19 @@ static int recv_impl(client_context_t *ctx, u8 *buffer, size_t *length_loc)
   return PKE_SUCCESS;
 }
 
-static int service_reads(client_context_t *ctx, pk_endpoint_receive_cb rx_cb, void *context)
+/**
+ * @brief service_reads_single - receive one message per recvmsg() call
+ */
+static int service_reads_single(client_context_t *ctx,
+                                size_t serviced,
+                                pk_endpoint_receive_cb rx_cb,
+                                void *context)
 {
-  for (size_t i = 0; i < ENDPOINT_SERVICE_MAX; i++) {
+  for (size_t i = serviced; i < ENDPOINT_SERVICE_MAX; i++) {
     u8 buffer[PK_ENDPOINT_RECV_BUF_SIZE] = {0};
     size_t length = sizeof(buffer);
     int rc = recv_impl(ctx, buffer, &length);
+    PK_METRICS_UPDATE(MR(ctx->ept), MI.read_syscalls_per_s);
     if (rc < 0) {
       if (rc == PKE_EAGAIN || rc == PKE_NOT_CONN) break;
       PK_LOG_ANNO(LOG_ERR, "failed to receive message");
@@ -700,6 +744,138 @@ static int service_reads(client_context_t *ctx, pk_endpoint_receive_cb rx_cb, vo
   return 0;
 }
 
+/**
+ * @brief receive_held - dispatch messages left in the receive batch by a stop
+ * @return true if @c rx_cb requested a stop
+ */
+static bool receive_held(pk_endpoint_t *pk_ept, pk_endpoint_receive_cb rx_cb, void *context)
+{
+  while (pk_ept->recv_next < pk_ept->recv_count) {
+    unsigned int i = pk_ept->recv_next++;
+    u8 *data = pk_ept->recv_batch + (i * PK_ENDPOINT_RECV_BUF_SIZE);
+    if (rx_cb(data, pk_ept->recv_lengths[i], context) != 0) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief hold_batch - keep the undelivered tail of a recvmmsg() batch
+ *
+ * The tail ends at the first zero length message, a closed socket keeps
+ * reporting zero length reads so the close is seen again on the next read.
+ */
+static void hold_batch(pk_endpoint_t *pk_ept, const struct mmsghdr *msgs, int first, int count)
+{
+  int held = first;
+  while (held < count && msgs[held].msg_len > 0) {
+    pk_ept->recv_lengths[held] = msgs[held].msg_len;
+    held++;
+  }
+  pk_ept->recv_next = (unsigned int)first;
+  pk_ept->recv_count = (unsigned int)held;
+}
+
+/* Cleared the first time the kernel reports ENOSYS for recvmmsg() */
+static bool recvmmsg_supported = true;
+
+/**
+ * @brief service_reads - receive and dispatch up to ENDPOINT_SERVICE_MAX messages
+ *
+ * Messages are pulled off the socket ENDPOINT_RECV_BATCH at a time with
+ * recvmmsg(), a short batch means the socket has been drained so no trailing
+ * EAGAIN read is needed.  If @c rx_cb requests a stop, the remainder of the
+ * current batch has already been read from the socket, it is held on the
+ * endpoint and delivered by the next receive.
+ */
+static int service_reads(client_context_t *ctx, pk_endpoint_receive_cb rx_cb, void *context)
+{
+  pk_endpoint_t *pk_ept = ctx->ept;
+
+  /* The batch buffer still holds messages from another client */
+  if (pk_ept->recv_next < pk_ept->recv_count) return 0;
+
+  if (!recvmmsg_supported) {
+    return service_reads_single(ctx, 0, rx_cb, context);
+  }
+
+  if (pk_ept->recv_batch == NULL) {
+    pk_ept->recv_batch = malloc(ENDPOINT_RECV_BATCH * PK_ENDPOINT_RECV_BUF_SIZE);
+    if (pk_ept->recv_batch == NULL) {
+      PK_LOG_ANNO(LOG_WARNING, "failed to allocate receive batch buffer");
+      return service_reads_single(ctx, 0, rx_cb, context);
+    }
+  }
+
+  struct mmsghdr msgs[ENDPOINT_RECV_BATCH];
+  struct iovec iovs[ENDPOINT_RECV_BATCH];
+
+  size_t serviced = 0;
+
+  while (serviced < ENDPOINT_SERVICE_MAX) {
+
+    unsigned int batch = ENDPOINT_RECV_BATCH;
+    if (ENDPOINT_SERVICE_MAX - serviced < batch) {
+      batch = (unsigned int)(ENDPOINT_SERVICE_MAX - serviced);
+    }
+
+    for (unsigned int i = 0; i < batch; i++) {
+      iovs[i].iov_base = pk_ept->recv_batch + (i * PK_ENDPOINT_RECV_BUF_SIZE);
+      iovs[i].iov_len = PK_ENDPOINT_RECV_BUF_SIZE;
+      msgs[i] = (struct mmsghdr){0};
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* MSG_WAITFORONE: block (if the socket is blocking) for the first message
+     * only, then return whatever else is already queued. */
+    int count = recvmmsg(ctx->handle, msgs, batch, MSG_WAITFORONE, NULL);
+
+    if (count < 0) {
+      int err = errno;
+      if (err == EINTR) continue;
+      if (err == ENOSYS) {
+        PK_LOG_ANNO(LOG_INFO, "recvmmsg not supported, falling back to recvmsg");
+        recvmmsg_supported = false;
+        return service_reads_single(ctx, serviced, rx_cb, context);
+      }
+      if (pk_ept->nonblock && err == EAGAIN) break;
+      if (err == ENOTCONN) break;
+      PK_LOG_ANNO(LOG_ERR, "recvmmsg error: %d (%s)", err, strerror(err));
+      PK_LOG_ANNO(LOG_ERR, "failed to receive message");
+      return -1;
+    }
+
+    PK_METRICS_UPDATE(MR(pk_ept), MI.read_syscalls_per_s);
+    PK_METRICS_UPDATE(MR(pk_ept), MI.read_batch_max, PK_METRICS_VALUE((u32)count));
+
+    for (int i = 0; i < count; i++) {
+
+      size_t length = msgs[i].msg_len;
+
+      if (length == 0) {
+        RECV_IMPL_DEBUG_LOG("socket closed");
+        if (ctx->node != NULL) record_disconnect(ctx->node);
+        PK_METRICS_UPDATE(MR(pk_ept), MI.read_close_count);
+        teardown_client(ctx);
+        return 0;
+      }
+
+      bool stop = rx_cb(iovs[i].iov_base, length, context) != 0;
+
+      if (stop) {
+        hold_batch(pk_ept, msgs, i + 1, count);
+        return 0;
+      }
+    }
+
+    serviced += (size_t)count;
+
+    if ((unsigned int)count < batch) break;
+  }
+
+  return 0;
+}
+
 static void send_close_socket_helper(client_context_t *ctx)
 {
   if (ctx->node != NULL) record_disconnect(ctx->node);
@@ -740,6 +916,8 @@ static int send_impl(client_context_t *ctx, const u8 *data, const size_t length)
     if (sendmsg_error == EAGAIN || sendmsg_error == EWOULDBLOCK) {
 
       if (++sleep_count >= MAX_SEND_SLEEP_COUNT) {
+        /* Real time even for a virtual loop, the send blocks the loop until
+         * the peer process drains the socket */
         nanosleep_autoresume(0, SEND_SLEEP_NS);
         continue;
       }
@@ -885,6 +1063,11 @@ static void handle_client_wake(pk_loop_t *loop, void *handle, int status, void *
     return;
   }
 
+  wake_endpoint(ept);
+}
+
+static void wake_endpoint(pk_endpoint_t *ept)
+{
   /* Don't wake-up loop again if one is already pending */
   if (ept->woke) return;
   ept->woke = true;
@@ -1054,6 +1237,9 @@ static pk_endpoint_t *create_impl(const char *endpoint,
     .metrics = NULL,
     .metrics_timer = NULL,
     .warned_on_discard = false,
+    .recv_batch = NULL,
+    .recv_next = 0,
+    .recv_count = 0,
   };
 
   strncpy(pk_ept->path, endpoint, sizeof(pk_ept->path));
@@ -1168,6 +1354,8 @@ static void flush_endpoint_metrics(pk_loop_t *loop, void *handle, int status, vo
   if (MR(pk_ept) != NULL) {
     pk_metrics_flush(MR(pk_ept));
     pk_metrics_reset(MR(pk_ept), MI.wakes_per_s);
+    pk_metrics_reset(MR(pk_ept), MI.read_syscalls_per_s);
+    pk_metrics_reset(MR(pk_ept), MI.read_batch_max);
   }
 
   pk_loop_timer_reset(handle);
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <libpiksi/file_watch.h>
+
+#include <libpiksi/logging.h>
+
+#define NSEC_PER_MSEC 1000000LL
+
+struct pk_file_watch_s {
+  int inotify_fd;
+  unsigned int generation;
+  int64_t next_check_ns;
+};
+
+static int64_t coarse_ns(void)
+{
+  /* Served from the vDSO, no syscall per call */
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+pk_file_watch_t *pk_file_watch_create(const char *path)
+{
+  pk_file_watch_t *watch = calloc(1, sizeof(*watch));
+  if (watch == NULL) {
+    PK_LOG_ANNO(LOG_ERR, "calloc failed");
+    return NULL;
+  }
+
+  watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->inotify_fd < 0) {
+    PK_LOG_ANNO(LOG_ERR, "inotify_init1 failed: %s", strerror(errno));
+    free(watch);
+    return NULL;
+  }
+
+  if (inotify_add_watch(watch->inotify_fd, path, IN_CLOSE_WRITE) < 0) {
+    PK_LOG_ANNO(LOG_ERR, "error watching %s: %s", path, strerror(errno));
+    close(watch->inotify_fd);
+    free(watch);
+    return NULL;
+  }
+
+  watch->generation = 0;
+  watch->next_check_ns = coarse_ns() + PK_FILE_WATCH_INTERVAL_MS * NSEC_PER_MSEC;
+
+  return watch;
+}
+
+void pk_file_watch_destroy(pk_file_watch_t **watch_loc)
+{
+  if (watch_loc == NULL || *watch_loc == NULL) {
+    return;
+  }
+  close((*watch_loc)->inotify_fd);
+  free(*watch_loc);
+  *watch_loc = NULL;
+}
+
+unsigned int pk_file_watch_generation(pk_file_watch_t *watch)
+{
+  int64_t now = coarse_ns();
+  if (now < watch->next_check_ns) {
+    return watch->generation;
+  }
+  watch->next_check_ns = now + PK_FILE_WATCH_INTERVAL_MS * NSEC_PER_MSEC;
+
+  char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  /* Drain every pending event, a burst of writes is one reload */
+  bool changed = false;
+  for (;;) {
+    ssize_t count = read(watch->inotify_fd, buf, sizeof(buf));
+    if (count > 0) {
+      changed = true;
+    } else if (count < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break;
+    }
+  }
+
+  if (changed) {
+    watch->generation++;
+  }
+
+  return watch->generation;
+}
@@ -10,19 +10,23 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <syslog.h>
 
 #include <libpiksi/filter.h>
+#include <libpiksi/table.h>
+
+#define FILTER_NAME_LEN_MAX 64
 
 typedef struct filter_interface_s {
   const char *name;
   filter_create_fn_t create;
   filter_destroy_fn_t destroy;
   filter_process_fn_t process;
-  struct filter_interface_s *next;
 } filter_interface_t;
 
 struct filter_s {
@@ -30,17 +34,30 @@ struct filter_s {
   filter_interface_t *interface;
 };
 
-static filter_interface_t *filter_interface_list = NULL;
+/* Interfaces are keyed by lower cased name so lookups are case insensitive
+ * without a strcasecmp() walk */
+static table_t *filter_interface_table = NULL;
 
-static filter_interface_t *filter_interface_lookup(const char *name)
+static bool filter_interface_key(const char *name, char *key)
 {
-  filter_interface_t *interface;
-  for (interface = filter_interface_list; interface != NULL; interface = interface->next) {
-    if (strcasecmp(name, interface->name) == 0) {
-      return interface;
+  size_t i;
+  for (i = 0; name[i] != '\0'; i++) {
+    if (i == FILTER_NAME_LEN_MAX - 1) {
+      return false;
     }
+    key[i] = (char)tolower((unsigned char)name[i]);
+  }
+  key[i] = '\0';
+  return true;
+}
+
+static filter_interface_t *filter_interface_lookup(const char *name)
+{
+  char key[FILTER_NAME_LEN_MAX];
+  if (filter_interface_table == NULL || !filter_interface_key(name, key)) {
+    return NULL;
   }
-  return NULL;
+  return (filter_interface_t *)table_get(filter_interface_table, key);
 }
 
 int filter_interface_register(const char *name,
@@ -48,6 +65,27 @@ int filter_interface_register(const char *name,
                               filter_destroy_fn_t destroy,
                               filter_process_fn_t process)
 {
+  char key[FILTER_NAME_LEN_MAX];
+  if (!filter_interface_key(name, key)) {
+    syslog(LOG_ERR, "filter name too long: %s", name);
+    return -1;
+  }
+
+  /* No limit on the number of filters, the table grows as needed */
+  if (filter_interface_table == NULL) {
+    filter_interface_table = table_create(SIZE_MAX);
+    if (filter_interface_table == NULL) {
+      syslog(LOG_ERR, "error allocating filter interface table");
+      return -1;
+    }
+  }
+
+  /* The first interface registered under a name takes effect */
+  if (table_get(filter_interface_table, key) != NULL) {
+    syslog(LOG_WARNING, "filter already registered: %s", name);
+    return 0;
+  }
+
   filter_interface_t *interface = (filter_interface_t *)malloc(sizeof(*interface));
   if (interface == NULL) {
     syslog(LOG_ERR, "error allocating filter interface");
@@ -59,7 +97,6 @@ int filter_interface_register(const char *name,
     .create = create,
     .destroy = destroy,
     .process = process,
-    .next = NULL,
   };
 
   if (interface->name == NULL) {
@@ -69,12 +106,13 @@ int filter_interface_register(const char *name,
     return -1;
   }
 
-  /* Add to list */
-  filter_interface_t **p_next = &filter_interface_list;
-  while (*p_next != NULL) {
-    p_next = &(*p_next)->next;
+  if (!table_put(filter_interface_table, key, interface)) {
+    syslog(LOG_ERR, "error registering filter interface: %s", name);
+    free((void *)interface->name);
+    free(interface);
+    interface = NULL;
+    return -1;
   }
-  *p_next = interface;
 
   return 0;
 }
@@ -10,19 +10,24 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <syslog.h>
 
 #include <libpiksi/framer.h>
+#include <libpiksi/table.h>
+
+#define FRAMER_NAME_LEN_MAX 64
 
 typedef struct framer_interface_s {
   const char *name;
   framer_create_fn_t create;
   framer_destroy_fn_t destroy;
   framer_process_fn_t process;
-  struct framer_interface_s *next;
+  framer_process_batch_fn_t process_batch;
 } framer_interface_t;
 
 struct framer_s {
@@ -30,24 +35,59 @@ struct framer_s {
   framer_interface_t *interface;
 };
 
-static framer_interface_t *framer_interface_list = NULL;
+/* Interfaces are keyed by lower cased name so lookups are case insensitive
+ * without a strcasecmp() walk */
+static table_t *framer_interface_table = NULL;
 
-static framer_interface_t *framer_interface_lookup(const char *name)
+static bool framer_interface_key(const char *name, char *key)
 {
-  framer_interface_t *interface;
-  for (interface = framer_interface_list; interface != NULL; interface = interface->next) {
-    if (strcasecmp(name, interface->name) == 0) {
-      return interface;
+  size_t i;
+  for (i = 0; name[i] != '\0'; i++) {
+    if (i == FRAMER_NAME_LEN_MAX - 1) {
+      return false;
     }
+    key[i] = (char)tolower((unsigned char)name[i]);
   }
-  return NULL;
+  key[i] = '\0';
+  return true;
+}
+
+static framer_interface_t *framer_interface_lookup(const char *name)
+{
+  char key[FRAMER_NAME_LEN_MAX];
+  if (framer_interface_table == NULL || !framer_interface_key(name, key)) {
+    return NULL;
+  }
+  return (framer_interface_t *)table_get(framer_interface_table, key);
 }
 
 int framer_interface_register(const char *name,
                               framer_create_fn_t create,
                               framer_destroy_fn_t destroy,
-                              framer_process_fn_t process)
+                              framer_process_fn_t process,
+                              framer_process_batch_fn_t process_batch)
 {
+  char key[FRAMER_NAME_LEN_MAX];
+  if (!framer_interface_key(name, key)) {
+    syslog(LOG_ERR, "framer name too long: %s", name);
+    return -1;
+  }
+
+  /* Not capped, the table grows with every protocol found */
+  if (framer_interface_table == NULL) {
+    framer_interface_table = table_create(SIZE_MAX);
+    if (framer_interface_table == NULL) {
+      syslog(LOG_ERR, "error allocating framer interface table");
+      return -1;
+    }
+  }
+
+  /* The first interface registered under a name takes effect */
+  if (table_get(framer_interface_table, key) != NULL) {
+    syslog(LOG_WARNING, "framer already registered: %s", name);
+    return 0;
+  }
+
   framer_interface_t *interface = (framer_interface_t *)malloc(sizeof(*interface));
   if (interface == NULL) {
     syslog(LOG_ERR, "error allocating framer interface");
@@ -59,7 +99,7 @@ int framer_interface_register(const char *name,
     .create = create,
     .destroy = destroy,
     .process = process,
-    .next = NULL,
+    .process_batch = process_batch,
   };
 
   if (interface->name == NULL) {
@@ -69,12 +109,13 @@ int framer_interface_register(const char *name,
     return -1;
   }
 
-  /* Add to list */
-  framer_interface_t **p_next = &framer_interface_list;
-  while (*p_next != NULL) {
-    p_next = &(*p_next)->next;
+  if (!table_put(framer_interface_table, key, interface)) {
+    syslog(LOG_ERR, "error registering framer interface: %s", name);
+    free((void *)interface->name);
+    free(interface);
+    interface = NULL;
+    return -1;
   }
-  *p_next = interface;
 
   return 0;
 }
@@ -133,3 +174,46 @@ uint32_t framer_process(framer_t *framer,
 {
   return framer->interface->process(framer->state, data, data_length, frame, frame_length);
 }
+
+uint32_t framer_process_batch(framer_t *framer,
+                              const uint8_t *data,
+                              uint32_t data_length,
+                              const uint8_t **frames,
+                              uint32_t *frame_lengths,
+                              uint32_t frames_max,
+                              uint32_t *frame_count)
+{
+  if (framer->interface->process_batch != NULL) {
+    return framer->interface->process_batch(framer->state,
+                                            data,
+                                            data_length,
+                                            frames,
+                                            frame_lengths,
+                                            frames_max,
+                                            frame_count);
+  }
+
+  uint32_t offset = 0;
+  uint32_t count = 0;
+
+  while (offset < data_length && count < frames_max) {
+    offset += framer->interface->process(framer->state,
+                                         &data[offset],
+                                         data_length - offset,
+                                         &frames[count],
+                                         &frame_lengths[count]);
+    if (frames[count] == NULL) {
+      break;
+    }
+    /* Frames found in place stay valid along with data. A frame completed in
+     * the framer's own buffer is handed out on its own, the next call may
+     * overwrite it. */
+    const uint8_t *frame = frames[count++];
+    if (frame < data || frame >= &data[data_length]) {
+      break;
+    }
+  }
+
+  *frame_count = count;
+  return offset;
+}
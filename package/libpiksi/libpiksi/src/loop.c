@@ -10,15 +10,55 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+
 #include <uv.h>
 
+#include <libpiksi/cast_check.h>
 #include <libpiksi/endpoint.h>
 #include <libpiksi/logging.h>
 #include <libpiksi/loop.h>
+#include <libpiksi/metrics.h>
 #include <libpiksi/util.h>
 
+#include <libpiksi/metrics_table.h>
+
 #define MSG_BUF_SIZE 128
 
+#define PROFILE_ENV_NAME "PK_LOOP_PROFILE_THRESHOLD_US"
+#define PROFILE_FLUSH_PERIOD_ms 1000
+#define PROFILE_NAME_LEN 64
+
+#define WORK_QUEUE_DEPTH_MAX 32
+#define WORK_FLUSH_PERIOD_ms 1000
+
+#define WHEEL_TICK_ms 10
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1u << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK ((u64)WHEEL_SLOTS - 1)
+#define WHEEL_MAX_TICKS ((1ull << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1)
+
+#define MI work_metrics_indexes
+#define MT work_metrics_table
+
+#define MR(X) ((X)->work_metrics)
+
+/* clang-format off */
+PK_METRICS_TABLE(work_metrics_table, MI,
+  PK_METRICS_ENTRY("queue/depth",  "current",     M_U32,   M_UPDATE_ASSIGN,  M_RESET_DEF,  depth),
+  PK_METRICS_ENTRY("queue/depth",  "max",         M_U32,   M_UPDATE_MAX,     M_RESET_DEF,  depth_max),
+  PK_METRICS_ENTRY("submitted",    "per_second",  M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  submitted),
+  PK_METRICS_ENTRY("rejected",     "per_second",  M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  rejected),
+  PK_METRICS_ENTRY("completed",    "per_second",  M_U32,   M_UPDATE_COUNT,   M_RESET_DEF,  completed),
+  PK_METRICS_ENTRY("latency",      "max",         M_TIME,  M_UPDATE_MAX,     M_RESET_DEF,  latency_max)
+  )
+/* clang-format on */
+
 /**
  * Libuv for some reason gets a file descriptor value of 0 (which appears
  * to be valid) in the docker unit test environment... however, it later
@@ -28,6 +68,27 @@
  */
 /* #define UNIT_TEST_WORKAROUND */
 
+/**
+ * @brief Callback Profile
+ *
+ * Per-handle statistics that are accumulated while profiling is enabled
+ * on the loop, they are published and cleared by the profile timer.
+ */
+typedef struct {
+  char name[PROFILE_NAME_LEN];
+  u32 count;
+  u32 slow_count;
+  u64 total_ns;
+  u64 max_ns;
+  bool slow_logged;
+  bool metrics_failed;
+  pk_metrics_t *metrics;
+  size_t idx_count;
+  size_t idx_slow_count;
+  size_t idx_total;
+  size_t idx_max;
+} pk_callback_profile_t;
+
 /**
  * @brief Loop Callback Context
  *
@@ -37,8 +98,82 @@
 typedef struct pk_callback_ctx_s {
   pk_loop_cb callback;
   void *data;
+  pk_callback_profile_t *profile;
+  bool virtual_armed; /**< Timer is scheduled in virtual time */
+  u64 virtual_due_ms;
+  u64 virtual_period_ms;
 } pk_callback_ctx_t;
 
+/**
+ * @brief Loop Work Request
+ *
+ * Work submitted with pk_loop_work_submit(), kept in a list on the loop
+ * so that queued work can be cancelled when the loop is destroyed.
+ */
+typedef struct pk_work_req_s {
+  uv_work_t uv_work;
+  pk_loop_work_fn work_fn;
+  pk_loop_work_done_fn done_fn;
+  void *context;
+  u64 submit_ns;
+  struct pk_work_req_s *prev;
+  struct pk_work_req_s *next;
+} pk_work_req_t;
+
+/**
+ * @brief Timer Wheel Node
+ *
+ * Intrusive circular list node, each wheel slot is a list head.
+ */
+typedef struct pk_wheel_node_s {
+  struct pk_wheel_node_s *prev;
+  struct pk_wheel_node_s *next;
+} pk_wheel_node_t;
+
+/**
+ * @brief Timer Wheel Timer
+ *
+ * Returned as the handle from pk_loop_wheel_timer_add().
+ */
+typedef struct {
+  pk_wheel_node_t node; /**< Must be first, the node is cast back to the timer */
+  u64 expires;          /**< Wheel tick the timer expires on */
+  u64 period_ticks;
+  u8 level;
+  u8 slot;
+  pk_loop_cb callback;
+  void *context;
+} pk_wheel_timer_t;
+
+/**
+ * @brief Hierarchical Timer Wheel
+ *
+ * Each level has 64 slots, a slot on level N covers 64^N ticks. Timers are
+ * placed on the lowest level that can hold their expiry and cascade down
+ * a level each time the level below wraps. A single uv timer wakes the
+ * loop for the next occupied slot only.
+ */
+typedef struct {
+  uv_timer_t *uv_timer;
+  u64 base_ms;  /**< Loop time of tick 0 */
+  u64 now_tick; /**< All timers up to and including this tick have fired */
+  u64 wake_tick;
+  u64 occupied[WHEEL_LEVELS];
+  pk_wheel_node_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} pk_timer_wheel_t;
+
+/**
+ * @brief Loop Post Entry
+ *
+ * Closure submitted with pk_loop_post(), entries are pushed on to a
+ * lock-free stack by any thread and drained in batches on the loop thread.
+ */
+typedef struct pk_post_entry_s {
+  pk_loop_post_fn fn;
+  void *context;
+  struct pk_post_entry_s *next;
+} pk_post_entry_t;
+
 /**
  * @brief Piksi Loop Context
  *
@@ -51,6 +186,23 @@ struct pk_loop_s {
   uv_timer_t *timeout_timer;
   int uv_last_error;
   char uv_error_msg[MSG_BUF_SIZE];
+  uv_timer_t *profile_timer;
+  char *profile_metrics_name;
+  u64 profile_slow_threshold_ns;
+  u32 profile_handle_count;
+  pk_metrics_t *work_metrics;
+  uv_timer_t *work_timer;
+  bool work_metrics_failed;
+  pk_work_req_t *work_pending;
+  u32 work_depth;
+  uv_async_t *post_async;
+  _Atomic(pk_post_entry_t *) post_head;
+  pk_timer_wheel_t *wheel;
+  bool virtual_time;
+  bool virtual_stopped;
+  bool virtual_timeout_armed;
+  u64 virtual_now_ms;
+  u64 virtual_timeout_ms;
 #ifdef UNIT_TEST_WORKAROUND /* see comment at top of file */
   int uv_handle_copy;
 #endif
@@ -58,6 +210,16 @@ struct pk_loop_s {
 
 /* Forward declare of static - see definition below */
 static void pk_loop_callback_context_destroy(pk_callback_ctx_t **cb_ctx_loc);
+static void *pk_loop_poll_add_kind(pk_loop_t *pk_loop,
+                                   int fd,
+                                   const char *kind,
+                                   pk_loop_cb callback,
+                                   void *context);
+static void pk_loop_work_cancel_all(pk_loop_t *pk_loop);
+static void pk_loop_post_async_callback(uv_async_t *async);
+static void pk_loop_post_drain(pk_loop_t *pk_loop, int status);
+static void pk_loop_wheel_destroy(pk_loop_t *pk_loop);
+static void wheel_timer_handler(uv_timer_t *uv_timer);
 
 /**
  * @brief pk_loop_callback_context_create - factory method for callback contexts
@@ -74,6 +236,8 @@ static pk_callback_ctx_t *pk_loop_callback_context_create(pk_loop_cb callback, v
   }
   cb_ctx->callback = callback;
   cb_ctx->data = data;
+  cb_ctx->profile = NULL;
+  cb_ctx->virtual_armed = false;
 
   return cb_ctx;
 
@@ -91,21 +255,57 @@ static void pk_loop_callback_context_destroy(pk_callback_ctx_t **cb_ctx_loc)
   if (cb_ctx_loc == NULL || *cb_ctx_loc == NULL) {
     return;
   }
+  pk_callback_profile_t *profile = (*cb_ctx_loc)->profile;
+  if (profile != NULL) {
+    pk_metrics_destroy(&profile->metrics);
+    free(profile);
+  }
   free(*cb_ctx_loc);
   *cb_ctx_loc = NULL;
 }
 
+/**
+ * @brief pk_loop_from_uv_handle - get Piksi loop the handle is associated with
+ * @param handle: handle to get loop from
+ * @return Piksi loop context
+ */
+static pk_loop_t *pk_loop_from_uv_handle(uv_handle_t *handle)
+{
+  return uv_loop_get_data(uv_handle_get_loop(handle));
+}
+
+/**
+ * @brief pk_loop_profile_create - allocate profile data for a new handle
+ * @param pk_loop: loop the handle belongs to
+ * @param kind: kind of handle, used to build the default handle name
+ * @return newly allocated profile or NULL if allocation failed
+ */
+static pk_callback_profile_t *pk_loop_profile_create(pk_loop_t *pk_loop, const char *kind)
+{
+  pk_callback_profile_t *profile = calloc(1, sizeof(pk_callback_profile_t));
+  if (profile == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate callback profile");
+    return NULL;
+  }
+  snprintf(profile->name, sizeof(profile->name), "%s_%u", kind, pk_loop->profile_handle_count++);
+  return profile;
+}
+
 /**
  * @brief pk_loop_add_handle_context - add callback context to a handle
  * This is a convenience function that allocates a callback context and
  * associates in with the handle. The context is retrieved from the handle
  * during loop operation to call the appropriate user function + data
  * @param handle: handle that will receive the allocated callback context
+ * @param kind: kind of handle, used to identify the handle while profiling
  * @param callback: Piksi loop callback
  * @param data: User data
  * @return 0 on success, -1 if allocation failed.
  */
-static int pk_loop_add_handle_context(uv_handle_t *handle, pk_loop_cb callback, void *data)
+static int pk_loop_add_handle_context(uv_handle_t *handle,
+                                      const char *kind,
+                                      pk_loop_cb callback,
+                                      void *data)
 {
   assert(handle != NULL);
   pk_callback_ctx_t *cb_ctx = pk_loop_callback_context_create(callback, data);
@@ -113,6 +313,13 @@ static int pk_loop_add_handle_context(uv_handle_t *handle, pk_loop_cb callback,
     piksi_log(LOG_ERR, "Create callback context failed in add handle context");
     goto failure;
   }
+  pk_loop_t *pk_loop = pk_loop_from_uv_handle(handle);
+  if (pk_loop->profile_timer != NULL) {
+    cb_ctx->profile = pk_loop_profile_create(pk_loop, kind);
+    if (cb_ctx->profile == NULL) {
+      goto failure;
+    }
+  }
   uv_handle_set_data(handle, cb_ctx);
 
   return 0;
@@ -122,16 +329,6 @@ failure:
   return -1;
 }
 
-/**
- * @brief pk_loop_from_uv_handle - get Piksi loop the handle is associated with
- * @param handle: handle to get loop from
- * @return Piksi loop context
- */
-static pk_loop_t *pk_loop_from_uv_handle(uv_handle_t *handle)
-{
-  return uv_loop_get_data(uv_handle_get_loop(handle));
-}
-
 /**
  * @brief pk_callback_context_from_uv_handle - get callback context associated with a handle
  * @param handle: handle to get context from
@@ -142,6 +339,54 @@ static pk_callback_ctx_t *pk_callback_context_from_uv_handle(uv_handle_t *handle
   return uv_handle_get_data(handle);
 }
 
+/**
+ * @brief pk_loop_callback_invoke - call the user callback of a handle
+ * When profiling is enabled the run time of the callback is accumulated
+ * in the profile of the handle, and callbacks which take longer than the
+ * configured threshold are logged (once per profile period per handle).
+ * @param loop: Piksi loop the handle belongs to
+ * @param handle: handle that triggered the callback
+ * @param cb_ctx: callback context of the handle
+ * @param status: loop status to pass to the callback
+ */
+static void pk_loop_callback_invoke(pk_loop_t *loop,
+                                    uv_handle_t *handle,
+                                    pk_callback_ctx_t *cb_ctx,
+                                    int status)
+{
+  if (cb_ctx->callback == NULL) {
+    return;
+  }
+
+  pk_callback_profile_t *profile = cb_ctx->profile;
+  if (profile == NULL) {
+    cb_ctx->callback(loop, handle, status, cb_ctx->data);
+    return;
+  }
+
+  /* Real time, not the loop clock: a virtual clock stands still while a
+   * callback runs */
+  u64 start_ns = pk_metrics_gettime().ns;
+  cb_ctx->callback(loop, handle, status, cb_ctx->data);
+  u64 elapsed_ns = pk_metrics_gettime().ns - start_ns;
+
+  profile->count++;
+  profile->total_ns += elapsed_ns;
+  profile->max_ns = SWFT_MAX(profile->max_ns, elapsed_ns);
+
+  if (loop->profile_slow_threshold_ns != 0 && elapsed_ns > loop->profile_slow_threshold_ns) {
+    profile->slow_count++;
+    if (!profile->slow_logged) {
+      piksi_log(LOG_WARNING,
+                "slow loop callback: %s took %" PRIu64 " us (threshold %" PRIu64 " us)",
+                profile->name,
+                elapsed_ns / 1000,
+                loop->profile_slow_threshold_ns / 1000);
+      profile->slow_logged = true;
+    }
+  }
+}
+
 pk_loop_t *pk_loop_create(void)
 {
   pk_loop_t *pk_loop = (pk_loop_t *)malloc(sizeof(pk_loop_t));
@@ -184,8 +429,36 @@ pk_loop_t *pk_loop_create(void)
     goto failure;
   }
 
+  pk_loop->post_async = (uv_async_t *)malloc(sizeof(uv_async_t));
+  if (pk_loop->post_async == NULL) {
+    piksi_log(LOG_ERR, "error creating post async");
+    goto failure;
+  }
+
+  if (uv_async_init(pk_loop->uv_loop, pk_loop->post_async, pk_loop_post_async_callback) != 0) {
+    piksi_log(LOG_ERR, "error initializing post async");
+    free(pk_loop->post_async);
+    pk_loop->post_async = NULL;
+    goto failure;
+  }
+  uv_handle_set_data((uv_handle_t *)pk_loop->post_async, NULL);
+  /* Pending posts alone should not keep the loop running */
+  uv_unref((uv_handle_t *)pk_loop->post_async);
+  atomic_init(&pk_loop->post_head, NULL);
+
   pk_loop->uv_error_msg[0] = '\0';
 
+  const char *profile_threshold = getenv(PROFILE_ENV_NAME);
+  if (profile_threshold != NULL) {
+    unsigned long threshold_us = 0;
+    if (!strtoul_all(10, profile_threshold, &threshold_us) || threshold_us > UINT32_MAX) {
+      piksi_log(LOG_WARNING, "invalid value for %s: %s", PROFILE_ENV_NAME, profile_threshold);
+    } else if (pk_loop_profiling_enable(pk_loop, program_invocation_short_name, (u32)threshold_us)
+               != 0) {
+      piksi_log(LOG_WARNING, "failed to enable loop profiling");
+    }
+  }
+
   return pk_loop;
 
 failure:
@@ -234,6 +507,9 @@ static void pk_loop_destroy_uv_handle(uv_handle_t *handle)
 static void loop_destroy_callback(uv_handle_t *handle, void *arg)
 {
   (void)arg;
+  if (uv_is_closing(handle)) {
+    return;
+  }
   pk_loop_destroy_uv_handle(handle);
 }
 
@@ -254,11 +530,12 @@ static void pk_loop_destroy_uv_loop(uv_loop_t *uv_loop)
   // call destroy on all handles in the loop
   uv_walk(uv_loop, loop_destroy_callback, NULL);
   // run loop to finish handle cleanup, is 'alive' until last handle removed
+  // and until work already running on the pool, which can't be cancelled,
+  // completes, so block for it rather than spin
   while (uv_loop_alive(uv_loop)) {
-    if (uv_run(uv_loop, UV_RUN_NOWAIT) == 0) {
+    if (uv_run(uv_loop, UV_RUN_ONCE) == 0) {
       break;
     }
-    // Shouldn't need to get here but log if we do
     piksi_log(LOG_DEBUG, "Re-running loop to close pending handles");
   }
 #ifdef UNIT_TEST_WORKAROUND /* see comment at top of file */
@@ -276,11 +553,26 @@ void pk_loop_destroy(pk_loop_t **pk_loop_loc)
 
   pk_loop_t *pk_loop = (pk_loop_t *)(*pk_loop_loc);
   pk_loop_destroy_uv_handle((uv_handle_t *)pk_loop->timeout_timer);
+  if (pk_loop->profile_timer != NULL) {
+    /* Unref'd, so closed here rather than freed by pk_loop_destroy_uv_handle() */
+    uv_close((uv_handle_t *)pk_loop->profile_timer, handle_destroy_callback);
+  }
+  if (pk_loop->work_timer != NULL) {
+    uv_close((uv_handle_t *)pk_loop->work_timer, handle_destroy_callback);
+  }
+  pk_loop_work_cancel_all(pk_loop);
+  if (pk_loop->post_async != NULL) {
+    pk_loop_post_drain(pk_loop, LOOP_ERROR);
+    uv_close((uv_handle_t *)pk_loop->post_async, handle_destroy_callback);
+  }
   pk_loop_destroy_uv_loop(pk_loop->uv_loop);
 #ifdef UNIT_TEST_WORKAROUND /* see comment at top of file */
   close(pk_loop->uv_handle_copy);
 #endif
   pk_loop->uv_loop = NULL;
+  pk_loop_wheel_destroy(pk_loop);
+  free(pk_loop->profile_metrics_name);
+  pk_metrics_destroy(&pk_loop->work_metrics);
   free(pk_loop);
 
   *pk_loop_loc = NULL;
@@ -305,9 +597,7 @@ static void signal_handler(uv_signal_t *signal, int signum)
   pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
   assert(signum == pk_loop_get_signal_from_handle(signal));
 
-  if (cb_ctx->callback != NULL) {
-    cb_ctx->callback(loop, handle, LOOP_SUCCESS, cb_ctx->data);
-  }
+  pk_loop_callback_invoke(loop, handle, cb_ctx, LOOP_SUCCESS);
 }
 
 void *pk_loop_signal_handler_add(pk_loop_t *pk_loop, int signal, pk_loop_cb callback, void *context)
@@ -330,7 +620,7 @@ void *pk_loop_signal_handler_add(pk_loop_t *pk_loop, int signal, pk_loop_cb call
     goto failure;
   }
 
-  if (pk_loop_add_handle_context((uv_handle_t *)uv_signal, callback, context) != 0) {
+  if (pk_loop_add_handle_context((uv_handle_t *)uv_signal, "signal", callback, context) != 0) {
     piksi_log(LOG_ERR, "Failed to allocate callback context for signal handler add");
     goto failure;
   }
@@ -352,9 +642,7 @@ static void timer_handler(uv_timer_t *timer)
   pk_loop_t *loop = pk_loop_from_uv_handle(handle);
   pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
 
-  if (cb_ctx->callback != NULL) {
-    cb_ctx->callback(loop, handle, LOOP_SUCCESS, cb_ctx->data);
-  }
+  pk_loop_callback_invoke(loop, handle, cb_ctx, LOOP_SUCCESS);
 }
 
 void *pk_loop_timer_add(pk_loop_t *pk_loop, u64 period_ms, pk_loop_cb callback, void *context)
@@ -372,16 +660,24 @@ void *pk_loop_timer_add(pk_loop_t *pk_loop, u64 period_ms, pk_loop_cb callback,
     goto failure;
   }
 
-  if (uv_timer_start(uv_timer, timer_handler, period_ms, period_ms) != 0) {
+  /* In virtual time the timer is only used as a handle, the loop fires it */
+  if (!pk_loop->virtual_time && uv_timer_start(uv_timer, timer_handler, period_ms, period_ms) != 0) {
     piksi_log(LOG_ERR, "Failed to start timer context");
     goto failure;
   }
 
-  if (pk_loop_add_handle_context((uv_handle_t *)uv_timer, callback, context) != 0) {
+  if (pk_loop_add_handle_context((uv_handle_t *)uv_timer, "timer", callback, context) != 0) {
     piksi_log(LOG_ERR, "Failed to allocate callback context for timer handle add");
     goto failure;
   }
 
+  if (pk_loop->virtual_time) {
+    pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle((uv_handle_t *)uv_timer);
+    cb_ctx->virtual_armed = true;
+    cb_ctx->virtual_period_ms = period_ms;
+    cb_ctx->virtual_due_ms = pk_loop->virtual_now_ms + period_ms;
+  }
+
   return uv_timer;
 
 failure:
@@ -398,6 +694,18 @@ int pk_loop_timer_reset(void *handle)
     return -1;
   }
 
+  pk_loop_t *pk_loop = pk_loop_from_uv_handle((uv_handle_t *)handle);
+  if (pk_loop->virtual_time) {
+    pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle((uv_handle_t *)handle);
+    if (cb_ctx->virtual_period_ms == 0) {
+      piksi_log(LOG_ERR, "Could not reset timer");
+      return -1;
+    }
+    cb_ctx->virtual_armed = true;
+    cb_ctx->virtual_due_ms = pk_loop->virtual_now_ms + cb_ctx->virtual_period_ms;
+    return 0;
+  }
+
   if (uv_timer_again((uv_timer_t *)handle) != 0) {
     piksi_log(LOG_ERR, "Could not reset timer");
     return -1;
@@ -406,155 +714,1345 @@ int pk_loop_timer_reset(void *handle)
   return 0;
 }
 
-/**
- * @brief uv_loop_poll_handler - wrapping callback for uv_poll_t
- * @param poller: poll handle
- * @param status: poll operation status
- * @param events: event that triggered this callback
- */
-static void uv_loop_poll_handler(uv_poll_t *poller, int status, int events)
+int pk_loop_timer_once(void *handle, u64 delay_ms)
 {
-  int loop_status = LOOP_SUCCESS;
-  bool remove = false;
-
-  uv_handle_t *handle = (uv_handle_t *)poller;
-  pk_loop_t *loop = pk_loop_from_uv_handle(handle);
-  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
-
-  if (status < 0) {
-    loop_status |= LOOP_ERROR;
-    loop->uv_last_error = status;
-    strncpy(loop->uv_error_msg, uv_strerror(status), sizeof(loop->uv_error_msg));
-    remove = true;
-  }
+  assert(handle != NULL);
 
-  if (events & UV_READABLE) {
-    loop_status |= LOOP_READ;
+  if (uv_handle_get_type((uv_handle_t *)handle) != UV_TIMER) {
+    piksi_log(LOG_ERR, "Invalid handle passed to timer once: type mismatch");
+    return -1;
   }
 
-  if (events & UV_DISCONNECT) {
-    loop_status |= LOOP_DISCONNECTED;
-    remove = true;
+  pk_loop_t *pk_loop = pk_loop_from_uv_handle((uv_handle_t *)handle);
+  if (pk_loop->virtual_time) {
+    pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle((uv_handle_t *)handle);
+    cb_ctx->virtual_armed = true;
+    cb_ctx->virtual_period_ms = 0;
+    cb_ctx->virtual_due_ms = pk_loop->virtual_now_ms + delay_ms;
+    return 0;
   }
 
-  if (remove) {
-    pk_loop_poll_remove(loop, handle);
+  if (uv_timer_start((uv_timer_t *)handle, timer_handler, delay_ms, 0) != 0) {
+    piksi_log(LOG_ERR, "Could not arm timer");
+    return -1;
   }
 
-  if (cb_ctx->callback != NULL) {
-    cb_ctx->callback(loop, handle, loop_status, cb_ctx->data);
-  }
+  return 0;
 }
 
-void *pk_loop_endpoint_reader_add(pk_loop_t *pk_loop,
-                                  pk_endpoint_t *pk_ept,
-                                  pk_loop_cb callback,
-                                  void *context)
+/**
+ * @brief wheel_list_init - make a wheel node an empty list
+ * @param node: node to initialize
+ */
+static void wheel_list_init(pk_wheel_node_t *node)
 {
-  assert(pk_loop != NULL);
-  assert(pk_ept != NULL);
-  assert(callback != NULL);
+  node->prev = node;
+  node->next = node;
+}
 
-  int poll_fd = pk_endpoint_poll_handle_get(pk_ept);
+/**
+ * @brief wheel_list_unlink - remove a wheel node from its list
+ * @param node: node to remove
+ */
+static void wheel_list_unlink(pk_wheel_node_t *node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  wheel_list_init(node);
+}
 
-  if (poll_fd < 0) {
-    PK_LOG_ANNO(LOG_WARNING, "error fetching poll fd");
-    return NULL;
+/**
+ * @brief wheel_list_splice - move all nodes of a list to an empty list
+ * @param from: list to take the nodes from, left empty
+ * @param to: empty list to move the nodes to
+ */
+static void wheel_list_splice(pk_wheel_node_t *from, pk_wheel_node_t *to)
+{
+  wheel_list_init(to);
+  if (from->next == from) {
+    return;
   }
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  wheel_list_init(from);
+}
 
-  void *poll_handle = pk_loop_poll_add(pk_loop, poll_fd, callback, context);
-
-  if (poll_handle == NULL) {
-    PK_LOG_ANNO(LOG_ERR, "error adding poll fd to loop");
-    return NULL;
+/**
+ * @brief wheel_timer_insert - place a timer in the slot for its expiry
+ * @param wheel: timer wheel
+ * @param timer: timer with expires set after the current wheel tick
+ */
+static void wheel_timer_insert(pk_timer_wheel_t *wheel, pk_wheel_timer_t *timer)
+{
+  u64 delta = timer->expires - wheel->now_tick;
+  u8 level = 0;
+  while (level < WHEEL_LEVELS - 1 && delta >= (1ull << ((level + 1) * WHEEL_SLOT_BITS))) {
+    level++;
   }
+  u8 slot = (u8)((timer->expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK);
 
-  if (pk_endpoint_loop_add(pk_ept, pk_loop) < 0) {
-    PK_LOG_ANNO(LOG_ERR, "error adding loop to endpoint");
-    return NULL;
-  }
+  pk_wheel_node_t *head = &wheel->slots[level][slot];
+  timer->node.prev = head->prev;
+  timer->node.next = head;
+  head->prev->next = &timer->node;
+  head->prev = &timer->node;
 
-  return poll_handle;
+  timer->level = level;
+  timer->slot = slot;
+  wheel->occupied[level] |= 1ull << slot;
 }
 
-void *pk_loop_poll_add(pk_loop_t *pk_loop, int fd, pk_loop_cb callback, void *context)
+/**
+ * @brief wheel_timer_unlink - remove a timer from its slot
+ * @param wheel: timer wheel
+ * @param timer: armed timer
+ */
+static void wheel_timer_unlink(pk_timer_wheel_t *wheel, pk_wheel_timer_t *timer)
 {
-  assert(pk_loop != NULL);
-  assert(fd >= 0);
-  assert(callback != NULL);
-
-  uv_poll_t *uv_poll = (uv_poll_t *)malloc(sizeof(uv_poll_t));
-  if (uv_poll == NULL) {
-    piksi_log(LOG_ERR, "Failed to allocate uv_poll for reader add");
-    goto failure;
+  wheel_list_unlink(&timer->node);
+  pk_wheel_node_t *head = &wheel->slots[timer->level][timer->slot];
+  if (head->next == head) {
+    wheel->occupied[timer->level] &= ~(1ull << timer->slot);
   }
+}
 
-  if (uv_poll_init(pk_loop->uv_loop, uv_poll, fd) != 0) {
-    piksi_log(LOG_ERR, "Failed to init uv_poll");
-    goto failure;
-  }
+/**
+ * @brief wheel_tick_now - get the wheel tick of the current loop time
+ * @param pk_loop: loop the wheel belongs to
+ * @return current tick
+ */
+static u64 wheel_tick_now(pk_loop_t *pk_loop)
+{
+  return (pk_loop_now_ms(pk_loop) - pk_loop->wheel->base_ms) / WHEEL_TICK_ms;
+}
 
-  if (uv_poll_start(uv_poll, UV_READABLE | UV_DISCONNECT, uv_loop_poll_handler) != 0) {
-    piksi_log(LOG_ERR, "Failed to start uv_poll");
-    goto failure;
+/**
+ * @brief wheel_next_tick - find the next tick the wheel has work to do on
+ * This is the next occupied slot on level 0, or the next tick a level
+ * above cascades an occupied slot down.
+ * @param wheel: timer wheel
+ * @return next tick or UINT64_MAX if the wheel is empty
+ */
+static u64 wheel_next_tick(pk_timer_wheel_t *wheel)
+{
+  u64 next = UINT64_MAX;
+  for (u8 level = 0; level < WHEEL_LEVELS; level++) {
+    u64 occupied = wheel->occupied[level];
+    if (occupied == 0) {
+      continue;
+    }
+    u8 shift = level * WHEEL_SLOT_BITS;
+    u64 cur = wheel->now_tick >> shift;
+    u8 rotate = (u8)((cur + 1) & WHEEL_SLOT_MASK);
+    if (rotate != 0) {
+      occupied = (occupied >> rotate) | (occupied << (WHEEL_SLOTS - rotate));
+    }
+    u64 candidate = (cur + 1 + (u64)__builtin_ctzll(occupied)) << shift;
+    next = SWFT_MIN(next, candidate);
   }
+  return next;
+}
 
-  if (pk_loop_add_handle_context((uv_handle_t *)uv_poll, callback, context) != 0) {
-    piksi_log(LOG_ERR, "Failed to allocate callback context for poll add");
-    goto failure;
+/**
+ * @brief wheel_skip_idle - move the wheel up to a tick without stepping
+ * The wheel only steps while it has timers, skipping the ticks before the
+ * next one with work keeps the wheel current after it has been idle.
+ * @param wheel: timer wheel
+ * @param tick: tick to move to, stops short of the next tick with work
+ */
+static void wheel_skip_idle(pk_timer_wheel_t *wheel, u64 tick)
+{
+  u64 next = wheel_next_tick(wheel);
+  if (tick >= next) {
+    tick = next - 1;
+  }
+  if (tick > wheel->now_tick) {
+    wheel->now_tick = tick;
   }
-
-  return uv_poll;
-
-failure:
-  pk_loop_destroy_uv_handle((uv_handle_t *)uv_poll);
-  return NULL;
 }
 
-void pk_loop_poll_remove(pk_loop_t *pk_loop, void *handle)
+/**
+ * @brief wheel_timer_arm - set the expiry of a timer one period from now
+ * The expiry is rounded up by a tick so that a timer never fires early.
+ * @param pk_loop: loop the wheel belongs to
+ * @param timer: timer to arm, must not be in a slot
+ */
+static void wheel_timer_arm(pk_loop_t *pk_loop, pk_wheel_timer_t *timer)
 {
-  (void)pk_loop;
-
-  if (!uv_is_closing((uv_handle_t *)handle)) uv_poll_stop((uv_poll_t *)handle);
-
-  pk_loop_remove_handle((uv_handle_t *)handle);
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  u64 now_tick = wheel_tick_now(pk_loop);
+  wheel_skip_idle(wheel, now_tick);
+  timer->expires = SWFT_MAX(now_tick, wheel->now_tick) + timer->period_ticks + 1;
+  wheel_timer_insert(wheel, timer);
 }
 
-int pk_loop_remove_handle(void *handle)
+/**
+ * @brief wheel_schedule - start the wheel uv timer for the next tick with work
+ * @param pk_loop: loop the wheel belongs to
+ */
+static void wheel_schedule(pk_loop_t *pk_loop)
 {
-  assert(handle != NULL);
-
-  pk_loop_destroy_uv_handle(handle);
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  u64 next = wheel_next_tick(wheel);
+  if (next == wheel->wake_tick) {
+    return;
+  }
+  wheel->wake_tick = next;
+  /* In virtual time the loop fires the wheel at the wake tick */
+  if (pk_loop->virtual_time) {
+    return;
+  }
+  if (next == UINT64_MAX) {
+    uv_timer_stop(wheel->uv_timer);
+    return;
+  }
+  u64 now_ms = uv_now(pk_loop->uv_loop);
+  u64 wake_ms = wheel->base_ms + next * WHEEL_TICK_ms;
+  uv_timer_start(wheel->uv_timer, wheel_timer_handler, wake_ms > now_ms ? wake_ms - now_ms : 0, 0);
+}
 
-  return 0;
+/**
+ * @brief wheel_cascade - move the timers of a slot down to the levels below
+ * @param wheel: timer wheel
+ * @param level: level of the slot
+ * @param slot: slot to cascade
+ */
+static void wheel_cascade(pk_timer_wheel_t *wheel, u8 level, u8 slot)
+{
+  pk_wheel_node_t pending;
+  wheel_list_splice(&wheel->slots[level][slot], &pending);
+  wheel->occupied[level] &= ~(1ull << slot);
+
+  while (pending.next != &pending) {
+    pk_wheel_timer_t *timer = (pk_wheel_timer_t *)pending.next;
+    wheel_list_unlink(&timer->node);
+    wheel_timer_insert(wheel, timer);
+  }
 }
 
-int pk_loop_run_simple(pk_loop_t *pk_loop)
+/**
+ * @brief wheel_step - advance the wheel by one tick and fire expired timers
+ * @param pk_loop: loop the wheel belongs to
+ */
+static void wheel_step(pk_loop_t *pk_loop)
 {
-  assert(pk_loop != NULL);
-  assert(pk_loop->uv_loop != NULL);
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  u64 tick = ++wheel->now_tick;
 
-  uv_run(pk_loop->uv_loop, UV_RUN_DEFAULT);
+  for (u8 level = 1; level < WHEEL_LEVELS; level++) {
+    u8 shift = (u8)(level * WHEEL_SLOT_BITS);
+    if ((tick & ((1ull << shift) - 1)) != 0) {
+      break;
+    }
+    wheel_cascade(wheel, level, (u8)((tick >> shift) & WHEEL_SLOT_MASK));
+  }
 
-  return 0;
+  u8 slot = (u8)(tick & WHEEL_SLOT_MASK);
+  pk_wheel_node_t expired;
+  wheel_list_splice(&wheel->slots[0][slot], &expired);
+  wheel->occupied[0] &= ~(1ull << slot);
+
+  while (expired.next != &expired) {
+    pk_wheel_timer_t *timer = (pk_wheel_timer_t *)expired.next;
+    wheel_list_unlink(&timer->node);
+    /* Re-arm before the callback, which may reset or remove the timer */
+    timer->expires = tick + timer->period_ticks;
+    wheel_timer_insert(wheel, timer);
+    timer->callback(pk_loop, timer, LOOP_SUCCESS, timer->context);
+  }
 }
 
 /**
- * @brief pk_loop_timeout_callback - callback for timeout timer
- * The timeout timers job is to stop the loop after a specified timeout,
- * so it simply calls uv_stop on the loop
- * @param timer: timer handle
+ * @brief wheel_timer_handler - wrapping callback for the wheel uv_timer_t
+ * @param uv_timer: wheel timer handle
  */
-static void pk_loop_timeout_callback(uv_timer_t *timer)
+static void wheel_timer_handler(uv_timer_t *uv_timer)
 {
-  uv_stop(uv_handle_get_loop((uv_handle_t *)timer));
+  pk_loop_t *pk_loop = pk_loop_from_uv_handle((uv_handle_t *)uv_timer);
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+
+  wheel->wake_tick = UINT64_MAX;
+  u64 target = wheel_tick_now(pk_loop);
+  while (wheel->now_tick < target) {
+    wheel_skip_idle(wheel, target);
+    if (wheel->now_tick < target) {
+      wheel_step(pk_loop);
+    }
+  }
+
+  wheel_schedule(pk_loop);
 }
 
-int pk_loop_run_simple_with_timeout(pk_loop_t *pk_loop, u32 timeout_ms)
+/**
+ * @brief pk_loop_wheel_create - lazily create the timer wheel of a loop
+ * @param pk_loop: loop to create the wheel for
+ * @return 0 on success, -1 on failure
+ */
+static int pk_loop_wheel_create(pk_loop_t *pk_loop)
+{
+  pk_timer_wheel_t *wheel = (pk_timer_wheel_t *)calloc(1, sizeof(pk_timer_wheel_t));
+  if (wheel == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate timer wheel");
+    return -1;
+  }
+
+  wheel->uv_timer = (uv_timer_t *)malloc(sizeof(uv_timer_t));
+  if (wheel->uv_timer == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate timer wheel timer");
+    free(wheel);
+    return -1;
+  }
+
+  if (uv_timer_init(pk_loop->uv_loop, wheel->uv_timer) != 0) {
+    piksi_log(LOG_ERR, "Failed to init timer wheel timer");
+    free(wheel->uv_timer);
+    free(wheel);
+    return -1;
+  }
+  uv_handle_set_data((uv_handle_t *)wheel->uv_timer, NULL);
+
+  for (u8 level = 0; level < WHEEL_LEVELS; level++) {
+    for (u8 slot = 0; slot < WHEEL_SLOTS; slot++) {
+      wheel_list_init(&wheel->slots[level][slot]);
+    }
+  }
+  wheel->base_ms = pk_loop_now_ms(pk_loop);
+  wheel->wake_tick = UINT64_MAX;
+
+  pk_loop->wheel = wheel;
+  return 0;
+}
+
+/**
+ * @brief pk_loop_wheel_destroy - free the timer wheel and any remaining timers
+ * The wheel uv timer is closed along with every other handle of the loop.
+ * @param pk_loop: loop to destroy the wheel of
+ */
+static void pk_loop_wheel_destroy(pk_loop_t *pk_loop)
+{
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  if (wheel == NULL) {
+    return;
+  }
+  for (u8 level = 0; level < WHEEL_LEVELS; level++) {
+    for (u8 slot = 0; slot < WHEEL_SLOTS; slot++) {
+      pk_wheel_node_t *head = &wheel->slots[level][slot];
+      while (head->next != head) {
+        pk_wheel_node_t *node = head->next;
+        wheel_list_unlink(node);
+        free(node);
+      }
+    }
+  }
+  free(wheel);
+  pk_loop->wheel = NULL;
+}
+
+void *pk_loop_wheel_timer_add(pk_loop_t *pk_loop, u64 period_ms, pk_loop_cb callback, void *context)
+{
+  assert(pk_loop != NULL);
+  assert(callback != NULL);
+
+  if (pk_loop->wheel == NULL && pk_loop_wheel_create(pk_loop) != 0) {
+    return NULL;
+  }
+
+  pk_wheel_timer_t *timer = (pk_wheel_timer_t *)malloc(sizeof(pk_wheel_timer_t));
+  if (timer == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate wheel timer");
+    return NULL;
+  }
+
+  *timer = (pk_wheel_timer_t){
+    .period_ticks = (period_ms + WHEEL_TICK_ms - 1) / WHEEL_TICK_ms,
+    .callback = callback,
+    .context = context,
+  };
+
+  if (timer->period_ticks == 0) {
+    timer->period_ticks = 1;
+  } else if (timer->period_ticks > WHEEL_MAX_TICKS - 1) {
+    timer->period_ticks = WHEEL_MAX_TICKS - 1;
+  }
+
+  wheel_timer_arm(pk_loop, timer);
+  if (timer->expires < pk_loop->wheel->wake_tick) {
+    wheel_schedule(pk_loop);
+  }
+
+  return timer;
+}
+
+int pk_loop_wheel_timer_reset(pk_loop_t *pk_loop, void *handle)
+{
+  assert(pk_loop != NULL);
+  assert(handle != NULL);
+
+  pk_wheel_timer_t *timer = (pk_wheel_timer_t *)handle;
+  wheel_timer_unlink(pk_loop->wheel, timer);
+  wheel_timer_arm(pk_loop, timer);
+  /* Resets normally push the expiry out, which never needs an earlier wake up */
+  if (timer->expires < pk_loop->wheel->wake_tick) {
+    wheel_schedule(pk_loop);
+  }
+
+  return 0;
+}
+
+void pk_loop_wheel_timer_remove(pk_loop_t *pk_loop, void *handle)
+{
+  assert(pk_loop != NULL);
+
+  if (handle == NULL) {
+    return;
+  }
+
+  pk_wheel_timer_t *timer = (pk_wheel_timer_t *)handle;
+  wheel_timer_unlink(pk_loop->wheel, timer);
+  free(timer);
+}
+
+/**
+ * @brief uv_loop_poll_handler - wrapping callback for uv_poll_t
+ * @param poller: poll handle
+ * @param status: poll operation status
+ * @param events: event that triggered this callback
+ */
+static void uv_loop_poll_handler(uv_poll_t *poller, int status, int events)
+{
+  int loop_status = LOOP_SUCCESS;
+  bool remove = false;
+
+  uv_handle_t *handle = (uv_handle_t *)poller;
+  pk_loop_t *loop = pk_loop_from_uv_handle(handle);
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
+
+  if (status < 0) {
+    loop_status |= LOOP_ERROR;
+    loop->uv_last_error = status;
+    strncpy(loop->uv_error_msg, uv_strerror(status), sizeof(loop->uv_error_msg));
+    remove = true;
+  }
+
+  if (events & UV_READABLE) {
+    loop_status |= LOOP_READ;
+  }
+
+  if (events & UV_WRITABLE) {
+    loop_status |= LOOP_WRITE;
+  }
+
+  if (events & UV_DISCONNECT) {
+    loop_status |= LOOP_DISCONNECTED;
+    remove = true;
+  }
+
+  if (remove) {
+    pk_loop_poll_remove(loop, handle);
+  }
+
+  pk_loop_callback_invoke(loop, handle, cb_ctx, loop_status);
+}
+
+void *pk_loop_endpoint_reader_add(pk_loop_t *pk_loop,
+                                  pk_endpoint_t *pk_ept,
+                                  pk_loop_cb callback,
+                                  void *context)
+{
+  assert(pk_loop != NULL);
+  assert(pk_ept != NULL);
+  assert(callback != NULL);
+
+  int poll_fd = pk_endpoint_poll_handle_get(pk_ept);
+
+  if (poll_fd < 0) {
+    PK_LOG_ANNO(LOG_WARNING, "error fetching poll fd");
+    return NULL;
+  }
+
+  void *poll_handle = pk_loop_poll_add_kind(pk_loop, poll_fd, "reader", callback, context);
+
+  if (poll_handle == NULL) {
+    PK_LOG_ANNO(LOG_ERR, "error adding poll fd to loop");
+    return NULL;
+  }
+
+  if (pk_endpoint_loop_add(pk_ept, pk_loop) < 0) {
+    PK_LOG_ANNO(LOG_ERR, "error adding loop to endpoint");
+    return NULL;
+  }
+
+  return poll_handle;
+}
+
+/**
+ * @brief pk_loop_poll_add_kind - add a poll handle tagged with a handle kind
+ * @param pk_loop: loop to add the poll handle to
+ * @param fd: file descriptor to poll
+ * @param kind: kind of handle, used to identify the handle while profiling
+ * @param callback: Piksi loop callback
+ * @param context: User data
+ * @return poll handle if added successfully, otherwise NULL
+ */
+static void *pk_loop_poll_add_kind(pk_loop_t *pk_loop,
+                                   int fd,
+                                   const char *kind,
+                                   pk_loop_cb callback,
+                                   void *context)
+{
+  assert(pk_loop != NULL);
+  assert(fd >= 0);
+  assert(callback != NULL);
+
+  uv_poll_t *uv_poll = (uv_poll_t *)malloc(sizeof(uv_poll_t));
+  if (uv_poll == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate uv_poll for reader add");
+    goto failure;
+  }
+
+  if (uv_poll_init(pk_loop->uv_loop, uv_poll, fd) != 0) {
+    piksi_log(LOG_ERR, "Failed to init uv_poll");
+    goto failure;
+  }
+
+  if (uv_poll_start(uv_poll, UV_READABLE | UV_DISCONNECT, uv_loop_poll_handler) != 0) {
+    piksi_log(LOG_ERR, "Failed to start uv_poll");
+    goto failure;
+  }
+
+  if (pk_loop_add_handle_context((uv_handle_t *)uv_poll, kind, callback, context) != 0) {
+    piksi_log(LOG_ERR, "Failed to allocate callback context for poll add");
+    goto failure;
+  }
+
+  return uv_poll;
+
+failure:
+  pk_loop_destroy_uv_handle((uv_handle_t *)uv_poll);
+  return NULL;
+}
+
+void *pk_loop_poll_add(pk_loop_t *pk_loop, int fd, pk_loop_cb callback, void *context)
+{
+  return pk_loop_poll_add_kind(pk_loop, fd, "poll", callback, context);
+}
+
+/**
+ * @brief prepare_handler - wrapping callback for uv_prepare_t
+ * @param prepare: prepare handle
+ */
+static void prepare_handler(uv_prepare_t *prepare)
+{
+  uv_handle_t *handle = (uv_handle_t *)prepare;
+  pk_loop_t *loop = pk_loop_from_uv_handle(handle);
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
+
+  pk_loop_callback_invoke(loop, handle, cb_ctx, LOOP_SUCCESS);
+}
+
+/**
+ * @brief check_handler - wrapping callback for uv_check_t
+ * @param check: check handle
+ */
+static void check_handler(uv_check_t *check)
+{
+  uv_handle_t *handle = (uv_handle_t *)check;
+  pk_loop_t *loop = pk_loop_from_uv_handle(handle);
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
+
+  pk_loop_callback_invoke(loop, handle, cb_ctx, LOOP_SUCCESS);
+}
+
+void *pk_loop_before_poll_add(pk_loop_t *pk_loop, pk_loop_cb callback, void *context)
+{
+  assert(pk_loop != NULL);
+  assert(callback != NULL);
+
+  uv_prepare_t *uv_prepare = (uv_prepare_t *)malloc(sizeof(uv_prepare_t));
+  if (uv_prepare == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate prepare context");
+    goto failure;
+  }
+
+  if (uv_prepare_init(pk_loop->uv_loop, uv_prepare) != 0) {
+    piksi_log(LOG_ERR, "Failed to init prepare context");
+    goto failure;
+  }
+
+  if (uv_prepare_start(uv_prepare, prepare_handler) != 0) {
+    piksi_log(LOG_ERR, "Failed to start prepare context");
+    goto failure;
+  }
+
+  if (pk_loop_add_handle_context((uv_handle_t *)uv_prepare, "before_poll", callback, context)
+      != 0) {
+    piksi_log(LOG_ERR, "Failed to allocate callback context for before poll add");
+    goto failure;
+  }
+
+  return uv_prepare;
+
+failure:
+  pk_loop_destroy_uv_handle((uv_handle_t *)uv_prepare);
+  return NULL;
+}
+
+void *pk_loop_after_poll_add(pk_loop_t *pk_loop, pk_loop_cb callback, void *context)
+{
+  assert(pk_loop != NULL);
+  assert(callback != NULL);
+
+  uv_check_t *uv_check = (uv_check_t *)malloc(sizeof(uv_check_t));
+  if (uv_check == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate check context");
+    goto failure;
+  }
+
+  if (uv_check_init(pk_loop->uv_loop, uv_check) != 0) {
+    piksi_log(LOG_ERR, "Failed to init check context");
+    goto failure;
+  }
+
+  if (uv_check_start(uv_check, check_handler) != 0) {
+    piksi_log(LOG_ERR, "Failed to start check context");
+    goto failure;
+  }
+
+  if (pk_loop_add_handle_context((uv_handle_t *)uv_check, "after_poll", callback, context) != 0) {
+    piksi_log(LOG_ERR, "Failed to allocate callback context for after poll add");
+    goto failure;
+  }
+
+  return uv_check;
+
+failure:
+  pk_loop_destroy_uv_handle((uv_handle_t *)uv_check);
+  return NULL;
+}
+
+void pk_loop_poll_remove(pk_loop_t *pk_loop, void *handle)
+{
+  (void)pk_loop;
+
+  if (!uv_is_closing((uv_handle_t *)handle)) uv_poll_stop((uv_poll_t *)handle);
+
+  pk_loop_remove_handle((uv_handle_t *)handle);
+}
+
+int pk_loop_poll_events_set(pk_loop_t *pk_loop, void *handle, int events)
+{
+  (void)pk_loop;
+  assert(handle != NULL);
+
+  uv_poll_t *uv_poll = (uv_poll_t *)handle;
+  if (uv_is_closing((uv_handle_t *)uv_poll)) return -1;
+
+  int uv_events = 0;
+  if (events & LOOP_READ) uv_events |= UV_READABLE | UV_DISCONNECT;
+  if (events & LOOP_WRITE) uv_events |= UV_WRITABLE;
+
+  int rc = (uv_events == 0) ? uv_poll_stop(uv_poll)
+                            : uv_poll_start(uv_poll, uv_events, uv_loop_poll_handler);
+  if (rc != 0) {
+    piksi_log(LOG_ERR, "Failed to update uv_poll events: %s", uv_strerror(rc));
+    return -1;
+  }
+
+  return 0;
+}
+
+int pk_loop_remove_handle(void *handle)
+{
+  assert(handle != NULL);
+
+  pk_loop_destroy_uv_handle(handle);
+
+  return 0;
+}
+
+int pk_loop_handle_name_set(void *handle, const char *name)
+{
+  assert(handle != NULL);
+  assert(name != NULL);
+
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle((uv_handle_t *)handle);
+  if (cb_ctx == NULL) {
+    piksi_log(LOG_ERR, "Invalid handle passed to handle name set");
+    return -1;
+  }
+
+  /* Names only identify handles in profiling output */
+  if (cb_ctx->profile == NULL) {
+    return 0;
+  }
+
+  if (cb_ctx->profile->metrics != NULL) {
+    piksi_log(LOG_WARNING, "handle %s already published, not renaming", cb_ctx->profile->name);
+    return -1;
+  }
+
+  snprintf(cb_ctx->profile->name, sizeof(cb_ctx->profile->name), "%s", name);
+  return 0;
+}
+
+/**
+ * @brief pk_loop_profile_metrics_setup - create the metrics for a profiled handle
+ * Metrics are created lazily on the first publish so that handles can be
+ * named with pk_loop_handle_name_set() after they have been added.
+ * @param pk_loop: loop the handle belongs to
+ * @param profile: profile of the handle
+ * @return 0 on success, -1 on failure
+ */
+static int pk_loop_profile_metrics_setup(pk_loop_t *pk_loop, pk_callback_profile_t *profile)
+{
+  char folder[PATH_MAX];
+  if (!snprintf_warn(folder,
+                     sizeof(folder),
+                     "%s/loop/%s",
+                     pk_loop->profile_metrics_name,
+                     profile->name)) {
+    return -1;
+  }
+
+  profile->metrics = _pk_metrics_create();
+  if (profile->metrics == NULL) {
+    return -1;
+  }
+
+  ssize_t idx_count = pk_metrics_add(profile->metrics,
+                                     folder,
+                                     "count",
+                                     METRICS_TYPE_U32,
+                                     pk_metrics_u32(0),
+                                     pk_metrics_updater_assign,
+                                     pk_metrics_reset_default,
+                                     NULL);
+  ssize_t idx_slow_count = pk_metrics_add(profile->metrics,
+                                          folder,
+                                          "slow_count",
+                                          METRICS_TYPE_U32,
+                                          pk_metrics_u32(0),
+                                          pk_metrics_updater_assign,
+                                          pk_metrics_reset_default,
+                                          NULL);
+  ssize_t idx_total = pk_metrics_add(profile->metrics,
+                                     folder,
+                                     "time_total",
+                                     METRICS_TYPE_TIME,
+                                     pk_metrics_time(PK_METRICS_AS_TIME(0)),
+                                     pk_metrics_updater_assign,
+                                     pk_metrics_reset_default,
+                                     NULL);
+  ssize_t idx_max = pk_metrics_add(profile->metrics,
+                                   folder,
+                                   "time_max",
+                                   METRICS_TYPE_TIME,
+                                   pk_metrics_time(PK_METRICS_AS_TIME(0)),
+                                   pk_metrics_updater_assign,
+                                   pk_metrics_reset_default,
+                                   NULL);
+
+  if (idx_count < 0 || idx_slow_count < 0 || idx_total < 0 || idx_max < 0) {
+    pk_metrics_destroy(&profile->metrics);
+    return -1;
+  }
+
+  profile->idx_count = ssizet_to_sizet(idx_count);
+  profile->idx_slow_count = ssizet_to_sizet(idx_slow_count);
+  profile->idx_total = ssizet_to_sizet(idx_total);
+  profile->idx_max = ssizet_to_sizet(idx_max);
+
+  return 0;
+}
+
+/**
+ * @brief pk_loop_profile_publish - publish and clear the profile of a handle
+ * @param handle: handle passed from uv_walk
+ * @param arg: Piksi loop the handle belongs to
+ */
+static void pk_loop_profile_publish(uv_handle_t *handle, void *arg)
+{
+  pk_loop_t *pk_loop = (pk_loop_t *)arg;
+
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
+  if (cb_ctx == NULL || cb_ctx->profile == NULL || uv_is_closing(handle)) {
+    return;
+  }
+
+  pk_callback_profile_t *profile = cb_ctx->profile;
+
+  if (profile->metrics == NULL && !profile->metrics_failed) {
+    if (pk_loop_profile_metrics_setup(pk_loop, profile) != 0) {
+      piksi_log(LOG_WARNING, "failed to create profile metrics for %s", profile->name);
+      profile->metrics_failed = true;
+    }
+  }
+
+  if (profile->metrics != NULL) {
+    PK_METRICS_UPDATE(profile->metrics, profile->idx_count, PK_METRICS_VALUE(profile->count));
+    PK_METRICS_UPDATE(profile->metrics,
+                      profile->idx_slow_count,
+                      PK_METRICS_VALUE(profile->slow_count));
+    PK_METRICS_UPDATE(profile->metrics,
+                      profile->idx_total,
+                      PK_METRICS_VALUE((pk_metrics_time_t){.ns = profile->total_ns}));
+    PK_METRICS_UPDATE(profile->metrics,
+                      profile->idx_max,
+                      PK_METRICS_VALUE((pk_metrics_time_t){.ns = profile->max_ns}));
+    pk_metrics_flush(profile->metrics);
+  }
+
+  profile->count = 0;
+  profile->slow_count = 0;
+  profile->total_ns = 0;
+  profile->max_ns = 0;
+  profile->slow_logged = false;
+}
+
+/**
+ * @brief pk_loop_profile_timer_callback - periodic publish of callback profiles
+ * @param timer: timer handle
+ */
+static void pk_loop_profile_timer_callback(uv_timer_t *timer)
+{
+  uv_loop_t *uv_loop = uv_handle_get_loop((uv_handle_t *)timer);
+  pk_loop_t *pk_loop = uv_loop_get_data(uv_loop);
+  uv_walk(uv_loop, pk_loop_profile_publish, pk_loop);
+}
+
+int pk_loop_profiling_enable(pk_loop_t *pk_loop, const char *metrics_name, u32 slow_threshold_us)
+{
+  assert(pk_loop != NULL);
+  assert(metrics_name != NULL);
+
+  if (pk_loop->profile_timer != NULL) {
+    piksi_log(LOG_WARNING, "loop profiling already enabled");
+    return -1;
+  }
+
+  pk_loop->profile_metrics_name = strdup(metrics_name);
+  if (pk_loop->profile_metrics_name == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate profile metrics name");
+    goto failure;
+  }
+
+  pk_loop->profile_timer = (uv_timer_t *)malloc(sizeof(uv_timer_t));
+  if (pk_loop->profile_timer == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate profile timer");
+    goto failure;
+  }
+  uv_handle_set_data((uv_handle_t *)pk_loop->profile_timer, NULL);
+
+  if (uv_timer_init(pk_loop->uv_loop, pk_loop->profile_timer) != 0) {
+    piksi_log(LOG_ERR, "Failed to init profile timer");
+    free(pk_loop->profile_timer);
+    pk_loop->profile_timer = NULL;
+    goto failure;
+  }
+
+  if (uv_timer_start(pk_loop->profile_timer,
+                     pk_loop_profile_timer_callback,
+                     PROFILE_FLUSH_PERIOD_ms,
+                     PROFILE_FLUSH_PERIOD_ms)
+      != 0) {
+    piksi_log(LOG_ERR, "Failed to start profile timer");
+    pk_loop_destroy_uv_handle((uv_handle_t *)pk_loop->profile_timer);
+    pk_loop->profile_timer = NULL;
+    goto failure;
+  }
+  /* Publishing profiles alone should not keep the loop running */
+  uv_unref((uv_handle_t *)pk_loop->profile_timer);
+
+  pk_loop->profile_slow_threshold_ns = (u64)slow_threshold_us * 1000;
+
+  return 0;
+
+failure:
+  free(pk_loop->profile_metrics_name);
+  pk_loop->profile_metrics_name = NULL;
+  return -1;
+}
+
+/**
+ * @brief pk_loop_now_ns - loop clock for latency metrics
+ * Each loop keeps its own clock, a virtual loop reports its simulated time
+ * without affecting pk_metrics_gettime() for anything else in the process.
+ * @param pk_loop: loop to read the clock of
+ * @return current loop time in nanoseconds
+ */
+static u64 pk_loop_now_ns(pk_loop_t *pk_loop)
+{
+  if (pk_loop->virtual_time) {
+    return pk_loop->virtual_now_ms * 1000000;
+  }
+  return pk_metrics_gettime().ns;
+}
+
+/**
+ * @brief pk_loop_work_handler - wrapping work callback for uv_work_t
+ * Runs on a thread of the libuv worker pool.
+ * @param uv_work: work request
+ */
+static void pk_loop_work_handler(uv_work_t *uv_work)
+{
+  pk_work_req_t *req = (pk_work_req_t *)uv_work;
+  req->work_fn(req->context);
+}
+
+/**
+ * @brief pk_loop_work_done_handler - wrapping after work callback for uv_work_t
+ * Runs on the loop thread once the work has completed or was cancelled.
+ * @param uv_work: work request
+ * @param status: 0 if the work ran, UV_ECANCELED if it was cancelled
+ */
+static void pk_loop_work_done_handler(uv_work_t *uv_work, int status)
+{
+  pk_work_req_t *req = (pk_work_req_t *)uv_work;
+  pk_loop_t *pk_loop = uv_loop_get_data(uv_work->loop);
+
+  if (req->prev != NULL) {
+    req->prev->next = req->next;
+  } else {
+    pk_loop->work_pending = req->next;
+  }
+  if (req->next != NULL) {
+    req->next->prev = req->prev;
+  }
+  pk_loop->work_depth--;
+
+  u64 latency_ns = pk_loop_now_ns(pk_loop) - req->submit_ns;
+  PK_METRICS_UPDATE(MR(pk_loop), MI.completed);
+  PK_METRICS_UPDATE(MR(pk_loop),
+                    MI.latency_max,
+                    PK_METRICS_VALUE((pk_metrics_time_t){.ns = latency_ns}));
+
+  if (req->done_fn != NULL) {
+    req->done_fn(pk_loop, status == 0 ? LOOP_SUCCESS : LOOP_ERROR, req->context);
+  }
+
+  free(req);
+}
+
+/**
+ * @brief pk_loop_work_timer_callback - periodic publish of work queue metrics
+ * @param timer: timer handle
+ */
+static void pk_loop_work_timer_callback(uv_timer_t *timer)
+{
+  pk_loop_t *pk_loop = uv_loop_get_data(uv_handle_get_loop((uv_handle_t *)timer));
+
+  PK_METRICS_UPDATE(MR(pk_loop), MI.depth, PK_METRICS_VALUE(pk_loop->work_depth));
+  pk_metrics_flush(MR(pk_loop));
+  pk_metrics_reset(MR(pk_loop), MI.submitted);
+  pk_metrics_reset(MR(pk_loop), MI.rejected);
+  pk_metrics_reset(MR(pk_loop), MI.completed);
+  pk_metrics_reset(MR(pk_loop), MI.latency_max);
+  pk_metrics_reset(MR(pk_loop), MI.depth_max);
+  PK_METRICS_UPDATE(MR(pk_loop), MI.depth_max, PK_METRICS_VALUE(pk_loop->work_depth));
+}
+
+/**
+ * @brief pk_loop_work_metrics_start - set up work queue metrics on first use
+ * Published whether or not profiling is enabled, under the profiling metrics
+ * name if there is one and the program name otherwise.
+ * @param pk_loop: loop to publish the work queue of
+ */
+static void pk_loop_work_metrics_start(pk_loop_t *pk_loop)
+{
+  if (pk_loop->work_timer != NULL || pk_loop->work_metrics_failed) {
+    return;
+  }
+
+  const char *metrics_name = pk_loop->profile_metrics_name != NULL
+                               ? pk_loop->profile_metrics_name
+                               : program_invocation_short_name;
+
+  pk_loop->work_metrics = pk_metrics_setup(metrics_name, "loop/work", MT, COUNT_OF(MT));
+  if (pk_loop->work_metrics == NULL) {
+    goto failure;
+  }
+
+  pk_loop->work_timer = (uv_timer_t *)malloc(sizeof(uv_timer_t));
+  if (pk_loop->work_timer == NULL) {
+    goto failure;
+  }
+  uv_handle_set_data((uv_handle_t *)pk_loop->work_timer, NULL);
+
+  if (uv_timer_init(pk_loop->uv_loop, pk_loop->work_timer) != 0) {
+    free(pk_loop->work_timer);
+    pk_loop->work_timer = NULL;
+    goto failure;
+  }
+
+  if (uv_timer_start(pk_loop->work_timer,
+                     pk_loop_work_timer_callback,
+                     WORK_FLUSH_PERIOD_ms,
+                     WORK_FLUSH_PERIOD_ms)
+      != 0) {
+    pk_loop_destroy_uv_handle((uv_handle_t *)pk_loop->work_timer);
+    pk_loop->work_timer = NULL;
+    goto failure;
+  }
+  /* Publishing metrics alone should not keep the loop running */
+  uv_unref((uv_handle_t *)pk_loop->work_timer);
+
+  return;
+
+failure:
+  piksi_log(LOG_WARNING, "failed to create work queue metrics");
+  pk_metrics_destroy(&pk_loop->work_metrics);
+  pk_loop->work_metrics_failed = true;
+}
+
+/**
+ * @brief pk_loop_work_cancel_all - cancel work that has not started yet
+ * Work that is already running cannot be cancelled, it is waited for
+ * when the loop is run to close the remaining handles.
+ * @param pk_loop: loop to cancel work on
+ */
+static void pk_loop_work_cancel_all(pk_loop_t *pk_loop)
+{
+  for (pk_work_req_t *req = pk_loop->work_pending; req != NULL; req = req->next) {
+    uv_cancel((uv_req_t *)&req->uv_work);
+  }
+}
+
+int pk_loop_work_submit(pk_loop_t *pk_loop,
+                        pk_loop_work_fn work_fn,
+                        pk_loop_work_done_fn done_fn,
+                        void *context)
+{
+  assert(pk_loop != NULL);
+  assert(work_fn != NULL);
+
+  pk_loop_work_metrics_start(pk_loop);
+
+  if (pk_loop->work_depth >= WORK_QUEUE_DEPTH_MAX) {
+    PK_METRICS_UPDATE(MR(pk_loop), MI.rejected);
+    piksi_log(LOG_WARNING, "loop work queue full, rejecting work");
+    return -1;
+  }
+
+  pk_work_req_t *req = (pk_work_req_t *)malloc(sizeof(pk_work_req_t));
+  if (req == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate work request");
+    return -1;
+  }
+
+  *req = (pk_work_req_t){
+    .work_fn = work_fn,
+    .done_fn = done_fn,
+    .context = context,
+    .submit_ns = pk_loop_now_ns(pk_loop),
+    .prev = NULL,
+    .next = pk_loop->work_pending,
+  };
+
+  if (uv_queue_work(pk_loop->uv_loop,
+                    &req->uv_work,
+                    pk_loop_work_handler,
+                    pk_loop_work_done_handler)
+      != 0) {
+    piksi_log(LOG_ERR, "Failed to queue work");
+    free(req);
+    return -1;
+  }
+
+  if (pk_loop->work_pending != NULL) {
+    pk_loop->work_pending->prev = req;
+  }
+  pk_loop->work_pending = req;
+  pk_loop->work_depth++;
+
+  PK_METRICS_UPDATE(MR(pk_loop), MI.submitted);
+  PK_METRICS_UPDATE(MR(pk_loop), MI.depth_max, PK_METRICS_VALUE(pk_loop->work_depth));
+
+  return 0;
+}
+
+u32 pk_loop_work_queue_depth(pk_loop_t *pk_loop)
+{
+  assert(pk_loop != NULL);
+  return pk_loop->work_depth;
+}
+
+/**
+ * @brief pk_loop_post_drain - run all closures posted so far
+ * The posted entries are detached from the shared stack in one exchange and
+ * reversed so that they run in the order they were posted.
+ * @param pk_loop: loop to drain
+ * @param status: loop status to pass to the closures
+ */
+static void pk_loop_post_drain(pk_loop_t *pk_loop, int status)
+{
+  pk_post_entry_t *entry = atomic_exchange(&pk_loop->post_head, NULL);
+
+  pk_post_entry_t *ordered = NULL;
+  while (entry != NULL) {
+    pk_post_entry_t *next = entry->next;
+    entry->next = ordered;
+    ordered = entry;
+    entry = next;
+  }
+
+  while (ordered != NULL) {
+    pk_post_entry_t *next = ordered->next;
+    ordered->fn(pk_loop, status, ordered->context);
+    free(ordered);
+    ordered = next;
+  }
+}
+
+/**
+ * @brief pk_loop_post_async_callback - wrapping callback for the post uv_async_t
+ * libuv coalesces wake ups, so every closure posted before this runs is
+ * handled by a single drain.
+ * @param async: post async handle
+ */
+static void pk_loop_post_async_callback(uv_async_t *async)
+{
+  pk_loop_post_drain(pk_loop_from_uv_handle((uv_handle_t *)async), LOOP_SUCCESS);
+}
+
+int pk_loop_post(pk_loop_t *pk_loop, pk_loop_post_fn fn, void *context)
+{
+  assert(pk_loop != NULL);
+  assert(fn != NULL);
+
+  pk_post_entry_t *entry = (pk_post_entry_t *)malloc(sizeof(pk_post_entry_t));
+  if (entry == NULL) {
+    piksi_log(LOG_ERR, "Failed to allocate post entry");
+    return -1;
+  }
+
+  entry->fn = fn;
+  entry->context = context;
+  entry->next = atomic_load(&pk_loop->post_head);
+  while (!atomic_compare_exchange_weak(&pk_loop->post_head, &entry->next, entry)) {
+  }
+
+  /* Only the first post of a batch needs to wake the loop */
+  if (entry->next == NULL) {
+    uv_async_send(pk_loop->post_async);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief pk_loop_count_user_handles - count handles added through the pk_loop API
+ * Internal handles carry no callback context and are not counted.
+ * @param handle: handle passed from uv_walk
+ * @param arg: address of the count so far
+ */
+static void pk_loop_count_user_handles(uv_handle_t *handle, void *arg)
+{
+  if (!uv_is_closing(handle) && uv_handle_get_data(handle) != NULL) {
+    (*(size_t *)arg)++;
+  }
+}
+
+int pk_loop_virtual_time_enable(pk_loop_t *pk_loop)
+{
+  assert(pk_loop != NULL);
+
+  if (pk_loop->virtual_time) {
+    piksi_log(LOG_WARNING, "virtual time already enabled");
+    return -1;
+  }
+
+  /* Timers already started run on the real clock and would stay there */
+  size_t handles = 0;
+  uv_walk(pk_loop->uv_loop, pk_loop_count_user_handles, &handles);
+  if (pk_loop->wheel != NULL || handles > 0) {
+    piksi_log(LOG_ERR, "virtual time must be enabled before timers or handles are added");
+    return -1;
+  }
+
+  pk_loop->virtual_time = true;
+  pk_loop->virtual_now_ms = 0;
+
+  return 0;
+}
+
+u64 pk_loop_now_ms(pk_loop_t *pk_loop)
+{
+  assert(pk_loop != NULL);
+  return pk_loop->virtual_time ? pk_loop->virtual_now_ms : uv_now(pk_loop->uv_loop);
+}
+
+/**
+ * @brief pk_loop_virtual_next_timer - find the armed timer which is due first
+ * Ties are broken by the order the timers were added in.
+ * @param handle: handle passed from uv_walk
+ * @param arg: address of the earliest timer handle found so far
+ */
+static void pk_loop_virtual_next_timer(uv_handle_t *handle, void *arg)
+{
+  uv_handle_t **next = (uv_handle_t **)arg;
+
+  if (uv_handle_get_type(handle) != UV_TIMER || uv_is_closing(handle)) {
+    return;
+  }
+  pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(handle);
+  if (cb_ctx == NULL || !cb_ctx->virtual_armed) {
+    return;
+  }
+  if (*next == NULL
+      || cb_ctx->virtual_due_ms < pk_callback_context_from_uv_handle(*next)->virtual_due_ms) {
+    *next = handle;
+  }
+}
+
+/**
+ * @brief pk_loop_virtual_next_due - find the next deadline in virtual time
+ * Considers the pending timers, the timer wheel and the run timeout.
+ * @param pk_loop: loop running in virtual time
+ * @param timer: set to the earliest timer handle, if any
+ * @return next deadline or UINT64_MAX if nothing is scheduled
+ */
+static u64 pk_loop_virtual_next_due(pk_loop_t *pk_loop, uv_handle_t **timer)
+{
+  *timer = NULL;
+  uv_walk(pk_loop->uv_loop, pk_loop_virtual_next_timer, timer);
+
+  u64 due = UINT64_MAX;
+  if (*timer != NULL) {
+    due = pk_callback_context_from_uv_handle(*timer)->virtual_due_ms;
+  }
+
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  if (wheel != NULL && wheel->wake_tick != UINT64_MAX) {
+    due = SWFT_MIN(due, wheel->base_ms + wheel->wake_tick * WHEEL_TICK_ms);
+  }
+
+  if (pk_loop->virtual_timeout_armed) {
+    due = SWFT_MIN(due, pk_loop->virtual_timeout_ms);
+  }
+
+  return due;
+}
+
+/**
+ * @brief pk_loop_virtual_fire - fire the first deadline that is due
+ * Timers go first, then the timer wheel and last the run timeout, which
+ * matches the order libuv runs timers expiring on the same tick.
+ * @param pk_loop: loop running in virtual time
+ * @return true if something fired, false if nothing is due yet
+ */
+static bool pk_loop_virtual_fire(pk_loop_t *pk_loop)
+{
+  uv_handle_t *timer = NULL;
+  u64 now_ms = pk_loop->virtual_now_ms;
+
+  if (pk_loop_virtual_next_due(pk_loop, &timer) > now_ms) {
+    return false;
+  }
+
+  if (timer != NULL && pk_callback_context_from_uv_handle(timer)->virtual_due_ms <= now_ms) {
+    pk_callback_ctx_t *cb_ctx = pk_callback_context_from_uv_handle(timer);
+    cb_ctx->virtual_armed = cb_ctx->virtual_period_ms != 0;
+    cb_ctx->virtual_due_ms = now_ms + cb_ctx->virtual_period_ms;
+    pk_loop_callback_invoke(pk_loop, timer, cb_ctx, LOOP_SUCCESS);
+    return true;
+  }
+
+  pk_timer_wheel_t *wheel = pk_loop->wheel;
+  if (wheel != NULL && wheel->wake_tick != UINT64_MAX
+      && wheel->base_ms + wheel->wake_tick * WHEEL_TICK_ms <= now_ms) {
+    wheel_timer_handler(wheel->uv_timer);
+    return true;
+  }
+
+  pk_loop->virtual_timeout_armed = false;
+  pk_loop_stop(pk_loop);
+  return true;
+}
+
+/**
+ * @brief pk_loop_virtual_advance - jump to the next deadline in virtual time
+ * Everything that is due at the new time fires before I/O is handled
+ * again, like timers expiring together in a single libuv iteration.
+ * @param pk_loop: loop running in virtual time
+ * @return true if the clock advanced, false if nothing is scheduled
+ */
+static bool pk_loop_virtual_advance(pk_loop_t *pk_loop)
+{
+  uv_handle_t *timer = NULL;
+  u64 due = pk_loop_virtual_next_due(pk_loop, &timer);
+  if (due == UINT64_MAX) {
+    return false;
+  }
+  pk_loop->virtual_now_ms = SWFT_MAX(pk_loop->virtual_now_ms, due);
+
+  while (!pk_loop->virtual_stopped && pk_loop_virtual_fire(pk_loop)) {
+  }
+
+  return true;
+}
+
+/**
+ * @brief pk_loop_virtual_run - run a loop in virtual time
+ * Ready I/O is handled first, whenever the loop would otherwise wait the
+ * virtual clock jumps straight to the next deadline. The loop only blocks
+ * when nothing is scheduled in virtual time.
+ * @param pk_loop: loop running in virtual time
+ */
+static void pk_loop_virtual_run(pk_loop_t *pk_loop)
+{
+  pk_loop->virtual_stopped = false;
+  while (!pk_loop->virtual_stopped) {
+    uv_run(pk_loop->uv_loop, UV_RUN_NOWAIT);
+    if (pk_loop->virtual_stopped) {
+      break;
+    }
+    if (!pk_loop_virtual_advance(pk_loop) && uv_run(pk_loop->uv_loop, UV_RUN_ONCE) == 0) {
+      break;
+    }
+  }
+}
+
+int pk_loop_run_simple(pk_loop_t *pk_loop)
+{
+  assert(pk_loop != NULL);
+  assert(pk_loop->uv_loop != NULL);
+
+  if (pk_loop->virtual_time) {
+    pk_loop_virtual_run(pk_loop);
+    return 0;
+  }
+
+  uv_run(pk_loop->uv_loop, UV_RUN_DEFAULT);
+
+  return 0;
+}
+
+/**
+ * @brief pk_loop_timeout_callback - callback for timeout timer
+ * The timeout timers job is to stop the loop after a specified timeout,
+ * so it simply calls uv_stop on the loop
+ * @param timer: timer handle
+ */
+static void pk_loop_timeout_callback(uv_timer_t *timer)
+{
+  uv_stop(uv_handle_get_loop((uv_handle_t *)timer));
+}
+
+int pk_loop_run_simple_with_timeout(pk_loop_t *pk_loop, u32 timeout_ms)
 {
   assert(pk_loop != NULL);
   assert(pk_loop->timeout_timer != NULL);
 
+  if (pk_loop->virtual_time) {
+    pk_loop->virtual_timeout_ms = pk_loop->virtual_now_ms + timeout_ms;
+    pk_loop->virtual_timeout_armed = true;
+    pk_loop_run_simple(pk_loop);
+    pk_loop->virtual_timeout_armed = false;
+    return 0;
+  }
+
   uv_timer_start(pk_loop->timeout_timer, pk_loop_timeout_callback, timeout_ms, 0);
   pk_loop_run_simple(pk_loop);
   uv_timer_stop(pk_loop->timeout_timer);
@@ -564,6 +2062,7 @@ int pk_loop_run_simple_with_timeout(pk_loop_t *pk_loop, u32 timeout_ms)
 
 void pk_loop_stop(pk_loop_t *pk_loop)
 {
+  pk_loop->virtual_stopped = true;
   uv_stop(pk_loop->uv_loop);
 }
 
@@ -581,6 +2080,7 @@ const char *pk_loop_describe_status(int status)
 {
   static char buf[MSG_BUF_SIZE] = {0};
   static char buf_read[MSG_BUF_SIZE] = {0};
+  static char buf_write[MSG_BUF_SIZE] = {0};
   static char buf_disco[MSG_BUF_SIZE] = {0};
   static char buf_error[MSG_BUF_SIZE] = {0};
   bool addbar = false;
@@ -601,6 +2101,12 @@ const char *pk_loop_describe_status(int status)
     addbar = true;
   }
 
+  if (status & LOOP_WRITE) {
+    snprintf(buf_write, sizeof(buf_write), "%s%sLOOP_WRITE", addbar ? buf : "", addbar ? "|" : "");
+    snprintf(buf, sizeof(buf), "%s", buf_write);
+    addbar = true;
+  }
+
   if (status & LOOP_DISCONNECTED) {
     snprintf(buf_disco,
              sizeof(buf_disco),
@@ -32,7 +32,7 @@
 
 #include <libpiksi/metrics.h>
 
-#define MAX_METRICS 32                  /**< Max metrics per pk_metrics_t */
+#define MAX_METRICS 64                  /**< Max metrics per pk_metrics_t, see metrics_foreach.h */
 #define METRICS_PATH "/var/log/metrics" /**< Base metrics path */
 
 #define NEW_DIR_MODE (0777)
@@ -47,7 +47,15 @@ static int import_framer(const char *protocol_name, void *handle)
     return -1;
   }
 
-  return framer_interface_register(protocol_name, create_fn, destroy_fn, process_fn);
+  /* Optional, framers without it are driven one frame at a time */
+  framer_process_batch_fn_t process_batch_fn;
+  DLSYM_CAST(process_batch_fn) = dlsym(handle, "framer_process_batch");
+
+  return framer_interface_register(protocol_name,
+                                   create_fn,
+                                   destroy_fn,
+                                   process_fn,
+                                   process_batch_fn);
 }
 
 static int import_filter(const char *protocol_name, void *handle)
@@ -108,13 +116,14 @@ error:
   return -1;
 }
 
-int protocols_import(const char *path)
+int protocols_register_builtin(void)
 {
   /* Register "none" protocol */
   if (framer_interface_register("none",
                                 framer_none_create,
                                 framer_none_destroy,
-                                framer_none_process)
+                                framer_none_process,
+                                NULL)
       != 0) {
     syslog(LOG_ERR, "error registering none framer");
     return -1;
@@ -129,6 +138,15 @@ int protocols_import(const char *path)
     return -1;
   }
 
+  return 0;
+}
+
+int protocols_import(const char *path)
+{
+  if (protocols_register_builtin() != 0) {
+    return -1;
+  }
+
   /* Load protocols from libraries */
   DIR *dir = opendir(path);
   if (dir == NULL) {
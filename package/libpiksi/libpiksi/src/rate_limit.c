@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <time.h>
+
+#include <libpiksi/rate_limit.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+static int64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+bool pk_rate_limit_valid(double max_hz)
+{
+  return isfinite(max_hz) && max_hz >= PK_RATE_LIMIT_MAX_HZ_MIN;
+}
+
+void pk_rate_limit_init(pk_rate_limit_t *limit, double max_hz)
+{
+  int64_t interval_ns = (int64_t)((double)NSEC_PER_SEC / max_hz);
+  *limit = (pk_rate_limit_t){
+    .interval_ns = interval_ns,
+    .credit_ns = interval_ns,
+    .last_ns = monotonic_ns(),
+  };
+}
+
+bool pk_rate_limit_take(pk_rate_limit_t *limit)
+{
+  int64_t now = monotonic_ns();
+  limit->credit_ns += now - limit->last_ns;
+  limit->last_ns = now;
+  if (limit->credit_ns > limit->interval_ns) {
+    limit->credit_ns = limit->interval_ns;
+  }
+
+  if (limit->credit_ns >= limit->interval_ns - limit->interval_ns / PK_RATE_LIMIT_TOLERANCE_DIV) {
+    limit->credit_ns -= limit->interval_ns;
+    return true;
+  }
+
+  return false;
+}
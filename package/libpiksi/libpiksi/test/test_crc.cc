@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi_tests.h>
+
+#include <libpiksi/crc.h>
+
+extern "C" {
+#include <libsbp/edc.h>
+}
+
+#define CRC_CHECK_STRING "123456789"
+#define BENCH_BUFFER_SIZE (1024 * 1024)
+#define BENCH_ITERATIONS 100
+
+/* Byte-at-a-time table CRCs: libsbp's crc16_ccitt() and the loop previously
+ * used by the RTCM3 framer (optimized as the plugin is, tests build at -O0) */
+static uint32_t crc24q_table_ref[256];
+
+static void crc_ref_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc24 = i << 16;
+    for (int bit = 0; bit < 8; bit++) {
+      crc24 = (crc24 & 0x800000) ? (crc24 << 1) ^ 0x864CFB : crc24 << 1;
+    }
+    crc24q_table_ref[i] = crc24 & 0xFFFFFF;
+  }
+}
+
+static uint16_t crc16_ccitt_ref(const uint8_t *buf, size_t len, uint16_t crc)
+{
+  return crc16_ccitt(buf, (u32)len, crc);
+}
+
+__attribute__((optimize("O2"))) static uint32_t crc24q_ref(const uint8_t *buf,
+                                                           size_t len,
+                                                           uint32_t crc)
+{
+  for (size_t i = 0; i < len; i++)
+    crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table_ref[((crc >> 16) ^ buf[i]) & 0xFF];
+  return crc;
+}
+
+TEST_F(LibpiksiTests, crcTests)
+{
+  crc_ref_init();
+
+  const uint8_t *check = (const uint8_t *)CRC_CHECK_STRING;
+  EXPECT_EQ(pk_crc16_ccitt(check, strlen(CRC_CHECK_STRING), 0), 0x31C3);
+  EXPECT_EQ(pk_crc24q(check, strlen(CRC_CHECK_STRING), 0), 0xCDE703u);
+  EXPECT_EQ(pk_crc16_ccitt(check, 0, 0x1234), 0x1234);
+
+  std::mt19937 rng(42);
+  std::vector<uint8_t> data(1100);
+  for (auto &b : data) {
+    b = (uint8_t)rng();
+  }
+
+  /* Every length and alignment around the 8 byte stride */
+  for (size_t offset = 0; offset < 8; offset++) {
+    for (size_t len = 0; len < 64; len++) {
+      EXPECT_EQ(pk_crc16_ccitt(&data[offset], len, 0), crc16_ccitt_ref(&data[offset], len, 0));
+      EXPECT_EQ(pk_crc24q(&data[offset], len, 0), crc24q_ref(&data[offset], len, 0));
+    }
+  }
+
+  /* Largest frames, and a running checksum split across calls */
+  EXPECT_EQ(pk_crc16_ccitt(data.data(), 263, 0), crc16_ccitt_ref(data.data(), 263, 0));
+  EXPECT_EQ(pk_crc24q(data.data(), 1026, 0), crc24q_ref(data.data(), 1026, 0));
+  EXPECT_EQ(pk_crc16_ccitt(&data[5], 258, pk_crc16_ccitt(data.data(), 5, 0)),
+            crc16_ccitt_ref(data.data(), 263, 0));
+  EXPECT_EQ(pk_crc24q(&data[13], 1013, pk_crc24q(data.data(), 13, 0)),
+            crc24q_ref(data.data(), 1026, 0));
+}
+
+template <typename Fn> static double crc_bench_gbps(const std::vector<uint8_t> &data, Fn fn)
+{
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_ITERATIONS; i++) {
+    sink ^= fn(data.data(), data.size());
+  }
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  EXPECT_NE(sink, 0xFFFFFFFFu);
+  return (double)data.size() * BENCH_ITERATIONS / elapsed / 1e9;
+}
+
+TEST_F(LibpiksiTests, crcBenchmark)
+{
+  crc_ref_init();
+
+  std::mt19937 rng(7);
+  std::vector<uint8_t> data(BENCH_BUFFER_SIZE);
+  for (auto &b : data) {
+    b = (uint8_t)rng();
+  }
+
+  double crc16_ref = crc_bench_gbps(data, [](const uint8_t *buf, size_t len) {
+    return (uint32_t)crc16_ccitt_ref(buf, len, 0);
+  });
+  double crc16 = crc_bench_gbps(data, [](const uint8_t *buf, size_t len) {
+    return (uint32_t)pk_crc16_ccitt(buf, len, 0);
+  });
+  double crc24_ref = crc_bench_gbps(data, [](const uint8_t *buf, size_t len) {
+    return crc24q_ref(buf, len, 0);
+  });
+  double crc24 = crc_bench_gbps(data, [](const uint8_t *buf, size_t len) {
+    return pk_crc24q(buf, len, 0);
+  });
+
+  std::cout << "crc16 per-byte: " << crc16_ref << " GB/s, slicing-by-8: " << crc16 << " GB/s"
+            << std::endl;
+  std::cout << "crc24q per-byte: " << crc24_ref << " GB/s, slicing-by-8: " << crc24 << " GB/s"
+            << std::endl;
+}
@@ -10,11 +10,16 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <chrono>
+#include <iostream>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <libpiksi_tests.h>
 
 #include <libpiksi/endpoint.h>
+#include <libpiksi/loop.h>
 
 extern "C" bool pk_endpoint_test(void);
 
@@ -90,3 +95,180 @@ TEST_F(LibpiksiTests, endpointTests)
     ASSERT_EQ(ept_srv, nullptr);
   }
 }
+
+#define BATCH_MSG_COUNT 100
+#define BENCH_BURST 32
+#define BENCH_ROUNDS 2000
+
+static int test_batch_recv_cb(const u8 *data, const size_t length, void *context)
+{
+  std::vector<u32> *received = (std::vector<u32> *)context;
+  EXPECT_EQ(length, sizeof(u32));
+  u32 seq = 0;
+  memcpy(&seq, data, sizeof(seq));
+  received->push_back(seq);
+  return 0;
+}
+
+static void test_batch_idle_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  (void)status;
+  (void)context;
+  pk_loop_stop(loop);
+}
+
+/* Connects a SUB client to a PUB server, the server accepts via the loop */
+static void test_batch_connect(pk_loop_t *loop, pk_endpoint_t **srv, pk_endpoint_t **sub)
+{
+  *srv = pk_endpoint_create(pk_endpoint_config()
+                              .endpoint("ipc:///tmp/tmp.49011")
+                              .identity("tmp.49011.pub.server")
+                              .type(PK_ENDPOINT_PUB_SERVER)
+                              .get());
+  ASSERT_NE(*srv, nullptr);
+  ASSERT_EQ(pk_endpoint_loop_add(*srv, loop), 0);
+
+  *sub = pk_endpoint_create(pk_endpoint_config()
+                              .endpoint("ipc:///tmp/tmp.49011")
+                              .identity("tmp.49011.sub")
+                              .type(PK_ENDPOINT_SUB)
+                              .get());
+  ASSERT_NE(*sub, nullptr);
+  ASSERT_EQ(pk_endpoint_set_non_blocking(*sub), 0);
+
+  ASSERT_NE(pk_loop_timer_add(loop, 10, test_batch_idle_cb, NULL), nullptr);
+  pk_loop_run_simple(loop);
+}
+
+TEST_F(LibpiksiTests, endpointBatchReceiveTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  pk_endpoint_t *srv = nullptr;
+  pk_endpoint_t *sub = nullptr;
+  test_batch_connect(loop, &srv, &sub);
+
+  for (u32 seq = 0; seq < BATCH_MSG_COUNT; seq++) {
+    ASSERT_EQ(pk_endpoint_send(srv, (u8 *)&seq, sizeof(seq)), 0);
+  }
+
+  /* Each receive services a bounded number of messages, in order */
+  std::vector<u32> received;
+  int calls = 0;
+  while (received.size() < BATCH_MSG_COUNT && calls < BATCH_MSG_COUNT) {
+    ASSERT_EQ(pk_endpoint_receive(sub, test_batch_recv_cb, &received), 0);
+    calls++;
+  }
+
+  ASSERT_EQ(received.size(), (size_t)BATCH_MSG_COUNT);
+  for (u32 seq = 0; seq < BATCH_MSG_COUNT; seq++) {
+    EXPECT_EQ(received[seq], seq);
+  }
+  EXPECT_GT(calls, 1);
+
+  /* Nothing left queued */
+  ASSERT_EQ(pk_endpoint_receive(sub, test_batch_recv_cb, &received), 0);
+  EXPECT_EQ(received.size(), (size_t)BATCH_MSG_COUNT);
+
+  pk_endpoint_destroy(&sub);
+  pk_endpoint_destroy(&srv);
+  pk_loop_destroy(&loop);
+}
+
+static int test_batch_stop_cb(const u8 *data, const size_t length, void *context)
+{
+  test_batch_recv_cb(data, length, context);
+  return 1;
+}
+
+TEST_F(LibpiksiTests, endpointBatchReceiveStopTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  pk_endpoint_t *srv = nullptr;
+  pk_endpoint_t *sub = nullptr;
+  test_batch_connect(loop, &srv, &sub);
+
+  for (u32 seq = 0; seq < 4; seq++) {
+    ASSERT_EQ(pk_endpoint_send(srv, (u8 *)&seq, sizeof(seq)), 0);
+  }
+
+  /* The whole burst is pulled by one recvmmsg(), stopping after the first
+   * message must not lose the rest of it */
+  std::vector<u32> received;
+  ASSERT_EQ(pk_endpoint_receive(sub, test_batch_stop_cb, &received), 0);
+  ASSERT_EQ(received.size(), (size_t)1);
+  EXPECT_EQ(received[0], 0u);
+
+  /* The next message goes to a plain read ahead of anything newer */
+  u32 seq = 4;
+  ASSERT_EQ(pk_endpoint_send(srv, (u8 *)&seq, sizeof(seq)), 0);
+  u8 buffer[PK_ENDPOINT_RECV_BUF_SIZE];
+  ASSERT_EQ(pk_endpoint_read(sub, buffer, sizeof(buffer)), (ssize_t)sizeof(u32));
+  memcpy(&seq, buffer, sizeof(seq));
+  received.push_back(seq);
+
+  ASSERT_EQ(pk_endpoint_receive(sub, test_batch_recv_cb, &received), 0);
+
+  ASSERT_EQ(received.size(), (size_t)5);
+  for (u32 i = 0; i < 5; i++) {
+    EXPECT_EQ(received[i], i);
+  }
+
+  pk_endpoint_destroy(&sub);
+  pk_endpoint_destroy(&srv);
+  pk_loop_destroy(&loop);
+}
+
+/* Compares draining bursts one recvmsg() per message (pk_endpoint_read)
+ * against the batched pk_endpoint_receive() path */
+TEST_F(LibpiksiTests, endpointBatchReceiveBenchmark)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  pk_endpoint_t *srv = nullptr;
+  pk_endpoint_t *sub = nullptr;
+  test_batch_connect(loop, &srv, &sub);
+
+  std::vector<u32> received;
+  received.reserve(BENCH_BURST);
+
+  s64 single_ns = 0;
+  s64 batch_ns = 0;
+
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (u32 seq = 0; seq < BENCH_BURST; seq++) {
+      ASSERT_EQ(pk_endpoint_send(srv, (u8 *)&seq, sizeof(seq)), 0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    u8 buffer[PK_ENDPOINT_RECV_BUF_SIZE];
+    while (pk_endpoint_read(sub, buffer, sizeof(buffer)) > 0) {
+    }
+    single_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+
+    for (u32 seq = 0; seq < BENCH_BURST; seq++) {
+      ASSERT_EQ(pk_endpoint_send(srv, (u8 *)&seq, sizeof(seq)), 0);
+    }
+    received.clear();
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(pk_endpoint_receive(sub, test_batch_recv_cb, &received), 0);
+    batch_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    EXPECT_EQ(received.size(), (size_t)BENCH_BURST);
+  }
+
+  std::cout << "recvmsg: " << single_ns / (BENCH_ROUNDS * BENCH_BURST)
+            << " ns/msg, recvmmsg: " << batch_ns / (BENCH_ROUNDS * BENCH_BURST) << " ns/msg"
+            << std::endl;
+
+  pk_endpoint_destroy(&sub);
+  pk_endpoint_destroy(&srv);
+  pk_loop_destroy(&loop);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <unistd.h>
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi_tests.h>
+
+#include <libpiksi/file_watch.h>
+
+#define WATCH_TEST_FILE "/tmp/test_file_watch"
+/* Past the check interval, with room for the coarse clock's resolution */
+#define WATCH_TEST_WAIT_US ((PK_FILE_WATCH_INTERVAL_MS + 50) * 1000)
+
+static void watch_test_write(const char *line)
+{
+  std::ofstream file(WATCH_TEST_FILE);
+  file << line << std::endl;
+}
+
+TEST_F(LibpiksiTests, fileWatchTest)
+{
+  watch_test_write("one");
+
+  pk_file_watch_t *watch = pk_file_watch_create(WATCH_TEST_FILE);
+  ASSERT_NE(watch, nullptr);
+  EXPECT_EQ(pk_file_watch_generation(watch), 0u);
+
+  /* A write is noticed once the interval has passed */
+  watch_test_write("two");
+  usleep(WATCH_TEST_WAIT_US);
+  EXPECT_EQ(pk_file_watch_generation(watch), 1u);
+
+  /* Nothing written, nothing to reload */
+  usleep(WATCH_TEST_WAIT_US);
+  EXPECT_EQ(pk_file_watch_generation(watch), 1u);
+
+  /* A burst of writes between checks is a single reload */
+  watch_test_write("three");
+  watch_test_write("four");
+  watch_test_write("five");
+  usleep(WATCH_TEST_WAIT_US);
+  EXPECT_EQ(pk_file_watch_generation(watch), 2u);
+
+  pk_file_watch_destroy(&watch);
+  EXPECT_EQ(watch, nullptr);
+
+  /* A file that does not exist cannot be watched */
+  unlink(WATCH_TEST_FILE);
+  EXPECT_EQ(pk_file_watch_create(WATCH_TEST_FILE), nullptr);
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <libpiksi_tests.h>
+
+#include <libpiksi/framer.h>
+
+/* Test framers split the input into two byte frames */
+#define TEST_FRAME_LEN 2u
+
+static int test_framer_state;
+
+static void *test_framer_create(void)
+{
+  return &test_framer_state;
+}
+
+static void test_framer_destroy(void **state)
+{
+  *state = NULL;
+}
+
+static uint32_t test_framer_process(void *state,
+                                    const uint8_t *data,
+                                    uint32_t data_length,
+                                    const uint8_t **frame,
+                                    uint32_t *frame_length)
+{
+  (void)state;
+  if (data_length < TEST_FRAME_LEN) {
+    *frame = NULL;
+    *frame_length = 0;
+    return data_length;
+  }
+  *frame = data;
+  *frame_length = TEST_FRAME_LEN;
+  return TEST_FRAME_LEN;
+}
+
+static uint32_t test_framer_process_batch(void *state,
+                                          const uint8_t *data,
+                                          uint32_t data_length,
+                                          const uint8_t **frames,
+                                          uint32_t *frame_lengths,
+                                          uint32_t frames_max,
+                                          uint32_t *frame_count)
+{
+  uint32_t offset = 0;
+  uint32_t count = 0;
+  while (offset < data_length && count < frames_max) {
+    offset += test_framer_process(state,
+                                  &data[offset],
+                                  data_length - offset,
+                                  &frames[count],
+                                  &frame_lengths[count]);
+    if (frames[count] == NULL) break;
+    count++;
+  }
+  *frame_count = count;
+  return offset;
+}
+
+static uint8_t test_framer_copy[TEST_FRAME_LEN];
+
+/* Hands every frame out of its own buffer, like a framer reassembling frames
+ * split across reads */
+static uint32_t test_framer_process_copy(void *state,
+                                         const uint8_t *data,
+                                         uint32_t data_length,
+                                         const uint8_t **frame,
+                                         uint32_t *frame_length)
+{
+  uint32_t consumed = test_framer_process(state, data, data_length, frame, frame_length);
+  if (*frame != NULL) {
+    memcpy(test_framer_copy, *frame, *frame_length);
+    *frame = test_framer_copy;
+  }
+  return consumed;
+}
+
+TEST_F(LibpiksiTests, framerBatchTest)
+{
+  ASSERT_EQ(framer_interface_register("test_single",
+                                      test_framer_create,
+                                      test_framer_destroy,
+                                      test_framer_process,
+                                      NULL),
+            0);
+  ASSERT_EQ(framer_interface_register("test_batch",
+                                      test_framer_create,
+                                      test_framer_destroy,
+                                      test_framer_process,
+                                      test_framer_process_batch),
+            0);
+  ASSERT_EQ(framer_interface_register("test_copy",
+                                      test_framer_create,
+                                      test_framer_destroy,
+                                      test_framer_process_copy,
+                                      NULL),
+            0);
+
+  const uint8_t data[] = {1, 2, 3, 4, 5, 6, 7};
+  const uint8_t *frames[4];
+  uint32_t frame_lengths[4];
+  uint32_t frame_count = 0;
+
+  /* Without a batch entry point frames found in place are still batched */
+  framer_t *framer = framer_create("test_single");
+  ASSERT_NE(framer, nullptr);
+  uint32_t consumed =
+    framer_process_batch(framer, data, sizeof(data), frames, frame_lengths, 4, &frame_count);
+  EXPECT_EQ(consumed, sizeof(data));
+  EXPECT_EQ(frame_count, 3u);
+  EXPECT_EQ(frames[0], &data[0]);
+  EXPECT_EQ(frames[2], &data[4]);
+  framer_destroy(&framer);
+
+  /* but a frame out of the framer's own buffer ends the batch */
+  framer = framer_create("test_copy");
+  ASSERT_NE(framer, nullptr);
+  consumed = framer_process_batch(framer, data, sizeof(data), frames, frame_lengths, 4, &frame_count);
+  EXPECT_EQ(consumed, TEST_FRAME_LEN);
+  EXPECT_EQ(frame_count, 1u);
+  EXPECT_EQ(frames[0], test_framer_copy);
+  framer_destroy(&framer);
+
+  framer = framer_create("test_batch");
+  ASSERT_NE(framer, nullptr);
+  consumed = framer_process_batch(framer, data, sizeof(data), frames, frame_lengths, 2, &frame_count);
+  EXPECT_EQ(consumed, 2 * TEST_FRAME_LEN);
+  EXPECT_EQ(frame_count, 2u);
+  EXPECT_EQ(frames[1], &data[2]);
+  consumed = framer_process_batch(framer,
+                                  &data[consumed],
+                                  sizeof(data) - consumed,
+                                  frames,
+                                  frame_lengths,
+                                  4,
+                                  &frame_count);
+  EXPECT_EQ(consumed, 3u);
+  EXPECT_EQ(frame_count, 1u);
+  EXPECT_EQ(frames[0], &data[4]);
+  EXPECT_EQ(frame_lengths[0], TEST_FRAME_LEN);
+  framer_destroy(&framer);
+}
+
+TEST_F(LibpiksiTests, framerRegistryTest)
+{
+  ASSERT_EQ(framer_interface_register("Test_Registry",
+                                      test_framer_create,
+                                      test_framer_destroy,
+                                      test_framer_process_copy,
+                                      NULL),
+            0);
+
+  /* Names are matched case insensitively */
+  EXPECT_EQ(framer_interface_valid("test_registry"), 0);
+  EXPECT_EQ(framer_interface_valid("TEST_REGISTRY"), 0);
+  EXPECT_EQ(framer_interface_valid("test_registry_missing"), -1);
+
+  /* The first registration under a name is kept */
+  ASSERT_EQ(framer_interface_register("test_registry",
+                                      test_framer_create,
+                                      test_framer_destroy,
+                                      test_framer_process,
+                                      test_framer_process_batch),
+            0);
+  const uint8_t data[] = {1, 2, 3, 4};
+  const uint8_t *frames[4];
+  uint32_t frame_lengths[4];
+  uint32_t frame_count = 0;
+  framer_t *framer = framer_create("test_registry");
+  ASSERT_NE(framer, nullptr);
+  framer_process_batch(framer, data, sizeof(data), frames, frame_lengths, 4, &frame_count);
+  EXPECT_EQ(frame_count, 1u);
+  framer_destroy(&framer);
+}
+
+TEST_F(LibpiksiTests, framerRegistryGrowsTest)
+{
+  /* Far more protocols than a typical install, all of them stay usable */
+  char name[32];
+  for (int i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "test_grow_%d", i);
+    ASSERT_EQ(framer_interface_register(name,
+                                        test_framer_create,
+                                        test_framer_destroy,
+                                        test_framer_process,
+                                        NULL),
+              0);
+  }
+  for (int i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "test_grow_%d", i);
+    EXPECT_EQ(framer_interface_valid(name), 0);
+  }
+}
@@ -0,0 +1,714 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi_tests.h>
+
+#include <libpiksi/loop.h>
+
+#define PROFILE_METRICS_PATH "/tmp/test_loop_metrics"
+
+static void test_slow_timer_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  (void)status;
+  int *count = (int *)context;
+  (*count)++;
+  usleep(5000);
+}
+
+TEST_F(LibpiksiTests, loopProfilingTest)
+{
+  setenv("PK_METRICS_PATH", PROFILE_METRICS_PATH, 1);
+
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  EXPECT_EQ(pk_loop_profiling_enable(loop, "test_loop", 1000), 0);
+  EXPECT_NE(pk_loop_profiling_enable(loop, "test_loop", 1000), 0);
+
+  int count = 0;
+  void *timer = pk_loop_timer_add(loop, 100, test_slow_timer_cb, &count);
+  ASSERT_NE(timer, nullptr);
+  EXPECT_EQ(pk_loop_handle_name_set(timer, "slow_timer"), 0);
+
+  pk_loop_run_simple_with_timeout(loop, 1500);
+
+  EXPECT_GT(count, 0);
+
+  std::ifstream count_file(PROFILE_METRICS_PATH "/test_loop/loop/slow_timer/count");
+  ASSERT_TRUE(count_file.good());
+  int published_count = -1;
+  count_file >> published_count;
+  EXPECT_GT(published_count, 0);
+  EXPECT_LE(published_count, count);
+
+  std::ifstream slow_file(PROFILE_METRICS_PATH "/test_loop/loop/slow_timer/slow_count");
+  ASSERT_TRUE(slow_file.good());
+  int slow_count = -1;
+  slow_file >> slow_count;
+  EXPECT_EQ(slow_count, published_count);
+
+  /* With its last handle gone the loop returns, the profile timer does not
+   * keep it alive */
+  EXPECT_EQ(pk_loop_remove_handle(timer), 0);
+  EXPECT_EQ(pk_loop_run_simple(loop), 0);
+
+  pk_loop_destroy(&loop);
+  unsetenv("PK_METRICS_PATH");
+
+  EXPECT_EQ(system("rm -rf " PROFILE_METRICS_PATH), 0);
+}
+
+struct test_work_ctx {
+  pthread_t loop_thread;
+  pthread_t work_thread;
+  int done_status;
+  int done_count;
+};
+
+static void test_work_fn(void *context)
+{
+  struct test_work_ctx *ctx = (struct test_work_ctx *)context;
+  ctx->work_thread = pthread_self();
+  usleep(10000);
+}
+
+static void test_work_done_fn(pk_loop_t *loop, int status, void *context)
+{
+  struct test_work_ctx *ctx = (struct test_work_ctx *)context;
+  EXPECT_TRUE(pthread_equal(ctx->loop_thread, pthread_self()));
+  ctx->done_status = status;
+  ctx->done_count++;
+  if (pk_loop_work_queue_depth(loop) == 0) {
+    pk_loop_stop(loop);
+  }
+}
+
+TEST_F(LibpiksiTests, loopWorkSubmitTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  struct test_work_ctx ctx[4] = {};
+  for (size_t i = 0; i < sizeof(ctx) / sizeof(ctx[0]); i++) {
+    ctx[i].loop_thread = pthread_self();
+    ctx[i].done_status = LOOP_UNKNOWN;
+    EXPECT_EQ(pk_loop_work_submit(loop, test_work_fn, test_work_done_fn, &ctx[i]), 0);
+  }
+  EXPECT_EQ(pk_loop_work_queue_depth(loop), 4);
+
+  pk_loop_run_simple_with_timeout(loop, 2000);
+
+  EXPECT_EQ(pk_loop_work_queue_depth(loop), 0);
+  for (size_t i = 0; i < sizeof(ctx) / sizeof(ctx[0]); i++) {
+    EXPECT_EQ(ctx[i].done_count, 1);
+    EXPECT_EQ(ctx[i].done_status, LOOP_SUCCESS);
+    EXPECT_FALSE(pthread_equal(ctx[i].work_thread, pthread_self()));
+  }
+
+  pk_loop_destroy(&loop);
+}
+
+static void test_work_count_fn(void *context)
+{
+  (void)context;
+  usleep(1000);
+}
+
+static void test_work_count_done_fn(pk_loop_t *loop, int status, void *context)
+{
+  (void)loop;
+  (void)status;
+  (*(int *)context)++;
+}
+
+TEST_F(LibpiksiTests, loopWorkMetricsTest)
+{
+  setenv("PK_METRICS_PATH", PROFILE_METRICS_PATH, 1);
+
+  /* Work queue metrics are published without profiling */
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  int done_count = 0;
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(pk_loop_work_submit(loop, test_work_count_fn, test_work_count_done_fn, &done_count),
+              0);
+  }
+
+  pk_loop_run_simple_with_timeout(loop, 1100);
+  EXPECT_EQ(done_count, 4);
+
+  std::string work_path =
+    std::string(PROFILE_METRICS_PATH "/") + program_invocation_short_name + "/loop/work";
+
+  std::ifstream submitted_file(work_path + "/submitted/per_second");
+  ASSERT_TRUE(submitted_file.good());
+  int submitted = -1;
+  submitted_file >> submitted;
+  EXPECT_EQ(submitted, 4);
+
+  std::ifstream depth_file(work_path + "/queue/depth/max");
+  ASSERT_TRUE(depth_file.good());
+  int depth_max = -1;
+  depth_file >> depth_max;
+  EXPECT_EQ(depth_max, 4);
+
+  pk_loop_destroy(&loop);
+  unsetenv("PK_METRICS_PATH");
+
+  EXPECT_EQ(system("rm -rf " PROFILE_METRICS_PATH), 0);
+}
+
+TEST_F(LibpiksiTests, loopWorkQueueLimitTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  int done_count = 0;
+  int accepted = 0;
+  for (int i = 0; i < 64; i++) {
+    if (pk_loop_work_submit(loop, test_work_count_fn, test_work_count_done_fn, &done_count) == 0) {
+      accepted++;
+    }
+  }
+  EXPECT_GT(accepted, 0);
+  EXPECT_LT(accepted, 64);
+
+  /* Work still queued is cancelled, but every done function is called */
+  pk_loop_destroy(&loop);
+  EXPECT_EQ(done_count, accepted);
+}
+
+static void test_work_running_fn(void *context)
+{
+  __atomic_store_n((int *)context, 1, __ATOMIC_SEQ_CST);
+  usleep(200000);
+}
+
+static double thread_cpu_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+TEST_F(LibpiksiTests, loopWorkDestroyWaitsTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  int running = 0;
+  int done_count = 0;
+  EXPECT_EQ(pk_loop_work_submit(loop, test_work_running_fn, test_work_count_done_fn, &running), 0);
+  EXPECT_EQ(pk_loop_work_submit(loop, test_work_count_fn, test_work_count_done_fn, &done_count),
+            0);
+  while (__atomic_load_n(&running, __ATOMIC_SEQ_CST) == 0) {
+    usleep(1000);
+  }
+
+  /* Work already running can't be cancelled, destroy blocks until it is
+   * done instead of spinning the loop */
+  double cpu_start_ms = thread_cpu_ms();
+  pk_loop_destroy(&loop);
+  EXPECT_LT(thread_cpu_ms() - cpu_start_ms, 50.0);
+  EXPECT_EQ(running, 2);
+  EXPECT_EQ(done_count, 1);
+}
+
+#define POST_THREAD_COUNT 4
+#define POST_COUNT 1000
+
+struct test_post_ctx {
+  pk_loop_t *loop;
+  pthread_t loop_thread;
+  int next_seq[POST_THREAD_COUNT];
+  int total;
+  bool in_order;
+  bool on_loop_thread;
+};
+
+struct test_post_entry {
+  struct test_post_ctx *ctx;
+  int thread;
+  int seq;
+};
+
+static void test_post_fn(pk_loop_t *loop, int status, void *context)
+{
+  struct test_post_entry *entry = (struct test_post_entry *)context;
+  struct test_post_ctx *ctx = entry->ctx;
+  if (status != LOOP_SUCCESS || !pthread_equal(ctx->loop_thread, pthread_self())) {
+    ctx->on_loop_thread = false;
+  }
+  if (entry->seq != ctx->next_seq[entry->thread]++) {
+    ctx->in_order = false;
+  }
+  if (++ctx->total == POST_THREAD_COUNT * POST_COUNT) {
+    pk_loop_stop(loop);
+  }
+  delete entry;
+}
+
+struct test_post_thread_arg {
+  struct test_post_ctx *ctx;
+  int thread;
+};
+
+static void *test_post_thread(void *arg)
+{
+  struct test_post_thread_arg *thread_arg = (struct test_post_thread_arg *)arg;
+  for (int seq = 0; seq < POST_COUNT; seq++) {
+    struct test_post_entry *entry = new test_post_entry{thread_arg->ctx, thread_arg->thread, seq};
+    EXPECT_EQ(pk_loop_post(thread_arg->ctx->loop, test_post_fn, entry), 0);
+  }
+  return NULL;
+}
+
+TEST_F(LibpiksiTests, loopPostTest)
+{
+  struct test_post_ctx ctx = {};
+  ctx.loop = pk_loop_create();
+  ASSERT_NE(ctx.loop, nullptr);
+  ctx.loop_thread = pthread_self();
+  ctx.in_order = true;
+  ctx.on_loop_thread = true;
+
+  pthread_t threads[POST_THREAD_COUNT];
+  struct test_post_thread_arg args[POST_THREAD_COUNT];
+  for (int i = 0; i < POST_THREAD_COUNT; i++) {
+    args[i] = {&ctx, i};
+    ASSERT_EQ(pthread_create(&threads[i], NULL, test_post_thread, &args[i]), 0);
+  }
+
+  pk_loop_run_simple_with_timeout(ctx.loop, 5000);
+
+  for (int i = 0; i < POST_THREAD_COUNT; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  EXPECT_EQ(ctx.total, POST_THREAD_COUNT * POST_COUNT);
+  EXPECT_TRUE(ctx.in_order);
+  EXPECT_TRUE(ctx.on_loop_thread);
+
+  pk_loop_destroy(&ctx.loop);
+}
+
+static void test_post_destroy_fn(pk_loop_t *loop, int status, void *context)
+{
+  (void)loop;
+  *(int *)context = status;
+}
+
+TEST_F(LibpiksiTests, loopPostDestroyTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  int status = LOOP_UNKNOWN;
+  EXPECT_EQ(pk_loop_post(loop, test_post_destroy_fn, &status), 0);
+
+  /* Posts alone do not keep the loop running */
+  pk_loop_run_simple(loop);
+  EXPECT_EQ(status, LOOP_UNKNOWN);
+
+  pk_loop_destroy(&loop);
+  EXPECT_EQ(status, LOOP_ERROR);
+}
+
+struct test_wheel_ctx {
+  void *handle;
+  int count;
+  int remove_after;
+};
+
+static void test_wheel_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)status;
+  struct test_wheel_ctx *ctx = (struct test_wheel_ctx *)context;
+  EXPECT_EQ(handle, ctx->handle);
+  if (++ctx->count == ctx->remove_after) {
+    pk_loop_wheel_timer_remove(loop, handle);
+  }
+}
+
+static void test_wheel_reset_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  (void)status;
+  pk_loop_wheel_timer_reset(loop, context);
+}
+
+TEST_F(LibpiksiTests, loopWheelTimerTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  /* Fires every 50 ms until it removes itself */
+  struct test_wheel_ctx periodic = {NULL, 0, 3};
+  periodic.handle = pk_loop_wheel_timer_add(loop, 50, test_wheel_cb, &periodic);
+  ASSERT_NE(periodic.handle, nullptr);
+
+  /* Kept from firing by a faster timer resetting it */
+  struct test_wheel_ctx watchdog = {NULL, 0, 0};
+  watchdog.handle = pk_loop_wheel_timer_add(loop, 100, test_wheel_cb, &watchdog);
+  ASSERT_NE(watchdog.handle, nullptr);
+  void *feeder = pk_loop_wheel_timer_add(loop, 20, test_wheel_reset_cb, watchdog.handle);
+  ASSERT_NE(feeder, nullptr);
+
+  /* Long enough to cascade down from the second level */
+  struct test_wheel_ctx slow = {NULL, 0, 0};
+  slow.handle = pk_loop_wheel_timer_add(loop, 700, test_wheel_cb, &slow);
+  ASSERT_NE(slow.handle, nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pk_loop_run_simple_with_timeout(loop, 1000);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(periodic.count, 3);
+  EXPECT_EQ(watchdog.count, 0);
+  EXPECT_EQ(slow.count, 1);
+  /* uv time has millisecond granularity, allow the timeout to land early */
+  EXPECT_GE(elapsed, std::chrono::milliseconds(990));
+
+  pk_loop_wheel_timer_remove(loop, feeder);
+  pk_loop_destroy(&loop);
+}
+
+static void test_bench_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  (void)status;
+  (void)context;
+}
+
+#define BENCH_TIMER_COUNT 1000
+#define BENCH_RESET_COUNT 1000000
+
+/* Compares re-arming watchdog timers, as done for every received message */
+TEST_F(LibpiksiTests, loopWheelTimerBenchmark)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  static void *uv_timers[BENCH_TIMER_COUNT];
+  static void *wheel_timers[BENCH_TIMER_COUNT];
+  for (int i = 0; i < BENCH_TIMER_COUNT; i++) {
+    uv_timers[i] = pk_loop_timer_add(loop, 1000 + (u64)i, test_bench_cb, NULL);
+    ASSERT_NE(uv_timers[i], nullptr);
+    wheel_timers[i] = pk_loop_wheel_timer_add(loop, 1000 + (u64)i, test_bench_cb, NULL);
+    ASSERT_NE(wheel_timers[i], nullptr);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_RESET_COUNT; i++) {
+    EXPECT_EQ(pk_loop_timer_reset(uv_timers[i % BENCH_TIMER_COUNT]), 0);
+  }
+  auto uv_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_RESET_COUNT; i++) {
+    EXPECT_EQ(pk_loop_wheel_timer_reset(loop, wheel_timers[i % BENCH_TIMER_COUNT]), 0);
+  }
+  auto wheel_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+  std::cout << "timer reset: " << uv_ns / BENCH_RESET_COUNT << " ns/op, wheel timer reset: "
+            << wheel_ns / BENCH_RESET_COUNT << " ns/op" << std::endl;
+
+  for (int i = 0; i < BENCH_TIMER_COUNT; i++) {
+    pk_loop_wheel_timer_remove(loop, wheel_timers[i]);
+  }
+  pk_loop_destroy(&loop);
+}
+
+static void test_virtual_timer_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)handle;
+  (void)status;
+  std::vector<u64> *fired = (std::vector<u64> *)context;
+  fired->push_back(pk_loop_now_ms(loop));
+}
+
+TEST_F(LibpiksiTests, loopVirtualTimeTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+  EXPECT_NE(pk_loop_virtual_time_enable(loop), 0);
+
+  std::vector<u64> fired;
+  std::vector<u64> wheel_fired;
+  ASSERT_NE(pk_loop_timer_add(loop, 1000, test_virtual_timer_cb, &fired), nullptr);
+  void *wheel_timer = pk_loop_wheel_timer_add(loop, 5000, test_virtual_timer_cb, &wheel_fired);
+  ASSERT_NE(wheel_timer, nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pk_loop_run_simple_with_timeout(loop, 60000);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  /* A minute of timers in (much) less than a second of wall clock time */
+  EXPECT_LT(elapsed, std::chrono::seconds(1));
+  EXPECT_EQ(pk_loop_now_ms(loop), 60000u);
+
+  ASSERT_EQ(fired.size(), 60u);
+  for (size_t i = 0; i < fired.size(); i++) {
+    EXPECT_EQ(fired[i], (i + 1) * 1000);
+  }
+
+  /* Wheel timers fire within two ticks of their period */
+  ASSERT_EQ(wheel_fired.size(), 11u);
+  EXPECT_GE(wheel_fired[0], 5000u);
+  EXPECT_LE(wheel_fired[0], 5020u);
+
+  pk_loop_wheel_timer_remove(loop, wheel_timer);
+  pk_loop_destroy(&loop);
+}
+
+static void test_wheel_once_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  test_virtual_timer_cb(loop, handle, status, context);
+  pk_loop_wheel_timer_remove(loop, handle);
+}
+
+TEST_F(LibpiksiTests, loopWheelTimerIdleTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+
+  std::vector<u64> fired;
+  ASSERT_NE(pk_loop_wheel_timer_add(loop, 100, test_wheel_once_cb, &fired), nullptr);
+  pk_loop_run_simple_with_timeout(loop, 1000);
+  ASSERT_EQ(fired.size(), 1u);
+
+  /* A week with the wheel empty, longer than the wheel spans */
+  pk_loop_run_simple_with_timeout(loop, 7 * 24 * 3600 * 1000ull);
+  u64 armed_ms = pk_loop_now_ms(loop);
+
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_NE(pk_loop_wheel_timer_add(loop, 100, test_wheel_once_cb, &fired), nullptr);
+  pk_loop_run_simple_with_timeout(loop, 1000);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  /* Fires once, on time, without walking the idle ticks */
+  ASSERT_EQ(fired.size(), 2u);
+  EXPECT_GE(fired[1], armed_ms + 100);
+  EXPECT_LE(fired[1], armed_ms + 120);
+  EXPECT_LT(elapsed, std::chrono::milliseconds(100));
+
+  pk_loop_destroy(&loop);
+}
+
+static void test_once_timer_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)status;
+  std::vector<u64> *fired = (std::vector<u64> *)context;
+  fired->push_back(pk_loop_now_ms(loop));
+  /* Each wait is 100 ms longer than the last */
+  EXPECT_EQ(pk_loop_timer_once(handle, 100 * (fired->size() + 1)), 0);
+}
+
+TEST_F(LibpiksiTests, loopTimerOnceTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+
+  std::vector<u64> fired;
+  void *timer = pk_loop_timer_add(loop, 1000, test_once_timer_cb, &fired);
+  ASSERT_NE(timer, nullptr);
+  ASSERT_EQ(pk_loop_timer_once(timer, 100), 0);
+
+  pk_loop_run_simple_with_timeout(loop, 1000);
+
+  /* 100, 100 + 200, 300 + 300, 600 + 400, the period it was added with is
+   * replaced */
+  ASSERT_EQ(fired.size(), 4u);
+  EXPECT_EQ(fired[0], 100u);
+  EXPECT_EQ(fired[1], 300u);
+  EXPECT_EQ(fired[2], 600u);
+  EXPECT_EQ(fired[3], 1000u);
+
+  pk_loop_destroy(&loop);
+
+  /* On the real clock a timer armed once stays stopped after it fires */
+  loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  int count = 0;
+  timer = pk_loop_timer_add(loop, 10, test_slow_timer_cb, &count);
+  ASSERT_NE(timer, nullptr);
+  ASSERT_EQ(pk_loop_timer_once(timer, 0), 0);
+  pk_loop_run_simple_with_timeout(loop, 100);
+  EXPECT_EQ(count, 1);
+  pk_loop_destroy(&loop);
+}
+
+TEST_F(LibpiksiTests, loopVirtualTimeLateEnableTest)
+{
+  std::vector<u64> fired;
+
+  /* A timer started on the real clock would never see virtual time */
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_NE(pk_loop_timer_add(loop, 1000, test_virtual_timer_cb, &fired), nullptr);
+  EXPECT_NE(pk_loop_virtual_time_enable(loop), 0);
+  pk_loop_destroy(&loop);
+
+  loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_NE(pk_loop_before_poll_add(loop, test_virtual_timer_cb, &fired), nullptr);
+  EXPECT_NE(pk_loop_virtual_time_enable(loop), 0);
+  pk_loop_destroy(&loop);
+}
+
+struct test_hook_ctx {
+  int pending;
+  int flushes;
+  int flushed;
+  int checks;
+};
+
+static void test_hook_queue_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  (void)status;
+  ((struct test_hook_ctx *)context)->pending++;
+}
+
+static void test_hook_flush_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  (void)status;
+  struct test_hook_ctx *ctx = (struct test_hook_ctx *)context;
+  if (ctx->pending > 0) {
+    ctx->flushes++;
+    ctx->flushed += ctx->pending;
+    ctx->pending = 0;
+  }
+}
+
+static void test_hook_check_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  (void)loop;
+  (void)handle;
+  (void)status;
+  ((struct test_hook_ctx *)context)->checks++;
+}
+
+TEST_F(LibpiksiTests, loopPollHooksTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+  ASSERT_EQ(pk_loop_virtual_time_enable(loop), 0);
+
+  struct test_hook_ctx ctx = {};
+  /* Three timers due together queue output in one loop iteration */
+  for (int i = 0; i < 3; i++) {
+    ASSERT_NE(pk_loop_timer_add(loop, 100, test_hook_queue_cb, &ctx), nullptr);
+  }
+  void *before = pk_loop_before_poll_add(loop, test_hook_flush_cb, &ctx);
+  ASSERT_NE(before, nullptr);
+  void *after = pk_loop_after_poll_add(loop, test_hook_check_cb, &ctx);
+  ASSERT_NE(after, nullptr);
+
+  pk_loop_run_simple_with_timeout(loop, 1050);
+
+  EXPECT_EQ(ctx.pending, 0);
+  EXPECT_EQ(ctx.flushed, 30);
+  EXPECT_EQ(ctx.flushes, 10);
+  EXPECT_GT(ctx.checks, 0);
+
+  EXPECT_EQ(pk_loop_remove_handle(before), 0);
+  EXPECT_EQ(pk_loop_remove_handle(after), 0);
+  pk_loop_destroy(&loop);
+}
+
+struct test_writable_ctx {
+  int fd;
+  void *handle;
+  int writes;
+  int reads;
+};
+
+static void test_writable_cb(pk_loop_t *loop, void *handle, int status, void *context)
+{
+  struct test_writable_ctx *ctx = (struct test_writable_ctx *)context;
+  if (status & LOOP_READ) ctx->reads++;
+  if (!(status & LOOP_WRITE)) return;
+  /* Fill the pipe, then stop waiting for it to drain */
+  char buf[512] = {0};
+  while (write(ctx->fd, buf, sizeof(buf)) > 0) {
+  }
+  ctx->writes++;
+  EXPECT_EQ(pk_loop_poll_events_set(loop, handle, 0), 0);
+}
+
+TEST_F(LibpiksiTests, loopPollWritableTest)
+{
+  pk_loop_t *loop = pk_loop_create();
+  ASSERT_NE(loop, nullptr);
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+  ASSERT_EQ(fcntl(fds[1], F_SETFL, O_NONBLOCK), 0);
+
+  struct test_writable_ctx ctx = {.fd = fds[1], .handle = NULL, .writes = 0, .reads = 0};
+  ctx.handle = pk_loop_poll_add(loop, fds[1], test_writable_cb, &ctx);
+  ASSERT_NE(ctx.handle, nullptr);
+
+  /* Nothing to read on a write end, the callback only runs once writable */
+  pk_loop_run_simple_with_timeout(loop, 100);
+  EXPECT_EQ(ctx.writes, 0);
+
+  ASSERT_EQ(pk_loop_poll_events_set(loop, ctx.handle, LOOP_WRITE), 0);
+  pk_loop_run_simple_with_timeout(loop, 100);
+  EXPECT_EQ(ctx.writes, 1);
+  EXPECT_EQ(ctx.reads, 0);
+
+  /* Full pipe, nothing happens until it is read from */
+  ASSERT_EQ(pk_loop_poll_events_set(loop, ctx.handle, LOOP_WRITE), 0);
+  pk_loop_run_simple_with_timeout(loop, 100);
+  EXPECT_EQ(ctx.writes, 1);
+
+  char buf[65536];
+  while (read(fds[0], buf, sizeof(buf)) > 0) {
+  }
+  pk_loop_run_simple_with_timeout(loop, 100);
+  EXPECT_EQ(ctx.writes, 2);
+
+  pk_loop_poll_remove(loop, ctx.handle);
+  pk_loop_destroy(&loop);
+  close(fds[0]);
+  close(fds[1]);
+}
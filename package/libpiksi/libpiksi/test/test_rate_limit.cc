@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi_tests.h>
+
+#include <libpiksi/rate_limit.h>
+
+TEST_F(LibpiksiTests, rateLimitValidTest)
+{
+  EXPECT_TRUE(pk_rate_limit_valid(1));
+  EXPECT_TRUE(pk_rate_limit_valid(PK_RATE_LIMIT_MAX_HZ_MIN));
+  EXPECT_TRUE(pk_rate_limit_valid(1e9));
+
+  EXPECT_FALSE(pk_rate_limit_valid(0));
+  EXPECT_FALSE(pk_rate_limit_valid(-1));
+  EXPECT_FALSE(pk_rate_limit_valid(PK_RATE_LIMIT_MAX_HZ_MIN / 2));
+  EXPECT_FALSE(pk_rate_limit_valid(INFINITY));
+  EXPECT_FALSE(pk_rate_limit_valid(NAN));
+}
+
+TEST_F(LibpiksiTests, rateLimitTakeTest)
+{
+  /* 100 ms interval, a message may be up to 5 ms early */
+  pk_rate_limit_t limit;
+  pk_rate_limit_init(&limit, 10);
+
+  /* Starts full */
+  EXPECT_TRUE(pk_rate_limit_take(&limit));
+  EXPECT_FALSE(pk_rate_limit_take(&limit));
+
+  usleep(97000);
+  EXPECT_TRUE(pk_rate_limit_take(&limit));
+
+  /* The early pass is paid back */
+  usleep(70000);
+  EXPECT_FALSE(pk_rate_limit_take(&limit));
+
+  /* Holds at most one message however long it idles */
+  usleep(250000);
+  EXPECT_TRUE(pk_rate_limit_take(&limit));
+  EXPECT_FALSE(pk_rate_limit_take(&limit));
+}
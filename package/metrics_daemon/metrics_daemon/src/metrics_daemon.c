@@ -47,6 +47,7 @@ static const char *target_file = METRICS_OUTPUT_FILENAME;
 static const char *metrics_path = METRICS_ROOT_DIRECTORY;
 static bool enable_log_to_file = false;
 static unsigned int metrics_update_interval = 1;
+static bool write_pending = false;
 
 
 /**
@@ -253,18 +254,29 @@ int handle_walk_path(const char *fpath, const struct stat *sb, int tflag)
 /**
  * @brief function that write json to file
  *
- * Write messaging metrics to file
+ * Write messaging metrics to file, runs on a worker thread so that
+ * the directory walk does not hold up the loop.
  */
-static void write_metrics_to_file()
+static void write_metrics_to_file(void *context)
 {
+  (void)context;
   // Walk dir for metrics
   first_folder = true;
-  if (enable_log_to_file) {
-    if (ftw(metrics_path, handle_walk_path, 20) == -1) {
-      return;
-    }
-    if (!write_json_to_file(jobj_root, target_file)) piksi_log(LOG_ERR, "Failed to write to file");
+  if (ftw(metrics_path, handle_walk_path, 20) == -1) {
+    return;
   }
+  if (!write_json_to_file(jobj_root, target_file)) piksi_log(LOG_ERR, "Failed to write to file");
+}
+
+/**
+ * @brief called on the loop thread once the metrics have been written
+ */
+static void write_metrics_done(pk_loop_t *loop, int status, void *context)
+{
+  (void)loop;
+  (void)status;
+  (void)context;
+  write_pending = false;
 }
 
 static int parse_options(int argc, char *argv[])
@@ -298,11 +310,16 @@ static int parse_options(int argc, char *argv[])
  */
 static void run_routine_function(pk_loop_t *loop, void *timer_handle, int status, void *context)
 {
-  (void)loop;
   (void)timer_handle;
   (void)status;
   (void)context;
-  write_metrics_to_file();
+  // The json tree is only touched by the worker, so never run two walks at once
+  if (!enable_log_to_file || write_pending) {
+    return;
+  }
+  if (pk_loop_work_submit(loop, write_metrics_to_file, write_metrics_done, NULL) == 0) {
+    write_pending = true;
+  }
 }
 
 
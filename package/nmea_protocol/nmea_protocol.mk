@@ -8,16 +8,34 @@ NMEA_PROTOCOL_VERSION = 0.1
 NMEA_PROTOCOL_SITE = \
   "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/nmea_protocol/src"
 NMEA_PROTOCOL_SITE_METHOD = local
-NMEA_PROTOCOL_DEPENDENCIES =
+NMEA_PROTOCOL_DEPENDENCIES = libpiksi
 NMEA_PROTOCOL_INSTALL_STAGING = YES
 
+ifeq ($(BR2_BUILD_TESTS),y)
+NMEA_PROTOCOL_DEPENDENCIES += gtest valgrind
+
+define NMEA_PROTOCOL_BUILD_CMDS_TESTS
+    $(MAKE) CROSS=$(TARGET_CROSS) LD=$(TARGET_LD) -C $(@D) test
+endef
+
+define NMEA_PROTOCOL_TESTS_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/test/run_nmea_protocol_tests $(TARGET_DIR)/usr/bin
+endef
+endif
+
+ifeq ($(BR2_RUN_TESTS),y)
+NMEA_PROTOCOL_TESTS_RUN = $(call pbr_proot_valgrind_test,run_nmea_protocol_tests)
+endif
+
 define NMEA_PROTOCOL_BUILD_CMDS
     $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) LTO_PLUGIN="$(LTO_PLUGIN)" -C $(@D) all
+    $(NMEA_PROTOCOL_BUILD_CMDS_TESTS)
 endef
 
 define NMEA_PROTOCOL_INSTALL_STAGING_CMDS
     $(INSTALL) -D -m 0755 $(@D)/libnmea_protocol.so* $(STAGING_DIR)/usr/lib
     $(INSTALL) -D -m 0755 $(@D)/libnmea_protocol.a $(STAGING_DIR)/usr/lib
+    $(INSTALL) -D -m 0755 $(@D)/libnmea_protocol_static.a $(STAGING_DIR)/usr/lib
 endef
 
 define NMEA_PROTOCOL_INSTALL_TARGET_CMDS
@@ -26,6 +44,8 @@ define NMEA_PROTOCOL_INSTALL_TARGET_CMDS
                           $(TARGET_DIR)/usr/lib/endpoint_protocols
     $(INSTALL) -d -m 0755 $(TARGET_DIR)/etc/endpoint_router
     $(INSTALL) -D -m 0755 $(@D)/nmea_router.yml $(TARGET_DIR)/etc/endpoint_router
+    $(NMEA_PROTOCOL_TESTS_INSTALL)
+    $(NMEA_PROTOCOL_TESTS_RUN)
 endef
 
 $(eval $(generic-package))
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ * Config file format, one rule per line:
+ *
+ *   <talker> <sentence> <max_hz>
+ *
+ * e.g. "GN GGA 1", "* GSV 0.2" or "GP RMC 0". A talker of "*" matches any
+ * talker, a max_hz of 0 drops the sentence and a negative max_hz passes it
+ * unthrottled. Positive rates below 0.001 Hz are a parse error. The first
+ * matching rule wins. Once any rule is configured
+ * sentences matching no rule are dropped, with no rules (or no config file)
+ * everything passes. The file is reloaded whenever it is written.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include <libpiksi/file_watch.h>
+#include <libpiksi/protocol_plugin.h>
+#include <libpiksi/rate_limit.h>
+
+// clang-format off
+#define NMEA_TALKER_LEN     2
+#define NMEA_SENTENCE_LEN   3
+/* '$' + talker + sentence ID */
+#define NMEA_ADDRESS_LEN    (1 + NMEA_TALKER_LEN + NMEA_SENTENCE_LEN)
+
+#define RULES_MAX           64
+#define TALKER_ANY          0
+// clang-format on
+
+typedef struct {
+  uint16_t talker; /**< Packed talker ID or TALKER_ANY */
+  uint32_t sentence;
+  bool throttled;
+  bool drop;
+  pk_rate_limit_t limit;
+} filter_nmea_rule_t;
+
+typedef struct {
+  filter_nmea_rule_t rules[RULES_MAX];
+  uint32_t rules_count;
+  const char *config_file;
+  pk_file_watch_t *config_watch;
+  unsigned int loaded_generation;
+} filter_nmea_state_t;
+
+static uint16_t pack_talker(const uint8_t *talker)
+{
+  return (uint16_t)((talker[0] << 8) | talker[1]);
+}
+
+static uint32_t pack_sentence(const uint8_t *sentence)
+{
+  return ((uint32_t)sentence[0] << 16) | ((uint32_t)sentence[1] << 8) | sentence[2];
+}
+
+static int process_rule(filter_nmea_rule_t *rule)
+{
+  if (!rule->throttled) {
+    return 0;
+  }
+
+  if (rule->drop) {
+    return 1;
+  }
+
+  return pk_rate_limit_take(&rule->limit) ? 0 : 1;
+}
+
+static filter_nmea_rule_t *rule_lookup(filter_nmea_state_t *s, uint16_t talker, uint32_t sentence)
+{
+  for (uint32_t i = 0; i < s->rules_count; i++) {
+    filter_nmea_rule_t *rule = &s->rules[i];
+    if (rule->sentence == sentence && (rule->talker == TALKER_ANY || rule->talker == talker)) {
+      return rule;
+    }
+  }
+  return NULL;
+}
+
+static bool parse_rule(const char *line, filter_nmea_rule_t *rule)
+{
+  /* Fields are read one character past their length so an overlong field
+   * is caught rather than split, and nothing may follow the rate */
+  char talker[NMEA_TALKER_LEN + 2];
+  char sentence[NMEA_SENTENCE_LEN + 2];
+  double max_hz;
+  int end = -1;
+  if (sscanf(line, "%3s %4s %lf %n", talker, sentence, &max_hz, &end) != 3 || end < 0
+      || line[end] != '\0') {
+    return false;
+  }
+
+  if (strcmp(talker, "*") == 0) {
+    rule->talker = TALKER_ANY;
+  } else if (strlen(talker) == NMEA_TALKER_LEN) {
+    rule->talker = pack_talker((const uint8_t *)talker);
+  } else {
+    return false;
+  }
+
+  if (strlen(sentence) != NMEA_SENTENCE_LEN) {
+    return false;
+  }
+  rule->sentence = pack_sentence((const uint8_t *)sentence);
+
+  if (!isfinite(max_hz) || (max_hz > 0 && !pk_rate_limit_valid(max_hz))) {
+    return false;
+  }
+
+  rule->throttled = (max_hz >= 0);
+  rule->drop = (max_hz == 0);
+  if (max_hz > 0) {
+    /* First sentence after a (re)load always passes */
+    pk_rate_limit_init(&rule->limit, max_hz);
+  }
+
+  return true;
+}
+
+static void filter_nmea_load_config(filter_nmea_state_t *s)
+{
+  const char *filename = s->config_file;
+
+  s->rules_count = 0;
+
+  /* A missing file just means no rules */
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    if (errno != ENOENT) {
+      syslog(LOG_ERR, "error opening %s", filename);
+    }
+    return;
+  }
+
+  bool error = false;
+  char line[256];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+
+    /* Skip blank lines and comments */
+    const char *p = line + strspn(line, " \t");
+    if (*p == '\n' || *p == '\0' || *p == '#') {
+      continue;
+    }
+
+    if (s->rules_count == RULES_MAX) {
+      syslog(LOG_ERR, "too many rules in %s, max %d", filename, RULES_MAX);
+      error = true;
+      break;
+    }
+
+    if (!parse_rule(p, &s->rules[s->rules_count])) {
+      syslog(LOG_ERR, "error parsing %s", filename);
+      error = true;
+      break;
+    }
+    s->rules_count++;
+  }
+
+  fclose(fp);
+
+  /* Clear rules if an error occurred */
+  if (error) {
+    s->rules_count = 0;
+  }
+}
+
+PK_PROTOCOL_API void *filter_create(const char *filename)
+{
+  filter_nmea_state_t *s = (filter_nmea_state_t *)calloc(1, sizeof(*s));
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->config_file = strdup(filename);
+  /* Watch before loading so a write during the load is not missed */
+  s->config_watch = pk_file_watch_create(filename);
+  if (s->config_watch == NULL) {
+    syslog(LOG_ERR, "error setting up inotify on config file: %s", filename);
+  }
+  s->loaded_generation = 0;
+  filter_nmea_load_config(s);
+
+  return (void *)s;
+}
+
+PK_PROTOCOL_API void filter_destroy(void **state)
+{
+  filter_nmea_state_t *s = (filter_nmea_state_t *)(*state);
+  pk_file_watch_destroy(&s->config_watch);
+  free((void *)s->config_file);
+  s->config_file = NULL;
+  free(*state);
+  *state = NULL;
+}
+
+PK_PROTOCOL_API int filter_process(void *state, const uint8_t *msg, uint32_t msg_length)
+{
+  filter_nmea_state_t *s = (filter_nmea_state_t *)state;
+
+  /* Reload config if changed */
+  if (s->config_watch != NULL) {
+    unsigned int generation = pk_file_watch_generation(s->config_watch);
+    if (generation != s->loaded_generation) {
+      s->loaded_generation = generation;
+      filter_nmea_load_config(s);
+    }
+  }
+
+  /* Pass everything if no rules are configured */
+  if (s->rules_count == 0) {
+    return 0;
+  }
+
+  /* Reject sentences too short to carry an address field */
+  if (msg_length < NMEA_ADDRESS_LEN) {
+    return 1;
+  }
+
+  /* Look up corresponding rule, reject sentence if there is none */
+  filter_nmea_rule_t *rule =
+    rule_lookup(s, pack_talker(&msg[1]), pack_sentence(&msg[1 + NMEA_TALKER_LEN]));
+  if (rule == NULL) {
+    return 1;
+  }
+
+  return process_rule(rule);
+}
+
+PK_PROTOCOL_FILTER("NMEA", filter_create, filter_destroy, filter_process)
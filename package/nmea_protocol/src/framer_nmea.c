@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include <libpiksi/protocol_plugin.h>
+
+/* NMEA 0183 caps sentences at 82 characters, proprietary sentences from some
+ * receivers run longer so allow some slack before declaring a resync */
+#define NMEA_SENTENCE_LEN_MAX (256)
+
+/* Log the first checksum error and then every Nth one */
+#define CHECKSUM_ERROR_LOG_INTERVAL (100)
+
+typedef enum {
+  NMEA_WAIT_START,
+  NMEA_BODY,
+  NMEA_CHECKSUM_HI,
+  NMEA_CHECKSUM_LO,
+  NMEA_CR,
+  NMEA_LF,
+} nmea_parse_state_t;
+
+/**
+ * Sentences are parsed a byte at a time with a running XOR so that a sentence
+ * split across reads never has to be rescanned. Sentences lying within the
+ * caller's buffer are returned in place, only ones split across calls are
+ * copied into `partial`.
+ */
+typedef struct {
+  nmea_parse_state_t parse_state;
+  uint8_t checksum;
+  uint8_t checksum_expected;
+  uint32_t sentence_length;
+  uint32_t partial_length;
+  uint8_t partial[NMEA_SENTENCE_LEN_MAX];
+  uint32_t resync_count;
+  uint32_t checksum_error_count;
+} framer_nmea_state_t;
+
+static bool sentence_start(uint8_t c)
+{
+  return (c == '$') || (c == '!');
+}
+
+static int hex_value(uint8_t c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static void record_checksum_error(framer_nmea_state_t *s)
+{
+  if ((s->checksum_error_count++ % CHECKSUM_ERROR_LOG_INTERVAL) == 0) {
+    syslog(LOG_WARNING,
+           "nmea checksum mismatch, %u sentence(s) dropped so far",
+           s->checksum_error_count);
+  }
+}
+
+PK_PROTOCOL_API void *framer_create(void)
+{
+  framer_nmea_state_t *s = calloc(1, sizeof(*s));
+
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->parse_state = NMEA_WAIT_START;
+
+  return (void *)s;
+}
+
+PK_PROTOCOL_API void framer_destroy(void **state)
+{
+  free(*state);
+  *state = NULL;
+}
+
+/**
+ * Advance the parser by one byte. Returns true when `c` completes a sentence
+ * with a valid checksum. A byte that does not fit the sentence grammar drops
+ * the sentence in progress and is then reconsidered as a potential start.
+ */
+static bool parse_byte(framer_nmea_state_t *s, uint8_t c, bool *started)
+{
+  *started = false;
+
+  switch (s->parse_state) {
+  case NMEA_WAIT_START: break;
+
+  case NMEA_BODY:
+    if (c == '*') {
+      s->parse_state = NMEA_CHECKSUM_HI;
+      goto accepted;
+    }
+    if (c >= 0x20 && c <= 0x7E && !sentence_start(c)) {
+      s->checksum ^= c;
+      goto accepted;
+    }
+    break;
+
+  case NMEA_CHECKSUM_HI:
+    if (hex_value(c) >= 0) {
+      s->checksum_expected = (uint8_t)(hex_value(c) << 4);
+      s->parse_state = NMEA_CHECKSUM_LO;
+      goto accepted;
+    }
+    break;
+
+  case NMEA_CHECKSUM_LO:
+    if (hex_value(c) >= 0) {
+      s->checksum_expected |= (uint8_t)hex_value(c);
+      s->parse_state = NMEA_CR;
+      goto accepted;
+    }
+    break;
+
+  case NMEA_CR:
+    if (c == '\r') {
+      s->parse_state = NMEA_LF;
+      goto accepted;
+    }
+    /* Tolerate senders that terminate with a bare LF */
+    if (c == '\n') {
+      goto terminated;
+    }
+    break;
+
+  case NMEA_LF:
+    if (c == '\n') {
+      goto terminated;
+    }
+    break;
+
+  default: break;
+  }
+
+  if (s->parse_state != NMEA_WAIT_START) {
+    s->resync_count++;
+    s->parse_state = NMEA_WAIT_START;
+  }
+
+  if (sentence_start(c)) {
+    s->parse_state = NMEA_BODY;
+    s->checksum = 0;
+    s->sentence_length = 1;
+    *started = true;
+  }
+  return false;
+
+accepted:
+  if (++s->sentence_length > NMEA_SENTENCE_LEN_MAX - 2) {
+    /* Leave room for the terminator, anything longer is line noise */
+    s->resync_count++;
+    s->parse_state = NMEA_WAIT_START;
+  }
+  return false;
+
+terminated:
+  s->parse_state = NMEA_WAIT_START;
+  if (s->checksum != s->checksum_expected) {
+    record_checksum_error(s);
+    return false;
+  }
+  return true;
+}
+
+static uint32_t framer_nmea_next(framer_nmea_state_t *s,
+                                 const uint8_t *data,
+                                 uint32_t data_length,
+                                 const uint8_t **frame,
+                                 uint32_t *frame_length)
+{
+  /* Start of the current sentence within `data`, or data_length if it began
+   * in an earlier call and lives in `partial` */
+  uint32_t start = (s->parse_state == NMEA_WAIT_START) ? 0 : data_length;
+  bool carried = (s->parse_state != NMEA_WAIT_START);
+  uint32_t offset = 0;
+
+  for (; offset < data_length; offset++) {
+
+    /* Skip straight to the next candidate when idle */
+    if (s->parse_state == NMEA_WAIT_START) {
+      while (offset < data_length && !sentence_start(data[offset])) {
+        offset++;
+      }
+      if (offset == data_length) {
+        break;
+      }
+    }
+
+    bool started;
+    bool complete = parse_byte(s, data[offset], &started);
+
+    if (started) {
+      start = offset;
+      carried = false;
+      s->partial_length = 0;
+    } else if (s->parse_state == NMEA_WAIT_START && !complete) {
+      carried = false;
+      s->partial_length = 0;
+    }
+
+    if (!complete) {
+      continue;
+    }
+
+    offset++;
+    if (carried) {
+      memcpy(&s->partial[s->partial_length], data, offset);
+      *frame = s->partial;
+      *frame_length = s->partial_length + offset;
+    } else {
+      *frame = &data[start];
+      *frame_length = offset - start;
+    }
+    s->partial_length = 0;
+    return offset;
+  }
+
+  /* Sentence continues in the next read */
+  if (s->parse_state != NMEA_WAIT_START) {
+    uint32_t from = carried ? 0 : start;
+    memcpy(&s->partial[s->partial_length], &data[from], data_length - from);
+    s->partial_length += data_length - from;
+  }
+
+  *frame = NULL;
+  *frame_length = 0;
+  return data_length;
+}
+
+PK_PROTOCOL_API uint32_t framer_process(void *state,
+                                        const uint8_t *data,
+                                        uint32_t data_length,
+                                        const uint8_t **frame,
+                                        uint32_t *frame_length)
+{
+  return framer_nmea_next((framer_nmea_state_t *)state, data, data_length, frame, frame_length);
+}
+
+PK_PROTOCOL_FRAMER("NMEA", framer_create, framer_destroy, framer_process, NULL)
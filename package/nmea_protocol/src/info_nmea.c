@@ -19,10 +19,15 @@
 const char *protocol_name = "NMEA";
 const char *setting_name = "NMEA OUT";
 
+/* ports_daemon writes the filter config from the port's enabled_nmea_messages
+ * setting */
 int port_adapter_opts_get(char *buf, size_t buf_size, const char *port_name)
 {
   return snprintf(buf,
                   buf_size,
+                  "--framer-out nmea "
+                  "--filter-out nmea "
+                  "--filter-out-config /etc/filter_out_config/%s.nmea "
                   "-p 'ipc:///var/run/sockets/nmea_external.sub' "
                   "-s 'ipc:///var/run/sockets/nmea_external.pub'",
                   port_name);
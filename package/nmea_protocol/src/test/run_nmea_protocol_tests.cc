@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi/file_watch.h>
+#include <libpiksi/logging.h>
+
+#define PROGRAM_NAME "nmea_protocol_tests"
+
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+#define PROTOCOL_LIBRARY_NAME "libnmea_protocol.so"
+
+#define FILTER_CONFIG_FILE "/tmp/test_nmea_filter_config"
+/* Past the config check interval, with room for the coarse clock's resolution */
+#define FILTER_RELOAD_WAIT_US ((PK_FILE_WATCH_INTERVAL_MS + 50) * 1000)
+
+#define FILTER_PASS 0
+#define FILTER_REJECT 1
+
+typedef void *(*filter_create_fn_t)(const char *filename);
+typedef void (*filter_destroy_fn_t)(void **state);
+typedef int (*filter_process_fn_t)(void *state, const uint8_t *msg, uint32_t msg_length);
+
+class NmeaFilterTests : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    const char *path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+    std::string library = std::string(path != nullptr ? path : PROTOCOL_LIBRARY_PATH_DEFAULT) + "/"
+                          + PROTOCOL_LIBRARY_NAME;
+
+    handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(handle, nullptr) << dlerror();
+
+    *(void **)&create = dlsym(handle, "filter_create");
+    *(void **)&destroy = dlsym(handle, "filter_destroy");
+    *(void **)&process = dlsym(handle, "filter_process");
+    ASSERT_NE(create, nullptr);
+    ASSERT_NE(destroy, nullptr);
+    ASSERT_NE(process, nullptr);
+  }
+
+  void TearDown() override
+  {
+    if (state != nullptr) destroy(&state);
+    if (handle != nullptr) dlclose(handle);
+    unlink(FILTER_CONFIG_FILE);
+  }
+
+  void write_config(const std::string &config)
+  {
+    std::ofstream file(FILTER_CONFIG_FILE);
+    file << config;
+  }
+
+  void create_filter(const std::string &config)
+  {
+    write_config(config);
+    state = create(FILTER_CONFIG_FILE);
+    ASSERT_NE(state, nullptr);
+  }
+
+  /* Only the address field matters to the filter */
+  int filter(const char *sentence)
+  {
+    return process(state, (const uint8_t *)sentence, strlen(sentence));
+  }
+
+  void *handle = nullptr;
+  void *state = nullptr;
+  filter_create_fn_t create = nullptr;
+  filter_destroy_fn_t destroy = nullptr;
+  filter_process_fn_t process = nullptr;
+};
+
+TEST_F(NmeaFilterTests, Rules)
+{
+  create_filter("# comment\n\nGN GGA -1\n  GP RMC -1\n");
+
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GPRMC,*00\r\n"), FILTER_PASS);
+
+  /* Talker and sentence must both match, nothing else passes */
+  EXPECT_EQ(filter("$GPGGA,*00\r\n"), FILTER_REJECT);
+  EXPECT_EQ(filter("$GNRMC,*00\r\n"), FILTER_REJECT);
+  EXPECT_EQ(filter("$GNGSV,*00\r\n"), FILTER_REJECT);
+
+  /* Too short to carry an address */
+  EXPECT_EQ(filter("$GNGG"), FILTER_REJECT);
+}
+
+TEST_F(NmeaFilterTests, TalkerWildcard)
+{
+  create_filter("* GSV -1\n");
+
+  EXPECT_EQ(filter("$GPGSV,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GLGSV,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GAGSV,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GPGGA,*00\r\n"), FILTER_REJECT);
+}
+
+TEST_F(NmeaFilterTests, FirstMatchWins)
+{
+  create_filter("GN GGA 0\n* GGA -1\n");
+
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+  EXPECT_EQ(filter("$GPGGA,*00\r\n"), FILTER_PASS);
+}
+
+TEST_F(NmeaFilterTests, ZeroRateDrops)
+{
+  create_filter("GN GGA 0\nGN RMC -1\n");
+
+  /* Dropped from the first sentence on, unlike a rate limit */
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+  usleep(50000);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+}
+
+TEST_F(NmeaFilterTests, NegativeRatePasses)
+{
+  create_filter("GN GGA -1\n");
+
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  }
+}
+
+TEST_F(NmeaFilterTests, RateLimit)
+{
+  /* 100 ms interval, a sentence may be up to 5 ms early */
+  create_filter("GN GGA 10\n");
+
+  /* The first sentence passes */
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+
+  usleep(97000);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+
+  /* The early pass is paid back */
+  usleep(70000);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+}
+
+TEST_F(NmeaFilterTests, RateDecimation)
+{
+  /* 200 Hz in for a second, 20 Hz out */
+  create_filter("* GGA 20\n");
+
+  int passed = 0;
+  for (int i = 0; i < 200; i++) {
+    if (filter("$GNGGA,*00\r\n") == FILTER_PASS) passed++;
+    usleep(5000);
+  }
+
+  EXPECT_GE(passed, 15);
+  EXPECT_LE(passed, 22);
+}
+
+TEST_F(NmeaFilterTests, ParseErrorPassesEverything)
+{
+  for (const char *rule : {"G GGA 1",
+                           "GNX GGA 1",
+                           "GN GG 1",
+                           "GN GGA",
+                           "GN GGA 0.0001",
+                           "GN GGA inf",
+                           "GN GGA nan",
+                           "GNGGA 1",
+                           "GN GGAA 1",
+                           "GN GGA 1x",
+                           "GN GGA 1 2"}) {
+    create_filter(std::string("GP RMC -1\n") + rule + "\n");
+    EXPECT_EQ(filter("$GNGSV,*00\r\n"), FILTER_PASS) << rule;
+    destroy(&state);
+  }
+}
+
+TEST_F(NmeaFilterTests, MissingConfigPassesEverything)
+{
+  unlink(FILTER_CONFIG_FILE);
+  state = create(FILTER_CONFIG_FILE);
+  ASSERT_NE(state, nullptr);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+}
+
+TEST_F(NmeaFilterTests, ReloadOnWrite)
+{
+  create_filter("GN GGA -1\n");
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GNRMC,*00\r\n"), FILTER_REJECT);
+
+  write_config("GN RMC -1\n");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+  EXPECT_EQ(filter("$GNRMC,*00\r\n"), FILTER_PASS);
+
+  /* An empty config passes everything */
+  write_config("");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+}
+
+TEST_F(NmeaFilterTests, ReloadResetsRateLimits)
+{
+  create_filter("GN GGA 0.01\n");
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+
+  /* Limits start full again, or this would wait 100 seconds */
+  write_config("GN GGA 0.01\n");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_PASS);
+  EXPECT_EQ(filter("$GNGGA,*00\r\n"), FILTER_REJECT);
+}
+
+int main(int argc, char **argv)
+{
+  logging_init(PROGRAM_NAME);
+  logging_log_to_stdout_only(true);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  auto ret = RUN_ALL_TESTS();
+
+  logging_deinit();
+
+  return ret;
+}
@@ -14,6 +14,7 @@
 #include <mutex>
 #include <cassert>
 #include <cstdlib>
+#include <memory>
 #include <thread>
 #include <unistd.h>
 #include <libpiksi/logging.h>
@@ -112,11 +113,20 @@ class Ctx {
 
   void stop()
   {
-    pk_loop_stop(loop_);
+    // Called from other threads, so the stop has to happen on the loop thread
+    pk_loop_post(loop_, stop_callback, nullptr);
   }
 
  protected:
   pk_loop_t *loop_;
+
+ private:
+  static void stop_callback(pk_loop_t *loop, int status, void *context)
+  {
+    (void)status;
+    (void)context;
+    pk_loop_stop(loop);
+  }
 };
 
 class SettingsCtx : public Ctx {
@@ -183,15 +193,36 @@ class SbpCtx : public Ctx {
 
   bool send(const orion_proto::SbpFrame &sbp_frame)
   {
-    return sbp_tx_send(sbp_pubsub_tx_ctx_get(pubsub_),
-                       sbp_frame.type(),
-                       sbp_frame.length(),
-                       const_cast<uint8_t *>(
-                         reinterpret_cast<const uint8_t *>(sbp_frame.payload().data())))
-           == 0;
+    // Frames are read on the main thread, hand them to the loop thread for sending
+    auto request = new SendRequest{pubsub_, sbp_frame};
+    if (pk_loop_post(loop_, send_callback, request) != 0) {
+      delete request;
+      return false;
+    }
+    return true;
   }
 
  private:
+  struct SendRequest {
+    sbp_pubsub_ctx_t *pubsub;
+    orion_proto::SbpFrame sbp_frame;
+  };
+
+  static void send_callback(pk_loop_t *loop, int status, void *context)
+  {
+    (void)loop;
+    std::unique_ptr<SendRequest> request{static_cast<SendRequest *>(context)};
+    if (status != LOOP_SUCCESS) {
+      return;
+    }
+    const orion_proto::SbpFrame &sbp_frame = request->sbp_frame;
+    sbp_tx_send(sbp_pubsub_tx_ctx_get(request->pubsub),
+                sbp_frame.type(),
+                sbp_frame.length(),
+                const_cast<uint8_t *>(
+                  reinterpret_cast<const uint8_t *>(sbp_frame.payload().data())));
+  }
+
   sbp_pubsub_ctx_t *pubsub_;
 };
 
@@ -44,6 +44,11 @@
 // See https://elixir.bootlin.com/linux/v4.6/source/drivers/usb/gadget/function/u_serial.c#L83
 #define USB_SERIAL_XMIT_SIZE "8192"
 
+// Upper bound of a TCP server's max_clients setting. With the default of 0
+//   each client gets an endpoint_adapter process of its own, otherwise up to
+//   max_clients are handled in one process.
+#define TCP_SERVER_CLIENTS_MAX 32
+
 #define RUNIT_SERVICE_DIR "/var/run/ports_daemon/sv"
 
 typedef enum {
@@ -64,6 +69,7 @@ typedef enum {
 typedef union {
   struct {
     uint32_t port;
+    uint32_t max_clients;
   } tcp_server_data;
   struct {
     char address[256];
@@ -136,11 +142,21 @@ static int opts_get_tcp_server(char *buf,
                                const port_config_t *port_config)
 {
   uint32_t port = opts_data->tcp_server_data.port;
+  uint32_t max_clients = opts_data->tcp_server_data.max_clients;
+  if (max_clients == 0) {
+    return snprintf(buf,
+                    buf_size,
+                    "--name %s --tcp-l %u%s",
+                    port_config->name,
+                    port,
+                    get_fileio_opts(port_config));
+  }
   return snprintf(buf,
                   buf_size,
-                  "--name %s --tcp-l %u%s",
+                  "--name %s --tcp-l %u --tcp-clients %u%s",
                   port_config->name,
                   port,
+                  max_clients,
                   get_fileio_opts(port_config));
 }
 
@@ -443,6 +459,15 @@ static int setting_tcp_server_port_notify(void *context)
   return port_configure(port_config, false);
 }
 
+static int setting_tcp_server_max_clients_notify(void *context)
+{
+  port_config_t *port_config = (port_config_t *)context;
+  if (port_config->opts_data.tcp_server_data.max_clients > TCP_SERVER_CLIENTS_MAX) {
+    return SETTINGS_WR_VALUE_REJECTED;
+  }
+  return port_configure(port_config, false);
+}
+
 static int setting_tcp_client_address_notify(void *context)
 {
   port_config_t *port_config = (port_config_t *)context;
@@ -488,6 +513,19 @@ static int setting_tcp_server_port_register(pk_settings_ctx_t *settings_ctx,
                               port_config);
 }
 
+static int setting_tcp_server_max_clients_register(pk_settings_ctx_t *settings_ctx,
+                                                   port_config_t *port_config)
+{
+  return pk_settings_register(settings_ctx,
+                              port_config->name,
+                              "max_clients",
+                              &port_config->opts_data.tcp_server_data.max_clients,
+                              sizeof(port_config->opts_data.tcp_server_data.max_clients),
+                              SETTINGS_TYPE_INT,
+                              setting_tcp_server_max_clients_notify,
+                              port_config);
+}
+
 static int setting_tcp_client_address_register(pk_settings_ctx_t *settings_ctx,
                                                port_config_t *port_config)
 {
@@ -612,6 +650,7 @@ int ports_init(pk_settings_ctx_t *settings_ctx, bool can_enabled)
 
     if (port_config->type == PORT_TYPE_TCP_SERVER) {
       setting_tcp_server_port_register(settings_ctx, port_config);
+      setting_tcp_server_max_clients_register(settings_ctx, port_config);
     }
 
     if (port_config->type == PORT_TYPE_TCP_CLIENT) {
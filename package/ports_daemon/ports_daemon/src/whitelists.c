@@ -16,14 +16,16 @@
 #include <errno.h>
 
 #include <libpiksi/logging.h>
+#include <libpiksi/rate_limit.h>
 
 #include "whitelists.h"
 
 // Not declared static so tests can access
 int whitelist_notify(void *context);
+int nmea_whitelist_notify(void *context);
 
 /* Whitelist settings are kept as formatted strings of message ids and
- * rate dividers.  Strings are parsed in whilelist_notify()
+ * rate dividers or rate limits.  Strings are parsed in whilelist_notify()
  *
  * Examples:
  * ""
@@ -34,8 +36,34 @@ int whitelist_notify(void *context);
  *  - Message 1234 is sent at full rate
  *  - Message 5678 is sent at half rate
  *  - Message 3456 is sent at 1/10 rate
+ * "522@1,74@0.5"
+ *  - Message 522 is sent at most once per second whatever its source rate
+ *  - Message 74 is sent at most once every two seconds
+ * "4099/4@2"
+ *  - Every 4th message 4099 is kept, and of those at most two per second
+ *    are sent
+ *
+ * Rates must be plain decimals the filter accepts, see pk_rate_limit_valid().
+ *
+ * Ports sending NMEA have a similar whitelist of sentences, a sentence ID
+ * alone matches any talker:
+ * ""
+ *  - All sentences are sent
+ * "GGA,GNRMC@1,GSV@0.2"
+ *  - GGA sentences from any talker are sent at full rate
+ *  - GNRMC sentences are sent at most once per second
+ *  - GSV sentences from any talker are sent at most once every five seconds
  */
 
+#define WHITESPACE " \t\n\r\v"
+
+/* NMEA address characters, talker and sentence IDs */
+#define NMEA_ADDRESS_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+#define NMEA_TALKER_LEN 2
+#define NMEA_SENTENCE_LEN 3
+/* As many rules as filter_nmea holds */
+#define NMEA_WHITELIST_MAX 64
+
 enum port {
   PORT_UART0,
   PORT_UART1,
@@ -449,18 +477,48 @@ static port_whitelist_config_t port_whitelist_config[PORT_MAX] = {
     .wl = "23,65,72,74,81,97,117,134,136,137,138,139,144,149,163,165,166,167,171,175,181,185,187,188,189,190,257,258,259,520,522,524,526,527,528,1025,2304,2305,2306,4098,30583,65280,65282,65535"
   },
 };
+
+static port_whitelist_config_t port_nmea_whitelist_config[PORT_MAX] = {
+  [PORT_UART0] = { .name = "uart0", .wl = "" },
+  [PORT_UART1] = { .name = "uart1", .wl = "" },
+  [PORT_USB0] = { .name = "usb0", .wl = "" },
+  [PORT_TCP_SERVER0] = { .name = "tcp_server0", .wl = "" },
+  [PORT_TCP_SERVER1] = { .name = "tcp_server1", .wl = "" },
+  [PORT_TCP_CLIENT0] = { .name = "tcp_client0", .wl = "" },
+  [PORT_TCP_CLIENT1] = { .name = "tcp_client1", .wl = "" },
+  [PORT_UDP_SERVER0] = { .name = "udp_server0", .wl = "" },
+  [PORT_UDP_SERVER1] = { .name = "udp_server1", .wl = "" },
+  [PORT_UDP_CLIENT0] = { .name = "udp_client0", .wl = "" },
+  [PORT_UDP_CLIENT1] = { .name = "udp_client1", .wl = "" },
+  [PORT_CAN0] = { .name = "can0", .wl = "" },
+  [PORT_CAN1] = { .name = "can1", .wl = "" },
+};
 // clang-format on
 
+/* Parses the rate following an '@', returns the characters taken or 0 */
+static size_t parse_rate(const char *c, double *max_hz)
+{
+  /* Plain decimals only, strtod() would also take inf, nan and hex */
+  size_t length = strspn(c, "0123456789.");
+  char *end;
+  *max_hz = strtod(c, &end);
+  if (length == 0 || end != c + length || !pk_rate_limit_valid(*max_hz)) {
+    return 0;
+  }
+  return length;
+}
+
 int whitelist_notify(void *context)
 {
   port_whitelist_config_t *port_whitelist_config_ = (port_whitelist_config_t *)context;
 
   char *c = port_whitelist_config_->wl;
   unsigned tmp;
-  enum { PARSE_ID, PARSE_AFTER_ID, PARSE_DIV, PARSE_AFTER_DIV } state = PARSE_ID;
+  enum { PARSE_ID, PARSE_AFTER_ID, PARSE_DIV, PARSE_AFTER_DIV, PARSE_AFTER_RATE } state = PARSE_ID;
   struct {
     unsigned id;
     unsigned div;
+    double max_hz;
   } whitelist[128];
   int entries = 0;
 
@@ -475,6 +533,7 @@ int whitelist_notify(void *context)
         state = PARSE_AFTER_ID;
         whitelist[entries].id = tmp;
         whitelist[entries].div = 1;
+        whitelist[entries].max_hz = 0;
         entries++;
         break;
       case PARSE_DIV:
@@ -483,6 +542,7 @@ int whitelist_notify(void *context)
         break;
       case PARSE_AFTER_DIV:
       case PARSE_AFTER_ID:
+      case PARSE_AFTER_RATE:
       default: return SETTINGS_WR_PARSE_FAILED;
       }
       break;
@@ -497,9 +557,23 @@ int whitelist_notify(void *context)
       }
       break;
 
+    /* Rate limit token, following is the maximum rate in Hz */
+    case '@':
+      if ((state == PARSE_AFTER_ID) || (state == PARSE_AFTER_DIV)) {
+        size_t length = parse_rate(c + 1, &whitelist[entries - 1].max_hz);
+        if (length == 0) {
+          return SETTINGS_WR_PARSE_FAILED;
+        }
+        state = PARSE_AFTER_RATE;
+        c += 1 + length;
+      } else {
+        return SETTINGS_WR_PARSE_FAILED;
+      }
+      break;
+
     /* Separator token, following is message id */
     case ',':
-      if ((state == PARSE_AFTER_ID) || (state == PARSE_AFTER_DIV)) {
+      if ((state == PARSE_AFTER_ID) || (state == PARSE_AFTER_DIV) || (state == PARSE_AFTER_RATE)) {
         state = PARSE_ID;
         c++;
       } else {
@@ -530,7 +604,83 @@ int whitelist_notify(void *context)
     return SETTINGS_WR_SERVICE_FAILED;
   }
   for (int i = 0; i < entries; i++) {
-    fprintf(cfg, "%x %x\n", whitelist[i].id, whitelist[i].div);
+    if (whitelist[i].max_hz > 0) {
+      fprintf(cfg, "%x %x %g\n", whitelist[i].id, whitelist[i].div, whitelist[i].max_hz);
+    } else {
+      fprintf(cfg, "%x %x\n", whitelist[i].id, whitelist[i].div);
+    }
+  }
+  fclose(cfg);
+
+  return SETTINGS_WR_OK;
+}
+
+int nmea_whitelist_notify(void *context)
+{
+  port_whitelist_config_t *port_whitelist_config_ = (port_whitelist_config_t *)context;
+
+  struct {
+    char talker[NMEA_TALKER_LEN + 1];
+    char sentence[NMEA_SENTENCE_LEN + 1];
+    double max_hz;
+  } whitelist[NMEA_WHITELIST_MAX];
+  int entries = 0;
+
+  /* Entries are "<sentence>" or "<talker><sentence>", each optionally
+   * followed by "@<max_hz>", separated by commas */
+  const char *c = port_whitelist_config_->wl;
+  c += strspn(c, WHITESPACE);
+  while (*c) {
+    if (entries == NMEA_WHITELIST_MAX) {
+      return SETTINGS_WR_PARSE_FAILED;
+    }
+
+    size_t length = strspn(c, NMEA_ADDRESS_CHARS);
+    if (length == NMEA_SENTENCE_LEN) {
+      strcpy(whitelist[entries].talker, "*");
+    } else if (length == NMEA_TALKER_LEN + NMEA_SENTENCE_LEN) {
+      memcpy(whitelist[entries].talker, c, NMEA_TALKER_LEN);
+      whitelist[entries].talker[NMEA_TALKER_LEN] = '\0';
+    } else {
+      return SETTINGS_WR_PARSE_FAILED;
+    }
+    memcpy(whitelist[entries].sentence, c + length - NMEA_SENTENCE_LEN, NMEA_SENTENCE_LEN);
+    whitelist[entries].sentence[NMEA_SENTENCE_LEN] = '\0';
+    c += length;
+
+    /* Negative passes the sentence unthrottled */
+    whitelist[entries].max_hz = -1;
+    if (*c == '@') {
+      length = parse_rate(c + 1, &whitelist[entries].max_hz);
+      if (length == 0) {
+        return SETTINGS_WR_PARSE_FAILED;
+      }
+      c += 1 + length;
+    }
+    entries++;
+
+    c += strspn(c, WHITESPACE);
+    if (*c == ',') {
+      c++;
+      c += strspn(c, WHITESPACE);
+      if (*c == '\0') {
+        return SETTINGS_WR_PARSE_FAILED;
+      }
+    } else if (*c != '\0') {
+      return SETTINGS_WR_PARSE_FAILED;
+    }
+  }
+
+  /* Parsed successfully, write config file and accept setting */
+  char fn[256];
+  sprintf(fn, "/etc/filter_out_config/%s.nmea", port_whitelist_config_->name);
+  FILE *cfg = fopen(fn, "w");
+  if (cfg == NULL) {
+    piksi_log(LOG_ERR, "Error opening file: %s (error: %s)", fn, strerror(errno));
+    return SETTINGS_WR_SERVICE_FAILED;
+  }
+  for (int i = 0; i < entries; i++) {
+    fprintf(cfg, "%s %s %g\n", whitelist[i].talker, whitelist[i].sentence, whitelist[i].max_hz);
   }
   fclose(cfg);
 
@@ -555,6 +705,25 @@ int whitelists_init(pk_settings_ctx_t *settings_ctx, bool can_enabled)
     if (rc != 0) {
       return rc;
     }
+
+    /* The NMEA filter watches its config for changes, so it must exist
+     * before any adapter starts */
+    rc = nmea_whitelist_notify(&port_nmea_whitelist_config[i]);
+    if (rc != 0) {
+      return rc;
+    }
+
+    rc = pk_settings_register(settings_ctx,
+                              port_nmea_whitelist_config[i].name,
+                              "enabled_nmea_messages",
+                              port_nmea_whitelist_config[i].wl,
+                              sizeof(port_nmea_whitelist_config[i].wl),
+                              SETTINGS_TYPE_STRING,
+                              nmea_whitelist_notify,
+                              &port_nmea_whitelist_config[i]);
+    if (rc != 0) {
+      return rc;
+    }
   }
 
   return 0;
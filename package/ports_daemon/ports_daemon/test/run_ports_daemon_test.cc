@@ -10,6 +10,7 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <streambuf>
@@ -21,11 +22,14 @@ extern "C" {
 }
 
 extern "C" int whitelist_notify(void *context);
+extern "C" int nmea_whitelist_notify(void *context);
 
 enum port {
   PORT_WHITESPACE,
   PORT_VALID,
   PORT_EMPTY,
+  PORT_RATE,
+  PORT_RATE_DIV,
   PORT_MAX,
 };
 
@@ -38,6 +42,37 @@ static port_whitelist_config_t port_whitelist_config[PORT_MAX] = {
   {"whitespace", " \t\n\r\v"},
   {"valid", "72,74"},
   {"empty", ""},
+  {"rate", "72,522@5,74/2,65535@0.5"},
+  {"rate_div", "522/2@5,74/4@0.001"},
+};
+
+static const char *invalid_nmea_whitelists[] = {
+  "GG",
+  "GNGGAX",
+  "gga",
+  "GGA@0",
+  "GGA@inf",
+  "GGA/2",
+  "GGA@1@1",
+  "GGA GSV",
+  "GGA,",
+  ",GGA",
+  "GGA,,GSV",
+};
+
+static const char *invalid_rates[] = {
+  "522@0",
+  "522@0.0001",
+  "522@1e-400",
+  "522@inf",
+  "522@nan",
+  "522@-5",
+  "522@0x10",
+  "522@1.2.3",
+  "522@",
+  "522@5@5",
+  "522@5/2",
+  "522@5 6",
 };
 
 // The fixture for testing class RotatingLogger.
@@ -85,6 +120,78 @@ TEST_F(PortsDaemonTests, Whitelist_empty)
   ASSERT_STREQ("", str.c_str());
 }
 
+TEST_F(PortsDaemonTests, Whitelist_rate)
+{
+
+  system("rm -f /etc/filter_out_config/rate");
+
+  ASSERT_EQ(0, whitelist_notify(&port_whitelist_config[PORT_RATE]));
+
+  std::ifstream t("/etc/filter_out_config/rate");
+  std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+
+  ASSERT_STREQ("48 1\n20a 1 5\n4a 2\nffff 1 0.5\n", str.c_str());
+}
+
+TEST_F(PortsDaemonTests, Whitelist_rate_div)
+{
+
+  system("rm -f /etc/filter_out_config/rate_div");
+
+  ASSERT_EQ(0, whitelist_notify(&port_whitelist_config[PORT_RATE_DIV]));
+
+  std::ifstream t("/etc/filter_out_config/rate_div");
+  std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+
+  ASSERT_STREQ("20a 2 5\n4a 4 0.001\n", str.c_str());
+}
+
+TEST_F(PortsDaemonTests, Whitelist_rate_invalid)
+{
+  for (const char *rate : invalid_rates) {
+    port_whitelist_config_t config = {"rate_invalid", ""};
+    strncpy(config.whitelist, rate, sizeof(config.whitelist) - 1);
+    EXPECT_NE(0, whitelist_notify(&config)) << rate;
+  }
+}
+
+TEST_F(PortsDaemonTests, Nmea_whitelist)
+{
+  system("rm -f /etc/filter_out_config/nmea.nmea");
+
+  port_whitelist_config_t config = {"nmea", " GGA, GNRMC@1 ,GSV@0.2 "};
+  ASSERT_EQ(0, nmea_whitelist_notify(&config));
+
+  std::ifstream t("/etc/filter_out_config/nmea.nmea");
+  std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+
+  ASSERT_STREQ("* GGA -1\nGN RMC 1\n* GSV 0.2\n", str.c_str());
+}
+
+TEST_F(PortsDaemonTests, Nmea_whitelist_empty)
+{
+  system("rm -f /etc/filter_out_config/nmea_empty.nmea");
+
+  port_whitelist_config_t config = {"nmea_empty", " \t"};
+  ASSERT_EQ(0, nmea_whitelist_notify(&config));
+
+  /* Written even when empty, the filter watches it */
+  std::ifstream t("/etc/filter_out_config/nmea_empty.nmea");
+  ASSERT_TRUE(t.good());
+  std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+
+  ASSERT_STREQ("", str.c_str());
+}
+
+TEST_F(PortsDaemonTests, Nmea_whitelist_invalid)
+{
+  for (const char *wl : invalid_nmea_whitelists) {
+    port_whitelist_config_t config = {"nmea_invalid", ""};
+    strncpy(config.whitelist, wl, sizeof(config.whitelist) - 1);
+    EXPECT_NE(0, nmea_whitelist_notify(&config)) << wl;
+  }
+}
+
 int main(int argc, char **argv)
 {
   system("mkdir -p /etc/filter_out_config");
@@ -0,0 +1,60 @@
+################################################################################
+#
+# protocol_bench
+#
+################################################################################
+
+PROTOCOL_BENCH_VERSION = 0.1
+PROTOCOL_BENCH_SITE = \
+  "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/protocol_bench/src"
+PROTOCOL_BENCH_SITE_METHOD = local
+PROTOCOL_BENCH_DEPENDENCIES = libuv libsbp libpiksi
+
+# Filters are only benchmarked for the protocols that are installed
+ifeq ($(BR2_PACKAGE_SBP_PROTOCOL),y)
+PROTOCOL_BENCH_DEPENDENCIES += sbp_protocol
+PROTOCOL_BENCH_FILTER_CONFIGS += --filter-config sbp=/etc/protocol_bench/sbp
+endif
+ifeq ($(BR2_PACKAGE_RTCM3_IN_PROTOCOL),y)
+PROTOCOL_BENCH_DEPENDENCIES += rtcm3_in_protocol
+endif
+ifeq ($(BR2_PACKAGE_NMEA_PROTOCOL),y)
+PROTOCOL_BENCH_DEPENDENCIES += nmea_protocol
+PROTOCOL_BENCH_FILTER_CONFIGS += --filter-config nmea=/etc/protocol_bench/nmea
+endif
+ifeq ($(BR2_PACKAGE_DEMUX_PROTOCOL),y)
+PROTOCOL_BENCH_DEPENDENCIES += demux_protocol
+endif
+
+ifeq ($(BR2_RUN_TESTS),y)
+PROTOCOL_BENCH_TESTS_RUN = \
+  $(call pbr_proot_test,protocol_bench --repeat 1 $(PROTOCOL_BENCH_FILTER_CONFIGS))
+endif
+
+# libFuzzer needs clang, the static protocol archives come from staging
+ifeq ($(BR2_PACKAGE_PROTOCOL_BENCH_FUZZ),y)
+PROTOCOL_BENCH_DEPENDENCIES += host-llvm_vanilla
+
+define PROTOCOL_BENCH_BUILD_CMDS_FUZZ
+    $(MAKE) FUZZ_CC=$(LLVM_CC) FUZZ_EXTRA_CFLAGS="--sysroot=$(STAGING_DIR)" -C $(@D) fuzz
+endef
+
+define PROTOCOL_BENCH_FUZZ_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/protocol_fuzz $(TARGET_DIR)/usr/bin
+endef
+endif
+
+define PROTOCOL_BENCH_BUILD_CMDS
+    $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) -C $(@D) all
+    $(PROTOCOL_BENCH_BUILD_CMDS_FUZZ)
+endef
+
+define PROTOCOL_BENCH_INSTALL_TARGET_CMDS
+    $(INSTALL) -D -m 0755 $(@D)/protocol_bench $(TARGET_DIR)/usr/bin
+    $(INSTALL) -d -m 0755 $(TARGET_DIR)/etc/protocol_bench
+    $(INSTALL) -D -m 0644 $(@D)/filter_config/* $(TARGET_DIR)/etc/protocol_bench
+    $(PROTOCOL_BENCH_FUZZ_INSTALL)
+    $(PROTOCOL_BENCH_TESTS_RUN)
+endef
+
+$(eval $(generic-package))
@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ * Pushes synthetic and recorded corpora through the framer and filter plugins
+ * using the same libpiksi API as endpoint_adapter. Every corpus is fed whole
+ * and split at random read boundaries, all splits must produce the same
+ * frames, and a clean synthetic corpus must come back frame for frame. Any
+ * difference fails the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+
+#include <libpiksi/logging.h>
+#include <libpiksi/framer.h>
+#include <libpiksi/filter.h>
+#include <libpiksi/protocols.h>
+#include <libpiksi/util.h>
+
+#include "protocol_corpus.h"
+
+#define PROGRAM_NAME "protocol_bench"
+
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+
+#define FRAMES_DEFAULT 2000
+#define REPEAT_DEFAULT 10
+#define SEED_DEFAULT 1
+
+#define NAMED_ARGS_MAX 16
+
+/* Largest read size in each split, 0 feeds the corpus in one call */
+static const uint32_t chunk_maxes[] = {0, 4096, 64, 1};
+
+static const char *const framers_default[] = {"sbp", "rtcm3", "nmea", "demux"};
+
+typedef struct {
+  const char *name;
+  const char *value;
+} named_arg_t;
+
+static const char *framers[NAMED_ARGS_MAX];
+static size_t framers_count = 0;
+static named_arg_t corpora[NAMED_ARGS_MAX];
+static size_t corpora_count = 0;
+static named_arg_t filter_configs[NAMED_ARGS_MAX];
+static size_t filter_configs_count = 0;
+static uint32_t frames_count = FRAMES_DEFAULT;
+static uint32_t repeat = REPEAT_DEFAULT;
+static uint32_t seed = SEED_DEFAULT;
+static const char *write_corpus_dir = NULL;
+
+static void usage(char *command)
+{
+  fprintf(stderr, "Usage: %s\n", command);
+
+  fprintf(stderr, "\t--framer <name>\n");
+  fprintf(stderr, "\t\tframer to run, may be repeated (default sbp, rtcm3, nmea, demux)\n");
+  fprintf(stderr, "\t--corpus <framer>=<file>\n");
+  fprintf(stderr, "\t\trecorded capture to run through a framer, may be repeated\n");
+  fprintf(stderr, "\t--filter-config <filter>=<file>\n");
+  fprintf(stderr, "\t\trun frames through the filter of the same name as the framer\n");
+  fprintf(stderr, "\t--frames <n>\n");
+  fprintf(stderr, "\t\tframes per synthetic corpus (default %d)\n", FRAMES_DEFAULT);
+  fprintf(stderr, "\t--repeat <n>\n");
+  fprintf(stderr, "\t\ttimes each corpus is timed (default %d)\n", REPEAT_DEFAULT);
+  fprintf(stderr, "\t--seed <n>\n");
+  fprintf(stderr, "\t--write-corpus <dir>\n");
+  fprintf(stderr, "\t\twrite the synthetic corpora to dir (e.g. as fuzzer seeds) and exit\n");
+}
+
+static int named_arg_parse(const char *arg, named_arg_t *args, size_t *count)
+{
+  const char *value = strchr(arg, '=');
+  if (value == NULL || value == arg || value[1] == '\0' || *count == NAMED_ARGS_MAX) {
+    return -1;
+  }
+
+  args[*count] = (named_arg_t){.name = strndup(arg, (size_t)(value - arg)), .value = value + 1};
+  *count += 1;
+  return 0;
+}
+
+static const char *named_arg_lookup(const named_arg_t *args, size_t count, const char *name)
+{
+  for (size_t i = 0; i < count; i++) {
+    if (strcasecmp(args[i].name, name) == 0) {
+      return args[i].value;
+    }
+  }
+  return NULL;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+  enum {
+    OPT_ID_FRAMER = 1,
+    OPT_ID_CORPUS,
+    OPT_ID_FILTER_CONFIG,
+    OPT_ID_FRAMES,
+    OPT_ID_REPEAT,
+    OPT_ID_SEED,
+    OPT_ID_WRITE_CORPUS,
+  };
+
+  /* clang-format off */
+  const struct option long_opts[] = {
+    {"framer",        required_argument, 0, OPT_ID_FRAMER},
+    {"corpus",        required_argument, 0, OPT_ID_CORPUS},
+    {"filter-config", required_argument, 0, OPT_ID_FILTER_CONFIG},
+    {"frames",        required_argument, 0, OPT_ID_FRAMES},
+    {"repeat",        required_argument, 0, OPT_ID_REPEAT},
+    {"seed",          required_argument, 0, OPT_ID_SEED},
+    {"write-corpus",  required_argument, 0, OPT_ID_WRITE_CORPUS},
+    {0, 0, 0, 0},
+  };
+  /* clang-format on */
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+    switch (opt) {
+    case OPT_ID_FRAMER: {
+      if (framer_interface_valid(optarg) != 0 || framers_count == NAMED_ARGS_MAX) {
+        fprintf(stderr, "invalid framer\n");
+        return -1;
+      }
+      framers[framers_count++] = optarg;
+    } break;
+
+    case OPT_ID_CORPUS: {
+      if (named_arg_parse(optarg, corpora, &corpora_count) != 0) {
+        fprintf(stderr, "invalid corpus\n");
+        return -1;
+      }
+    } break;
+
+    case OPT_ID_FILTER_CONFIG: {
+      if (named_arg_parse(optarg, filter_configs, &filter_configs_count) != 0) {
+        fprintf(stderr, "invalid filter config\n");
+        return -1;
+      }
+    } break;
+
+    case OPT_ID_FRAMES: {
+      frames_count = (uint32_t)strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_REPEAT: {
+      repeat = (uint32_t)strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_SEED: {
+      seed = (uint32_t)strtoul(optarg, NULL, 10);
+    } break;
+
+    case OPT_ID_WRITE_CORPUS: {
+      write_corpus_dir = optarg;
+    } break;
+
+    default: {
+      fprintf(stderr, "invalid option\n");
+      return -1;
+    } break;
+    }
+  }
+
+  if (frames_count == 0 || repeat == 0) {
+    fprintf(stderr, "--frames and --repeat must be positive\n");
+    return -1;
+  }
+
+  /* Default to every framer that is installed */
+  if (framers_count == 0) {
+    for (size_t i = 0; i < COUNT_OF(framers_default); i++) {
+      if (framer_interface_valid(framers_default[i]) == 0) {
+        framers[framers_count++] = framers_default[i];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < corpora_count; i++) {
+    if (framer_interface_valid(corpora[i].name) != 0) {
+      fprintf(stderr, "invalid framer for corpus %s\n", corpora[i].value);
+      return -1;
+    }
+  }
+
+  for (size_t i = 0; i < filter_configs_count; i++) {
+    if (filter_interface_valid(filter_configs[i].name) != 0) {
+      fprintf(stderr, "invalid filter %s\n", filter_configs[i].name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static double monotonic_s(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Feed the corpus once with fresh framer and filter state */
+static int feed_once(const char *framer_name,
+                     const corpus_t *corpus,
+                     uint32_t chunk_max,
+                     corpus_result_t *result)
+{
+  framer_t *framer = framer_create(framer_name);
+  if (framer == NULL) {
+    return -1;
+  }
+
+  filter_t *filter = NULL;
+  const char *filter_config = named_arg_lookup(filter_configs, filter_configs_count, framer_name);
+  if (filter_config != NULL) {
+    filter = filter_create(framer_name, filter_config);
+    if (filter == NULL) {
+      framer_destroy(&framer);
+      return -1;
+    }
+  }
+
+  *result = (corpus_result_t){.digest = CORPUS_DIGEST_INIT};
+  uint32_t effective_chunk_max = (chunk_max == 0) ? UINT32_MAX : chunk_max;
+  int ret =
+    corpus_feed(framer, filter, corpus->data, corpus->length, effective_chunk_max, seed, result);
+
+  if (filter != NULL) {
+    filter_destroy(&filter);
+  }
+  framer_destroy(&framer);
+
+  return ret;
+}
+
+/**
+ * Run one corpus through every split. For a synthetic corpus the intact frame
+ * count is known, and `expect_exact` requires the frames to match the ones
+ * the corpus was generated from. Returns the number of failures.
+ */
+static int bench_corpus(const char *framer_name,
+                        const char *corpus_name,
+                        const corpus_t *corpus,
+                        bool synthetic,
+                        bool expect_exact)
+{
+  int failures = 0;
+  corpus_result_t reference;
+  bool have_reference = false;
+
+  for (size_t c = 0; c < COUNT_OF(chunk_maxes); c++) {
+    corpus_result_t result;
+    double start = monotonic_s();
+    for (uint32_t r = 0; r < repeat; r++) {
+      if (feed_once(framer_name, corpus, chunk_maxes[c], &result) != 0) {
+        printf("%-8s %-20s framer broke the framer_process() contract\n",
+               framer_name,
+               corpus_name);
+        return failures + 1;
+      }
+    }
+    double elapsed = monotonic_s() - start;
+
+    const char *status = "ok";
+    if (!have_reference) {
+      reference = result;
+      have_reference = true;
+      if (expect_exact && (result.frames != corpus->frames || result.digest != corpus->digest)) {
+        status = "FRAMES DIFFER FROM CORPUS";
+        failures++;
+      }
+    } else if (result.frames != reference.frames || result.digest != reference.digest) {
+      status = "SPLIT CHANGED FRAMES";
+      failures++;
+    }
+
+    char intact[16] = "-";
+    if (synthetic) {
+      snprintf(intact, sizeof(intact), "%u", corpus->frames);
+    }
+
+    char chunk_name[16];
+    if (chunk_maxes[c] == 0) {
+      snprintf(chunk_name, sizeof(chunk_name), "whole");
+    } else {
+      snprintf(chunk_name, sizeof(chunk_name), "1-%u", chunk_maxes[c]);
+    }
+
+    double mbytes = (double)corpus->length * repeat / 1e6;
+    double skipped = (corpus->length > 0)
+                       ? 100.0 * (double)(corpus->length - result.framed_bytes) / (double)corpus->length
+                       : 0;
+    printf("%-8s %-20s %-7s %9.2f %11.0f %7u %7s %8.2f%% %7u  %s\n",
+           framer_name,
+           corpus_name,
+           chunk_name,
+           mbytes / elapsed,
+           (double)result.frames * repeat / elapsed,
+           result.frames,
+           intact,
+           skipped,
+           result.frames_passed,
+           status);
+  }
+
+  return failures;
+}
+
+static int write_corpora(void)
+{
+  int ret = 0;
+  for (size_t i = 0; i < framers_count; i++) {
+    for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+      corpus_t corpus;
+      if (corpus_generate(&corpus, framers[i], (corpus_kind_t)kind, frames_count, seed) != 0) {
+        continue;
+      }
+      char filename[PATH_MAX];
+      snprintf(filename,
+               sizeof(filename),
+               "%s/%s_%s.bin",
+               write_corpus_dir,
+               framers[i],
+               corpus_kind_name((corpus_kind_t)kind));
+      if (corpus_save(&corpus, filename) != 0) {
+        ret = -1;
+      }
+      corpus_free(&corpus);
+    }
+  }
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  logging_init(PROGRAM_NAME);
+
+  const char *protocol_library_path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+  if (protocol_library_path == NULL) {
+    protocol_library_path = PROTOCOL_LIBRARY_PATH_DEFAULT;
+  }
+
+  if (protocols_import(protocol_library_path) != 0) {
+    fprintf(stderr, "error importing protocols\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (parse_options(argc, argv) != 0) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (write_corpus_dir != NULL) {
+    exit(write_corpora() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  printf("%-8s %-20s %-7s %9s %11s %7s %7s %9s %7s\n",
+         "framer",
+         "corpus",
+         "reads",
+         "MB/s",
+         "frames/s",
+         "frames",
+         "intact",
+         "skipped",
+         "passed");
+
+  int failures = 0;
+
+  for (size_t i = 0; i < framers_count; i++) {
+    for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+      corpus_t corpus;
+      if (corpus_generate(&corpus, framers[i], (corpus_kind_t)kind, frames_count, seed) != 0) {
+        continue;
+      }
+      failures += bench_corpus(framers[i],
+                               corpus_kind_name((corpus_kind_t)kind),
+                               &corpus,
+                               true,
+                               kind == CORPUS_CLEAN);
+      corpus_free(&corpus);
+    }
+  }
+
+  for (size_t i = 0; i < corpora_count; i++) {
+    corpus_t corpus;
+    if (corpus_load(&corpus, corpora[i].value) != 0) {
+      failures++;
+      continue;
+    }
+    const char *basename = strrchr(corpora[i].value, '/');
+    failures += bench_corpus(corpora[i].name,
+                             basename != NULL ? basename + 1 : corpora[i].value,
+                             &corpus,
+                             false,
+                             false);
+    corpus_free(&corpus);
+  }
+
+  logging_deinit();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d framing failure(s)\n", failures);
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <libpiksi/crc.h>
+#include <libpiksi/logging.h>
+
+#include "protocol_corpus.h"
+
+#define SBP_PREAMBLE 0x55
+#define RTCM3_PREAMBLE 0xD3
+
+/* Largest frame any generator produces, RTCM3 with a 1023 byte payload */
+#define FRAME_SIZE_MAX 1029
+
+#define FRAMER_BATCH_MAX 32
+
+/* One frame in this many is damaged in the bit flip and truncated corpora */
+#define DAMAGE_INTERVAL 5
+
+typedef uint32_t (*frame_generate_fn_t)(uint8_t *frame, uint32_t *rng);
+
+static const char *const kind_names[CORPUS_KIND_COUNT] = {
+  [CORPUS_CLEAN] = "clean",
+  [CORPUS_BITFLIP] = "bitflip",
+  [CORPUS_TRUNCATED] = "truncated",
+};
+
+uint32_t corpus_rand(uint32_t *state)
+{
+  /* xorshift32, the state must not be zero */
+  uint32_t x = (*state != 0) ? *state : 0x9E3779B9u;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/* FNV-1a over the frame length and contents */
+uint64_t corpus_digest(uint64_t digest, const uint8_t *frame, uint32_t length)
+{
+  for (uint32_t i = 0; i < sizeof(length); i++) {
+    digest = (digest ^ ((length >> (8 * i)) & 0xFF)) * 0x100000001b3ULL;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    digest = (digest ^ frame[i]) * 0x100000001b3ULL;
+  }
+  return digest;
+}
+
+static uint32_t sbp_frame_generate(uint8_t *frame, uint32_t *rng)
+{
+  uint8_t payload_length = (uint8_t)corpus_rand(rng);
+  uint16_t msg_type = (uint16_t)corpus_rand(rng);
+
+  frame[0] = SBP_PREAMBLE;
+  frame[1] = (uint8_t)msg_type;
+  frame[2] = (uint8_t)(msg_type >> 8);
+  frame[3] = 0x42;
+  frame[4] = 0x00;
+  frame[5] = payload_length;
+  for (uint32_t i = 0; i < payload_length; i++) {
+    frame[6 + i] = (uint8_t)corpus_rand(rng);
+  }
+
+  uint32_t crc_offset = 6 + payload_length;
+  uint16_t crc = pk_crc16_ccitt(&frame[1], crc_offset - 1, 0);
+  frame[crc_offset] = (uint8_t)crc;
+  frame[crc_offset + 1] = (uint8_t)(crc >> 8);
+
+  return crc_offset + 2;
+}
+
+static uint32_t rtcm3_frame_generate(uint8_t *frame, uint32_t *rng)
+{
+  uint32_t payload_length = corpus_rand(rng) % 1024;
+
+  frame[0] = RTCM3_PREAMBLE;
+  frame[1] = (uint8_t)(payload_length >> 8);
+  frame[2] = (uint8_t)payload_length;
+  for (uint32_t i = 0; i < payload_length; i++) {
+    frame[3 + i] = (uint8_t)corpus_rand(rng);
+  }
+
+  uint32_t crc_offset = 3 + payload_length;
+  uint32_t crc = pk_crc24q(frame, crc_offset, 0);
+  frame[crc_offset] = (uint8_t)(crc >> 16);
+  frame[crc_offset + 1] = (uint8_t)(crc >> 8);
+  frame[crc_offset + 2] = (uint8_t)crc;
+
+  return crc_offset + 3;
+}
+
+static uint32_t nmea_frame_generate(uint8_t *frame, uint32_t *rng)
+{
+  static const char *const addresses[] = {"GPGGA", "GNRMC", "GPGSV", "GNZDA", "GNGST"};
+
+  char body[200];
+  int length = snprintf(body, sizeof(body), "%s", addresses[corpus_rand(rng) % 5]);
+  uint32_t fields = corpus_rand(rng) % 16;
+  for (uint32_t i = 0; i < fields; i++) {
+    length += snprintf(&body[length],
+                       sizeof(body) - (size_t)length,
+                       ",%u",
+                       corpus_rand(rng) % 100000);
+  }
+
+  uint8_t checksum = 0;
+  for (int i = 0; i < length; i++) {
+    checksum ^= (uint8_t)body[i];
+  }
+
+  return (uint32_t)sprintf((char *)frame, "$%s*%02X\r\n", body, checksum);
+}
+
+static uint32_t demux_frame_generate(uint8_t *frame, uint32_t *rng)
+{
+  switch (corpus_rand(rng) % 3) {
+  case 0: return sbp_frame_generate(frame, rng);
+  case 1: return rtcm3_frame_generate(frame, rng);
+  default: return nmea_frame_generate(frame, rng);
+  }
+}
+
+static frame_generate_fn_t frame_generator(const char *framer_name)
+{
+  if (strcasecmp(framer_name, "sbp") == 0) return sbp_frame_generate;
+  if (strcasecmp(framer_name, "rtcm3") == 0) return rtcm3_frame_generate;
+  if (strcasecmp(framer_name, "nmea") == 0) return nmea_frame_generate;
+  if (strcasecmp(framer_name, "demux") == 0) return demux_frame_generate;
+  return NULL;
+}
+
+const char *corpus_kind_name(corpus_kind_t kind)
+{
+  return kind_names[kind];
+}
+
+bool corpus_supported(const char *framer_name)
+{
+  return frame_generator(framer_name) != NULL;
+}
+
+static int corpus_append(corpus_t *corpus, const uint8_t *data, size_t length)
+{
+  if (corpus->length + length > corpus->capacity) {
+    size_t capacity = (corpus->capacity > 0) ? corpus->capacity * 2 : 65536;
+    while (capacity < corpus->length + length) {
+      capacity *= 2;
+    }
+    uint8_t *buffer = realloc(corpus->data, capacity);
+    if (buffer == NULL) {
+      piksi_log(LOG_ERR, "error allocating corpus buffer");
+      return -1;
+    }
+    corpus->data = buffer;
+    corpus->capacity = capacity;
+  }
+  memcpy(&corpus->data[corpus->length], data, length);
+  corpus->length += length;
+  return 0;
+}
+
+int corpus_generate(corpus_t *corpus,
+                    const char *framer_name,
+                    corpus_kind_t kind,
+                    uint32_t frames,
+                    uint32_t seed)
+{
+  frame_generate_fn_t generate = frame_generator(framer_name);
+  if (generate == NULL) {
+    return -1;
+  }
+
+  *corpus = (corpus_t){.frames = 0, .digest = CORPUS_DIGEST_INIT};
+
+  uint32_t rng = seed;
+  uint8_t frame[FRAME_SIZE_MAX];
+  for (uint32_t i = 0; i < frames; i++) {
+    uint32_t length = generate(frame, &rng);
+    bool damage = (kind != CORPUS_CLEAN) && (corpus_rand(&rng) % DAMAGE_INTERVAL == 0);
+
+    if (damage && kind == CORPUS_BITFLIP) {
+      frame[1 + corpus_rand(&rng) % (length - 1)] ^= (uint8_t)(1 << (corpus_rand(&rng) % 8));
+    } else if (damage && kind == CORPUS_TRUNCATED) {
+      length = 1 + corpus_rand(&rng) % (length - 1);
+    }
+
+    if (corpus_append(corpus, frame, length) != 0) {
+      corpus_free(corpus);
+      return -1;
+    }
+
+    if (!damage) {
+      corpus->frames++;
+      corpus->digest = corpus_digest(corpus->digest, frame, length);
+    }
+  }
+
+  return 0;
+}
+
+int corpus_load(corpus_t *corpus, const char *filename)
+{
+  *corpus = (corpus_t){.frames = 0, .digest = CORPUS_DIGEST_INIT};
+
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    piksi_log(LOG_ERR, "error opening %s", filename);
+    return -1;
+  }
+
+  int result = 0;
+  uint8_t buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    if (corpus_append(corpus, buffer, count) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  if (ferror(fp)) {
+    piksi_log(LOG_ERR, "error reading %s", filename);
+    result = -1;
+  }
+
+  fclose(fp);
+  if (result != 0) {
+    corpus_free(corpus);
+  }
+  return result;
+}
+
+int corpus_save(const corpus_t *corpus, const char *filename)
+{
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    piksi_log(LOG_ERR, "error opening %s", filename);
+    return -1;
+  }
+
+  size_t written = fwrite(corpus->data, 1, corpus->length, fp);
+  if (fclose(fp) != 0 || written != corpus->length) {
+    piksi_log(LOG_ERR, "error writing %s", filename);
+    return -1;
+  }
+  return 0;
+}
+
+void corpus_free(corpus_t *corpus)
+{
+  free(corpus->data);
+  *corpus = (corpus_t){0};
+}
+
+int corpus_feed(framer_t *framer,
+                filter_t *filter,
+                const uint8_t *data,
+                size_t length,
+                uint32_t chunk_max,
+                uint32_t seed,
+                corpus_result_t *result)
+{
+  uint32_t rng = seed;
+  size_t pos = 0;
+
+  while (pos < length) {
+    uint32_t chunk = 1 + corpus_rand(&rng) % chunk_max;
+    if (chunk > length - pos) {
+      chunk = (uint32_t)(length - pos);
+    }
+
+    uint32_t offset = 0;
+    while (offset < chunk) {
+      const uint8_t *frames[FRAMER_BATCH_MAX];
+      uint32_t frame_lengths[FRAMER_BATCH_MAX];
+      uint32_t frame_count = 0;
+      uint32_t remaining = chunk - offset;
+      uint32_t consumed = framer_process_batch(framer,
+                                               &data[pos + offset],
+                                               remaining,
+                                               frames,
+                                               frame_lengths,
+                                               FRAMER_BATCH_MAX,
+                                               &frame_count);
+
+      /* A framer that returns nothing must have taken all of the input */
+      if (consumed > remaining || (frame_count == 0 && consumed != remaining)
+          || frame_count > FRAMER_BATCH_MAX) {
+        return -1;
+      }
+      offset += consumed;
+
+      for (uint32_t i = 0; i < frame_count; i++) {
+        if (frames[i] == NULL || frame_lengths[i] == 0) {
+          return -1;
+        }
+        result->frames++;
+        result->framed_bytes += frame_lengths[i];
+        result->digest = corpus_digest(result->digest, frames[i], frame_lengths[i]);
+        if (filter != NULL && filter_process(filter, frames[i], frame_lengths[i]) == 0) {
+          result->frames_passed++;
+        }
+      }
+    }
+
+    pos += chunk;
+  }
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_PROTOCOL_CORPUS_H
+#define SWIFTNAV_PROTOCOL_CORPUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libpiksi/framer.h>
+#include <libpiksi/filter.h>
+
+typedef enum {
+  CORPUS_CLEAN,
+  CORPUS_BITFLIP,   /**< One frame in five has a bit flipped */
+  CORPUS_TRUNCATED, /**< One frame in five is cut short by the next one */
+  CORPUS_KIND_COUNT,
+} corpus_kind_t;
+
+typedef struct {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+  uint32_t frames; /**< Intact frames in the stream */
+  uint64_t digest; /**< corpus_digest() of the intact frames, in order */
+} corpus_t;
+
+/* Result of running a corpus through a framer, and optionally a filter */
+typedef struct {
+  uint32_t frames;
+  uint32_t frames_passed; /**< Frames the filter let through */
+  uint64_t framed_bytes;
+  uint64_t digest;
+} corpus_result_t;
+
+const char *corpus_kind_name(corpus_kind_t kind);
+
+/* Whether synthetic frames can be generated for the named framer */
+bool corpus_supported(const char *framer_name);
+
+/**
+ * Generate a stream of `frames` random frames for the named framer ("sbp",
+ * "rtcm3", "nmea", or "demux" for all three interleaved). The same seed
+ * always produces the same stream.
+ */
+int corpus_generate(corpus_t *corpus,
+                    const char *framer_name,
+                    corpus_kind_t kind,
+                    uint32_t frames,
+                    uint32_t seed);
+
+/* Read a recorded capture, the frames it holds are not known up front */
+int corpus_load(corpus_t *corpus, const char *filename);
+int corpus_save(const corpus_t *corpus, const char *filename);
+void corpus_free(corpus_t *corpus);
+
+uint32_t corpus_rand(uint32_t *state);
+uint64_t corpus_digest(uint64_t digest, const uint8_t *frame, uint32_t length);
+#define CORPUS_DIGEST_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Push data through a framer, and filter if not NULL, in reads of 1 to
+ * chunk_max bytes. Read sizes come from `seed`, so a run can be repeated
+ * exactly. Returns -1 if the framer breaks the framer_process() contract.
+ */
+int corpus_feed(framer_t *framer,
+                filter_t *filter,
+                const uint8_t *data,
+                size_t length,
+                uint32_t chunk_max,
+                uint32_t seed,
+                corpus_result_t *result);
+
+#endif /* SWIFTNAV_PROTOCOL_CORPUS_H */
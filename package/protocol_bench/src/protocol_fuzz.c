@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ * libFuzzer entry point for the framers. The protocol archives are linked in
+ * statically. The first input byte picks the framer, the rest is framed once
+ * whole and once split at read boundaries taken from the input. Both runs
+ * must keep to the framer_process() contract and return the same frames.
+ */
+
+#include <stdlib.h>
+
+#include <libpiksi/logging.h>
+#include <libpiksi/framer.h>
+#include <libpiksi/protocols.h>
+#include <libpiksi/util.h>
+
+#include "protocol_corpus.h"
+
+#define PROGRAM_NAME "protocol_fuzz"
+
+/* Largest read size when the input is split up */
+#define FUZZ_CHUNK_MAX 64
+
+/* Called by libFuzzer, which does not ship a header for them */
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static const char *const fuzz_framers[] = {"sbp", "rtcm3", "nmea", "demux"};
+
+static int fuzz_feed(const char *framer_name,
+                     const uint8_t *data,
+                     size_t length,
+                     uint32_t chunk_max,
+                     uint32_t seed,
+                     corpus_result_t *result)
+{
+  framer_t *framer = framer_create(framer_name);
+  if (framer == NULL) {
+    abort();
+  }
+
+  *result = (corpus_result_t){.digest = CORPUS_DIGEST_INIT};
+  int ret = corpus_feed(framer, NULL, data, length, chunk_max, seed, result);
+
+  framer_destroy(&framer);
+  return ret;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  (void)argc;
+  (void)argv;
+
+  logging_init(PROGRAM_NAME);
+
+  return protocols_register_builtin();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (size < 2) {
+    return 0;
+  }
+
+  const char *framer_name = fuzz_framers[data[0] % COUNT_OF(fuzz_framers)];
+  if (framer_interface_valid(framer_name) != 0) {
+    return 0;
+  }
+
+  /* Read boundaries depend on the input so the fuzzer can steer them */
+  uint32_t seed = (uint32_t)data[1] << 8 | data[size - 1];
+  data += 2;
+  size -= 2;
+
+  corpus_result_t whole;
+  corpus_result_t split;
+  if (fuzz_feed(framer_name, data, size, UINT32_MAX, seed, &whole) != 0
+      || fuzz_feed(framer_name, data, size, FUZZ_CHUNK_MAX, seed, &split) != 0) {
+    abort();
+  }
+
+  if (whole.frames != split.frames || whole.digest != split.digest) {
+    abort();
+  }
+
+  return 0;
+}
@@ -8,16 +8,34 @@ RTCM3_IN_PROTOCOL_VERSION = 0.1
 RTCM3_IN_PROTOCOL_SITE = \
   "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/rtcm3_in_protocol/src"
 RTCM3_IN_PROTOCOL_SITE_METHOD = local
-RTCM3_IN_PROTOCOL_DEPENDENCIES =
+RTCM3_IN_PROTOCOL_DEPENDENCIES = libpiksi
 RTCM3_IN_PROTOCOL_INSTALL_STAGING = YES
 
+ifeq ($(BR2_BUILD_TESTS),y)
+RTCM3_IN_PROTOCOL_DEPENDENCIES += gtest valgrind
+
+define RTCM3_IN_PROTOCOL_BUILD_CMDS_TESTS
+    $(MAKE) CROSS=$(TARGET_CROSS) LD=$(TARGET_LD) -C $(@D) test
+endef
+
+define RTCM3_IN_PROTOCOL_TESTS_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/test/run_rtcm3_in_protocol_tests $(TARGET_DIR)/usr/bin
+endef
+endif
+
+ifeq ($(BR2_RUN_TESTS),y)
+RTCM3_IN_PROTOCOL_TESTS_RUN = $(call pbr_proot_valgrind_test,run_rtcm3_in_protocol_tests)
+endif
+
 define RTCM3_IN_PROTOCOL_BUILD_CMDS
     $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) LTO_PLUGIN="$(LTO_PLUGIN)" -C $(@D) all
+    $(RTCM3_IN_PROTOCOL_BUILD_CMDS_TESTS)
 endef
 
 define RTCM3_IN_PROTOCOL_INSTALL_STAGING_CMDS
     $(INSTALL) -D -m 0755 $(@D)/librtcm3_in_protocol.so* $(STAGING_DIR)/usr/lib
     $(INSTALL) -D -m 0755 $(@D)/librtcm3_in_protocol.a $(STAGING_DIR)/usr/lib
+    $(INSTALL) -D -m 0755 $(@D)/librtcm3_in_protocol_static.a $(STAGING_DIR)/usr/lib
 endef
 
 define RTCM3_IN_PROTOCOL_INSTALL_TARGET_CMDS
@@ -26,6 +44,8 @@ define RTCM3_IN_PROTOCOL_INSTALL_TARGET_CMDS
                           $(TARGET_DIR)/usr/lib/endpoint_protocols
     $(INSTALL) -d -m 0755 $(TARGET_DIR)/etc/endpoint_router
     $(INSTALL) -D -m 0755 $(@D)/rtcm3_router.yml $(TARGET_DIR)/etc/endpoint_router
+    $(RTCM3_IN_PROTOCOL_TESTS_INSTALL)
+    $(RTCM3_IN_PROTOCOL_TESTS_RUN)
 endef
 
 $(eval $(generic-package))
@@ -10,7 +10,9 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <libpiksi/crc.h>
 #include <libpiksi/logging.h>
+#include <libpiksi/protocol_plugin.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -22,164 +24,261 @@
 #define RTCM3_FOOTER_LENGTH 3
 #define RTCM3_FRAME_SIZE_MAX 1029
 
+/* The six bits following the preamble are reserved and must be zero */
+#define RTCM3_RESERVED_MASK 0xFC
+
+/* Must be a power of two no smaller than RTCM3_FRAME_SIZE_MAX */
+#define RING_SIZE 2048
+#define RING_MASK (RING_SIZE - 1)
+
+/* Log the first CRC error, then one in every RTCM3_CRC_LOG_INTERVAL */
+#define RTCM3_CRC_LOG_INTERVAL 100
+
+/**
+ * Complete frames found in the caller's buffer are validated and returned in
+ * place. Only frames split across reads are carried in the ring, resync after
+ * a bad frame then advances the ring head to the next preamble instead of
+ * shifting the buffered data.
+ */
 typedef struct {
-  uint8_t buffer[RTCM3_FRAME_SIZE_MAX];
-  uint32_t buffer_length;
-  uint32_t refill_count;
-  uint32_t remove_count;
+  uint8_t ring[RING_SIZE];
+  uint32_t head;
+  uint32_t tail;
+  uint8_t frame[RTCM3_FRAME_SIZE_MAX]; /* Frames that wrap around the ring */
+  uint32_t resync_count;
+  uint32_t crc_error_count;
 } framer_rtcm3_state_t;
 
-static const uint32_t crc24qtab[256] =
-  {0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC, 0x9F7F17, 0xA18139,
-   0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23, 0xB8B2D5, 0x3EFE2E, 0xC54E89, 0x430272,
-   0x4F9B84, 0xC9D77F, 0x56A868, 0xD0E493, 0xDC7D65, 0x5A319E, 0x64CFB0, 0xE2834B, 0xEE1ABD,
-   0x685646, 0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7, 0x0CD1E9, 0x8A9D12, 0x8604E4, 0x00481F,
-   0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE, 0xAD50D0, 0x2B1C2B, 0x2785DD, 0xA1C926, 0x3EB631,
-   0xB8FACA, 0xB4633C, 0x322FC7, 0xC99F60, 0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A,
-   0xD0AC8C, 0x56E077, 0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5,
-   0xF7614E, 0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8, 0x00903E, 0x86DCC5,
-   0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A, 0xAD88F1, 0xA11107, 0x275DFC, 0xDCED5B,
-   0x5AA1A0, 0x563856, 0xD074AD, 0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C, 0x7D6C62, 0xFB2099,
-   0xF7B96F, 0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375, 0x15723B, 0x933EC0, 0x9FA736,
-   0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C, 0xB4F302, 0x32BFF9, 0x3E260F, 0xB86AF4,
-   0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15, 0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53,
-   0xC596A8, 0xC90F5E, 0x4F43A5, 0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791,
-   0x688E67, 0xEEC29C, 0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145, 0x26EDBE, 0x2A7448,
-   0xAC38B3, 0x92C69D, 0x148A66, 0x181390, 0x9E5F6B, 0x01207C, 0x876C87, 0x8BF571, 0x0DB98A,
-   0xF6092D, 0x7045D6, 0x7CDC20, 0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A, 0x578814,
-   0xD1C4EF, 0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703, 0x3F964D, 0xB9DAB6,
-   0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A, 0x9E1774, 0x185B8F, 0x14C279,
-   0x928E82, 0x0DF195, 0x8BBD6E, 0x872498, 0x016863, 0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132,
-   0x693E25, 0xEF72DE, 0xE3EB28, 0x65A7D3, 0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C,
-   0x4EF3E7, 0x426A11, 0xC426EA, 0x2AE476, 0xACA88D, 0xA0317B, 0x267D80, 0xB90297, 0x3F4E6C,
-   0x33D79A, 0xB59B61, 0x8B654F, 0x0D29B4, 0x01B042, 0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3,
-   0x141A58, 0xEFAAFF, 0x69E604, 0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8,
-   0x4E2BC6, 0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1, 0x26359F,
-   0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673, 0xB94A88, 0x87B4A6, 0x01F85D,
-   0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC, 0x9E874A, 0x18CBB1, 0xE37B16, 0x6537ED, 0x69AE1B,
-   0xEFE2E0, 0x709DF7, 0xF6D10C, 0xFA48FA, 0x7C0401, 0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9,
-   0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538};
-
-static uint32_t crc24q(const uint8_t *buf, uint32_t len, uint32_t crc)
+static bool header_valid(const uint8_t *header)
+{
+  return (header[1] & RTCM3_RESERVED_MASK) == 0;
+}
+
+static uint32_t frame_length_from_header(const uint8_t *header)
+{
+  uint32_t message_length = ((header[1] & 0x3) << 8) | header[2];
+  return RTCM3_HEADER_LENGTH + message_length + RTCM3_FOOTER_LENGTH;
+}
+
+static bool frame_crc_valid(const uint8_t *frame, uint32_t total_length)
+{
+  uint32_t computed_crc = pk_crc24q(frame, total_length - RTCM3_FOOTER_LENGTH, 0);
+  uint32_t frame_crc = (frame[total_length - 3] << 16) | (frame[total_length - 2] << 8)
+                       | (frame[total_length - 1] << 0);
+  return frame_crc == computed_crc;
+}
+
+static void record_crc_error(framer_rtcm3_state_t *s, uint32_t total_length)
+{
+  if (s->crc_error_count++ % RTCM3_CRC_LOG_INTERVAL == 0) {
+    piksi_log(LOG_INFO,
+              "RTCM CRC error, buffer length %u (crc errors %u, resyncs %u)",
+              total_length,
+              s->crc_error_count,
+              s->resync_count);
+  }
+}
+
+static uint32_t ring_used(const framer_rtcm3_state_t *s)
 {
-  for (uint32_t i = 0; i < len; i++)
-    crc = ((crc << 8) & 0xFFFFFF) ^ crc24qtab[((crc >> 16) ^ buf[i]) & 0xff];
-  return crc;
+  return s->tail - s->head;
+}
+
+static void ring_push(framer_rtcm3_state_t *s, const uint8_t *data, uint32_t length)
+{
+  uint32_t offset = s->tail & RING_MASK;
+  uint32_t first = RING_SIZE - offset;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(&s->ring[offset], data, first);
+  memcpy(&s->ring[0], &data[first], length - first);
+  s->tail += length;
+}
+
+/* Copy out of the ring, unwrapping if needed */
+static void ring_peek(const framer_rtcm3_state_t *s, uint8_t *out, uint32_t length)
+{
+  uint32_t offset = s->head & RING_MASK;
+  uint32_t first = RING_SIZE - offset;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(out, &s->ring[offset], first);
+  memcpy(&out[first], &s->ring[0], length - first);
+}
+
+/* Returns the buffered frame as one contiguous span */
+static const uint8_t *ring_frame(framer_rtcm3_state_t *s, uint32_t length)
+{
+  uint32_t offset = s->head & RING_MASK;
+  if (offset + length <= RING_SIZE) {
+    return &s->ring[offset];
+  }
+  ring_peek(s, s->frame, length);
+  return s->frame;
+}
+
+static uint32_t ring_crc24q(const framer_rtcm3_state_t *s, uint32_t length)
+{
+  uint32_t offset = s->head & RING_MASK;
+  uint32_t first = RING_SIZE - offset;
+  if (first > length) {
+    first = length;
+  }
+  uint32_t crc = pk_crc24q(&s->ring[offset], first, 0);
+  return pk_crc24q(&s->ring[0], length - first, crc);
 }
 
-void *framer_create(void)
+static bool ring_crc_valid(const framer_rtcm3_state_t *s, uint32_t total_length)
+{
+  uint8_t footer[RTCM3_FOOTER_LENGTH];
+  uint32_t crc_offset = total_length - RTCM3_FOOTER_LENGTH;
+  for (uint32_t i = 0; i < RTCM3_FOOTER_LENGTH; i++) {
+    footer[i] = s->ring[(s->head + crc_offset + i) & RING_MASK];
+  }
+  uint32_t frame_crc = (footer[0] << 16) | (footer[1] << 8) | footer[2];
+  return frame_crc == ring_crc24q(s, crc_offset);
+}
+
+/* Drop the candidate at the head and skip to the next buffered preamble */
+static void ring_resync(framer_rtcm3_state_t *s)
+{
+  s->resync_count++;
+  s->head++;
+
+  while (s->head != s->tail) {
+    uint32_t offset = s->head & RING_MASK;
+    uint32_t span = RING_SIZE - offset;
+    if (span > ring_used(s)) {
+      span = ring_used(s);
+    }
+    const uint8_t *preamble = memchr(&s->ring[offset], RTCM3_PREAMBLE, span);
+    if (preamble != NULL) {
+      s->head += (uint32_t)(preamble - &s->ring[offset]);
+      return;
+    }
+    s->head += span;
+  }
+}
+
+PK_PROTOCOL_API void *framer_create(void)
 {
   framer_rtcm3_state_t *s = (framer_rtcm3_state_t *)malloc(sizeof(*s));
   if (s == NULL) {
     return NULL;
   }
 
-  s->buffer_length = 0;
-  s->refill_count = 0;
-  s->remove_count = 0;
+  s->head = 0;
+  s->tail = 0;
+  s->resync_count = 0;
+  s->crc_error_count = 0;
 
   return (void *)s;
 }
 
-void framer_destroy(void **state)
+PK_PROTOCOL_API void framer_destroy(void **state)
 {
   free(*state);
   *state = NULL;
 }
 
-uint32_t framer_process(void *state,
-                        const uint8_t *data,
-                        uint32_t data_length,
-                        const uint8_t **frame,
-                        uint32_t *frame_length)
+PK_PROTOCOL_API uint32_t framer_process(void *state,
+                                        const uint8_t *data,
+                                        uint32_t data_length,
+                                        const uint8_t **frame,
+                                        uint32_t *frame_length)
 {
   framer_rtcm3_state_t *s = (framer_rtcm3_state_t *)state;
 
   uint32_t data_offset = 0;
   while (1) {
 
-    /* Remove from the front of the buffer if requested */
-    if (s->remove_count != 0) {
-
-      /* Search for the first valid preamble after the removed bytes */
-      uint32_t offset = s->remove_count;
-      while (offset < s->buffer_length) {
-        if (s->buffer[offset] == RTCM3_PREAMBLE) {
-          break;
-        }
-        offset++;
-      }
+    if (ring_used(s) == 0) {
 
-      /* Shift the remaning data down to the start of the buffer */
-      if (offset < s->buffer_length) {
-        memmove(&s->buffer[0], &s->buffer[offset], s->buffer_length - offset);
-        s->buffer_length -= offset;
-      } else {
-        s->buffer_length = 0;
+      /* Nothing carried over, search the caller's buffer directly */
+      const uint8_t *preamble =
+        memchr(&data[data_offset], RTCM3_PREAMBLE, data_length - data_offset);
+      if (preamble == NULL) {
+        data_offset = data_length;
+        break;
       }
 
-      /* Note: remove count should never be greater than the buffer length */
-      s->remove_count = 0;
-    }
+      data_offset = (uint32_t)(preamble - data);
+      uint32_t available = data_length - data_offset;
 
-    /* Refill the buffer if requested */
-    if (s->refill_count != 0) {
+      if (available >= RTCM3_HEADER_LENGTH) {
 
-      uint32_t count = s->refill_count;
-      uint32_t available = data_length - data_offset;
-      if (count > available) {
-        count = available;
-      }
+        if (!header_valid(preamble)) {
+          s->resync_count++;
+          data_offset++;
+          continue;
+        }
 
-      memcpy(&s->buffer[s->buffer_length], &data[data_offset], count);
-      s->buffer_length += count;
-      data_offset += count;
-      s->refill_count -= count;
+        uint32_t total_length = frame_length_from_header(preamble);
 
-      /* Return if there is still not enough data available */
-      if (s->refill_count != 0) {
-        *frame = NULL;
-        *frame_length = 0;
-        return data_offset;
+        if (available >= total_length) {
+          if (frame_crc_valid(preamble, total_length)) {
+            *frame = preamble;
+            *frame_length = total_length;
+            return data_offset + total_length;
+          }
+          record_crc_error(s, total_length);
+          s->resync_count++;
+          data_offset++;
+          continue;
+        }
       }
-    }
 
-    /* Wait for header */
-    if (s->buffer_length < RTCM3_HEADER_LENGTH) {
-      s->refill_count = RTCM3_HEADER_LENGTH - s->buffer_length;
-      continue;
+      /* Frame continues in the next read */
+      ring_push(s, preamble, available);
+      data_offset = data_length;
+      break;
     }
 
-    /* Verify preamble */
-    if (s->buffer[0] != RTCM3_PREAMBLE) {
-      s->remove_count = 1;
-      continue;
-    }
+    /* Complete the candidate frame at the head of the ring */
+    uint32_t needed = RTCM3_HEADER_LENGTH;
+    uint32_t used = ring_used(s);
 
-    /* Get message length */
-    uint32_t message_length = ((s->buffer[1] & 0x3) << 8) | s->buffer[2];
-    uint32_t total_length = RTCM3_HEADER_LENGTH + message_length + RTCM3_FOOTER_LENGTH;
+    if (used >= RTCM3_HEADER_LENGTH) {
+      uint8_t header[RTCM3_HEADER_LENGTH];
+      ring_peek(s, header, sizeof(header));
+      if (!header_valid(header)) {
+        ring_resync(s);
+        continue;
+      }
+      needed = frame_length_from_header(header);
+    }
 
-    /* Wait for full frame */
-    if (s->buffer_length < total_length) {
-      s->refill_count = total_length - s->buffer_length;
+    if (used < needed) {
+      uint32_t count = needed - used;
+      if (count > data_length - data_offset) {
+        count = data_length - data_offset;
+      }
+      if (count == 0) {
+        break;
+      }
+      ring_push(s, &data[data_offset], count);
+      data_offset += count;
       continue;
     }
 
-    /* Verify CRC */
-    uint32_t computed_crc = crc24q(s->buffer, total_length - RTCM3_FOOTER_LENGTH, 0);
-    uint32_t frame_crc = (s->buffer[total_length - 3] << 16) | (s->buffer[total_length - 2] << 8)
-                         | (s->buffer[total_length - 1] << 0);
-    if (frame_crc != computed_crc) {
-      s->remove_count = 1;
-      piksi_log(LOG_INFO, "RTCM CRC error, buffer length %u\n", total_length);
+    if (!ring_crc_valid(s, needed)) {
+      record_crc_error(s, needed);
+      ring_resync(s);
       continue;
     }
 
-    /* Decoded frame */
-    s->remove_count = total_length;
-    *frame = s->buffer;
-    *frame_length = total_length;
+    /* Decoded frame, valid until the next call */
+    *frame = ring_frame(s, needed);
+    *frame_length = needed;
+    s->head += needed;
     return data_offset;
   }
+
+  *frame = NULL;
+  *frame_length = 0;
+  return data_offset;
 }
+
+PK_PROTOCOL_FRAMER("RTCM3", framer_create, framer_destroy, framer_process, NULL)
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi/crc.h>
+#include <libpiksi/logging.h>
+
+#define PROGRAM_NAME "rtcm3_in_protocol_tests"
+
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+#define PROTOCOL_LIBRARY_NAME "librtcm3_in_protocol.so"
+
+#define RTCM3_PREAMBLE 0xD3
+#define CORPUS_FRAMES 500
+
+typedef std::vector<uint8_t> bytes_t;
+
+typedef void *(*framer_create_fn_t)(void);
+typedef void (*framer_destroy_fn_t)(void **state);
+typedef uint32_t (*framer_process_fn_t)(void *state,
+                                        const uint8_t *data,
+                                        uint32_t data_length,
+                                        const uint8_t **frame,
+                                        uint32_t *frame_length);
+
+class Rtcm3FramerTests : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    const char *path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+    std::string library = std::string(path != nullptr ? path : PROTOCOL_LIBRARY_PATH_DEFAULT) + "/"
+                          + PROTOCOL_LIBRARY_NAME;
+
+    handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(handle, nullptr) << dlerror();
+
+    *(void **)&create = dlsym(handle, "framer_create");
+    *(void **)&destroy = dlsym(handle, "framer_destroy");
+    *(void **)&process = dlsym(handle, "framer_process");
+    ASSERT_NE(create, nullptr);
+    ASSERT_NE(destroy, nullptr);
+    ASSERT_NE(process, nullptr);
+
+    state = create();
+    ASSERT_NE(state, nullptr);
+  }
+
+  void TearDown() override
+  {
+    if (state != nullptr) destroy(&state);
+    if (handle != nullptr) dlclose(handle);
+  }
+
+  /* Feeds the stream in chunks of up to max_chunk bytes, returns the frames */
+  std::vector<bytes_t> frame_stream(const bytes_t &stream, size_t max_chunk)
+  {
+    std::vector<bytes_t> frames;
+    std::mt19937 rng(1);
+    size_t pos = 0;
+    while (pos < stream.size()) {
+      size_t chunk = 1 + rng() % max_chunk;
+      if (chunk > stream.size() - pos) chunk = stream.size() - pos;
+      bytes_t read(&stream[pos], &stream[pos] + chunk);
+      pos += chunk;
+      uint32_t offset = 0;
+      while (offset < read.size()) {
+        const uint8_t *frame = nullptr;
+        uint32_t frame_length = 0;
+        offset += process(state, &read[offset], (uint32_t)(read.size() - offset), &frame, &frame_length);
+        if (frame != nullptr) frames.emplace_back(frame, frame + frame_length);
+      }
+    }
+    return frames;
+  }
+
+  void *handle = nullptr;
+  void *state = nullptr;
+  framer_create_fn_t create = nullptr;
+  framer_destroy_fn_t destroy = nullptr;
+  framer_process_fn_t process = nullptr;
+};
+
+static bytes_t make_frame(std::mt19937 &rng)
+{
+  uint32_t length = rng() % 1024;
+  bytes_t frame = {RTCM3_PREAMBLE, (uint8_t)(length >> 8), (uint8_t)length};
+  for (uint32_t i = 0; i < length; i++) {
+    frame.push_back((uint8_t)rng());
+  }
+  uint32_t crc = pk_crc24q(frame.data(), frame.size(), 0);
+  frame.push_back((uint8_t)(crc >> 16));
+  frame.push_back((uint8_t)(crc >> 8));
+  frame.push_back((uint8_t)crc);
+  return frame;
+}
+
+/* Noise biased towards preambles and plausible headers */
+static void append_noise(std::mt19937 &rng, bytes_t &stream, size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    stream.push_back(rng() % 4 == 0 ? RTCM3_PREAMBLE : (uint8_t)(rng() % 4));
+  }
+}
+
+TEST_F(Rtcm3FramerTests, cleanStream)
+{
+  std::mt19937 rng(42);
+  std::vector<bytes_t> expected;
+  bytes_t stream;
+  for (int i = 0; i < CORPUS_FRAMES; i++) {
+    expected.push_back(make_frame(rng));
+    stream.insert(stream.end(), expected.back().begin(), expected.back().end());
+  }
+
+  EXPECT_EQ(frame_stream(stream, 4096), expected);
+}
+
+TEST_F(Rtcm3FramerTests, corruptedStream)
+{
+  std::mt19937 rng(7);
+  std::vector<bytes_t> expected;
+  bytes_t stream;
+  int flipped = 0;
+
+  for (int i = 0; i < CORPUS_FRAMES; i++) {
+    bytes_t frame = make_frame(rng);
+    switch (rng() % 5) {
+    case 0:
+      /* Bit error inside the frame */
+      frame[3 + rng() % (frame.size() - 3)] ^= (uint8_t)(1 << (rng() % 8));
+      flipped++;
+      break;
+    case 1:
+      /* Garbage, including false preambles, before the frame */
+      append_noise(rng, stream, rng() % 64);
+      expected.push_back(frame);
+      break;
+    case 2:
+      /* Truncated frame, the next frame starts inside its claimed length */
+      stream.insert(stream.end(), frame.begin(), frame.begin() + frame.size() / 2);
+      frame = make_frame(rng);
+      expected.push_back(frame);
+      break;
+    default: expected.push_back(frame); break;
+    }
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  /* Every damaged frame is dropped, none of its neighbours */
+  ASSERT_GT(flipped, 0);
+  EXPECT_EQ(frame_stream(stream, 4096), expected);
+
+  /* Byte at a time reads must agree */
+  destroy(&state);
+  state = create();
+  ASSERT_NE(state, nullptr);
+  EXPECT_EQ(frame_stream(stream, 1), expected);
+}
+
+TEST_F(Rtcm3FramerTests, invalidHeaderResyncsImmediately)
+{
+  std::mt19937 rng(3);
+  bytes_t frame = make_frame(rng);
+
+  /* Reserved bits set: rejected without waiting for a full length of data.
+   * The bogus header claims the longest frame, so if it were waited on the
+   * stream would end before the real frame came out. */
+  bytes_t stream = {RTCM3_PREAMBLE, 0xFF, 0xFF};
+  stream.insert(stream.end(), frame.begin(), frame.end());
+  ASSERT_LT(stream.size(), 3 + 0x3FFu + 3);
+
+  std::vector<bytes_t> frames = frame_stream(stream, 4096);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0], frame);
+}
+
+int main(int argc, char **argv)
+{
+  logging_init(PROGRAM_NAME);
+  logging_log_to_stdout_only(true);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  auto ret = RUN_ALL_TESTS();
+
+  logging_deinit();
+
+  return ret;
+}
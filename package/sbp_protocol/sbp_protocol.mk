@@ -8,16 +8,34 @@ SBP_PROTOCOL_VERSION = 0.1
 SBP_PROTOCOL_SITE = \
   "${BR2_EXTERNAL_piksi_buildroot_PATH}/package/sbp_protocol/src"
 SBP_PROTOCOL_SITE_METHOD = local
-SBP_PROTOCOL_DEPENDENCIES = libsbp
+SBP_PROTOCOL_DEPENDENCIES = libsbp libpiksi
 SBP_PROTOCOL_INSTALL_STAGING = YES
 
+ifeq ($(BR2_BUILD_TESTS),y)
+SBP_PROTOCOL_DEPENDENCIES += gtest valgrind
+
+define SBP_PROTOCOL_BUILD_CMDS_TESTS
+    $(MAKE) CROSS=$(TARGET_CROSS) LD=$(TARGET_LD) -C $(@D) test
+endef
+
+define SBP_PROTOCOL_TESTS_INSTALL
+    $(INSTALL) -D -m 0755 $(@D)/test/run_sbp_protocol_tests $(TARGET_DIR)/usr/bin
+endef
+endif
+
+ifeq ($(BR2_RUN_TESTS),y)
+SBP_PROTOCOL_TESTS_RUN = $(call pbr_proot_valgrind_test,run_sbp_protocol_tests)
+endif
+
 define SBP_PROTOCOL_BUILD_CMDS
     $(MAKE) CC=$(TARGET_CC) LD=$(TARGET_LD) LTO_PLUGIN="$(LTO_PLUGIN)" -C $(@D) all
+    $(SBP_PROTOCOL_BUILD_CMDS_TESTS)
 endef
 
 define SBP_PROTOCOL_INSTALL_STAGING_CMDS
     $(INSTALL) -D -m 0755 $(@D)/libsbp_protocol.so* $(STAGING_DIR)/usr/lib
     $(INSTALL) -D -m 0755 $(@D)/libsbp_protocol.a $(STAGING_DIR)/usr/lib
+    $(INSTALL) -D -m 0755 $(@D)/libsbp_protocol_static.a $(STAGING_DIR)/usr/lib
 endef
 
 define SBP_PROTOCOL_INSTALL_TARGET_CMDS
@@ -27,6 +45,8 @@ define SBP_PROTOCOL_INSTALL_TARGET_CMDS
     $(INSTALL) -d -m 0755 $(TARGET_DIR)/etc/endpoint_router
     $(INSTALL) -D -m 0755 $(@D)/sbp_router.yml $(TARGET_DIR)/etc/endpoint_router
     $(INSTALL) -D -m 0755 $(@D)/sbp_router_smoothpose.yml $(TARGET_DIR)/etc/endpoint_router
+    $(SBP_PROTOCOL_TESTS_INSTALL)
+    $(SBP_PROTOCOL_TESTS_RUN)
 endef
 
 $(eval $(generic-package))
@@ -15,62 +15,146 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <sys/inotify.h>
-#include <fcntl.h>
-#include <limits.h>
 #include <libsbp/sbp.h>
 #include <syslog.h>
 
+#include <libpiksi/file_watch.h>
+#include <libpiksi/protocol_plugin.h>
+#include <libpiksi/rate_limit.h>
+
 // clang-format off
 #define SBP_MSG_TYPE_OFFSET 1
 #define SBP_MSG_SIZE_MIN    6
 
-#define RULES_COUNT_INIT  256
+/* msg_type -> rule lookup is split on the high byte into pages that are only
+ * allocated when a rule uses them */
+#define RULE_PAGE_COUNT   256
+#define RULE_PAGE_SIZE    256
 // clang-format on
 
 typedef struct {
-  uint16_t type;
+  bool present;
   uint8_t divisor;
   uint8_t counter;
+  uint16_t bucket; /**< 1-based index into buckets, 0 if not rate limited */
 } filter_sbp_rule_t;
 
 typedef struct {
-  filter_sbp_rule_t *rules;
+  filter_sbp_rule_t rules[RULE_PAGE_SIZE];
+} filter_sbp_page_t;
+
+typedef struct {
+  filter_sbp_page_t *pages[RULE_PAGE_COUNT];
   uint32_t rules_count;
+  pk_rate_limit_t *buckets;
+  uint32_t buckets_count;
   const char *config_file;
-  int config_inotify;
+  pk_file_watch_t *config_watch;
+  unsigned int loaded_generation;
 } filter_sbp_state_t;
 
-static int process_rule(filter_sbp_rule_t *rule)
+static int process_rule(filter_sbp_state_t *s, filter_sbp_rule_t *rule)
 {
   /* Reject message if divisor is zero */
   if (rule->divisor == 0) {
     return 1;
   }
 
-  /* Pass message when counter == divisor */
-  if (++rule->counter >= rule->divisor) {
-    rule->counter = 0;
-    return 0;
+  /* Reject unless counter == divisor */
+  if (++rule->counter < rule->divisor) {
+    return 1;
+  }
+  rule->counter = 0;
+
+  /* Messages left by the divisor are then held to max_hz */
+  if (rule->bucket != 0) {
+    return pk_rate_limit_take(&s->buckets[rule->bucket - 1]) ? 0 : 1;
   }
 
-  /* Otherwise reject */
-  return 1;
+  return 0;
 }
 
-static void filter_sbp_load_config(filter_sbp_state_t *s)
+static filter_sbp_rule_t *rule_lookup(filter_sbp_state_t *s, uint16_t msg_type)
+{
+  filter_sbp_page_t *page = s->pages[msg_type >> 8];
+  if (page == NULL) {
+    return NULL;
+  }
+  filter_sbp_rule_t *rule = &page->rules[msg_type & 0xFF];
+  return rule->present ? rule : NULL;
+}
+
+static void filter_sbp_clear_rules(filter_sbp_state_t *s)
 {
+  for (uint32_t i = 0; i < RULE_PAGE_COUNT; i++) {
+    free(s->pages[i]);
+    s->pages[i] = NULL;
+  }
   s->rules_count = 0;
-  uint32_t rules_buffer_count = RULES_COUNT_INIT;
+  free(s->buckets);
+  s->buckets = NULL;
+  s->buckets_count = 0;
+}
+
+static bool filter_sbp_add_bucket(filter_sbp_state_t *s, double max_hz, uint16_t *bucket)
+{
+  if (s->buckets_count == UINT16_MAX) {
+    syslog(LOG_ERR, "too many rate limited rules");
+    return false;
+  }
 
-  /* Allocate buffer for rules */
-  s->rules = malloc(rules_buffer_count * sizeof(filter_sbp_rule_t));
-  if (s->rules == NULL) {
+  pk_rate_limit_t *buckets = realloc(s->buckets, (s->buckets_count + 1) * sizeof(pk_rate_limit_t));
+  if (buckets == NULL) {
     syslog(LOG_ERR, "error allocating buffer for rules");
-    rules_buffer_count = 0;
-    return;
+    return false;
   }
+  s->buckets = buckets;
+
+  /* Starts full so the first message after a (re)load passes */
+  pk_rate_limit_init(&s->buckets[s->buckets_count], max_hz);
+  *bucket = (uint16_t)(++s->buckets_count);
+
+  return true;
+}
+
+static bool filter_sbp_add_rule(filter_sbp_state_t *s,
+                                uint16_t msg_type,
+                                uint8_t divisor,
+                                double max_hz)
+{
+  filter_sbp_page_t **page = &s->pages[msg_type >> 8];
+  if (*page == NULL) {
+    *page = calloc(1, sizeof(filter_sbp_page_t));
+    if (*page == NULL) {
+      syslog(LOG_ERR, "error allocating buffer for rules");
+      return false;
+    }
+  }
+
+  /* The first rule for a msg_type takes effect */
+  filter_sbp_rule_t *rule = &(*page)->rules[msg_type & 0xFF];
+  if (rule->present) {
+    return true;
+  }
+
+  *rule = (filter_sbp_rule_t){
+    .present = true,
+    .divisor = divisor,
+    .counter = 0,
+    .bucket = 0,
+  };
+  s->rules_count++;
+
+  if (max_hz > 0) {
+    return filter_sbp_add_bucket(s, max_hz, &rule->bucket);
+  }
+
+  return true;
+}
+
+static void filter_sbp_load_config(filter_sbp_state_t *s)
+{
+  filter_sbp_clear_rules(s);
 
   /* Open file */
   FILE *fp = fopen(s->config_file, "r");
@@ -84,32 +168,22 @@ static void filter_sbp_load_config(filter_sbp_state_t *s)
   char line[256];
   while (fgets(line, sizeof(line), fp) != NULL) {
 
-    /* Expected format: <msg_type> <divisor> */
+    /* Expected format: <msg_type> <divisor> [<max_hz>] */
     unsigned int msg_type;
     unsigned int divisor;
-    if (sscanf(line, "%x %x", &msg_type, &divisor) != 2) {
+    double max_hz = 0;
+    int fields = sscanf(line, "%x %x %lf", &msg_type, &divisor, &max_hz);
+    if (fields < 2 || (fields == 3 && !pk_rate_limit_valid(max_hz))) {
       syslog(LOG_ERR, "error parsing %s", s->config_file);
       error = true;
       break;
     }
 
-    /* Reallocate rules buffer if required */
-    if (s->rules_count >= rules_buffer_count) {
-      rules_buffer_count *= 2;
-      s->rules = realloc(s->rules, rules_buffer_count * sizeof(filter_sbp_rule_t));
-      if (s->rules == NULL) {
-        syslog(LOG_ERR, "error reallocating buffer for rules");
-        rules_buffer_count = 0;
-        error = true;
-        break;
-      }
-    }
-
     /* Set rule */
-    filter_sbp_rule_t *rule = &s->rules[s->rules_count++];
-    rule->type = msg_type;
-    rule->divisor = divisor;
-    rule->counter = 0;
+    if (!filter_sbp_add_rule(s, (uint16_t)msg_type, (uint8_t)divisor, max_hz)) {
+      error = true;
+      break;
+    }
   }
 
   /* Close file */
@@ -117,60 +191,51 @@ static void filter_sbp_load_config(filter_sbp_state_t *s)
 
   /* Clear rules if an error occurred */
   if (error) {
-    s->rules_count = 0;
+    filter_sbp_clear_rules(s);
   }
 }
 
-void *filter_create(const char *filename)
+PK_PROTOCOL_API void *filter_create(const char *filename)
 {
-  filter_sbp_state_t *s = (filter_sbp_state_t *)malloc(sizeof(*s));
+  filter_sbp_state_t *s = (filter_sbp_state_t *)calloc(1, sizeof(*s));
   if (s == NULL) {
     return NULL;
   }
 
   s->config_file = strdup(filename);
-  filter_sbp_load_config(s);
-  s->config_inotify = inotify_init1(IN_NONBLOCK);
-  int wd = inotify_add_watch(s->config_inotify, filename, IN_CLOSE_WRITE);
-  if ((s->config_inotify < 0) || (wd < 0)) {
+  /* Watch before loading so a write during the load is not missed */
+  s->config_watch = pk_file_watch_create(filename);
+  if (s->config_watch == NULL) {
     syslog(LOG_ERR, "error setting up inotify on config file: %s", filename);
   }
+  s->loaded_generation = 0;
+  filter_sbp_load_config(s);
 
   return (void *)s;
 }
 
-void filter_destroy(void **state)
+PK_PROTOCOL_API void filter_destroy(void **state)
 {
   filter_sbp_state_t *s = (filter_sbp_state_t *)(*state);
-  if (s->rules != NULL) {
-    free(s->rules);
-    s->rules = NULL;
-    s->rules_count = 0;
-  }
-  close(s->config_inotify);
-  s->config_inotify = -1;
+  filter_sbp_clear_rules(s);
+  pk_file_watch_destroy(&s->config_watch);
   free((void *)s->config_file);
   s->config_file = NULL;
   free(*state);
   *state = NULL;
 }
 
-int filter_process(void *state, const uint8_t *msg, uint32_t msg_length)
+PK_PROTOCOL_API int filter_process(void *state, const uint8_t *msg, uint32_t msg_length)
 {
   filter_sbp_state_t *s = (filter_sbp_state_t *)state;
 
   /* Reload config if changed */
-  char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
-    __attribute__((aligned(__alignof__(struct inotify_event))));
-  if (read(s->config_inotify, buf, sizeof(buf)) > 0) {
-    /* Any events on the config file trigger a reload.
-     * We only subscribe to modify events. */
-    if (s->rules) {
-      free(s->rules);
-      s->rules = NULL;
-      s->rules_count = 0;
+  if (s->config_watch != NULL) {
+    unsigned int generation = pk_file_watch_generation(s->config_watch);
+    if (generation != s->loaded_generation) {
+      s->loaded_generation = generation;
+      filter_sbp_load_config(s);
     }
-    filter_sbp_load_config(s);
   }
 
   /* Pass everything if no rules are configured */
@@ -183,16 +248,17 @@ int filter_process(void *state, const uint8_t *msg, uint32_t msg_length)
     return 1;
   }
 
-  /* Search for corresponding rule */
-  uint16_t msg_type = le16toh(*(uint16_t *)&msg[SBP_MSG_TYPE_OFFSET]);
-  uint32_t i;
-  for (i = 0; i < s->rules_count; i++) {
-    filter_sbp_rule_t *rule = &s->rules[i];
-    if (rule->type == msg_type) {
-      return process_rule(rule);
-    }
+  /* Look up corresponding rule, reject message if there is none */
+  /* Frames are handed over in place, so the type may not be aligned */
+  uint16_t msg_type;
+  memcpy(&msg_type, &msg[SBP_MSG_TYPE_OFFSET], sizeof(msg_type));
+  msg_type = le16toh(msg_type);
+  filter_sbp_rule_t *rule = rule_lookup(s, msg_type);
+  if (rule == NULL) {
+    return 1;
   }
 
-  /* Reject message if no matching rule was found */
-  return 1;
+  return process_rule(s, rule);
 }
+
+PK_PROTOCOL_FILTER("SBP", filter_create, filter_destroy, filter_process)
@@ -18,51 +18,53 @@
 #include <libsbp/sbp.h>
 #include <syslog.h>
 
+#include <libpiksi/crc.h>
+#include <libpiksi/protocol_plugin.h>
+
+#define SBP_HEADER_LEN (6)
+#define SBP_CRC_LEN (2)
 #define SBP_MSG_LEN_MAX (264)
 
-typedef struct {
-  const uint8_t *read_buffer;
-  uint32_t read_length;
-  uint32_t read_offset;
-  uint8_t *write_buffer;
-  uint32_t write_length;
-  uint32_t write_offset;
-} sbp_io_context_t;
+/* Offset of the payload length within the header */
+#define SBP_HEADER_LEN_OFFSET (5)
 
+/**
+ * Frames are validated in place: when a complete frame lies within the
+ * caller's buffer a pointer into that buffer is returned, only frames that
+ * are split across calls are copied into `partial`.
+ */
 typedef struct {
-  sbp_state_t sbp_state;
-  uint8_t send_buffer[SBP_MSG_LEN_MAX];
+  uint32_t partial_length;
+  uint8_t partial[SBP_MSG_LEN_MAX];
 } framer_sbp_state_t;
 
-static s32 sbp_read(u8 *buff, u32 n, void *context)
+static uint32_t frame_length_from_header(const uint8_t *header)
 {
-  sbp_io_context_t *c = (sbp_io_context_t *)context;
-
-  ssize_t count = c->read_length - c->read_offset;
-  if (count > n) {
-    count = n;
-  }
-
-  memcpy(buff, &c->read_buffer[c->read_offset], count);
-  c->read_offset += count;
-  return count;
+  return SBP_HEADER_LEN + header[SBP_HEADER_LEN_OFFSET] + SBP_CRC_LEN;
 }
 
-static s32 sbp_write(u8 *buff, u32 n, void *context)
+/* CRC covers the header (minus the preamble) and the payload */
+static bool frame_crc_valid(const uint8_t *frame, uint32_t frame_length)
 {
-  sbp_io_context_t *c = (sbp_io_context_t *)context;
-
-  ssize_t count = c->write_length - c->write_offset;
-  if (count > n) {
-    count = n;
-  }
+  uint32_t crc_offset = frame_length - SBP_CRC_LEN;
+  u16 crc = pk_crc16_ccitt(&frame[1], crc_offset - 1, 0);
+  u16 frame_crc = (u16)(frame[crc_offset] | (frame[crc_offset + 1] << 8));
+  return crc == frame_crc;
+}
 
-  memcpy(&c->write_buffer[c->write_offset], buff, count);
-  c->write_offset += count;
+/* Copy bytes into the partial frame buffer, returns the number consumed */
+static uint32_t partial_fill(framer_sbp_state_t *s, const uint8_t *data, uint32_t data_length)
+{
+  uint32_t need = (s->partial_length < SBP_HEADER_LEN)
+                    ? SBP_HEADER_LEN - s->partial_length
+                    : frame_length_from_header(s->partial) - s->partial_length;
+  uint32_t count = data_length < need ? data_length : need;
+  memcpy(&s->partial[s->partial_length], data, count);
+  s->partial_length += count;
   return count;
 }
 
-void *framer_create(void)
+PK_PROTOCOL_API void *framer_create(void)
 {
   framer_sbp_state_t *s = calloc(1, sizeof(*s));
 
@@ -70,56 +72,85 @@ void *framer_create(void)
     return NULL;
   }
 
-  sbp_state_init(&s->sbp_state);
   return (void *)s;
 }
 
-void framer_destroy(void **state)
+PK_PROTOCOL_API void framer_destroy(void **state)
 {
   free(*state);
   *state = NULL;
 }
 
-uint32_t framer_process(void *state,
-                        const uint8_t *data,
-                        uint32_t data_length,
-                        const uint8_t **frame,
-                        uint32_t *frame_length)
+static uint32_t framer_sbp_next(framer_sbp_state_t *s,
+                                const uint8_t *data,
+                                uint32_t data_length,
+                                const uint8_t **frame,
+                                uint32_t *frame_length)
 {
-  framer_sbp_state_t *s = (framer_sbp_state_t *)state;
-
-  sbp_io_context_t c;
-  sbp_state_set_io_context(&s->sbp_state, &c);
-
-  c.read_buffer = data;
-  c.read_length = data_length;
-  c.read_offset = 0;
-
-  while (c.read_offset < data_length) {
-    if (sbp_process(&s->sbp_state, sbp_read) == SBP_OK_CALLBACK_UNDEFINED) {
-
-      /* A message was just decoded */
-      c.write_buffer = s->send_buffer;
-      c.write_length = sizeof(s->send_buffer);
-      c.write_offset = 0;
-
-      if (sbp_send_message(&s->sbp_state,
-                           s->sbp_state.msg_type,
-                           s->sbp_state.sender_id,
-                           s->sbp_state.msg_len,
-                           s->sbp_state.msg_buff,
-                           sbp_write)
-          == SBP_OK) {
-        *frame = s->send_buffer;
-        *frame_length = c.write_offset;
-        return c.read_offset;
-      } else {
-        syslog(LOG_ERR, "SBP send error");
-      }
+  uint32_t offset = 0;
+
+  /* Finish a frame carried over from a previous call */
+  while (s->partial_length > 0 && offset < data_length) {
+    offset += partial_fill(s, &data[offset], data_length - offset);
+    if (s->partial_length < SBP_HEADER_LEN) {
+      continue;
+    }
+    uint32_t length = frame_length_from_header(s->partial);
+    if (s->partial_length < length) {
+      continue;
+    }
+    s->partial_length = 0;
+    if (frame_crc_valid(s->partial, length)) {
+      *frame = s->partial;
+      *frame_length = length;
+      return offset;
     }
   }
 
+  while (offset < data_length) {
+
+    const uint8_t *preamble = memchr(&data[offset], SBP_PREAMBLE, data_length - offset);
+    if (preamble == NULL) {
+      offset = data_length;
+      break;
+    }
+
+    offset = (uint32_t)(preamble - data);
+    uint32_t available = data_length - offset;
+
+    if (available < SBP_HEADER_LEN || available < frame_length_from_header(preamble)) {
+      /* Frame continues in the next read */
+      memcpy(s->partial, preamble, available);
+      s->partial_length = available;
+      offset = data_length;
+      break;
+    }
+
+    uint32_t length = frame_length_from_header(preamble);
+    offset += length;
+
+    if (frame_crc_valid(preamble, length)) {
+      *frame = preamble;
+      *frame_length = length;
+      return offset;
+    }
+
+    /* Like the libsbp state machine, a frame failing its CRC is dropped as a
+     * whole and the search resumes after it */
+  }
+
   *frame = NULL;
   *frame_length = 0;
-  return c.read_offset;
+  return offset;
 }
+
+PK_PROTOCOL_API uint32_t framer_process(void *state,
+                                        const uint8_t *data,
+                                        uint32_t data_length,
+                                        const uint8_t **frame,
+                                        uint32_t *frame_length)
+{
+  return framer_sbp_next((framer_sbp_state_t *)state, data, data_length, frame, frame_length);
+}
+
+PK_PROTOCOL_FRAMER("SBP", framer_create, framer_destroy, framer_process, NULL)
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <libpiksi/file_watch.h>
+#include <libpiksi/logging.h>
+
+#define PROGRAM_NAME "sbp_protocol_tests"
+
+#define PROTOCOL_LIBRARY_PATH_ENV_NAME "PROTOCOL_LIBRARY_PATH"
+#define PROTOCOL_LIBRARY_PATH_DEFAULT "/usr/lib/endpoint_protocols"
+#define PROTOCOL_LIBRARY_NAME "libsbp_protocol.so"
+
+#define FILTER_CONFIG_FILE "/tmp/test_sbp_filter_config"
+/* Past the config check interval, with room for the coarse clock's resolution */
+#define FILTER_RELOAD_WAIT_US ((PK_FILE_WATCH_INTERVAL_MS + 50) * 1000)
+
+#define FILTER_PASS 0
+#define FILTER_REJECT 1
+
+typedef void *(*filter_create_fn_t)(const char *filename);
+typedef void (*filter_destroy_fn_t)(void **state);
+typedef int (*filter_process_fn_t)(void *state, const uint8_t *msg, uint32_t msg_length);
+
+class SbpFilterTests : public ::testing::Test {
+ protected:
+  void SetUp() override
+  {
+    const char *path = getenv(PROTOCOL_LIBRARY_PATH_ENV_NAME);
+    std::string library = std::string(path != nullptr ? path : PROTOCOL_LIBRARY_PATH_DEFAULT) + "/"
+                          + PROTOCOL_LIBRARY_NAME;
+
+    handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(handle, nullptr) << dlerror();
+
+    *(void **)&create = dlsym(handle, "filter_create");
+    *(void **)&destroy = dlsym(handle, "filter_destroy");
+    *(void **)&process = dlsym(handle, "filter_process");
+    ASSERT_NE(create, nullptr);
+    ASSERT_NE(destroy, nullptr);
+    ASSERT_NE(process, nullptr);
+  }
+
+  void TearDown() override
+  {
+    if (state != nullptr) destroy(&state);
+    if (handle != nullptr) dlclose(handle);
+    unlink(FILTER_CONFIG_FILE);
+  }
+
+  void write_config(const std::string &config)
+  {
+    std::ofstream file(FILTER_CONFIG_FILE);
+    file << config;
+  }
+
+  void create_filter(const std::string &config)
+  {
+    write_config(config);
+    state = create(FILTER_CONFIG_FILE);
+    ASSERT_NE(state, nullptr);
+  }
+
+  /* Only the header matters to the filter */
+  int filter(uint16_t msg_type)
+  {
+    uint8_t msg[] = {0x55, (uint8_t)(msg_type & 0xFF), (uint8_t)(msg_type >> 8), 0, 0, 0, 0, 0};
+    return process(state, msg, sizeof(msg));
+  }
+
+  void *handle = nullptr;
+  void *state = nullptr;
+  filter_create_fn_t create = nullptr;
+  filter_destroy_fn_t destroy = nullptr;
+  filter_process_fn_t process = nullptr;
+};
+
+TEST_F(SbpFilterTests, Rules)
+{
+  create_filter("0102 1\n0103 2\n0104 0\n");
+
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+
+  /* Every second message of a divisor of 2 passes */
+  EXPECT_EQ(filter(0x0103), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0103), FILTER_PASS);
+  EXPECT_EQ(filter(0x0103), FILTER_REJECT);
+
+  /* A divisor of 0 rejects the type, as does having no rule for it */
+  EXPECT_EQ(filter(0x0104), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0105), FILTER_REJECT);
+}
+
+TEST_F(SbpFilterTests, ReloadOnWrite)
+{
+  create_filter("0102 1\n");
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0103), FILTER_REJECT);
+
+  write_config("0103 1\n");
+  usleep(FILTER_RELOAD_WAIT_US);
+
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0103), FILTER_PASS);
+
+  /* Without a write the rules are left alone */
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter(0x0103), FILTER_PASS);
+
+  /* An empty config passes everything */
+  write_config("");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0103), FILTER_PASS);
+}
+
+TEST_F(SbpFilterTests, ReloadResetsCounters)
+{
+  create_filter("0102 2\n");
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+
+  /* Rewriting the same rules still reloads them, the count starts over */
+  write_config("0102 2\n");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+}
+
+TEST_F(SbpFilterTests, ParseErrorPassesEverything)
+{
+  create_filter("0102 1\nnot a rule\n");
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0103), FILTER_PASS);
+}
+
+TEST_F(SbpFilterTests, RateFirstMessagePasses)
+{
+  create_filter("0102 1 1\n");
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+}
+
+TEST_F(SbpFilterTests, RateAfterDivisor)
+{
+  /* The divisor lets every second message through, the rate then holds
+   * those to one a second */
+  create_filter("0102 2 1\n");
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+}
+
+TEST_F(SbpFilterTests, RateDecimation)
+{
+  /* 200 Hz in for a second, 20 Hz out */
+  create_filter("0102 1 20\n");
+
+  int passed = 0;
+  for (int i = 0; i < 200; i++) {
+    if (filter(0x0102) == FILTER_PASS) passed++;
+    usleep(5000);
+  }
+
+  /* The sleeps only ever overshoot, which can cost a few messages but
+   * never adds any: at most the first plus one per early interval */
+  EXPECT_GE(passed, 15);
+  EXPECT_LE(passed, 22);
+}
+
+TEST_F(SbpFilterTests, RateTolerance)
+{
+  /* 100 ms interval, a message may be up to 5 ms early */
+  create_filter("0102 1 10\n");
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+
+  usleep(97000);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+
+  /* The early pass is paid back, well short of an interval is rejected */
+  usleep(70000);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+}
+
+TEST_F(SbpFilterTests, ReloadResetsBuckets)
+{
+  create_filter("0102 1 0.01\n");
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+
+  /* Buckets start full again, or this would wait 100 seconds */
+  write_config("0102 1 0.01\n");
+  usleep(FILTER_RELOAD_WAIT_US);
+  EXPECT_EQ(filter(0x0102), FILTER_PASS);
+  EXPECT_EQ(filter(0x0102), FILTER_REJECT);
+}
+
+TEST_F(SbpFilterTests, InvalidRateIsParseError)
+{
+  /* A rule for 0x0102 only would reject 0x0103, a parse error passes it */
+  for (const char *rate : {"0", "-1", "0.0001", "inf", "nan"}) {
+    create_filter(std::string("0102 1 ") + rate + "\n");
+    EXPECT_EQ(filter(0x0103), FILTER_PASS) << rate;
+    destroy(&state);
+  }
+
+  create_filter("0102 1 0.001\n");
+  EXPECT_EQ(filter(0x0103), FILTER_REJECT);
+}
+
+int main(int argc, char **argv)
+{
+  logging_init(PROGRAM_NAME);
+  logging_log_to_stdout_only(true);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  auto ret = RUN_ALL_TESTS();
+
+  logging_deinit();
+
+  return ret;
+}